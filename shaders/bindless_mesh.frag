@@ -0,0 +1,44 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout (location = 0) in vec3 inColor;
+layout (location = 1) in vec2 inUV;
+layout (location = 2) flat in uint inMaterial;
+layout (location = 3) flat in float inFade;
+
+layout (location = 0) out vec4 outFragColor;
+
+struct MaterialData {
+    vec4 base_color;
+    uint texture_index;
+};
+
+// same binding as the object buffers in the vertex shader, declared with the material layout
+layout (std430, set = 0, binding = 0) readonly buffer MaterialBuffers {
+    MaterialData materials[];
+} materialBuffers[];
+
+layout (set = 0, binding = 1) uniform texture2D textures[];
+layout (set = 0, binding = 2) uniform sampler textureSampler;
+
+layout ( push_constant ) uniform constants {
+    uint objectBuffer;
+    uint materialBuffer;
+} PushConstants;
+
+// same pattern as colored_triangle.frag
+float dither(vec2 pixel) {
+    return fract(52.9829189f * fract(dot(pixel, vec2(0.06711056f, 0.00583715f))));
+}
+
+void main() {
+    // cross-fading into its impostor
+    if (inFade < 1.0f && dither(gl_FragCoord.xy) >= inFade) {
+        discard;
+    }
+
+    MaterialData material = materialBuffers[PushConstants.materialBuffer].materials[inMaterial];
+    // neighbouring pixels can belong to different objects, so the texture index is not uniform
+    vec4 texel = texture(sampler2D(textures[nonuniformEXT(material.texture_index)], textureSampler), inUV);
+    outFragColor = vec4(inColor, 1.0) * material.base_color * texel;
+}
@@ -0,0 +1,42 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout (location = 0) in vec3 vPosition;
+layout (location = 1) in vec3 vNormal;
+layout (location = 2) in vec3 vColor;
+
+layout (location = 0) out vec3 outColor;
+layout (location = 1) out vec2 outUV;
+layout (location = 2) flat out uint outMaterial;
+layout (location = 3) flat out float outFade;
+
+struct ObjectData {
+    mat4 render_matrix;
+    vec4 sphere;
+    uint material_index;
+    // below 1 the mesh is dithered out while its impostor fades in
+    float fade;
+};
+
+// every storage buffer registered with the bindless heap, the push constants say which one holds the objects
+layout (std430, set = 0, binding = 0) readonly buffer ObjectBuffers {
+    ObjectData objects[];
+} objectBuffers[];
+
+layout ( push_constant ) uniform constants {
+    uint objectBuffer;
+    uint materialBuffer;
+} PushConstants;
+
+// must match depth_only.vert bit for bit so the depth prepass results compare equal
+invariant gl_Position;
+
+void main() {
+    ObjectData object = objectBuffers[PushConstants.objectBuffer].objects[gl_InstanceIndex];
+    gl_Position = object.render_matrix * vec4(vPosition, 1.0f);
+    outColor = vColor;
+    // the vertex format has no texture coordinates yet, project object space xy instead
+    outUV = vPosition.xy * 0.5 + 0.5;
+    outMaterial = object.material_index;
+    outFade = object.fade;
+}
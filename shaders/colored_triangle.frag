@@ -1,8 +1,105 @@
 #version 450
 
 layout (location = 0) in vec3 inColor;
+layout (location = 1) in vec3 inNormal;
+layout (location = 2) in vec3 inPosition;
+layout (location = 3) in vec3 inViewPosition;
+layout (location = 4) in vec3 inViewNormal;
+layout (location = 5) flat in float inFade;
 
 layout (location = 0) out vec4 outFragColor;
+
+// permutation bits, constant_id matches the bit index in ShaderVariantBits (vk_variants.h)
+layout (constant_id = 1) const bool LIGHTING = false;
+layout (constant_id = 2) const bool ALPHA_TEST = false;
+
+// must match vk_lights.h
+const uint GRID_X = 16;
+const uint GRID_Y = 9;
+const uint GRID_Z = 24;
+const uint MAX_LIGHTS_PER_CLUSTER = 128;
+
+struct PointLight {
+    // view space
+    vec4 positionRadius;
+    vec4 color;
+};
+
+layout (std140, set = 0, binding = 1) uniform ClusterParams {
+    mat4 projection;
+    mat4 inverseProjection;
+    vec2 pixelToTile;
+    float sliceScale;
+    float sliceBias;
+    float nearPlane;
+    float farPlane;
+    uint lightCount;
+} clusterParams;
+
+layout (std430, set = 0, binding = 2) readonly buffer LightBuffer {
+    PointLight lights[];
+} lightBuffer;
+
+// written by light_cull.comp this frame
+layout (std430, set = 0, binding = 3) readonly buffer ClusterCounts {
+    uint counts[];
+} clusterCounts;
+
+layout (std430, set = 0, binding = 4) readonly buffer ClusterIndices {
+    uint indices[];
+} clusterIndices;
+
+// only the lights binned into this fragment's cluster are visited
+vec3 clustered_lights(vec3 albedo) {
+    uvec2 tile = min(uvec2(gl_FragCoord.xy * clusterParams.pixelToTile), uvec2(GRID_X - 1, GRID_Y - 1));
+    float depth = max(-inViewPosition.z, clusterParams.nearPlane);
+    uint slice = uint(clamp(floor(log(depth) * clusterParams.sliceScale - clusterParams.sliceBias), 0.0, float(GRID_Z - 1)));
+    uint cluster = tile.x + tile.y * GRID_X + slice * GRID_X * GRID_Y;
+
+    uint count = min(clusterCounts.counts[cluster], MAX_LIGHTS_PER_CLUSTER);
+    vec3 normal = normalize(inViewNormal);
+    vec3 result = vec3(0.0f);
+    for (uint i = 0; i < count; i++) {
+        PointLight light = lightBuffer.lights[clusterIndices.indices[cluster * MAX_LIGHTS_PER_CLUSTER + i]];
+        vec3 toLight = light.positionRadius.xyz - inViewPosition;
+        float distance = length(toLight);
+        float falloff = clamp(1.0f - distance / light.positionRadius.w, 0.0f, 1.0f);
+        float diffuse = max(dot(normal, toLight / max(distance, 0.0001f)), 0.0f);
+        result += albedo * light.color.rgb * light.color.a * diffuse * falloff * falloff;
+    }
+    return result;
+}
+
+// interleaved gradient noise, impostor.frag discards the complement so the two never overlap
+float dither(vec2 pixel) {
+    return fract(52.9829189f * fract(dot(pixel, vec2(0.06711056f, 0.00583715f))));
+}
+
 void main() {
-    outFragColor = vec4(inColor, 1.0);
+    // cross-fading into its impostor
+    if (inFade < 1.0f && dither(gl_FragCoord.xy) >= inFade) {
+        discard;
+    }
+
+    vec3 color = inColor;
+
+    // fixed light in object space, enough to tell the variants apart
+    if (LIGHTING) {
+        float diffuse = max(dot(normalize(inNormal), normalize(vec3(0.3f, 1.0f, 0.5f))), 0.0f);
+        color *= 0.25f + 0.75f * diffuse;
+
+        if (clusterParams.lightCount > 0) {
+            color += clustered_lights(inColor);
+        }
+    }
+
+    // horizontal stripes stand in for a texture alpha channel
+    if (ALPHA_TEST) {
+        float alpha = step(0.5f, fract(inPosition.y * 4.0f));
+        if (alpha < 0.5f) {
+            discard;
+        }
+    }
+
+    outFragColor = vec4(color, 1.0);
 }
@@ -0,0 +1,20 @@
+#version 450
+
+layout (location = 0) in vec3 vPosition;
+
+struct ObjectData {
+    mat4 render_matrix;
+    vec4 sphere;
+    uint material_index;
+};
+
+layout (std430, set = 0, binding = 0) readonly buffer ObjectBuffer {
+    ObjectData objects[];
+} objectBuffer;
+
+invariant gl_Position;
+
+// position only variant of tri_mesh.vert for the depth prepass
+void main() {
+    gl_Position = objectBuffer.objects[gl_InstanceIndex].render_matrix * vec4(vPosition, 1.0f);
+}
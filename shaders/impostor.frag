@@ -0,0 +1,23 @@
+#version 450
+
+layout (location = 0) in vec2 inUV;
+layout (location = 1) flat in float inFade;
+
+layout (location = 0) out vec4 outFragColor;
+
+// every baked view of every impostor mesh, alpha is 0 where the mesh is not
+layout (set = 0, binding = 1) uniform sampler2D atlas;
+
+// same pattern as colored_triangle.frag
+float dither(vec2 pixel) {
+    return fract(52.9829189f * fract(dot(pixel, vec2(0.06711056f, 0.00583715f))));
+}
+
+void main() {
+    vec4 texel = texture(atlas, inUV);
+    // the mesh keeps the pixels below its fade, the impostor takes the rest
+    if (texel.a < 0.5f || dither(gl_FragCoord.xy) < inFade) {
+        discard;
+    }
+    outFragColor = vec4(texel.rgb, 1.0f);
+}
@@ -0,0 +1,43 @@
+#version 450
+
+layout (location = 0) out vec2 outUV;
+layout (location = 1) flat out float outFade;
+
+// must match GPUImpostorInstance in vk_impostor.h
+struct ImpostorInstance {
+    vec4 sphere;
+    uint tile;
+    float fade;
+};
+
+layout (std430, set = 0, binding = 0) readonly buffer InstanceBuffer {
+    ImpostorInstance instances[];
+} instanceBuffer;
+
+layout ( push_constant ) uniform constants {
+    mat4 viewProj;
+    // camera right and up in world space, w holds the atlas columns and rows
+    vec4 right;
+    vec4 up;
+} PushConstants;
+
+// two triangles, no vertex buffer
+const vec2 corners[6] = vec2[6](
+    vec2(-1.0f, -1.0f), vec2(1.0f, -1.0f), vec2(1.0f, 1.0f),
+    vec2(-1.0f, -1.0f), vec2(1.0f, 1.0f), vec2(-1.0f, 1.0f)
+);
+
+void main() {
+    ImpostorInstance instance = instanceBuffer.instances[gl_InstanceIndex];
+    vec2 corner = corners[gl_VertexIndex];
+
+    // the tile was baked with the bounding sphere filling it, so the quad spans the radius
+    vec3 position = instance.sphere.xyz + (PushConstants.right.xyz * corner.x + PushConstants.up.xyz * corner.y) * instance.sphere.w;
+    gl_Position = PushConstants.viewProj * vec4(position, 1.0f);
+
+    // tiles are stored top row first, the top of the quad is v = 0
+    uint columns = uint(PushConstants.right.w);
+    vec2 tile = vec2(instance.tile % columns, instance.tile / columns);
+    outUV = (tile + vec2(corner.x, -corner.y) * 0.5f + 0.5f) / vec2(PushConstants.right.w, PushConstants.up.w);
+    outFade = instance.fade;
+}
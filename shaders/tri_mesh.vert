@@ -5,14 +5,54 @@ layout (location = 1) in vec3 vNormal;
 layout (location = 2) in vec3 vColor;
 
 layout (location = 0) out vec3 outColor;
+layout (location = 1) out vec3 outNormal;
+layout (location = 2) out vec3 outPosition;
+layout (location = 3) out vec3 outViewPosition;
+layout (location = 4) out vec3 outViewNormal;
+layout (location = 5) flat out float outFade;
+
+// permutation bits, constant_id matches the bit index in ShaderVariantBits (vk_variants.h).
+// every attribute stays declared, the pipeline vertex layout is the same for all variants
+layout (constant_id = 0) const bool FLAT_COLOR = false;
+
+struct ObjectData {
+    mat4 render_matrix;
+    vec4 sphere;
+    uint material_index;
+    // below 1 the mesh is dithered out while its impostor fades in
+    float fade;
+};
+
+// per object data, every draw passes its object index as firstInstance
+layout (std430, set = 0, binding = 0) readonly buffer ObjectBuffer {
+    ObjectData objects[];
+} objectBuffer;
+
+// only the projection part is read here, see vk_lights.h for the rest
+layout (std140, set = 0, binding = 1) uniform ClusterParams {
+    mat4 projection;
+    mat4 inverseProjection;
+} clusterParams;
 
 // Push constants from graphics pipeline
 layout ( push_constant ) uniform constants {
 vec4 data;
-mat4 render_matrix;
 } PushConstants;
 
+// must match depth_only.vert bit for bit so the depth prepass results compare equal
+invariant gl_Position;
+
 void main() {
-    gl_Position = PushConstants.render_matrix * vec4(vPosition, 1.0f);
-    outColor = vColor;
+    mat4 renderMatrix = objectBuffer.objects[gl_InstanceIndex].render_matrix;
+    gl_Position = renderMatrix * vec4(vPosition, 1.0f);
+    outColor = FLAT_COLOR ? vec3(0.8f) : vColor;
+    outNormal = vNormal;
+    outPosition = vPosition;
+    outFade = objectBuffer.objects[gl_InstanceIndex].fade;
+
+    // view space for the clustered lights, the object data only has projection * view * model.
+    // the normal assumes uniform scale, like the culling bounds do
+    vec4 viewPosition = clusterParams.inverseProjection * gl_Position;
+    outViewPosition = viewPosition.xyz / viewPosition.w;
+    outViewNormal = mat3(clusterParams.inverseProjection * renderMatrix) * vNormal;
 }
@@ -1,12 +1,128 @@
 #include <vk_engine.h>
 
+#include <cstdlib>
+#include <cstring>
+
 int main(int argc, char* argv[])
 {
+	//standalone benchmarks, no window needed. only the light benchmark creates a device
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--bench-jobs") == 0) {
+			run_job_system_benchmark();
+			return 0;
+		}
+		if (strcmp(argv[i], "--bench-transforms") == 0) {
+			run_transform_benchmark();
+			return 0;
+		}
+		//cpu binning, then the gpu light cull and main pass for the same light sets on a headless engine
+		//sized for the largest of them
+		if (strcmp(argv[i], "--bench-lights") == 0) {
+			VulkanEngine engine;
+			engine._headless = true;
+			engine._lightCount = 10000;
+			engine.init();
+			run_light_benchmark([&](const GPUPointLight* lights, uint32_t lightCount, LightPassTimings& timings) {
+				return engine.measure_light_passes(lights, lightCount, 20, timings);
+			});
+			engine.cleanup();
+			return 0;
+		}
+		if (strcmp(argv[i], "--bench-spatial") == 0) {
+			run_spatial_benchmark();
+			return 0;
+		}
+		//splits an obj into a chunk pack for --world, optionally with the chunk size in world units
+		if (strcmp(argv[i], "--import-world") == 0 && i + 2 < argc) {
+			float chunkSize = i + 3 < argc ? (float)atof(argv[i + 3]) : 32.f;
+			return import_world(argv[i + 1], argv[i + 2], chunkSize > 0.f ? chunkSize : 32.f) ? 0 : 1;
+		}
+	}
+
 	VulkanEngine engine;
+	//startup regression runs: init, one frame, then the time to first frame line is the result
+	bool firstFrameOnly = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--decoupled") == 0) {
+			engine._decoupledSimulation = true;
+		}
+		else if (strcmp(argv[i], "--depth-prepass") == 0) {
+			engine._depthPrepass = true;
+		}
+		else if (strcmp(argv[i], "--occlusion") == 0) {
+			engine._occlusionCulling = true;
+		}
+		else if (strcmp(argv[i], "--meshlets") == 0) {
+			engine._meshletCulling = true;
+		}
+		else if (strcmp(argv[i], "--meshlet-stats") == 0) {
+			engine._logMeshletStats = true;
+		}
+		else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+			engine._lightCount = (uint32_t)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--world") == 0 && i + 1 < argc) {
+			engine._worldPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--no-pack") == 0) {
+			engine._assetPackPath.clear();
+		}
+		else if (strcmp(argv[i], "--cold-start") == 0) {
+			engine._coldStart = true;
+		}
+		else if (strcmp(argv[i], "--no-command-cache") == 0) {
+			engine._cacheCommands = false;
+		}
+		else if (strcmp(argv[i], "--bindless") == 0) {
+			engine._bindless = true;
+		}
+		else if (strcmp(argv[i], "--dynamic-resolution") == 0) {
+			engine._dynamicResolution = true;
+		}
+		else if (strcmp(argv[i], "--readback") == 0 && i + 1 < argc) {
+			engine._readbackTarget = argv[++i];
+		}
+		else if (strcmp(argv[i], "--impostors") == 0 && i + 1 < argc) {
+			engine._impostorPixels = (float)atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--capture-frame") == 0 && i + 1 < argc) {
+			engine._captureAtFrame = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--fps-cap") == 0 && i + 1 < argc) {
+			engine._pacer.targetFps = (float)atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--idle") == 0) {
+			engine._idleWhenStatic = true;
+		}
+		else if (strcmp(argv[i], "--pacing-stats") == 0) {
+			engine._logFramePacing = true;
+		}
+		else if (strcmp(argv[i], "--assert-no-alloc") == 0) {
+			engine._assertNoFrameAllocations = true;
+		}
+		else if (strcmp(argv[i], "--alloc-stats") == 0) {
+			engine._logAllocations = true;
+		}
+		else if (strcmp(argv[i], "--defragment") == 0) {
+			engine.request_defragmentation();
+		}
+		else if (strcmp(argv[i], "--variant") == 0 && i + 1 < argc) {
+			engine._meshVariant = (uint32_t)atoi(argv[++i]) % SHADER_VARIANT_COUNT;
+		}
+		else if (strcmp(argv[i], "--first-frame-only") == 0) {
+			firstFrameOnly = true;
+		}
+	}
 
 	engine.init();	
 	
-	engine.run();	
+	if (firstFrameOnly) {
+		engine.draw();
+	}
+	else {
+		engine.run();	
+	}
 
 	engine.cleanup();	
 
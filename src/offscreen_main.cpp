@@ -0,0 +1,97 @@
+#include <vk_engine.h>
+
+#include <glm/gtx/transform.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// vulkan_offscreen [--views N] [--tile W H] [--batch N] [--passes N] [--out dir]
+// renders the scene headless from N cameras orbiting it and reports views per second.
+// --out writes every view as dir/view_<n>.ppm
+int main(int argc, char* argv[])
+{
+	uint32_t viewCount = 256;
+	uint32_t passes = 3;
+	OffscreenSettings settings;
+	std::string outDir;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--views") == 0 && i + 1 < argc) {
+			viewCount = (uint32_t)std::max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--tile") == 0 && i + 2 < argc) {
+			settings.tileExtent.width = (uint32_t)std::max(1, atoi(argv[++i]));
+			settings.tileExtent.height = (uint32_t)std::max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+			settings.viewsPerBatch = (uint32_t)std::max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--passes") == 0 && i + 1 < argc) {
+			passes = (uint32_t)std::max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+			outDir = argv[++i];
+		}
+	}
+
+	VulkanEngine engine;
+	engine._headless = true;
+	engine.init();
+
+	//a ring of cameras around the grid, every one looking at its center
+	std::vector<OffscreenView> views(viewCount);
+	const float aspect = (float)settings.tileExtent.width / (float)settings.tileExtent.height;
+	for (uint32_t i = 0; i < viewCount; i++) {
+		const float angle = glm::two_pi<float>() * i / viewCount;
+		const glm::vec3 eye = glm::vec3(cosf(angle) * 30.f, 12.f, sinf(angle) * 30.f);
+
+		views[i].view = glm::lookAt(eye, glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
+		views[i].projection = glm::perspective(glm::radians(70.f), aspect, 0.1f, 200.0f);
+		views[i].projection[1][1] *= -1;
+	}
+
+	const size_t pixelCount = (size_t)settings.tileExtent.width * settings.tileExtent.height;
+	std::vector<uint8_t> rgb(pixelCount * 3);
+	auto writeView = [&](uint32_t view, const uint8_t* pixels) {
+		if (outDir.empty()) {
+			return;
+		}
+		for (size_t p = 0; p < pixelCount; p++) {
+			rgb[p * 3 + 0] = pixels[p * 4 + 0];
+			rgb[p * 3 + 1] = pixels[p * 4 + 1];
+			rgb[p * 3 + 2] = pixels[p * 4 + 2];
+		}
+		std::ofstream file(outDir + "/view_" + std::to_string(view) + ".ppm", std::ios::binary);
+		file << "P6\n" << settings.tileExtent.width << " " << settings.tileExtent.height << "\n255\n";
+		file.write((const char*)rgb.data(), rgb.size());
+	};
+
+	//the first pass makes the targets and warms the driver, the rest are measured. only the first one is written out
+	float bestViewsPerSecond = 0.f;
+	for (uint32_t pass = 0; pass <= passes; pass++) {
+		const bool write = pass == 0;
+		if (!engine.render_views(views.data(), viewCount, settings, write ? OffscreenCallback(writeView) : OffscreenCallback([](uint32_t, const uint8_t*) {}))) {
+			std::cout << "render_views failed, tile " << settings.tileExtent.width << "x" << settings.tileExtent.height << std::endl;
+			engine.cleanup();
+			return 1;
+		}
+		if (pass == 0) {
+			continue;
+		}
+
+		const OffscreenStats& stats = engine.get_offscreen_stats();
+		bestViewsPerSecond = std::max(bestViewsPerSecond, stats.viewsPerSecond);
+		std::cout << "Pass " << pass << ": " << stats.views << " views in " << stats.batches << " batches, " << stats.totalMs
+		          << " ms, " << stats.viewsPerSecond << " views/s, " << stats.draws << " draws" << std::endl;
+	}
+	std::cout << "Best " << bestViewsPerSecond << " views/s at " << settings.tileExtent.width << "x" << settings.tileExtent.height
+	          << ", " << settings.viewsPerBatch << " views per batch" << std::endl;
+
+	engine.cleanup();
+	return 0;
+}
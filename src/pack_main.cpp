@@ -0,0 +1,30 @@
+#include <vk_vfs.h>
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// asset_packer <pack> <root> <directory>... [--compress]
+// writes every file under the directories into one pack, named relative to root. the engine mounts
+// the pack over its parent directory, so root/shaders/x.spv is found as ../shaders/x.spv
+int main(int argc, char* argv[])
+{
+	if (argc < 4) {
+		std::cout << "usage: asset_packer <pack> <root> <directory>... [--compress]" << std::endl;
+		return 1;
+	}
+
+	bool compress = false;
+	std::vector<std::string> directories;
+	for (int i = 3; i < argc; i++) {
+		if (strcmp(argv[i], "--compress") == 0) {
+			compress = true;
+		}
+		else {
+			directories.push_back(argv[i]);
+		}
+	}
+
+	return write_asset_pack(argv[1], argv[2], directories, compress) ? 0 : 1;
+}
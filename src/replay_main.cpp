@@ -0,0 +1,87 @@
+#include <vk_engine.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// vulkan_replay <capture> [--iterations N] [--range first count]
+// renders a captured frame headless and reports cpu and gpu timings.
+// --range replays a slice of the captured draw list, to bisect which draws make a frame slow
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		std::cout << "usage: vulkan_replay <capture> [--iterations N] [--range first count]" << std::endl;
+		return 1;
+	}
+
+	uint32_t iterations = 100;
+	uint32_t firstDraw = 0;
+	uint32_t drawCount = UINT32_MAX;
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+			iterations = (uint32_t)std::max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--range") == 0 && i + 2 < argc) {
+			firstDraw = (uint32_t)atoi(argv[++i]);
+			drawCount = (uint32_t)atoi(argv[++i]);
+		}
+	}
+
+	FrameCapture capture;
+	if (!load_capture(argv[1], capture)) {
+		return 1;
+	}
+
+	VulkanEngine engine;
+	engine._headless = true;
+	engine._windowExtent = {capture.windowWidth, capture.windowHeight};
+	//init() only makes the depth targets the captured paths need
+	engine._depthPrepass = (capture.flags & CAPTURE_DEPTH_PREPASS) != 0;
+	engine._occlusionCulling = (capture.flags & CAPTURE_OCCLUSION_CULLING) != 0;
+	engine.init();
+
+	if (!engine.apply_capture(capture, firstDraw, drawCount)) {
+		engine.cleanup();
+		return 1;
+	}
+
+	//the first frames build the depth pyramid and fill caches, they are not measured
+	const uint32_t warmupFrames = 3;
+	for (uint32_t i = 0; i < warmupFrames; i++) {
+		engine.draw();
+	}
+
+	//the culling result should match the captured draw list, unless the engine changed since the capture
+	if (drawCount == UINT32_MAX && engine._visibleObjects != capture.drawList) {
+		std::cout << "WARNING: replay draws " << engine._visibleObjects.size() << " objects, the capture drew "
+		          << capture.drawList.size() << std::endl;
+	}
+
+	double cpuTotal = 0.0;
+	double gpuTotal = 0.0;
+	float cpuMin = 1e9f;
+	float cpuMax = 0.f;
+	float gpuMin = 1e9f;
+	float gpuMax = 0.f;
+	for (uint32_t i = 0; i < iterations; i++) {
+		engine.draw();
+
+		//gpu timings always describe the frame before, which is still one of the replayed frames
+		cpuTotal += engine._cpuFrameMs;
+		gpuTotal += engine._gpuFrameMs;
+		cpuMin = std::min(cpuMin, engine._cpuFrameMs);
+		cpuMax = std::max(cpuMax, engine._cpuFrameMs);
+		gpuMin = std::min(gpuMin, engine._gpuFrameMs);
+		gpuMax = std::max(gpuMax, engine._gpuFrameMs);
+	}
+
+	std::cout << "Replayed frame " << capture.frame << " " << iterations << " times, "
+	          << engine._renderables.size() << " objects, " << engine._visibleObjects.size() << " draws" << std::endl;
+	std::cout << "cpu ms avg " << cpuTotal / iterations << " min " << cpuMin << " max " << cpuMax << std::endl;
+	std::cout << "gpu ms avg " << gpuTotal / iterations << " min " << gpuMin << " max " << gpuMax << std::endl;
+
+	engine.cleanup();
+	return 0;
+}
@@ -0,0 +1,216 @@
+#include <vk_allocator.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+namespace {
+
+// sits right in front of every pointer handed to the driver
+struct AllocationHeader {
+    size_t size;
+    uint32_t scope;
+    // distance from the malloc result to the returned pointer
+    uint32_t offset;
+};
+
+std::atomic<uint64_t> g_heapAllocations{0};
+std::atomic<uint64_t> g_heapBytes{0};
+
+void* counted_malloc(size_t size) {
+    g_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    g_heapBytes.fetch_add(size, std::memory_order_relaxed);
+    // malloc(0) may return null, operator new must not
+    return std::malloc(size > 0 ? size : 1);
+}
+
+}
+
+const char* host_allocation_scope_name(uint32_t scope) {
+    switch (scope) {
+        case VK_SYSTEM_ALLOCATION_SCOPE_COMMAND: return "command";
+        case VK_SYSTEM_ALLOCATION_SCOPE_OBJECT: return "object";
+        case VK_SYSTEM_ALLOCATION_SCOPE_CACHE: return "cache";
+        case VK_SYSTEM_ALLOCATION_SCOPE_DEVICE: return "device";
+        case VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE: return "instance";
+        default: return "unknown";
+    }
+}
+
+HostAllocator::HostAllocator() {
+    _callbacks = {};
+    _callbacks.pUserData = this;
+    _callbacks.pfnAllocation = vk_allocate;
+    _callbacks.pfnReallocation = vk_reallocate;
+    _callbacks.pfnFree = vk_free;
+    _callbacks.pfnInternalAllocation = vk_internal_allocation;
+    _callbacks.pfnInternalFree = vk_internal_free;
+}
+
+void* HostAllocator::allocate(size_t size, size_t alignment, uint32_t scope) {
+    if (size == 0) {
+        return nullptr;
+    }
+    if (scope >= HOST_ALLOCATION_SCOPE_COUNT) {
+        scope = VK_SYSTEM_ALLOCATION_SCOPE_OBJECT;
+    }
+    // the header needs its own alignment, and alignment is always a power of two
+    if (alignment < alignof(AllocationHeader)) {
+        alignment = alignof(AllocationHeader);
+    }
+
+    char* raw = (char*)std::malloc(size + alignment + sizeof(AllocationHeader));
+    if (!raw) {
+        return nullptr;
+    }
+    uintptr_t aligned = ((uintptr_t)raw + sizeof(AllocationHeader) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+
+    AllocationHeader* header = (AllocationHeader*)aligned - 1;
+    header->size = size;
+    header->scope = scope;
+    header->offset = (uint32_t)(aligned - (uintptr_t)raw);
+
+    ScopeCounters& counters = _scopes[scope];
+    counters.allocations.fetch_add(1, std::memory_order_relaxed);
+    counters.liveAllocations.fetch_add(1, std::memory_order_relaxed);
+    uint64_t live = counters.liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+    uint64_t peak = counters.peakBytes.load(std::memory_order_relaxed);
+    while (live > peak && !counters.peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+    _totalAllocations.fetch_add(1, std::memory_order_relaxed);
+
+    return (void*)aligned;
+}
+
+void HostAllocator::release(void* memory) {
+    if (!memory) {
+        return;
+    }
+    AllocationHeader* header = (AllocationHeader*)memory - 1;
+
+    ScopeCounters& counters = _scopes[header->scope];
+    counters.liveAllocations.fetch_sub(1, std::memory_order_relaxed);
+    counters.liveBytes.fetch_sub(header->size, std::memory_order_relaxed);
+
+    std::free((char*)memory - header->offset);
+}
+
+void* VKAPI_PTR HostAllocator::vk_allocate(void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    return ((HostAllocator*)userData)->allocate(size, alignment, (uint32_t)scope);
+}
+
+void* VKAPI_PTR HostAllocator::vk_reallocate(void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    HostAllocator* allocator = (HostAllocator*)userData;
+    if (!original) {
+        return allocator->allocate(size, alignment, (uint32_t)scope);
+    }
+    if (size == 0) {
+        allocator->release(original);
+        return nullptr;
+    }
+
+    // a new block keeps the alignment and scope bookkeeping simple, the old one stays valid on failure
+    void* memory = allocator->allocate(size, alignment, (uint32_t)scope);
+    if (!memory) {
+        return nullptr;
+    }
+    const size_t originalSize = ((AllocationHeader*)original - 1)->size;
+    std::memcpy(memory, original, originalSize < size ? originalSize : size);
+    allocator->release(original);
+    return memory;
+}
+
+void VKAPI_PTR HostAllocator::vk_free(void* userData, void* memory) {
+    ((HostAllocator*)userData)->release(memory);
+}
+
+void VKAPI_PTR HostAllocator::vk_internal_allocation(void* userData, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope) {
+    HostAllocator* allocator = (HostAllocator*)userData;
+    if ((uint32_t)scope < HOST_ALLOCATION_SCOPE_COUNT) {
+        allocator->_scopes[scope].internalBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+void VKAPI_PTR HostAllocator::vk_internal_free(void* userData, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope) {
+    HostAllocator* allocator = (HostAllocator*)userData;
+    if ((uint32_t)scope < HOST_ALLOCATION_SCOPE_COUNT) {
+        allocator->_scopes[scope].internalBytes.fetch_sub(size, std::memory_order_relaxed);
+    }
+}
+
+HostAllocationStats HostAllocator::get_stats() const {
+    HostAllocationStats stats = {};
+    for (uint32_t i = 0; i < HOST_ALLOCATION_SCOPE_COUNT; i++) {
+        const ScopeCounters& counters = _scopes[i];
+        stats.scopes[i].allocations = counters.allocations.load(std::memory_order_relaxed);
+        stats.scopes[i].liveAllocations = counters.liveAllocations.load(std::memory_order_relaxed);
+        stats.scopes[i].liveBytes = counters.liveBytes.load(std::memory_order_relaxed);
+        stats.scopes[i].peakBytes = counters.peakBytes.load(std::memory_order_relaxed);
+        stats.scopes[i].internalBytes = counters.internalBytes.load(std::memory_order_relaxed);
+    }
+    stats.totalAllocations = total_allocations();
+    return stats;
+}
+
+void HostAllocator::log_stats() const {
+    HostAllocationStats stats = get_stats();
+    std::cout << "Vulkan host allocations: " << stats.totalAllocations << " total" << std::endl;
+    for (uint32_t i = 0; i < HOST_ALLOCATION_SCOPE_COUNT; i++) {
+        const HostScopeStats& scope = stats.scopes[i];
+        std::cout << "  " << host_allocation_scope_name(i) << ": " << scope.allocations << " allocations, "
+                  << scope.liveAllocations << " live (" << scope.liveBytes / 1024 << " KB), peak "
+                  << scope.peakBytes / 1024 << " KB, internal " << scope.internalBytes / 1024 << " KB" << std::endl;
+    }
+}
+
+HostAllocator& host_allocator() {
+    // constructed on first use, before the instance that needs it
+    static HostAllocator allocator;
+    return allocator;
+}
+
+HeapAllocationCounters heap_allocation_counters() {
+    HeapAllocationCounters counters;
+    counters.allocations = g_heapAllocations.load(std::memory_order_relaxed);
+    counters.bytes = g_heapBytes.load(std::memory_order_relaxed);
+    return counters;
+}
+
+// replacing the global operators counts every container, std::function and string in the process.
+// the array and sized forms of the standard library forward to these
+void* operator new(size_t size) {
+    void* memory = counted_malloc(size);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return counted_malloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return counted_malloc(size);
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, const std::nothrow_t&) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory, const std::nothrow_t&) noexcept {
+    std::free(memory);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vk_types.h>
+#include <atomic>
+#include <cstdint>
+
+// one entry per VkSystemAllocationScope, COMMAND through INSTANCE
+constexpr uint32_t HOST_ALLOCATION_SCOPE_COUNT = 5;
+
+const char* host_allocation_scope_name(uint32_t scope);
+
+struct HostScopeStats {
+    // allocate and reallocate calls since startup
+    uint64_t allocations;
+    uint64_t liveAllocations;
+    uint64_t liveBytes;
+    uint64_t peakBytes;
+    // memory the driver allocated itself and only reported, usually executable code
+    uint64_t internalBytes;
+};
+
+struct HostAllocationStats {
+    HostScopeStats scopes[HOST_ALLOCATION_SCOPE_COUNT];
+    // allocations over every scope, cheap enough to sample every frame
+    uint64_t totalAllocations;
+};
+
+// VkAllocationCallbacks that keep counts and bytes per allocation scope. every allocation carries a
+// small header with its size and scope, so frees and reallocations are attributed to the right scope.
+// the loader and drivers call it from any thread, the counters are atomics
+class HostAllocator {
+public:
+    HostAllocator();
+
+    VkAllocationCallbacks* callbacks() { return &_callbacks; }
+
+    HostAllocationStats get_stats() const;
+
+    uint64_t total_allocations() const { return _totalAllocations.load(std::memory_order_relaxed); }
+
+    void log_stats() const;
+
+private:
+    struct ScopeCounters {
+        std::atomic<uint64_t> allocations{0};
+        std::atomic<uint64_t> liveAllocations{0};
+        std::atomic<uint64_t> liveBytes{0};
+        std::atomic<uint64_t> peakBytes{0};
+        std::atomic<uint64_t> internalBytes{0};
+    };
+
+    static void* VKAPI_PTR vk_allocate(void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope);
+    static void* VKAPI_PTR vk_reallocate(void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+    static void VKAPI_PTR vk_free(void* userData, void* memory);
+    static void VKAPI_PTR vk_internal_allocation(void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+    static void VKAPI_PTR vk_internal_free(void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+
+    void* allocate(size_t size, size_t alignment, uint32_t scope);
+    void release(void* memory);
+
+    ScopeCounters _scopes[HOST_ALLOCATION_SCOPE_COUNT];
+    std::atomic<uint64_t> _totalAllocations{0};
+    VkAllocationCallbacks _callbacks;
+};
+
+// process wide instance, every vkCreate*/vkDestroy* pair is given its callbacks
+HostAllocator& host_allocator();
+
+struct HeapAllocationCounters {
+    uint64_t allocations;
+    uint64_t bytes;
+};
+
+// operator new calls on every thread since startup, counted by the replacement operators in vk_allocator.cpp
+HeapAllocationCounters heap_allocation_counters();
@@ -0,0 +1,191 @@
+#include <vk_bindless.h>
+#include <vk_allocator.h>
+
+#include <iostream>
+
+bool BindlessHeap::supported(const VkPhysicalDeviceVulkan12Features& features) {
+    return features.runtimeDescriptorArray &&
+           features.descriptorBindingPartiallyBound &&
+           features.descriptorBindingStorageBufferUpdateAfterBind &&
+           features.descriptorBindingSampledImageUpdateAfterBind &&
+           features.shaderSampledImageArrayNonUniformIndexing;
+}
+
+void BindlessHeap::enable_features(VkPhysicalDeviceVulkan12Features& features) {
+    features.runtimeDescriptorArray = VK_TRUE;
+    features.descriptorBindingPartiallyBound = VK_TRUE;
+    features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+    features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+}
+
+void BindlessHeap::init(VkDevice device, uint32_t maxBuffers, uint32_t maxTextures, VkSampler sampler) {
+    _device = device;
+    _bufferCapacity = maxBuffers;
+    _textureCapacity = maxTextures;
+
+    VkDescriptorSetLayoutBinding bindings[3] = {};
+    bindings[0].binding = BUFFER_BINDING;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[0].descriptorCount = maxBuffers;
+    bindings[0].stageFlags = VK_SHADER_STAGE_ALL;
+
+    bindings[1].binding = TEXTURE_BINDING;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    bindings[1].descriptorCount = maxTextures;
+    bindings[1].stageFlags = VK_SHADER_STAGE_ALL;
+
+    // images are combined with it in the shader, one sampler covers everything drawn so far
+    bindings[2].binding = SAMPLER_BINDING;
+    bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    bindings[2].descriptorCount = 1;
+    bindings[2].stageFlags = VK_SHADER_STAGE_ALL;
+    bindings[2].pImmutableSamplers = &sampler;
+
+    // unused slots are never written, and slots can be filled while the set is bound by a recorded frame
+    VkDescriptorBindingFlags bindingFlags[3] = {
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
+            0
+    };
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo = {};
+    flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    flagsInfo.pNext = nullptr;
+    flagsInfo.bindingCount = 3;
+    flagsInfo.pBindingFlags = bindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &flagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layoutInfo.bindingCount = 3;
+    layoutInfo.pBindings = bindings;
+
+    if (vkCreateDescriptorSetLayout(_device, &layoutInfo, host_allocator().callbacks(), &_layout) != VK_SUCCESS) {
+        std::cout << "Failed to create the bindless descriptor set layout" << std::endl;
+        return;
+    }
+
+    VkDescriptorPoolSize sizes[] = {
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxBuffers},
+            {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, maxTextures},
+            {VK_DESCRIPTOR_TYPE_SAMPLER, 1}
+    };
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.pNext = nullptr;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    poolInfo.maxSets = 1;
+    poolInfo.poolSizeCount = 3;
+    poolInfo.pPoolSizes = sizes;
+
+    if (vkCreateDescriptorPool(_device, &poolInfo, host_allocator().callbacks(), &_pool) != VK_SUCCESS) {
+        std::cout << "Failed to create the bindless descriptor pool" << std::endl;
+        return;
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.pNext = nullptr;
+    allocInfo.descriptorPool = _pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &_layout;
+
+    if (vkAllocateDescriptorSets(_device, &allocInfo, &_set) != VK_SUCCESS) {
+        std::cout << "Failed to allocate the bindless descriptor set" << std::endl;
+    }
+}
+
+void BindlessHeap::cleanup() {
+    // the set goes away with its pool
+    vkDestroyDescriptorPool(_device, _pool, host_allocator().callbacks());
+    vkDestroyDescriptorSetLayout(_device, _layout, host_allocator().callbacks());
+    _pool = VK_NULL_HANDLE;
+    _layout = VK_NULL_HANDLE;
+    _set = VK_NULL_HANDLE;
+    _buffersUsed = 0;
+    _texturesUsed = 0;
+    _freeBuffers.clear();
+    _freeTextures.clear();
+}
+
+BindlessIndex BindlessHeap::allocate_slot(std::vector<BindlessIndex>& freeSlots, uint32_t& used, uint32_t capacity) {
+    if (!freeSlots.empty()) {
+        BindlessIndex index = freeSlots.back();
+        freeSlots.pop_back();
+        return index;
+    }
+    if (used == capacity) {
+        return UINT32_MAX;
+    }
+    return used++;
+}
+
+BindlessIndex BindlessHeap::add_buffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+    BindlessIndex index = allocate_slot(_freeBuffers, _buffersUsed, _bufferCapacity);
+    if (index == UINT32_MAX) {
+        std::cout << "Bindless buffer array is full (" << _bufferCapacity << ")" << std::endl;
+        return index;
+    }
+    update_buffer(index, buffer, offset, range);
+    return index;
+}
+
+void BindlessHeap::update_buffer(BindlessIndex index, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+    VkDescriptorBufferInfo bufferInfo = {buffer, offset, range};
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.pNext = nullptr;
+    write.dstSet = _set;
+    write.dstBinding = BUFFER_BINDING;
+    write.dstArrayElement = index;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &bufferInfo;
+
+    vkUpdateDescriptorSets(_device, 1, &write, 0, nullptr);
+}
+
+BindlessIndex BindlessHeap::add_texture(VkImageView view, VkImageLayout layout) {
+    BindlessIndex index = allocate_slot(_freeTextures, _texturesUsed, _textureCapacity);
+    if (index == UINT32_MAX) {
+        std::cout << "Bindless texture array is full (" << _textureCapacity << ")" << std::endl;
+        return index;
+    }
+
+    VkDescriptorImageInfo imageInfo = {VK_NULL_HANDLE, view, layout};
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.pNext = nullptr;
+    write.dstSet = _set;
+    write.dstBinding = TEXTURE_BINDING;
+    write.dstArrayElement = index;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    write.pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(_device, 1, &write, 0, nullptr);
+    return index;
+}
+
+void BindlessHeap::remove_buffer(BindlessIndex index) {
+    // partially bound, the stale descriptor is fine as long as nothing indexes it
+    _freeBuffers.push_back(index);
+}
+
+void BindlessHeap::remove_texture(BindlessIndex index) {
+    _freeTextures.push_back(index);
+}
+
+BindlessStats BindlessHeap::get_stats() const {
+    BindlessStats stats = {};
+    stats.buffersUsed = _buffersUsed - (uint32_t)_freeBuffers.size();
+    stats.bufferCapacity = _bufferCapacity;
+    stats.texturesUsed = _texturesUsed - (uint32_t)_freeTextures.size();
+    stats.textureCapacity = _textureCapacity;
+    return stats;
+}
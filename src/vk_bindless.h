@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vk_types.h>
+#include <cstdint>
+#include <vector>
+
+// slot in one of the bindless arrays, shaders receive these instead of descriptor sets
+using BindlessIndex = uint32_t;
+
+struct BindlessStats {
+    uint32_t buffersUsed;
+    uint32_t bufferCapacity;
+    uint32_t texturesUsed;
+    uint32_t textureCapacity;
+};
+
+// one global descriptor set holding large update-after-bind arrays of storage buffers and sampled
+// images, plus a single immutable sampler. a resource is written into a free slot once, shaders index
+// the arrays with values from push constants or other buffers, so the set is bound once per pass
+class BindlessHeap {
+public:
+    static constexpr uint32_t BUFFER_BINDING = 0;
+    static constexpr uint32_t TEXTURE_BINDING = 1;
+    static constexpr uint32_t SAMPLER_BINDING = 2;
+
+    // the device needs runtime arrays, partially bound and update-after-bind bindings for both arrays
+    static bool supported(const VkPhysicalDeviceVulkan12Features& features);
+
+    // fills the feature bits the layout depends on
+    static void enable_features(VkPhysicalDeviceVulkan12Features& features);
+
+    void init(VkDevice device, uint32_t maxBuffers, uint32_t maxTextures, VkSampler sampler);
+
+    void cleanup();
+
+    // UINT32_MAX once the array is full
+    BindlessIndex add_buffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+
+    BindlessIndex add_texture(VkImageView view, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+    // rewrites a slot in place, for resources whose VkBuffer was recreated
+    void update_buffer(BindlessIndex index, VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+
+    // the slot must not be read by any frame still in flight when it gets reused
+    void remove_buffer(BindlessIndex index);
+
+    void remove_texture(BindlessIndex index);
+
+    BindlessStats get_stats() const;
+
+    VkDescriptorSetLayout _layout{VK_NULL_HANDLE};
+    VkDescriptorSet _set{VK_NULL_HANDLE};
+
+private:
+    BindlessIndex allocate_slot(std::vector<BindlessIndex>& freeSlots, uint32_t& used, uint32_t capacity);
+
+    VkDevice _device{VK_NULL_HANDLE};
+    VkDescriptorPool _pool{VK_NULL_HANDLE};
+
+    uint32_t _bufferCapacity{0};
+    uint32_t _textureCapacity{0};
+    // slots below these have been handed out at least once
+    uint32_t _buffersUsed{0};
+    uint32_t _texturesUsed{0};
+    std::vector<BindlessIndex> _freeBuffers;
+    std::vector<BindlessIndex> _freeTextures;
+};
@@ -0,0 +1,90 @@
+#include <vk_capture.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+namespace {
+    const char CAPTURE_MAGIC[4] = {'V', 'K', 'F', 'C'};
+    const uint32_t CAPTURE_VERSION = 1;
+
+    struct CaptureHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t frame;
+        uint32_t windowWidth;
+        uint32_t windowHeight;
+        float renderScale;
+        uint32_t flags;
+        glm::mat4 view;
+        glm::mat4 projection;
+        uint32_t objectCount;
+        uint32_t drawCount;
+    };
+}
+
+bool save_capture(const std::string& path, const FrameCapture& capture) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        std::cout << "Could not open " << path << " to write a capture" << std::endl;
+        return false;
+    }
+
+    CaptureHeader header = {};
+    std::copy(CAPTURE_MAGIC, CAPTURE_MAGIC + 4, header.magic);
+    header.version = CAPTURE_VERSION;
+    header.frame = capture.frame;
+    header.windowWidth = capture.windowWidth;
+    header.windowHeight = capture.windowHeight;
+    header.renderScale = capture.renderScale;
+    header.flags = capture.flags;
+    header.view = capture.view;
+    header.projection = capture.projection;
+    header.objectCount = (uint32_t)capture.objects.size();
+    header.drawCount = (uint32_t)capture.drawList.size();
+
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)capture.objects.data(), capture.objects.size() * sizeof(CapturedObject));
+    file.write((const char*)capture.drawList.data(), capture.drawList.size() * sizeof(uint32_t));
+    return file.good();
+}
+
+bool load_capture(const std::string& path, FrameCapture& outCapture) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        std::cout << "Could not open capture " << path << std::endl;
+        return false;
+    }
+
+    CaptureHeader header;
+    file.read((char*)&header, sizeof(header));
+    if (!file || !std::equal(CAPTURE_MAGIC, CAPTURE_MAGIC + 4, header.magic) || header.version != CAPTURE_VERSION) {
+        std::cout << path << " is not a version " << CAPTURE_VERSION << " frame capture" << std::endl;
+        return false;
+    }
+
+    outCapture.frame = header.frame;
+    outCapture.windowWidth = header.windowWidth;
+    outCapture.windowHeight = header.windowHeight;
+    outCapture.renderScale = header.renderScale;
+    outCapture.flags = header.flags;
+    outCapture.view = header.view;
+    outCapture.projection = header.projection;
+
+    outCapture.objects.resize(header.objectCount);
+    outCapture.drawList.resize(header.drawCount);
+    file.read((char*)outCapture.objects.data(), outCapture.objects.size() * sizeof(CapturedObject));
+    file.read((char*)outCapture.drawList.data(), outCapture.drawList.size() * sizeof(uint32_t));
+    if (!file) {
+        std::cout << "Capture " << path << " is truncated" << std::endl;
+        return false;
+    }
+
+    for (uint32_t index : outCapture.drawList) {
+        if (index >= header.objectCount) {
+            std::cout << "Capture " << path << " draws an object it does not contain" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
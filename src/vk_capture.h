@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// render paths that were active when the frame was captured
+enum CaptureFlags : uint32_t {
+    CAPTURE_DEPTH_PREPASS = 1 << 0,
+    CAPTURE_OCCLUSION_CULLING = 1 << 1,
+};
+
+struct CapturedObject {
+    // NameId hashes, resolved against the registries when the capture is replayed
+    uint32_t mesh;
+    uint32_t material;
+    glm::mat4 transform;
+};
+
+// everything draw() consumed for one frame
+struct FrameCapture {
+    uint64_t frame{0};
+    uint32_t windowWidth{0};
+    uint32_t windowHeight{0};
+    float renderScale{1.f};
+    uint32_t flags{0};
+
+    glm::mat4 view{1.f};
+    glm::mat4 projection{1.f};
+
+    // every renderable, indexed like VulkanEngine::_renderables
+    std::vector<CapturedObject> objects;
+    // object indices that survived frustum culling, in draw order
+    std::vector<uint32_t> drawList;
+};
+
+// raw little endian dump, captures are meant to be replayed by a build of the same engine
+bool save_capture(const std::string& path, const FrameCapture& capture);
+
+bool load_capture(const std::string& path, FrameCapture& outCapture);
@@ -0,0 +1,84 @@
+#include <vk_culling.h>
+
+#include <algorithm>
+
+Frustum Frustum::from_matrix(const glm::mat4& viewProj) {
+    // rows of the matrix, glm is column major
+    glm::vec4 row0 = {viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]};
+    glm::vec4 row1 = {viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]};
+    glm::vec4 row2 = {viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]};
+    glm::vec4 row3 = {viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]};
+
+    Frustum frustum;
+    frustum.planes[0] = row3 + row0;
+    frustum.planes[1] = row3 - row0;
+    frustum.planes[2] = row3 + row1;
+    frustum.planes[3] = row3 - row1;
+    frustum.planes[4] = row3 + row2;
+    frustum.planes[5] = row3 - row2;
+
+    // normalize so the plane distance is in world units and can be compared with a radius
+    for (glm::vec4& plane : frustum.planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return frustum;
+}
+
+bool Frustum::intersects_sphere(const glm::vec3& center, float radius) const {
+    for (const glm::vec4& plane : planes) {
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+FrustumTest Frustum::test_box(const Aabb& box, uint32_t& planeMask) const {
+    for (uint32_t i = 0; i < 6; i++) {
+        if ((planeMask & (1u << i)) == 0) {
+            continue;
+        }
+        const glm::vec3 normal = glm::vec3(planes[i]);
+        // the corners furthest along and against the normal
+        const glm::bvec3 positiveAxis = glm::greaterThan(normal, glm::vec3(0.f));
+        const glm::vec3 furthest = glm::mix(box.min, box.max, positiveAxis);
+        const glm::vec3 nearest = glm::mix(box.max, box.min, positiveAxis);
+
+        if (glm::dot(normal, furthest) + planes[i].w < 0.f) {
+            return FrustumTest::Outside;
+        }
+        if (glm::dot(normal, nearest) + planes[i].w >= 0.f) {
+            planeMask &= ~(1u << i);
+        }
+    }
+    return planeMask == 0 ? FrustumTest::Inside : FrustumTest::Intersects;
+}
+
+bool Aabb::contains(const Aabb& other) const {
+    return min.x <= other.min.x && min.y <= other.min.y && min.z <= other.min.z &&
+           max.x >= other.max.x && max.y >= other.max.y && max.z >= other.max.z;
+}
+
+float Aabb::surface_area() const {
+    glm::vec3 size = max - min;
+    return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+Aabb Aabb::merge(const Aabb& a, const Aabb& b) {
+    return Aabb{glm::min(a.min, b.min), glm::max(a.max, b.max)};
+}
+
+Aabb Aabb::from_sphere(const glm::vec3& center, float radius) {
+    return Aabb{center - glm::vec3(radius), center + glm::vec3(radius)};
+}
+
+MeshBounds transform_bounds(const MeshBounds& bounds, const glm::mat4& transform) {
+    float scaleX = glm::length(glm::vec3(transform[0]));
+    float scaleY = glm::length(glm::vec3(transform[1]));
+    float scaleZ = glm::length(glm::vec3(transform[2]));
+
+    MeshBounds world;
+    world.origin = glm::vec3(transform * glm::vec4(bounds.origin, 1.f));
+    world.radius = bounds.radius * std::max(scaleX, std::max(scaleY, scaleZ));
+    return world;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+
+// bounding sphere in mesh space
+struct MeshBounds {
+    glm::vec3 origin{0.f};
+    float radius{0.f};
+};
+
+// axis aligned box
+struct Aabb {
+    glm::vec3 min{0.f};
+    glm::vec3 max{0.f};
+
+    bool contains(const Aabb& other) const;
+
+    float surface_area() const;
+
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+
+    static Aabb merge(const Aabb& a, const Aabb& b);
+
+    static Aabb from_sphere(const glm::vec3& center, float radius);
+};
+
+enum class FrustumTest : uint8_t {
+    Outside,
+    Intersects,
+    Inside
+};
+
+struct Frustum {
+    // xyz = inward facing normal, w = distance. order is left, right, bottom, top, near, far
+    glm::vec4 planes[6];
+
+    // extracts the planes of a projection * view matrix
+    static Frustum from_matrix(const glm::mat4& viewProj);
+
+    bool intersects_sphere(const glm::vec3& center, float radius) const;
+
+    // planeMask has a bit per plane left to test. planes the box is completely inside are cleared from it,
+    // boxes nested inside it can skip them
+    FrustumTest test_box(const Aabb& box, uint32_t& planeMask) const;
+};
+
+// moves a mesh space sphere into world space, the radius grows by the largest axis scale
+MeshBounds transform_bounds(const MeshBounds& bounds, const glm::mat4& transform);
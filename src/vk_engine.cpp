@@ -10,6 +10,10 @@
 
 #include<iostream>
 #include<fstream>
+#include<thread>
+#include<cstring>
+#include<algorithm>
+#include<random>
 
 #define VMA_IMPLEMENTATION
 #include "vk_mem_alloc.h"
@@ -32,65 +36,246 @@ const uint32_t ONE_SECOND_TIMEOUT = 1000000000;
                                                                             \
     } while (0)                                                             \
 
+namespace {
+    struct DepthReduceConstants {
+        glm::vec2 srcSize;
+        glm::vec2 dstSize;
+    };
+
+    struct OcclusionCullConstants {
+        glm::mat4 viewProj;
+        glm::vec2 pyramidSize;
+        uint32_t drawCount;
+        uint32_t pad;
+    };
+
+    struct MeshletCullConstants {
+        uint32_t workCount;
+        uint32_t maxDraws;
+    };
+
+    //the graphics queue writes the first four and the light cull pair, the compute queue the rest.
+    //each queue resets what it writes
+    enum Timestamp : uint32_t {
+        TIMESTAMP_GRAPHICS_BEGIN,
+        TIMESTAMP_PREPASS_END,
+        TIMESTAMP_MAIN_END,
+        TIMESTAMP_UPSCALE_END,
+        TIMESTAMP_CULL_BEGIN,
+        TIMESTAMP_CULL_END,
+        TIMESTAMP_PYRAMID_BEGIN,
+        TIMESTAMP_PYRAMID_END,
+        TIMESTAMP_LIGHT_CULL_BEGIN,
+        TIMESTAMP_LIGHT_CULL_END,
+        TIMESTAMP_COUNT
+    };
+
+    uint32_t previous_pow2(uint32_t value) {
+        uint32_t result = 1;
+        while (result * 2 <= value) {
+            result *= 2;
+        }
+        return result;
+    }
+
+    //fnv1a over the bytes, chained through hash
+    uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+        const uint8_t* bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    template<typename T>
+    uint64_t hash_value(uint64_t hash, const T& value) {
+        return hash_bytes(hash, &value, sizeof(T));
+    }
+}
+
 
 void VulkanEngine::init()
 {
-	// We initialize SDL and create a window with it. 
-	SDL_Init(SDL_INIT_VIDEO);
-
-	SDL_WindowFlags window_flags = (SDL_WindowFlags)(SDL_WINDOW_VULKAN);
-    std::cout << "SDL init" << std::endl;
-	_window = SDL_CreateWindow(
-		"Vulkan Engine",
-		SDL_WINDOWPOS_UNDEFINED,
-		SDL_WINDOWPOS_UNDEFINED,
-		_windowExtent.width,
-		_windowExtent.height,
-		window_flags
-	);
+    //before the clock starts, so startup pays for every read from the disk but not for the eviction
+    if (_coldStart) {
+        evict_file_cache(_assetPackPath);
+        evict_file_cache("../shaders");
+        evict_file_cache("../assets");
+    }
+
+    _startupBegin = std::chrono::steady_clock::now();
+
+    //workers are needed by every phase below
+    _jobs.init();
+
+    //only the table of contents is read here, entries are paged in by whoever reads them
+    timed_phase("asset pack", [this]() {
+        if (_assetPackPath.empty() || !_assetPack.open(_assetPackPath, "../")) {
+            std::cout << "No asset pack at " << _assetPackPath << ", reading loose files" << std::endl;
+            return;
+        }
+        AssetPackStats packStats = _assetPack.get_stats();
+        std::cout << "Asset pack " << _assetPackPath << ": " << packStats.entries << " entries (" << packStats.compressedEntries
+                  << " compressed), " << packStats.packBytes << " bytes" << (packStats.mapped ? "" : ", not mapped") << std::endl;
+    });
+
+    //meshlets draw from their own indirect list, the object level gpu path does not apply
+    if (_meshletCulling && (_depthPrepass || _occlusionCulling)) {
+        std::cout << "Meshlet culling replaces the depth prepass and occlusion culling, both disabled" << std::endl;
+        _depthPrepass = false;
+        _occlusionCulling = false;
+    }
+
+    //point lights are shaded by the LIGHTING variant only
+    _lightCount = std::min(_lightCount, _maxLights);
+    if (_lightCount > 0) {
+        _meshVariant |= VARIANT_LIGHTING;
+    }
+
+    //startup is a small dependency graph. file reads and obj parsing need no device and start right away,
+    //pipeline compiles wait for the shader files, mesh uploads for the parsed meshes, the scene for both
+    JobCounter shadersRead;
+    JobCounter meshesParsed;
+    _jobs.run([this]() { timed_phase("read shaders", [this]() { read_shaders(); }); }, &shadersRead);
+    //init_vulkan may still turn meshlet culling off, the parse job works from the flag as it is now
+    const bool buildMeshlets = _meshletCulling;
+    _jobs.run([this, buildMeshlets]() { timed_phase("parse meshes", [this, buildMeshlets]() { parse_meshes(buildMeshlets); }); }, &meshesParsed);
+
+    //headless runs never present, so there is no window to create
+    if (!_headless) {
+        timed_phase("window", [this]() {
+	        // We initialize SDL and create a window with it. 
+	        SDL_Init(SDL_INIT_VIDEO);
+
+	        SDL_WindowFlags window_flags = (SDL_WindowFlags)(SDL_WINDOW_VULKAN);
+	        _window = SDL_CreateWindow(
+		        "Vulkan Engine",
+		        SDL_WINDOWPOS_UNDEFINED,
+		        SDL_WINDOWPOS_UNDEFINED,
+		        _windowExtent.width,
+		        _windowExtent.height,
+		        window_flags
+	        );
+        });
+    }
 
     //load core vulkan structure
-    init_vulkan();
-    std::cout << "Vulkan initialized" << std::endl;
+    timed_phase("vulkan", [this]() { init_vulkan(); });
     //create swapchain
-    init_swapchain();
+    timed_phase("swapchain", [this]() { init_swapchain(); });
     //create command buffer
-    init_commands();
+    timed_phase("commands", [this]() { init_commands(); });
+
+    //pipelines are built against these, the render graph creates the render passes and framebuffers frames use
+    timed_phase("renderpasses", [this]() {
+        init_default_renderpass();
+        _renderGraph.init(_device, _allocator, &_gpuMemory);
+        _renderGraph.logPlacements = _logAllocations;
+        _mainDeletionQueue.push_function([=]() {
+            _renderGraph.cleanup();
+        });
+    });
 
-    init_default_renderpass();
-    std::cout << "past Renderpass" << std::endl;
+    timed_phase("sync", [this]() { init_sync_structures(); });
 
-    // we need to create the renderpass before framebuffers
-    // framebuffers are created for specific renderpass
-    init_framebuffers();
+    if (!_readbackTarget.empty()) {
+        timed_phase("readback", [this]() { init_readback(); });
+    }
+
+    timed_phase("descriptors", [this]() {
+        init_descriptors();
+        init_bindless();
+    });
+
+    //compiles overlap the geometry pool and mesh uploads below. the two sides only share the device,
+    //the allocator, the memory tracker and the deletion queue, which are all safe to use concurrently
+    JobCounter pipelinesBuilt;
+    _jobs.run_after(shadersRead, [this]() {
+        timed_phase("pipelines", [this]() { init_pipelines(); });
+        timed_phase("occlusion culling", [this]() { init_occlusion_culling(); });
+        timed_phase("meshlet culling", [this]() { init_meshlet_culling(); });
+        timed_phase("light culling", [this]() { init_light_culling(); });
+    }, &pipelinesBuilt);
+
+    timed_phase("geometry pool", [this]() { init_geometry_pool(); });
+    _jobs.wait(meshesParsed);
+    timed_phase("mesh uploads", [this]() { load_meshes(); });
+
+    //the scene resolves material names, so every pipeline has to exist
+    _jobs.wait(pipelinesBuilt);
+    _shaderCache.clear();
+
+    timed_phase("scene", [this]() {
+        init_scene();
+        check_meshlet_materials();
+        //draw() always renders from a snapshot, so one has to exist before the first frame
+        publish_snapshot();
+    });
 
-    init_sync_structures();
+    //the bake draws the meshes the scene uses with their materials
+    if (_impostorPixels > 0.f) {
+        timed_phase("impostors", [this]() { init_impostors(); });
+    }
 
-    init_pipelines();
-    std::cout << "Past Pipelines" << std::endl;
-    load_meshes();
-    std::cout << "Load scene" << std::endl;
-    init_scene();
+    _startupStats.initMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - _startupBegin).count();
 	
 	//everything went fine
 	_isInitialized = true;
 }
 
-void VulkanEngine::init_swapchain() {
-    vkb::SwapchainBuilder swapchainBuilder{_chosenGPU,_device,_surface};
+void VulkanEngine::timed_phase(const char* name, const std::function<void()>& phase) {
+    auto start = std::chrono::steady_clock::now();
+    phase();
+    auto end = std::chrono::steady_clock::now();
+
+    StartupPhase record;
+    record.name = name;
+    record.startMs = std::chrono::duration<float, std::milli>(start - _startupBegin).count();
+    record.durationMs = std::chrono::duration<float, std::milli>(end - start).count();
+    record.thread = JobSystem::thread_index();
 
-    vkb::Swapchain vkbSwapchain = swapchainBuilder
-            .use_default_format_selection()
-            .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)                 //how will the images render to the swapchain?
-            .set_desired_extent(_windowExtent.width, _windowExtent.height)     //send the window description
-            .build()
-            .value();
+    std::lock_guard<std::mutex> lock(_startupLock);
+    _startupPhases.push_back(record);
+}
+
+void VulkanEngine::finish_startup() {
+    _startupStats.timeToFirstFrameMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - _startupBegin).count();
+    _startupStats.firstFrameMs = _startupStats.timeToFirstFrameMs - _startupStats.initMs;
+
+    //phases from different threads interleave, start order shows what overlapped
+    std::sort(_startupPhases.begin(), _startupPhases.end(), [](const StartupPhase& a, const StartupPhase& b) {
+        return a.startMs < b.startMs;
+    });
 
-    _swapchain = vkbSwapchain.swapchain;
-    _swapchainImages = vkbSwapchain.get_images().value();
-    _swapchainImageViews = vkbSwapchain.get_image_views().value();
+    std::cout << "Startup phases:" << std::endl;
+    for (const StartupPhase& phase : _startupPhases) {
+        std::cout << "  " << phase.name << ": " << phase.startMs << " ms + " << phase.durationMs << " ms (thread "
+                  << phase.thread << ")" << std::endl;
+    }
+    std::cout << "Time to first frame: " << _startupStats.timeToFirstFrameMs << " ms (init " << _startupStats.initMs
+              << " ms, first frame " << _startupStats.firstFrameMs << " ms)" << std::endl;
+}
 
-    _swapchainImageFormat = vkbSwapchain.image_format;
+void VulkanEngine::init_swapchain() {
+    //the offscreen targets below are all a headless run needs
+    if (!_headless) {
+        vkb::SwapchainBuilder swapchainBuilder{_chosenGPU,_device,_surface};
+
+        vkb::Swapchain vkbSwapchain = swapchainBuilder
+                .set_allocation_callbacks(_hostCallbacks)
+                .use_default_format_selection()
+                .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)                 //how will the images render to the swapchain?
+                .set_desired_extent(_windowExtent.width, _windowExtent.height)     //send the window description
+                .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)            //the draw image is blitted in
+                .build()
+                .value();
+
+        _swapchain = vkbSwapchain.swapchain;
+        _swapchainImages = vkbSwapchain.get_images().value();
+        _swapchainImageViews = vkbSwapchain.get_image_views().value();
+
+        _swapchainImageFormat = vkbSwapchain.image_format;
+    }
 
     VkExtent3D depthImageExtent = {
             _windowExtent.width,
@@ -100,38 +285,68 @@ void VulkanEngine::init_swapchain() {
 
     _depthFormat = VK_FORMAT_D32_SFLOAT;
 
-    VkImageCreateInfo dimg_info = vkinit::image_create_info(_depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, depthImageExtent);
-
-    //allocate the depth image from GPU local memory
+    //allocate the offscreen targets from GPU local memory
     VmaAllocationCreateInfo dimg_allocinfo = {};
     dimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
     //Force allocation to GPU VRAM
     dimg_allocinfo.requiredFlags = VkMemoryPropertyFlags (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-    //allocate and create the image
-    vmaCreateImage(_allocator, &dimg_info, &dimg_allocinfo, &_depthImage._image, &_depthImage._allocation, nullptr);
+    //the depth pyramid reduction samples the depth after the frame, so it has to outlive the graph.
+    //without occlusion culling depth never leaves the render passes and the render graph owns it
+    if (_occlusionCulling) {
+        VkImageCreateInfo dimg_info = vkinit::image_create_info(_depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, depthImageExtent);
+
+        //allocate and create the image
+        vmaCreateImage(_allocator, &dimg_info, &dimg_allocinfo, &_depthImage._image, &_depthImage._allocation, nullptr);
+        _gpuMemory.track(_depthImage._allocation, MemoryCategory::Attachment);
+
+        VkImageViewCreateInfo dview_info = vkinit::imageview_create_info(_depthFormat, _depthImage._image, VK_IMAGE_ASPECT_DEPTH_BIT);
+        VK_CHECK(vkCreateImageView(_device, &dview_info, _hostCallbacks, &_depthImageView));
+
+        _mainDeletionQueue.push_function([=]() {
+            vkDestroyImageView(_device, _depthImageView, _hostCallbacks);
+            _gpuMemory.untrack(_depthImage._allocation);
+            vmaDestroyImage(_allocator, _depthImage._image, _depthImage._allocation);
+        });
+    }
+
+    //offscreen color target, the scene never renders into the swapchain directly
+    _drawImageFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+    VkImageCreateInfo drawimg_info = vkinit::image_create_info(_drawImageFormat,
+                                                               VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                                                               depthImageExtent);
 
-    VkImageViewCreateInfo dview_info = vkinit::imageview_create_info(_depthFormat, _depthImage._image, VK_IMAGE_ASPECT_DEPTH_BIT);
-    // the image is now created, and will be hooked into the renderpass
-    VK_CHECK(vkCreateImageView(_device, &dview_info, nullptr, &_depthImageView));
+    vmaCreateImage(_allocator, &drawimg_info, &dimg_allocinfo, &_drawImage._image, &_drawImage._allocation, nullptr);
+    _gpuMemory.track(_drawImage._allocation, MemoryCategory::Attachment);
+
+    VkImageViewCreateInfo drawview_info = vkinit::imageview_create_info(_drawImageFormat, _drawImage._image, VK_IMAGE_ASPECT_COLOR_BIT);
+    VK_CHECK(vkCreateImageView(_device, &drawview_info, _hostCallbacks, &_drawImageView));
+
+    _drawExtent = _windowExtent;
 
     _mainDeletionQueue.push_function([=]() {
-        vkDestroyImageView(_device, _depthImageView, nullptr);
-        vmaDestroyImage(_allocator, _depthImage._image, _depthImage._allocation);
-        vkDestroySwapchainKHR(_device, _swapchain, nullptr);
+        vkDestroyImageView(_device, _drawImageView, _hostCallbacks);
+        _gpuMemory.untrack(_drawImage._allocation);
+        vmaDestroyImage(_allocator, _drawImage._image, _drawImage._allocation);
+        for (VkImageView view : _swapchainImageViews) {
+            vkDestroyImageView(_device, view, _hostCallbacks);
+        }
+        vkDestroySwapchainKHR(_device, _swapchain, _hostCallbacks);
     });
 
 
 }
 
 void VulkanEngine::init_vulkan() {
-    std::cout << "Starting Vulkan Initialization" << std::endl;
     vkb::InstanceBuilder builder;
 
     auto inst_ret = builder.set_app_name("Example Vulkan Application")
+            .set_allocation_callbacks(_hostCallbacks)
             .request_validation_layers(true)
-            .require_api_version(1,1,0)
+            .require_api_version(1,2,0)     //timeline semaphores are core in 1.2
             .use_default_debug_messenger()
+            .set_headless(_headless)     //no surface extensions, works on machines without a display
             .build();
 
     vkb::Instance vkb_inst = inst_ret.value(); // result of the builder
@@ -140,21 +355,101 @@ void VulkanEngine::init_vulkan() {
     // store the debug messenger
     _debug_messenger = vkb_inst.debug_messenger;
     std::cout << "debug util started" << std::endl;
-    // get the window surface from SDL
-    SDL_Vulkan_CreateSurface(_window, _instance, &_surface);
-    std::cout << "Surface created" << std::endl;
-    //select a GUP capable of writing to an SDL surface
     vkb::PhysicalDeviceSelector selector{ vkb_inst};
-    vkb::PhysicalDevice physicalDevice = selector
-            .set_minimum_version(1,1) //requested version
-            .set_surface(_surface)                //SDL draw surface
-            .select()
-            .value();
+    selector.set_minimum_version(1,2) //requested version
+            .add_desired_extension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME); //real heap budgets instead of estimates
+
+    if (_headless) {
+        //any device with a graphics queue will do, including software rasterizers
+        selector.require_present(false);
+    } else {
+        // get the window surface from SDL
+        SDL_Vulkan_CreateSurface(_window, _instance, &_surface);
+        std::cout << "Surface created" << std::endl;
+        //select a GUP capable of writing to an SDL surface
+        selector.set_surface(_surface);
+    }
+
+    vkb::PhysicalDevice physicalDevice = selector.select().value();
+
+    //desired extensions are enabled when present, check which way it went
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice.physical_device, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice.physical_device, nullptr, &extensionCount, extensions.data());
+    for (const VkExtensionProperties& extension : extensions) {
+        if (strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+            _memoryBudgetSupported = true;
+        }
+        //by name, older headers do not define the extension
+        if (strcmp(extension.extensionName, "VK_EXT_mesh_shader") == 0) {
+            _meshShaderSupported = true;
+        }
+    }
+
+    //multi draw indirect is optional, without it every indirect command is its own draw call
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice.physical_device, &supportedFeatures);
+    _multiDrawIndirect = supportedFeatures.multiDrawIndirect == VK_TRUE;
+
+    //indirect draws carry the object index in firstInstance, without the feature it has to be 0
+    _drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance == VK_TRUE;
+    if (!_drawIndirectFirstInstance && (_depthPrepass || _occlusionCulling || _meshletCulling)) {
+        std::cout << "drawIndirectFirstInstance is not supported, depth prepass, occlusion and meshlet culling disabled" << std::endl;
+        _depthPrepass = false;
+        _occlusionCulling = false;
+        _meshletCulling = false;
+    }
+
+    VkPhysicalDeviceFeatures2 enabledFeatures = {};
+    enabledFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    enabledFeatures.features.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+    enabledFeatures.features.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+
+    //cross queue sync, always supported by 1.2 devices
+    VkPhysicalDeviceVulkan12Features enabledFeatures12 = {};
+    enabledFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    enabledFeatures12.timelineSemaphore = VK_TRUE;
+    enabledFeatures.pNext = &enabledFeatures12;
+
+    VkPhysicalDeviceVulkan12Features supportedFeatures12 = {};
+    supportedFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+    VkPhysicalDeviceFeatures2 supportedFeatures2 = {};
+    supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    supportedFeatures2.pNext = &supportedFeatures12;
+    vkGetPhysicalDeviceFeatures2(physicalDevice.physical_device, &supportedFeatures2);
+
+    //the meshlet draw count comes from the gpu, without the feature every possible draw is issued
+    //and the ones the cull shader did not write are empty
+    if (_meshletCulling) {
+        _drawIndirectCount = supportedFeatures12.drawIndirectCount == VK_TRUE;
+        enabledFeatures12.drawIndirectCount = supportedFeatures12.drawIndirectCount;
+        std::cout << "Meshlet culling: draw indirect count " << (_drawIndirectCount ? "on" : "off")
+                  << ", mesh shaders " << (_meshShaderSupported ? "available, not used" : "not available")
+                  << ", meshlets are drawn through indirect draws" << std::endl;
+    }
+
+    //bindless needs descriptor indexing, without it the per material pipelines are used
+    if (_bindless) {
+        if (BindlessHeap::supported(supportedFeatures12)) {
+            BindlessHeap::enable_features(enabledFeatures12);
+        } else {
+            std::cout << "Descriptor indexing is not supported, bindless rendering disabled" << std::endl;
+            _bindless = false;
+        }
+    }
+
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice.physical_device, &deviceProperties);
+    //0 marks timestamps as unsupported, gpu timings are then reported as 0
+    _timestampPeriod = deviceProperties.limits.timestampComputeAndGraphics ? deviceProperties.limits.timestampPeriod : 0.f;
+    _maxImageDimension = deviceProperties.limits.maxImageDimension2D;
 
     // build the VkDevice from the physical device
     vkb::DeviceBuilder deviceBuilder {physicalDevice};
 
-    vkb::Device vkbDevice = deviceBuilder.build().value();
+    vkb::Device vkbDevice = deviceBuilder.add_pNext(&enabledFeatures).set_allocation_callbacks(_hostCallbacks).build().value();
 
     _device = vkbDevice.device;
     _chosenGPU = physicalDevice.physical_device;
@@ -162,11 +457,51 @@ void VulkanEngine::init_vulkan() {
     _graphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
     _graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
+    //async compute wants a family without graphics, uploads one without graphics or compute.
+    //vk-bootstrap creates one queue per family, so whatever is missing shares the graphics queue
+    auto computeQueue = vkbDevice.get_queue(vkb::QueueType::compute);
+    if (computeQueue.has_value()) {
+        _computeQueue = computeQueue.value();
+        _computeQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::compute).value();
+    } else {
+        _computeQueue = _graphicsQueue;
+        _computeQueueFamily = _graphicsQueueFamily;
+    }
+
+    auto transferQueue = vkbDevice.get_dedicated_queue(vkb::QueueType::transfer);
+    if (transferQueue.has_value()) {
+        _transferQueue = transferQueue.value();
+        _transferQueueFamily = vkbDevice.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+    } else {
+        _transferQueue = _graphicsQueue;
+        _transferQueueFamily = _graphicsQueueFamily;
+    }
+
+    std::cout << "Queues: graphics family " << _graphicsQueueFamily
+              << ", compute " << (_computeQueue != _graphicsQueue ? "async family " : "shared with graphics, family ") << _computeQueueFamily
+              << ", transfer " << (_transferQueue != _graphicsQueue ? "dedicated family " : "shared with graphics, family ") << _transferQueueFamily
+              << std::endl;
+
+    //the graphics family is covered by timestampComputeAndGraphics, the compute one has to be checked
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(_chosenGPU, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(_chosenGPU, &familyCount, families.data());
+    _computeTimestamps = _timestampPeriod > 0.f && families[_computeQueueFamily].timestampValidBits > 0;
+
     VmaAllocatorCreateInfo allocatorInfo = {};
     allocatorInfo.physicalDevice = _chosenGPU;
     allocatorInfo.device = _device;
     allocatorInfo.instance = _instance;
+    allocatorInfo.vulkanApiVersion = VK_API_VERSION_1_2;
+    //buffers and images VMA creates report to the same callbacks
+    allocatorInfo.pAllocationCallbacks = _hostCallbacks;
+    if (_memoryBudgetSupported) {
+        allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+    }
     vmaCreateAllocator(&allocatorInfo, &_allocator);
+
+    _gpuMemory.init(_device, _allocator, _memoryBudgetSupported);
 }
 
 void VulkanEngine::init_commands() {
@@ -174,37 +509,92 @@ void VulkanEngine::init_commands() {
     VkCommandPoolCreateInfo commandPoolInfo =
             vkinit::command_pool_create_info(_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
 
-    VK_CHECK(vkCreateCommandPool(_device, &commandPoolInfo, nullptr, &_commandPool));
+    VK_CHECK(vkCreateCommandPool(_device, &commandPoolInfo, _hostCallbacks, &_commandPool));
 
     VkCommandBufferAllocateInfo cmdAllocInfo =
             vkinit::command_buffer_allocate_info(_commandPool, 1, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
 
     VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_mainCommandBuffer));
+    VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_upscaleCommandBuffer));
+
+    _mainDeletionQueue.push_function([=]() {
+        vkDestroyCommandPool(_device, _commandPool, _hostCallbacks);
+    });
+
+    //separate pool for uploads so they never touch the frame command buffer
+    VkCommandPoolCreateInfo uploadCommandPoolInfo = vkinit::command_pool_create_info(_graphicsQueueFamily);
+
+    VK_CHECK(vkCreateCommandPool(_device, &uploadCommandPoolInfo, _hostCallbacks, &_uploadContext._commandPool));
+
+    VkCommandBufferAllocateInfo uploadCmdAllocInfo = vkinit::command_buffer_allocate_info(_uploadContext._commandPool, 1);
+
+    VK_CHECK(vkAllocateCommandBuffers(_device, &uploadCmdAllocInfo, &_uploadContext._commandBuffer));
+
+    _mainDeletionQueue.push_function([=]() {
+        vkDestroyCommandPool(_device, _uploadContext._commandPool, _hostCallbacks);
+    });
+
+    //mesh uploads allocate one command buffer each and free it once the copy has retired
+    VkCommandPoolCreateInfo transferPoolInfo =
+            vkinit::command_pool_create_info(_transferQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
 
+    VK_CHECK(vkCreateCommandPool(_device, &transferPoolInfo, _hostCallbacks, &_transferContext._commandPool));
+
+    //both compute command buffers are re-recorded every frame, the pool is reset once the frame is done
+    VkCommandPoolCreateInfo computePoolInfo = vkinit::command_pool_create_info(_computeQueueFamily);
+
+    VK_CHECK(vkCreateCommandPool(_device, &computePoolInfo, _hostCallbacks, &_computeContext._commandPool));
+
+    VkCommandBufferAllocateInfo computeCmdAllocInfo = vkinit::command_buffer_allocate_info(_computeContext._commandPool, 1);
+
+    VK_CHECK(vkAllocateCommandBuffers(_device, &computeCmdAllocInfo, &_computeContext._cullCommandBuffer));
+    VK_CHECK(vkAllocateCommandBuffers(_device, &computeCmdAllocInfo, &_computeContext._pyramidCommandBuffer));
+
+    _mainDeletionQueue.push_function([=]() {
+        vkDestroyCommandPool(_device, _transferContext._commandPool, _hostCallbacks);
+        vkDestroyCommandPool(_device, _computeContext._commandPool, _hostCallbacks);
+    });
+
+    //command pools are externally synchronized, so every job system thread records from its own
+    _recordingContexts.resize(_jobs.thread_count());
+    for (RecordingContext& context : _recordingContexts) {
+        VkCommandPoolCreateInfo recordPoolInfo =
+                vkinit::command_pool_create_info(_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+
+        VK_CHECK(vkCreateCommandPool(_device, &recordPoolInfo, _hostCallbacks, &context._commandPool));
+
+        VkCommandPool pool = context._commandPool;
+        _mainDeletionQueue.push_function([=]() {
+            vkDestroyCommandPool(_device, pool, _hostCallbacks);
+        });
+    }
+    //the cached chunks get their pools as the scene grows, whatever exists at cleanup goes here
     _mainDeletionQueue.push_function([=]() {
-        vkDestroyCommandPool(_device, _commandPool, nullptr);
+        for (CachedChunk& chunk : _cachedChunks) {
+            vkDestroyCommandPool(_device, chunk._commandPool, _hostCallbacks);
+        }
+        _cachedChunks.clear();
     });
 }
-// Renderpass -> builds images to display to the swapchain
+// Renderpass -> describes the attachments the pipelines render into
 
 /*
- * General image lifespan flow
- *
- * UNDEFINED -> RenderPass Begins -> Subpass 0 begins (Transition to Attachment Optimal) ->
- * Subpass 0 renders -> Subpass 0 ends -> Renderpass Ends (Transitions to Present Source)
+ * Frames never begin these. The render graph creates render passes with the load and store ops and
+ * layouts of each frame, they only differ from these in those, so they stay compatible with the
+ * pipelines and the secondary command buffers built against these
  */
 void VulkanEngine::init_default_renderpass() {
     VkAttachmentDescription color_attachment = {};
 
-    //format has to be the same as the swapchain image format
-    color_attachment.format = _swapchainImageFormat;
+    //renders into the offscreen draw image, upscale_to_swapchain copies it out afterwards
+    color_attachment.format = _drawImageFormat;
     color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
     color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    color_attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
     // Subpass that will render into the image defined by the renderpass
     VkAttachmentReference color_attachment_ref = {};
@@ -254,71 +644,66 @@ void VulkanEngine::init_default_renderpass() {
     depth_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
     depth_dependency.dstSubpass = 0;
     depth_dependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
-    depth_dependency.srcAccessMask = 0;
+    depth_dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
     depth_dependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
-    depth_dependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    depth_dependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
     VkSubpassDependency dependencies[2] = {dependency, depth_dependency};
 
     render_pass_info.dependencyCount = 2;
     render_pass_info.pDependencies = &dependencies[0];
 
-    VK_CHECK(vkCreateRenderPass(_device, &render_pass_info, nullptr, &_renderPass));
+    VK_CHECK(vkCreateRenderPass(_device, &render_pass_info, _hostCallbacks, &_renderPass));
 
-    _mainDeletionQueue.push_function([=]() {
-        vkDestroyRenderPass(_device, _renderPass, nullptr);
-    });
+    //depth prepass, the depth attachment alone
+    VkAttachmentReference prepass_depth_ref = depth_attachment_ref;
+    prepass_depth_ref.attachment = 0;
 
+    VkSubpassDescription depth_subpass = {};
+    depth_subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    depth_subpass.colorAttachmentCount = 0;
+    depth_subpass.pDepthStencilAttachment = &prepass_depth_ref;
 
-}
-/*
- * Framebuffers serve as the link form the image created from the renderpass to the real image
- */
-void VulkanEngine::init_framebuffers() {
-    VkFramebufferCreateInfo fb_info = {};
-    fb_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-    fb_info.pNext = nullptr;
-
-    fb_info.renderPass = _renderPass;
-    fb_info.attachmentCount = 1;
-    fb_info.width = _windowExtent.width;
-    fb_info.height = _windowExtent.height;
-    fb_info.layers = 1;
-
-    const uint32_t swapchain_imagecount = _swapchainImages.size();
-    _framebuffers = std::vector<VkFramebuffer>(swapchain_imagecount);
-
-    for(int i = 0; i < swapchain_imagecount; i++) {
-        VkImageView attachments[2];
-        attachments[0] = _swapchainImageViews[i];
-        attachments[1] = _depthImageView;
-
-        fb_info.pAttachments = attachments;
-        fb_info.attachmentCount = 2;
-        VK_CHECK(vkCreateFramebuffer(_device, &fb_info, nullptr, &_framebuffers[i]));
-
-        _mainDeletionQueue.push_function([=] (){
-            vkDestroyFramebuffer(_device, _framebuffers[i], nullptr);
-            vkDestroyImageView(_device, _swapchainImageViews[i], nullptr);
-        });
-    }
+    VkRenderPassCreateInfo prepass_info = {};
+    prepass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    prepass_info.attachmentCount = 1;
+    prepass_info.pAttachments = &depth_attachment;
+    prepass_info.subpassCount = 1;
+    prepass_info.pSubpasses = &depth_subpass;
+    prepass_info.dependencyCount = 1;
+    prepass_info.pDependencies = &depth_dependency;
 
+    VK_CHECK(vkCreateRenderPass(_device, &prepass_info, _hostCallbacks, &_depthPrepassRenderPass));
 
-}
+    _mainDeletionQueue.push_function([=]() {
+        vkDestroyRenderPass(_device, _renderPass, _hostCallbacks);
+        vkDestroyRenderPass(_device, _depthPrepassRenderPass, _hostCallbacks);
+    });
 
-void VulkanEngine::init_sync_structures() {
-    // for cpu and gpu sync
-    VkFenceCreateInfo fenceCreateInfo = {};
-    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceCreateInfo.pNext = nullptr;
 
-    //use the signal flag so we can wait on it's execution
-    fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+}
 
-    VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_renderFence));
+void VulkanEngine::init_sync_structures() {
+    // for cpu and gpu sync, and between the queues. all three start at 0, nothing has been submitted yet
+    VkSemaphoreTypeCreateInfo timelineInfo = {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    timelineInfo.pNext = nullptr;
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    timelineInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo timelineCreateInfo = {};
+    timelineCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    timelineCreateInfo.pNext = &timelineInfo;
+    timelineCreateInfo.flags = 0;
+
+    VK_CHECK(vkCreateSemaphore(_device, &timelineCreateInfo, _hostCallbacks, &_graphicsTimeline));
+    VK_CHECK(vkCreateSemaphore(_device, &timelineCreateInfo, _hostCallbacks, &_computeTimeline));
+    VK_CHECK(vkCreateSemaphore(_device, &timelineCreateInfo, _hostCallbacks, &_transferTimeline));
 
     _mainDeletionQueue.push_function([=] () {
-        vkDestroyFence(_device, _renderFence, nullptr);
+        vkDestroySemaphore(_device, _graphicsTimeline, _hostCallbacks);
+        vkDestroySemaphore(_device, _computeTimeline, _hostCallbacks);
+        vkDestroySemaphore(_device, _transferTimeline, _hostCallbacks);
     });
 
     // for gpu and gpu sync
@@ -328,48 +713,330 @@ void VulkanEngine::init_sync_structures() {
     // no flags needed
     semaphoreCreateInfo.flags = 0;
 
-    VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_presentSemaphore));
-    VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_renderSemaphore));
+    VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, _hostCallbacks, &_presentSemaphore));
+    VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, _hostCallbacks, &_renderSemaphore));
+
+    _mainDeletionQueue.push_function([=] () {
+        vkDestroySemaphore(_device, _presentSemaphore, _hostCallbacks);
+        vkDestroySemaphore(_device, _renderSemaphore, _hostCallbacks);
+    });
+
+    //upload fence starts unsignaled, immediate_submit waits on it right after submitting
+    VkFenceCreateInfo uploadFenceCreateInfo = vkinit::fence_create_info();
+
+    VK_CHECK(vkCreateFence(_device, &uploadFenceCreateInfo, _hostCallbacks, &_uploadContext._uploadFence));
 
     _mainDeletionQueue.push_function([=] () {
-        vkDestroySemaphore(_device, _presentSemaphore, nullptr);
-        vkDestroySemaphore(_device, _renderSemaphore, nullptr);
+        vkDestroyFence(_device, _uploadContext._uploadFence, _hostCallbacks);
     });
 }
 
-bool VulkanEngine::load_shader_module(const char *filePath, VkShaderModule *outShaderModule) {
+void VulkanEngine::init_descriptors() {
+    //object set, cull sets and one reduce set per depth pyramid level
+    std::vector<VkDescriptorPoolSize> sizes = {
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 32},
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 8},
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 32},
+            {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 32}
+    };
 
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.pNext = nullptr;
+    poolInfo.flags = 0;
+    poolInfo.maxSets = 32;
+    poolInfo.poolSizeCount = (uint32_t)sizes.size();
+    poolInfo.pPoolSizes = sizes.data();
+
+    VK_CHECK(vkCreateDescriptorPool(_device, &poolInfo, _hostCallbacks, &_descriptorPool));
+
+    //objects, then the cluster params and light lists the LIGHTING mesh variant reads
+    VkDescriptorSetLayoutBinding objectBindings[] = {
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0),
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 1),
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 2),
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 3),
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 4)
+    };
 
-    // std::ios::ate -> put file cursor at the end of the file
-    // std::ios::binary -> read the file in as binary
-    std::ifstream file(filePath, std::ios::ate | std::ios::binary);
+    VkDescriptorSetLayoutCreateInfo setInfo = {};
+    setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setInfo.pNext = nullptr;
+    setInfo.flags = 0;
+    setInfo.bindingCount = 5;
+    setInfo.pBindings = objectBindings;
+
+    VK_CHECK(vkCreateDescriptorSetLayout(_device, &setInfo, _hostCallbacks, &_objectSetLayout));
+
+    //host visible and persistently mapped, cull_objects writes straight into it
+    _objectBuffer = create_buffer(sizeof(GPUObjectData) * _maxObjects, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                  VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Frame, true);
+    vmaMapMemory(_allocator, _objectBuffer._allocation, (void**)&_objectData);
+
+    //the occlusion cull shader writes instance counts, so the commands are storage as well
+    _drawCommandBuffer = create_buffer(sizeof(VkDrawIndexedIndirectCommand) * _maxObjects,
+                                       VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                       VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Frame, true);
+    vmaMapMemory(_allocator, _drawCommandBuffer._allocation, (void**)&_drawCommands);
+
+    //tested and occluded object counters
+    _cullStatsBuffer = create_buffer(sizeof(uint32_t) * 2, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                     VMA_MEMORY_USAGE_GPU_TO_CPU, MemoryCategory::Frame);
+    vmaMapMemory(_allocator, _cullStatsBuffer._allocation, (void**)&_cullStats);
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.pNext = nullptr;
+    allocInfo.descriptorPool = _descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &_objectSetLayout;
+
+    VK_CHECK(vkAllocateDescriptorSets(_device, &allocInfo, &_objectDescriptor));
+
+    VkDescriptorBufferInfo objectInfo = {};
+    objectInfo.buffer = _objectBuffer._buffer;
+    objectInfo.offset = 0;
+    objectInfo.range = VK_WHOLE_SIZE;
+
+    //the mesh shaders always declare the light bindings, so the buffers exist even without lights
+    _lightCapacity = std::max(_lightCount, 1u);
+    _lightBuffer = create_buffer(sizeof(GPUPointLight) * _lightCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                 VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Frame);
+    vmaMapMemory(_allocator, _lightBuffer._allocation, (void**)&_lightData);
+
+    _clusterParamsBuffer = create_buffer(sizeof(GPUClusterParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                                         VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Frame);
+    vmaMapMemory(_allocator, _clusterParamsBuffer._allocation, (void**)&_clusterParams);
+
+    //rewritten only when the projection changes
+    _clusterBoundsBuffer = create_buffer(sizeof(GPUClusterBounds) * CLUSTER_COUNT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                         VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Frame);
+    vmaMapMemory(_allocator, _clusterBoundsBuffer._allocation, (void**)&_clusterBoundsData);
+
+    _clusterCountBuffer = create_buffer(sizeof(uint32_t) * CLUSTER_COUNT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                        VMA_MEMORY_USAGE_GPU_ONLY, MemoryCategory::Frame);
+    _clusterIndexBuffer = create_buffer(sizeof(uint32_t) * CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                        VMA_MEMORY_USAGE_GPU_ONLY, MemoryCategory::Frame);
+
+    VkDescriptorBufferInfo clusterParamsInfo = {_clusterParamsBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo lightInfo = {_lightBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo clusterCountInfo = {_clusterCountBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo clusterIndexInfo = {_clusterIndexBuffer._buffer, 0, VK_WHOLE_SIZE};
+
+    VkWriteDescriptorSet objectWrites[] = {
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _objectDescriptor, &objectInfo, 0),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, _objectDescriptor, &clusterParamsInfo, 1),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _objectDescriptor, &lightInfo, 2),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _objectDescriptor, &clusterCountInfo, 3),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _objectDescriptor, &clusterIndexInfo, 4)
+    };
 
-    if(!file.is_open()) {
-        return false;
+    vkUpdateDescriptorSets(_device, 5, objectWrites, 0, nullptr);
+
+    _mainDeletionQueue.push_function([=]() {
+        vmaUnmapMemory(_allocator, _lightBuffer._allocation);
+        vmaUnmapMemory(_allocator, _clusterParamsBuffer._allocation);
+        vmaUnmapMemory(_allocator, _clusterBoundsBuffer._allocation);
+        destroy_buffer(_lightBuffer);
+        destroy_buffer(_clusterParamsBuffer);
+        destroy_buffer(_clusterBoundsBuffer);
+        destroy_buffer(_clusterCountBuffer);
+        destroy_buffer(_clusterIndexBuffer);
+    });
+
+    //created here rather than with the pipeline, mesh uploads write meshlets while the pipelines compile
+    if (_meshletCulling) {
+        _meshletBuffer = create_buffer(sizeof(GPUMeshlet) * _maxMeshlets, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                       VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Mesh);
+        vmaMapMemory(_allocator, _meshletBuffer._allocation, (void**)&_meshletData);
+
+        _meshletWorkBuffer = create_buffer(sizeof(GPUMeshletWork) * _maxObjects, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                           VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Frame);
+        vmaMapMemory(_allocator, _meshletWorkBuffer._allocation, (void**)&_meshletWork);
+
+        //only the cull shader writes the draws, the fill is for devices without draw indirect count
+        _meshletDrawBuffer = create_buffer(sizeof(VkDrawIndexedIndirectCommand) * _maxMeshletDraws,
+                                           VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                           VMA_MEMORY_USAGE_GPU_ONLY, MemoryCategory::Frame);
+
+        _meshletCountBuffer = create_buffer(sizeof(uint32_t) * 5,
+                                            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                            VMA_MEMORY_USAGE_GPU_TO_CPU, MemoryCategory::Frame);
+        vmaMapMemory(_allocator, _meshletCountBuffer._allocation, (void**)&_meshletCounts);
+
+        _mainDeletionQueue.push_function([=]() {
+            vmaUnmapMemory(_allocator, _meshletBuffer._allocation);
+            vmaUnmapMemory(_allocator, _meshletWorkBuffer._allocation);
+            vmaUnmapMemory(_allocator, _meshletCountBuffer._allocation);
+            destroy_buffer(_meshletBuffer);
+            destroy_buffer(_meshletWorkBuffer);
+            destroy_buffer(_meshletDrawBuffer);
+            destroy_buffer(_meshletCountBuffer);
+        });
+    }
+
+    _mainDeletionQueue.push_function([=]() {
+        vmaUnmapMemory(_allocator, _objectBuffer._allocation);
+        vmaUnmapMemory(_allocator, _drawCommandBuffer._allocation);
+        vmaUnmapMemory(_allocator, _cullStatsBuffer._allocation);
+        destroy_buffer(_objectBuffer);
+        destroy_buffer(_drawCommandBuffer);
+        destroy_buffer(_cullStatsBuffer);
+        vkDestroyDescriptorSetLayout(_device, _objectSetLayout, _hostCallbacks);
+        vkDestroyDescriptorPool(_device, _descriptorPool, _hostCallbacks);
+    });
+}
+
+void VulkanEngine::init_bindless() {
+    if (!_bindless) {
+        return;
+    }
+
+    VkSamplerCreateInfo samplerInfo = vkinit::sampler_create_info(VK_FILTER_LINEAR);
+    VK_CHECK(vkCreateSampler(_device, &samplerInfo, _hostCallbacks, &_textureSampler));
+
+    //far below the update-after-bind limits of any device with the features
+    _bindlessHeap.init(_device, 1024, 4096, _textureSampler);
+
+    //written by create_material, the gpu only ever reads it
+    _materialBuffer = create_buffer(sizeof(GPUMaterialData) * _maxMaterials, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                    VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Frame);
+    vmaMapMemory(_allocator, _materialBuffer._allocation, (void**)&_materialData);
+
+    _objectBufferIndex = _bindlessHeap.add_buffer(_objectBuffer._buffer);
+    _materialBufferIndex = _bindlessHeap.add_buffer(_materialBuffer._buffer);
+
+    const uint32_t white = 0xffffffff;
+    _whiteTexture = upload_texture(VkExtent2D{1, 1}, &white);
+
+    VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, _whiteTexture._image, VK_IMAGE_ASPECT_COLOR_BIT);
+    VK_CHECK(vkCreateImageView(_device, &viewInfo, _hostCallbacks, &_whiteTextureView));
+
+    //first texture added, so it lands in slot 0 where Material::texture points by default
+    _bindlessHeap.add_texture(_whiteTextureView);
+
+    BindlessStats stats = _bindlessHeap.get_stats();
+    std::cout << "Bindless heap: " << stats.bufferCapacity << " buffers, " << stats.textureCapacity << " textures" << std::endl;
+
+    _mainDeletionQueue.push_function([=]() {
+        vkDestroyImageView(_device, _whiteTextureView, _hostCallbacks);
+        _gpuMemory.untrack(_whiteTexture._allocation);
+        vmaDestroyImage(_allocator, _whiteTexture._image, _whiteTexture._allocation);
+        vmaUnmapMemory(_allocator, _materialBuffer._allocation);
+        destroy_buffer(_materialBuffer);
+        _bindlessHeap.cleanup();
+        vkDestroySampler(_device, _textureSampler, _hostCallbacks);
+    });
+}
+
+AllocatedImage VulkanEngine::upload_texture(VkExtent2D extent, const void* rgbaPixels) {
+    const size_t imageBytes = (size_t)extent.width * extent.height * 4;
+
+    AllocatedBuffer stagingBuffer = create_buffer(imageBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                                  VMA_MEMORY_USAGE_CPU_ONLY, MemoryCategory::Staging);
+
+    void* data;
+    vmaMapMemory(_allocator, stagingBuffer._allocation, &data);
+    memcpy(data, rgbaPixels, imageBytes);
+    vmaUnmapMemory(_allocator, stagingBuffer._allocation);
+
+    VkExtent3D imageExtent = {extent.width, extent.height, 1};
+    VkImageCreateInfo imageInfo = vkinit::image_create_info(VK_FORMAT_R8G8B8A8_UNORM,
+                                                            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent);
+
+    VmaAllocationCreateInfo imageAllocInfo = {};
+    imageAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    AllocatedImage image;
+    VK_CHECK(vmaCreateImage(_allocator, &imageInfo, &imageAllocInfo, &image._image, &image._allocation, nullptr));
+    _gpuMemory.track(image._allocation, MemoryCategory::Texture);
+
+    //textures are sampled on graphics, so the copy stays on the graphics queue and needs no ownership transfer
+    immediate_submit([&](VkCommandBuffer cmd) {
+        VkImageMemoryBarrier toTransfer = vkinit::image_barrier(image._image, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                                                                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                                                VK_IMAGE_ASPECT_COLOR_BIT);
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &toTransfer);
+
+        VkBufferImageCopy copy = {};
+        copy.bufferOffset = 0;
+        copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copy.imageSubresource.mipLevel = 0;
+        copy.imageSubresource.baseArrayLayer = 0;
+        copy.imageSubresource.layerCount = 1;
+        copy.imageExtent = imageExtent;
+        vkCmdCopyBufferToImage(cmd, stagingBuffer._buffer, image._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+
+        VkImageMemoryBarrier toRead = vkinit::image_barrier(image._image, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                                            VK_IMAGE_ASPECT_COLOR_BIT);
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &toRead);
+    });
+
+    destroy_buffer(stagingBuffer);
+    return image;
+}
+
+bool VulkanEngine::read_asset(const char* path, AssetData& out) {
+    if (_assetPack.is_open() && _assetPack.read(path, out)) {
+        return true;
     }
+    return read_file(path, out);
+}
 
-    // cursor is at the end, so itll tell us the file size in bytes
-    size_t fileSize = (size_t)file.tellg();
-    //spriv expects the buffer type to be of uint32
-    std::vector<uint32_t> buffer(fileSize/sizeof(uint32_t));
-    //put cursor at beginning of file
-    file.seekg(0);
+void VulkanEngine::read_shaders() {
+    //every file init_pipelines and init_occlusion_culling load, a file missing here is read from disk later
+    const char* startupShaders[] = {
+            "../shaders/colored_triangle.frag.spv",
+            "../shaders/tri_mesh.vert.spv",
+            "../shaders/depth_only.vert.spv",
+            "../shaders/bindless_mesh.vert.spv",
+            "../shaders/bindless_mesh.frag.spv",
+            "../shaders/depth_reduce.comp.spv",
+            "../shaders/occlusion_cull.comp.spv",
+            "../shaders/meshlet_cull.comp.spv",
+            "../shaders/light_cull.comp.spv",
+    };
+    const uint32_t shaderCount = sizeof(startupShaders) / sizeof(startupShaders[0]);
+
+    //one batch out of the pack, whatever it does not have comes from loose files
+    std::vector<AssetData> shaders(shaderCount);
+    if (_assetPack.is_open()) {
+        JobCounter shadersRead;
+        _assetPack.read_batch(startupShaders, shaderCount, shaders.data(), _jobs, &shadersRead);
+        _jobs.wait(shadersRead);
+    }
 
-    //load entire file
-    file.read((char*)buffer.data(), fileSize);
+    for (uint32_t i = 0; i < shaderCount; i++) {
+        if (shaders[i].valid() || read_file(startupShaders[i], shaders[i])) {
+            _shaderCache[startupShaders[i]] = std::move(shaders[i]);
+        }
+    }
+}
 
-    file.close();
+bool VulkanEngine::load_shader_module(const char *filePath, VkShaderModule *outShaderModule) {
+    //the cache is only written before the pipeline phase starts, reading it here needs no lock
+    AssetData fileCode;
+    const AssetData* code = &fileCode;
+    auto cached = _shaderCache.find(filePath);
+    if (cached != _shaderCache.end()) {
+        code = &cached->second;
+    } else if (!read_asset(filePath, fileCode)) {
+        return false;
+    }
 
     VkShaderModuleCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
     createInfo.pNext = nullptr;
 
-    //codeSize must be in bytes, so we multiply the size of the buffer by the size of uint32_t
-    createInfo.codeSize = buffer.size() * sizeof(uint32_t);
-    createInfo.pCode = buffer.data();
+    //straight out of the mapped pack when it is stored uncompressed, pack entries are page aligned
+    createInfo.codeSize = code->size;
+    createInfo.pCode = (const uint32_t*)code->data;
 
     VkShaderModule shaderModule;
-    if(vkCreateShaderModule(_device, &createInfo, nullptr,&shaderModule) != VK_SUCCESS){
+    if(vkCreateShaderModule(_device, &createInfo, _hostCallbacks,&shaderModule) != VK_SUCCESS){
         return false;
     }
     *outShaderModule = shaderModule;
@@ -378,15 +1045,14 @@ bool VulkanEngine::load_shader_module(const char *filePath, VkShaderModule *outS
 }
 
 void VulkanEngine::init_pipelines(){
-    std::cout << "In pipeline initialization" << std::endl;
-    VkShaderModule colorMeshShader;
+    VkShaderModule& colorMeshShader = _meshFragShader;
     if(!load_shader_module("../shaders/colored_triangle.frag.spv", &colorMeshShader)){
         std::cout << "Error when building the triangle fragment shader module" << std::endl;
     }
     else {
         std::cout << "Triangle fragment shader successfully loaded" << std::endl;
     }
-    VkShaderModule meshVertShader;
+    VkShaderModule& meshVertShader = _meshVertShader;
     if(!load_shader_module("../shaders/tri_mesh.vert.spv", &meshVertShader)){
         std::cout << "Error when building the Green triangle vertex shader module" << std::endl;
     }
@@ -417,9 +1083,13 @@ void VulkanEngine::init_pipelines(){
     mesh_pipeline_layout_info.pPushConstantRanges = &push_constant;
     mesh_pipeline_layout_info.pushConstantRangeCount = 1;
 
+    //object matrices come from the object buffer in set 0
+    mesh_pipeline_layout_info.setLayoutCount = 1;
+    mesh_pipeline_layout_info.pSetLayouts = &_objectSetLayout;
+
     pipelineBuilder._pipelineLayout = _meshPipelineLayout;
 
-    VK_CHECK(vkCreatePipelineLayout(_device, &mesh_pipeline_layout_info, nullptr, &_meshPipelineLayout));
+    VK_CHECK(vkCreatePipelineLayout(_device, &mesh_pipeline_layout_info, _hostCallbacks, &_meshPipelineLayout));
 
     pipelineBuilder._pipelineLayout = _meshPipelineLayout;
 
@@ -430,16 +1100,7 @@ void VulkanEngine::init_pipelines(){
 	//we are just going to draw triangle list
 	pipelineBuilder._inputAssembly = vkinit::input_assembly_create_info(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
 
-	//build viewport and scissor from the swapchain extents
-	pipelineBuilder._viewport.x = 0.0f;
-	pipelineBuilder._viewport.y = 0.0f;
-	pipelineBuilder._viewport.width = (float)_windowExtent.width;
-	pipelineBuilder._viewport.height = (float)_windowExtent.height;
-	pipelineBuilder._viewport.minDepth = 0.0f;
-	pipelineBuilder._viewport.maxDepth = 1.0f;
-
-	pipelineBuilder._scissor.offset = { 0, 0 };
-	pipelineBuilder._scissor.extent = _windowExtent;
+	//viewport and scissor are dynamic state, set_draw_viewport sets them to the current render resolution
 
 	//configure the rasterizer to draw filled triangles
 	pipelineBuilder._rasterizer = vkinit::rasterization_state_create_info(VK_POLYGON_MODE_FILL);
@@ -456,7 +1117,8 @@ void VulkanEngine::init_pipelines(){
 
 	//build the mesh pipeline
 
-    VertexInputDescription vertexDescription = Vertex::get_vertex_description();
+    _meshVertexDescription = Vertex::get_vertex_description();
+    VertexInputDescription& vertexDescription = _meshVertexDescription;
 
     pipelineBuilder._vertexInputInfo.pVertexAttributeDescriptions = vertexDescription.attributes.data();
     pipelineBuilder._vertexInputInfo.vertexAttributeDescriptionCount = vertexDescription.attributes.size();
@@ -464,22 +1126,91 @@ void VulkanEngine::init_pipelines(){
     pipelineBuilder._vertexInputInfo.pVertexBindingDescriptions = vertexDescription.bindings.data();
     pipelineBuilder._vertexInputInfo.vertexBindingDescriptionCount = vertexDescription.bindings.size();
 
-    _meshPipeline = pipelineBuilder.build_pipeline(_device, _renderPass);
+    //variants only differ in their specialization constants, the base one is built right here
+    _meshVariantBuilder = pipelineBuilder;
+    _meshVariants.init(&_jobs, [this](const VkSpecializationInfo& specialization) {
+        PipelineBuilder builder = _meshVariantBuilder;
+        for (VkPipelineShaderStageCreateInfo& stage : builder._shaderStages) {
+            stage.pSpecializationInfo = &specialization;
+        }
+        return builder.build_pipeline(_device, _renderPass);
+    });
+    _meshPipeline = _meshVariants.get(0);
+
+    //same state, but one layout for every material: the global set plus the heap slots of the object and material buffers
+    if (_bindless) {
+        VkShaderModule bindlessVertShader;
+        if (!load_shader_module("../shaders/bindless_mesh.vert.spv", &bindlessVertShader)) {
+            std::cout << "Error when building the bindless vertex shader module" << std::endl;
+        }
+        VkShaderModule bindlessFragShader;
+        if (!load_shader_module("../shaders/bindless_mesh.frag.spv", &bindlessFragShader)) {
+            std::cout << "Error when building the bindless fragment shader module" << std::endl;
+        }
+
+        VkPushConstantRange bindlessConstants = {};
+        bindlessConstants.offset = 0;
+        bindlessConstants.size = sizeof(BindlessPushConstants);
+        bindlessConstants.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        VkPipelineLayoutCreateInfo bindlessLayoutInfo = vkinit::pipeline_layout_create_info();
+        bindlessLayoutInfo.setLayoutCount = 1;
+        bindlessLayoutInfo.pSetLayouts = &_bindlessHeap._layout;
+        bindlessLayoutInfo.pushConstantRangeCount = 1;
+        bindlessLayoutInfo.pPushConstantRanges = &bindlessConstants;
+
+        VK_CHECK(vkCreatePipelineLayout(_device, &bindlessLayoutInfo, _hostCallbacks, &_bindlessPipelineLayout));
+
+        PipelineBuilder bindlessBuilder = pipelineBuilder;
+        bindlessBuilder._shaderStages.clear();
+        bindlessBuilder._shaderStages.push_back(
+                vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, bindlessVertShader));
+        bindlessBuilder._shaderStages.push_back(
+                vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, bindlessFragShader));
+        bindlessBuilder._pipelineLayout = _bindlessPipelineLayout;
+
+        _bindlessPipeline = bindlessBuilder.build_pipeline(_device, _renderPass);
+
+        vkDestroyShaderModule(_device, bindlessVertShader, _hostCallbacks);
+        vkDestroyShaderModule(_device, bindlessFragShader, _hostCallbacks);
+
+        _mainDeletionQueue.push_function([=]() {
+            vkDestroyPipeline(_device, _bindlessPipeline, _hostCallbacks);
+            vkDestroyPipelineLayout(_device, _bindlessPipelineLayout, _hostCallbacks);
+        });
+    }
 
     //build the red triangle now
     pipelineBuilder._shaderStages.clear();
 
-    create_material(_meshPipeline, _meshPipelineLayout, "defaultmesh");
+    _defaultMaterial = create_material(_meshPipeline, _meshPipelineLayout, "defaultmesh");
+
+    //depth prepass variant: positions only, no fragment shader, no color attachment
+    VkShaderModule depthOnlyVertShader;
+    if(!load_shader_module("../shaders/depth_only.vert.spv", &depthOnlyVertShader)){
+        std::cout << "Error when building the depth only vertex shader module" << std::endl;
+    }
+
+    pipelineBuilder._shaderStages.push_back(
+            vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, depthOnlyVertShader));
+
+    //binding and position attribute are the first entries of the full description
+    pipelineBuilder._vertexInputInfo.vertexAttributeDescriptionCount = 1;
+    pipelineBuilder._colorAttachmentCount = 0;
 
+    _depthPrepassPipeline = pipelineBuilder.build_pipeline(_device, _depthPrepassRenderPass);
 
-    //destroy shaders
-    vkDestroyShaderModule(_device, meshVertShader, nullptr);
+    //destroy shaders, the mesh modules are kept for variants that have not been compiled yet
+    vkDestroyShaderModule(_device, depthOnlyVertShader, _hostCallbacks);
 
     _mainDeletionQueue.push_function([=] () {
-        // destroy pipelines
-        vkDestroyPipeline(_device, _meshPipeline, nullptr);
+        // destroy pipelines, the cache owns _meshPipeline
+        _meshVariants.cleanup(_device, _hostCallbacks);
+        vkDestroyShaderModule(_device, _meshVertShader, _hostCallbacks);
+        vkDestroyShaderModule(_device, _meshFragShader, _hostCallbacks);
+        vkDestroyPipeline(_device, _depthPrepassPipeline, _hostCallbacks);
         //destroy pipeline layout
-        vkDestroyPipelineLayout(_device, _meshPipelineLayout, nullptr);
+        vkDestroyPipelineLayout(_device, _meshPipelineLayout, _hostCallbacks);
     });
 }
 
@@ -488,10 +1219,19 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkRenderPass pass) {
     viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewportState.pNext = nullptr;
 
+    //values come from vkCmdSetViewport/vkCmdSetScissor, so one pipeline works at any render resolution
     viewportState.viewportCount = 1;
-    viewportState.pViewports= &_viewport;
+    viewportState.pViewports = nullptr;
     viewportState.scissorCount = 1;
-    viewportState.pScissors = &_scissor;
+    viewportState.pScissors = nullptr;
+
+    VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+
+    VkPipelineDynamicStateCreateInfo dynamicState = {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.pNext = nullptr;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
 
     // not using right now but will use later, must match the fragment shader
     VkPipelineColorBlendStateCreateInfo colorBlending = {};
@@ -500,7 +1240,7 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkRenderPass pass) {
 
     colorBlending.logicOpEnable = VK_FALSE;
     colorBlending.logicOp = VK_LOGIC_OP_COPY;
-    colorBlending.attachmentCount = 1;
+    colorBlending.attachmentCount = _colorAttachmentCount;
     colorBlending.pAttachments = &_colorBlendAttachment;
 
     //Begin building the pipeline
@@ -521,9 +1261,10 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkRenderPass pass) {
     pipelineCreateInfo.subpass = 0;
     pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineCreateInfo.pDepthStencilState = &_depthStencil;
+    pipelineCreateInfo.pDynamicState = &dynamicState;
 
     VkPipeline newPipeline;
-    if(vkCreateGraphicsPipelines(device,VK_NULL_HANDLE,1,&pipelineCreateInfo,nullptr,&newPipeline) != VK_SUCCESS) {
+    if(vkCreateGraphicsPipelines(device,VK_NULL_HANDLE,1,&pipelineCreateInfo,host_allocator().callbacks(),&newPipeline) != VK_SUCCESS) {
         std::cout << "Failed to create pipeline" << std::endl;
         return VK_NULL_HANDLE;
     }else {
@@ -534,175 +1275,2867 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkRenderPass pass) {
 
 
 
-void VulkanEngine::cleanup()
-{	
-	if (_isInitialized) {
-
-        vkWaitForFences(_device,1,&_renderFence,true, 1000000000);
-
-        _mainDeletionQueue.flush();
+bool VulkanEngine::build_compute_pipeline(const char* shaderPath, VkPipelineLayout layout, VkPipeline* outPipeline) {
+    VkShaderModule computeShader;
+    if (!load_shader_module(shaderPath, &computeShader)) {
+        std::cout << "Error when building the compute shader module " << shaderPath << std::endl;
+        return false;
+    }
 
-        vkDestroySurfaceKHR(_instance, _surface, nullptr);
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.pNext = nullptr;
+    pipelineInfo.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, computeShader);
+    pipelineInfo.layout = layout;
 
-        vkDestroyDevice(_device, nullptr);
-        vkDestroyInstance(_instance, nullptr);
+    VkResult result = vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1, &pipelineInfo, _hostCallbacks, outPipeline);
+    vkDestroyShaderModule(_device, computeShader, _hostCallbacks);
 
-		SDL_DestroyWindow(_window);
-	}
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create compute pipeline " << shaderPath << std::endl;
+        return false;
+    }
+    return true;
 }
 
-void VulkanEngine::load_meshes() {
-    // resize the array to 3 members
-    _triangleMesh._vertices.resize(3);
+void VulkanEngine::init_occlusion_culling() {
+    //the frame timestamps are written with or without occlusion culling
+    VkQueryPoolCreateInfo queryPoolInfo = {};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.pNext = nullptr;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = TIMESTAMP_COUNT;
+    VK_CHECK(vkCreateQueryPool(_device, &queryPoolInfo, _hostCallbacks, &_timestampPool));
 
-    //vertex positions
-    _triangleMesh._vertices[0].position = {1.f,1.f,0.0f};
-    _triangleMesh._vertices[1].position = {-1.f,1.f,0.0f};
-    _triangleMesh._vertices[2].position = {0.f,-1.f, 0.0f};
+    _mainDeletionQueue.push_function([=]() {
+        vkDestroyQueryPool(_device, _timestampPool, _hostCallbacks);
+    });
 
-    //vertex colors
-    _triangleMesh._vertices[0].color = {0.f, 1.f, 0.0f};
-    _triangleMesh._vertices[1].color = {0.f, 1.f, 0.0f};
-    _triangleMesh._vertices[2].color = {0.f, 1.f, 0.0f};
+    //the pyramid is built from the sampled depth image, which only exists with occlusion culling
+    if (!_occlusionCulling) {
+        return;
+    }
 
-    _monkeyMesh.load_from_obj("../assets/monkey_smooth.obj");
+    //power of two levels halve exactly, only the first reduction from the depth buffer is uneven
+    _depthPyramidWidth = previous_pow2(_windowExtent.width);
+    _depthPyramidHeight = previous_pow2(_windowExtent.height);
+    _depthPyramidLevels = 1;
+    while ((_depthPyramidWidth >> _depthPyramidLevels) > 0 || (_depthPyramidHeight >> _depthPyramidLevels) > 0) {
+        _depthPyramidLevels++;
+    }
+    if (_depthPyramidLevels > 16) {
+        _depthPyramidLevels = 16;
+    }
 
-    upload_mesh(_triangleMesh);
-    upload_mesh(_monkeyMesh);
+    VkExtent3D pyramidExtent = {_depthPyramidWidth, _depthPyramidHeight, 1};
+    VkImageCreateInfo pyramidInfo = vkinit::image_create_info(VK_FORMAT_R32_SFLOAT,
+                                                              VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT, pyramidExtent);
+    pyramidInfo.mipLevels = _depthPyramidLevels;
 
-    _meshes["monkey"] = _monkeyMesh;
-    _meshes["triangle"] = _triangleMesh;
-}
+    VmaAllocationCreateInfo pyramidAllocInfo = {};
+    pyramidAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    pyramidAllocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-void VulkanEngine::upload_mesh(Mesh &mesh) {
-    VkBufferCreateInfo bufferInfo = {};
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    // total size in bytes of the buffer
-    bufferInfo.size = mesh._vertices.size() * sizeof(Vertex);
-    // how is the buffer going to be used?
-    bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    VK_CHECK(vmaCreateImage(_allocator, &pyramidInfo, &pyramidAllocInfo, &_depthPyramid._image, &_depthPyramid._allocation, nullptr));
+    _gpuMemory.track(_depthPyramid._allocation, MemoryCategory::Attachment);
 
-    VmaAllocationCreateInfo vmaAllocationInfo = {};
-    //How will the memory be used?
-    vmaAllocationInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+    //the cull shader picks a level with textureLod, the reduce passes write one level each
+    VkImageViewCreateInfo pyramidViewInfo = vkinit::imageview_create_info(VK_FORMAT_R32_SFLOAT, _depthPyramid._image, VK_IMAGE_ASPECT_COLOR_BIT);
+    pyramidViewInfo.subresourceRange.levelCount = _depthPyramidLevels;
+    VK_CHECK(vkCreateImageView(_device, &pyramidViewInfo, _hostCallbacks, &_depthPyramidView));
 
-    VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaAllocationInfo,
-                             &mesh._vertexBuffer._buffer, &mesh._vertexBuffer._allocation,
-                             nullptr));
+    for (uint32_t i = 0; i < _depthPyramidLevels; i++) {
+        VkImageViewCreateInfo mipViewInfo = vkinit::imageview_create_info(VK_FORMAT_R32_SFLOAT, _depthPyramid._image, VK_IMAGE_ASPECT_COLOR_BIT);
+        mipViewInfo.subresourceRange.baseMipLevel = i;
+        VK_CHECK(vkCreateImageView(_device, &mipViewInfo, _hostCallbacks, &_depthPyramidMips[i]));
+    }
 
-    _mainDeletionQueue.push_function([=](){
-        vmaDestroyBuffer(_allocator, mesh._vertexBuffer._buffer, mesh._vertexBuffer._allocation);
-    });
+    VkSamplerCreateInfo samplerInfo = vkinit::sampler_create_info(VK_FILTER_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    VK_CHECK(vkCreateSampler(_device, &samplerInfo, _hostCallbacks, &_depthSampler));
 
-    void* data;
-    vmaMapMemory(_allocator, mesh._vertexBuffer._allocation, &data);
-    memcpy(data, mesh._vertices.data(), mesh._vertices.size() * sizeof(Vertex));
-    vmaUnmapMemory(_allocator, mesh._vertexBuffer._allocation);
+    //reduce: previous level (or the depth buffer) in, one level out
+    VkDescriptorSetLayoutBinding reduceBindings[] = {
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 1)
+    };
 
-}
+    VkDescriptorSetLayoutCreateInfo reduceSetInfo = {};
+    reduceSetInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    reduceSetInfo.pNext = nullptr;
+    reduceSetInfo.bindingCount = 2;
+    reduceSetInfo.pBindings = reduceBindings;
+    VK_CHECK(vkCreateDescriptorSetLayout(_device, &reduceSetInfo, _hostCallbacks, &_reduceSetLayout));
+
+    VkDescriptorSetLayoutBinding cullBindings[] = {
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 2),
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3)
+    };
 
-Material* VulkanEngine::create_material(VkPipeline pipeline, VkPipelineLayout layout, const std::string &name) {
-    Material mat;
-    mat.pipeline = pipeline;
-    mat.pipelineLayout = layout;
-    _materials[name] = mat;
-    return &_materials[name];
-}
+    VkDescriptorSetLayoutCreateInfo cullSetInfo = {};
+    cullSetInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    cullSetInfo.pNext = nullptr;
+    cullSetInfo.bindingCount = 4;
+    cullSetInfo.pBindings = cullBindings;
+    VK_CHECK(vkCreateDescriptorSetLayout(_device, &cullSetInfo, _hostCallbacks, &_cullSetLayout));
+
+    for (uint32_t i = 0; i < _depthPyramidLevels; i++) {
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.pNext = nullptr;
+        allocInfo.descriptorPool = _descriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &_reduceSetLayout;
+        VK_CHECK(vkAllocateDescriptorSets(_device, &allocInfo, &_reduceDescriptors[i]));
+
+        VkDescriptorImageInfo sourceInfo = {};
+        sourceInfo.sampler = _depthSampler;
+        if (i == 0) {
+            sourceInfo.imageView = _depthImageView;
+            sourceInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        } else {
+            sourceInfo.imageView = _depthPyramidMips[i - 1];
+            sourceInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        }
 
-Material* VulkanEngine::get_material(const std::string &name) {
-    auto it = _materials.find(name);
-    if(it == _materials.end()) {
-        return nullptr;
-    }
-    else {
-        return &(*it).second;
-    }
-}
+        VkDescriptorImageInfo destinationInfo = {};
+        destinationInfo.imageView = _depthPyramidMips[i];
+        destinationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
 
-Mesh* VulkanEngine::get_mesh(const std::string& name){
-    auto it = _meshes.find(name);
-    if(it == _meshes.end()){
-        return nullptr;
-    } else {
-        return &(*it).second;
+        VkWriteDescriptorSet writes[] = {
+                vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _reduceDescriptors[i], &sourceInfo, 0),
+                vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, _reduceDescriptors[i], &destinationInfo, 1)
+        };
+        vkUpdateDescriptorSets(_device, 2, writes, 0, nullptr);
     }
-}
-
-void VulkanEngine::draw_objects(VkCommandBuffer cmd, RenderObject *first, int count) {
-    //model view matrix
-    //camera view
-    glm::vec3 camPos = {0.f, -6.f, -10.f};
 
-    glm::mat4 view = glm::translate(glm::mat4(1.f), camPos);
-    //camera projection
-    glm::mat4 projection = glm::perspective(glm::radians(70.f),1700.f/ 900.f, 0.1f, 200.0f);
-    projection[1][1] *= -1;
+    VkDescriptorSetAllocateInfo cullAllocInfo = {};
+    cullAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    cullAllocInfo.pNext = nullptr;
+    cullAllocInfo.descriptorPool = _descriptorPool;
+    cullAllocInfo.descriptorSetCount = 1;
+    cullAllocInfo.pSetLayouts = &_cullSetLayout;
+    VK_CHECK(vkAllocateDescriptorSets(_device, &cullAllocInfo, &_cullDescriptor));
+
+    VkDescriptorBufferInfo objectInfo = {_objectBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo drawInfo = {_drawCommandBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo statsInfo = {_cullStatsBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorImageInfo pyramidImageInfo = {_depthSampler, _depthPyramidView, VK_IMAGE_LAYOUT_GENERAL};
+
+    VkWriteDescriptorSet cullWrites[] = {
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _cullDescriptor, &objectInfo, 0),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _cullDescriptor, &drawInfo, 1),
+            vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _cullDescriptor, &pyramidImageInfo, 2),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _cullDescriptor, &statsInfo, 3)
+    };
+    vkUpdateDescriptorSets(_device, 4, cullWrites, 0, nullptr);
+
+    VkPushConstantRange reduceConstants = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DepthReduceConstants)};
+    VkPipelineLayoutCreateInfo reduceLayoutInfo = vkinit::pipeline_layout_create_info();
+    reduceLayoutInfo.setLayoutCount = 1;
+    reduceLayoutInfo.pSetLayouts = &_reduceSetLayout;
+    reduceLayoutInfo.pushConstantRangeCount = 1;
+    reduceLayoutInfo.pPushConstantRanges = &reduceConstants;
+    VK_CHECK(vkCreatePipelineLayout(_device, &reduceLayoutInfo, _hostCallbacks, &_reducePipelineLayout));
+
+    VkPushConstantRange cullConstants = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(OcclusionCullConstants)};
+    VkPipelineLayoutCreateInfo cullLayoutInfo = vkinit::pipeline_layout_create_info();
+    cullLayoutInfo.setLayoutCount = 1;
+    cullLayoutInfo.pSetLayouts = &_cullSetLayout;
+    cullLayoutInfo.pushConstantRangeCount = 1;
+    cullLayoutInfo.pPushConstantRanges = &cullConstants;
+    VK_CHECK(vkCreatePipelineLayout(_device, &cullLayoutInfo, _hostCallbacks, &_cullPipelineLayout));
+
+    build_compute_pipeline("../shaders/depth_reduce.comp.spv", _reducePipelineLayout, &_reducePipeline);
+    build_compute_pipeline("../shaders/occlusion_cull.comp.spv", _cullPipelineLayout, &_cullPipeline);
 
-    Mesh * lastMesh = nullptr;
-    Material* lastMaterial = nullptr;
-    for (int i = 0; i < count; i++){
-        RenderObject& object = first[i];
-        if (object.material != lastMaterial) {
-            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material-> pipeline);
-            lastMaterial = object.material;
+    _mainDeletionQueue.push_function([=]() {
+        vkDestroyPipeline(_device, _reducePipeline, _hostCallbacks);
+        vkDestroyPipeline(_device, _cullPipeline, _hostCallbacks);
+        vkDestroyPipelineLayout(_device, _reducePipelineLayout, _hostCallbacks);
+        vkDestroyPipelineLayout(_device, _cullPipelineLayout, _hostCallbacks);
+        vkDestroyDescriptorSetLayout(_device, _reduceSetLayout, _hostCallbacks);
+        vkDestroyDescriptorSetLayout(_device, _cullSetLayout, _hostCallbacks);
+        vkDestroySampler(_device, _depthSampler, _hostCallbacks);
+        for (uint32_t i = 0; i < _depthPyramidLevels; i++) {
+            vkDestroyImageView(_device, _depthPyramidMips[i], _hostCallbacks);
         }
+        vkDestroyImageView(_device, _depthPyramidView, _hostCallbacks);
+        _gpuMemory.untrack(_depthPyramid._allocation);
+        vmaDestroyImage(_allocator, _depthPyramid._image, _depthPyramid._allocation);
+    });
+}
 
-        glm::mat4 model = object.transformMatrix;
+void VulkanEngine::init_meshlet_culling() {
+    if (!_meshletCulling) {
+        return;
+    }
 
-        glm::mat4 mesh_matrix = projection * view * model;
+    //objects, meshlets, work list in. draws and counters out
+    VkDescriptorSetLayoutBinding bindings[] = {
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2),
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3),
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 4)
+    };
 
-        MeshPushConstants constants;
-        constants.render_matrix = mesh_matrix;
+    VkDescriptorSetLayoutCreateInfo setInfo = {};
+    setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setInfo.pNext = nullptr;
+    setInfo.bindingCount = 5;
+    setInfo.pBindings = bindings;
+    VK_CHECK(vkCreateDescriptorSetLayout(_device, &setInfo, _hostCallbacks, &_meshletSetLayout));
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.pNext = nullptr;
+    allocInfo.descriptorPool = _descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &_meshletSetLayout;
+    VK_CHECK(vkAllocateDescriptorSets(_device, &allocInfo, &_meshletDescriptor));
+
+    VkDescriptorBufferInfo objectInfo = {_objectBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo meshletInfo = {_meshletBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo workInfo = {_meshletWorkBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo drawInfo = {_meshletDrawBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo countInfo = {_meshletCountBuffer._buffer, 0, VK_WHOLE_SIZE};
+
+    VkWriteDescriptorSet writes[] = {
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _meshletDescriptor, &objectInfo, 0),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _meshletDescriptor, &meshletInfo, 1),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _meshletDescriptor, &workInfo, 2),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _meshletDescriptor, &drawInfo, 3),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _meshletDescriptor, &countInfo, 4)
+    };
+    vkUpdateDescriptorSets(_device, 5, writes, 0, nullptr);
+
+    VkPushConstantRange constants = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MeshletCullConstants)};
+    VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipeline_layout_create_info();
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &_meshletSetLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &constants;
+    VK_CHECK(vkCreatePipelineLayout(_device, &layoutInfo, _hostCallbacks, &_meshletPipelineLayout));
+
+    build_compute_pipeline("../shaders/meshlet_cull.comp.spv", _meshletPipelineLayout, &_meshletPipeline);
+
+    _mainDeletionQueue.push_function([=]() {
+        vkDestroyPipeline(_device, _meshletPipeline, _hostCallbacks);
+        vkDestroyPipelineLayout(_device, _meshletPipelineLayout, _hostCallbacks);
+        vkDestroyDescriptorSetLayout(_device, _meshletSetLayout, _hostCallbacks);
+    });
+}
+
+void VulkanEngine::init_light_culling() {
+    if (_lightCount == 0) {
+        return;
+    }
+
+    //params, lights and cluster bounds in, per cluster counts and light lists out
+    VkDescriptorSetLayoutBinding bindings[] = {
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2),
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3),
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 4)
+    };
+
+    VkDescriptorSetLayoutCreateInfo setInfo = {};
+    setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setInfo.pNext = nullptr;
+    setInfo.bindingCount = 5;
+    setInfo.pBindings = bindings;
+    VK_CHECK(vkCreateDescriptorSetLayout(_device, &setInfo, _hostCallbacks, &_lightCullSetLayout));
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.pNext = nullptr;
+    allocInfo.descriptorPool = _descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &_lightCullSetLayout;
+    VK_CHECK(vkAllocateDescriptorSets(_device, &allocInfo, &_lightCullDescriptor));
+
+    VkDescriptorBufferInfo paramsInfo = {_clusterParamsBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo lightInfo = {_lightBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo boundsInfo = {_clusterBoundsBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo countInfo = {_clusterCountBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo indexInfo = {_clusterIndexBuffer._buffer, 0, VK_WHOLE_SIZE};
+
+    VkWriteDescriptorSet writes[] = {
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, _lightCullDescriptor, &paramsInfo, 0),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _lightCullDescriptor, &lightInfo, 1),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _lightCullDescriptor, &boundsInfo, 2),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _lightCullDescriptor, &countInfo, 3),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _lightCullDescriptor, &indexInfo, 4)
+    };
+    vkUpdateDescriptorSets(_device, 5, writes, 0, nullptr);
+
+    VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipeline_layout_create_info();
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &_lightCullSetLayout;
+    VK_CHECK(vkCreatePipelineLayout(_device, &layoutInfo, _hostCallbacks, &_lightCullPipelineLayout));
+
+    build_compute_pipeline("../shaders/light_cull.comp.spv", _lightCullPipelineLayout, &_lightCullPipeline);
+
+    _mainDeletionQueue.push_function([=]() {
+        vkDestroyPipeline(_device, _lightCullPipeline, _hostCallbacks);
+        vkDestroyPipelineLayout(_device, _lightCullPipelineLayout, _hostCallbacks);
+        vkDestroyDescriptorSetLayout(_device, _lightCullSetLayout, _hostCallbacks);
+    });
+}
+
+void VulkanEngine::cleanup()
+{	
+	if (_isInitialized) {
+
+        //every queue has to be idle, not just the last graphics submission
+        vkDeviceWaitIdle(_device);
+        _transferValueAcquired = _transferTimelineValue;
+        retire_uploads();
+
+        _mainDeletionQueue.flush();
+        _assetPack.close();
+
+        //SDL creates the surface without callbacks, so it is destroyed without them
+        vkDestroySurfaceKHR(_instance, _surface, nullptr);
+
+        vkDestroyDevice(_device, _hostCallbacks);
+        vkDestroyInstance(_instance, _hostCallbacks);
+
+        //everything is destroyed, whatever is still live in a scope has leaked
+        if (_logAllocations) {
+            host_allocator().log_stats();
+            std::cout << "Last frame heap allocations: " << _frameAllocations.heapAllocations << " (" << _frameAllocations.heapBytes
+                      << " bytes), host " << _frameAllocations.hostAllocations << ", steady state frames that allocated: "
+                      << _frameAllocations.flaggedFrames << std::endl;
+        }
+
+        if (_window) {
+		    SDL_DestroyWindow(_window);
+        }
+
+        _jobs.cleanup();
+	}
+}
+
+void VulkanEngine::init_geometry_pool() {
+    //sized for the demo scenes, ranges that do not fit fail in upload_mesh. the vertex buffer stays under half
+    //of VMA's 256MB block so it is placed in a block, dedicated allocations are never moved by defragmentation
+    const uint32_t maxVertices = 3 * 1024 * 1024;
+    const uint32_t maxIndices = 12 * 1024 * 1024;
+
+    _geometryPool.init(_allocator, maxVertices, maxIndices);
+
+    //the pool buffers are the only long lived buffers, so they are what defragmentation moves
+    _gpuMemory.track(_geometryPool._vertexBuffer._allocation, MemoryCategory::Mesh);
+    _gpuMemory.track(_geometryPool._indexBuffer._allocation, MemoryCategory::Mesh);
+    _gpuMemory.register_movable(&_geometryPool._vertexBuffer, (VkDeviceSize)maxVertices * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    _gpuMemory.register_movable(&_geometryPool._indexBuffer, (VkDeviceSize)maxIndices * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+
+    _mainDeletionQueue.push_function([=]() {
+        _gpuMemory.unregister_movable(&_geometryPool._vertexBuffer);
+        _gpuMemory.unregister_movable(&_geometryPool._indexBuffer);
+        _gpuMemory.untrack(_geometryPool._vertexBuffer._allocation);
+        _gpuMemory.untrack(_geometryPool._indexBuffer._allocation);
+        _geometryPool.cleanup();
+    });
+}
+
+void VulkanEngine::parse_meshes(bool buildMeshlets) {
+    Mesh triangleMesh;
+    // resize the array to 3 members
+    triangleMesh._vertices.resize(3);
+
+    //vertex positions
+    triangleMesh._vertices[0].position = {1.f,1.f,0.0f};
+    triangleMesh._vertices[1].position = {-1.f,1.f,0.0f};
+    triangleMesh._vertices[2].position = {0.f,-1.f, 0.0f};
+
+    //vertex colors
+    triangleMesh._vertices[0].color = {0.f, 1.f, 0.0f};
+    triangleMesh._vertices[1].color = {0.f, 1.f, 0.0f};
+    triangleMesh._vertices[2].color = {0.f, 1.f, 0.0f};
+
+    triangleMesh._indices = {0, 1, 2};
+    triangleMesh.compute_bounds();
+    if (buildMeshlets) {
+        triangleMesh._meshlets = build_meshlets(triangleMesh._vertices, triangleMesh._indices);
+    }
+
+    struct ObjAsset {
+        const char* name;
+        const char* path;
+    };
+    const ObjAsset objAssets[] = {
+            {"monkey", "../assets/monkey_smooth.obj"},
+    };
+    const uint32_t objCount = sizeof(objAssets) / sizeof(objAssets[0]);
+
+    //obj parsing is pure cpu work, one job per file
+    std::vector<Mesh> objMeshes(objCount);
+    _jobs.parallel_for(objCount, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            AssetData obj;
+            if (!read_asset(objAssets[i].path, obj)) {
+                std::cout << "Could not read " << objAssets[i].path << std::endl;
+                continue;
+            }
+            objMeshes[i].load_from_obj(obj.data, obj.size);
+            objMeshes[i].compute_bounds();
+            if (buildMeshlets) {
+                objMeshes[i]._meshlets = build_meshlets(objMeshes[i]._vertices, objMeshes[i]._indices);
+            }
+        }
+    });
+
+    for (uint32_t i = 0; i < objCount; i++) {
+        _parsedMeshes.emplace_back(objAssets[i].name, std::move(objMeshes[i]));
+    }
+    _parsedMeshes.emplace_back("triangle", std::move(triangleMesh));
+}
+
+void VulkanEngine::load_meshes() {
+    //move the meshes into the registry first so the upload works on the stored copy
+    //uploads share the single upload context, so they stay on this thread
+    for (auto& parsed : _parsedMeshes) {
+        MeshHandle handle = _meshes.add(parsed.first, std::move(parsed.second));
+        //a duplicate name returns the mesh already in the pool, a hash collision no mesh at all
+        Mesh* mesh = _meshes.get(handle);
+        if (mesh && mesh->_range.indexCount == 0) {
+            upload_mesh(*mesh);
+        }
+    }
+    _parsedMeshes.clear();
+
+    GeometryPoolStats poolStats = _geometryPool.get_stats();
+    std::cout << "Geometry pool: " << poolStats.verticesUsed << "/" << poolStats.vertexCapacity << " vertices, "
+              << poolStats.indicesUsed << "/" << poolStats.indexCapacity << " indices, "
+              << poolStats.rangeCount << " meshes" << std::endl;
+}
+
+void VulkanEngine::upload_mesh(Mesh &mesh) {
+    const uint32_t vertexCount = (uint32_t)mesh._vertices.size();
+    const uint32_t indexCount = (uint32_t)mesh._indices.size();
+
+    if (!_geometryPool.allocate(vertexCount, indexCount, mesh._range)) {
+        std::cout << "Geometry pool is out of space for a mesh of " << vertexCount << " vertices" << std::endl;
+        return;
+    }
+
+    const size_t vertexBytes = vertexCount * sizeof(Vertex);
+    const size_t indexBytes = indexCount * sizeof(uint32_t);
+
+    //vertices and indices share one staging buffer, indices go right after the vertices
+    AllocatedBuffer stagingBuffer = create_buffer(vertexBytes + indexBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                                  VMA_MEMORY_USAGE_CPU_ONLY, MemoryCategory::Staging);
+
+    void* data;
+    vmaMapMemory(_allocator, stagingBuffer._allocation, &data);
+    memcpy(data, mesh._vertices.data(), vertexBytes);
+    memcpy((char*)data + vertexBytes, mesh._indices.data(), indexBytes);
+    vmaUnmapMemory(_allocator, stagingBuffer._allocation);
+
+    const MeshRange range = mesh._range;
+
+    //meshlets only need the final index range, the buffer is host visible and written right away
+    if (_meshletCulling) {
+        if (_meshletCount + mesh._meshlets.size() > _maxMeshlets) {
+            std::cout << "Meshlet buffer is out of space, the mesh is left out of meshlet culling" << std::endl;
+            mesh._meshlets.clear();
+        }
+        mesh._firstMeshlet = _meshletCount;
+        for (const Meshlet& meshlet : mesh._meshlets) {
+            GPUMeshlet& gpuMeshlet = _meshletData[_meshletCount++];
+            gpuMeshlet.sphere = glm::vec4(meshlet.center, meshlet.radius);
+            gpuMeshlet.cone = glm::vec4(meshlet.coneAxis, meshlet.coneCutoff);
+            gpuMeshlet.firstIndex = range.firstIndex + meshlet.triangleOffset * 3;
+            gpuMeshlet.indexCount = meshlet.triangleCount * 3;
+            gpuMeshlet.vertexOffset = (int32_t)range.firstVertex;
+            gpuMeshlet.pad = 0;
+        }
+    }
+
+    VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(_transferContext._commandPool, 1);
+    VkCommandBuffer cmd;
+    VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &cmd));
+
+    VkCommandBufferBeginInfo cmdBeginInfo = {};
+    cmdBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    cmdBeginInfo.pNext = nullptr;
+    cmdBeginInfo.pInheritanceInfo = nullptr;
+    cmdBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+
+    VkBufferCopy vertexCopy = {};
+    vertexCopy.srcOffset = 0;
+    vertexCopy.dstOffset = range.firstVertex * sizeof(Vertex);
+    vertexCopy.size = vertexBytes;
+    vkCmdCopyBuffer(cmd, stagingBuffer._buffer, _geometryPool._vertexBuffer._buffer, 1, &vertexCopy);
+
+    VkBufferCopy indexCopy = {};
+    indexCopy.srcOffset = vertexBytes;
+    indexCopy.dstOffset = range.firstIndex * sizeof(uint32_t);
+    indexCopy.size = indexBytes;
+    vkCmdCopyBuffer(cmd, stagingBuffer._buffer, _geometryPool._indexBuffer._buffer, 1, &indexCopy);
+
+    PendingUpload upload;
+    upload.timelineValue = ++_transferTimelineValue;
+    upload.commandBuffer = cmd;
+    upload.stagingBuffer = stagingBuffer;
+
+    //the pool buffers are exclusive, a dedicated transfer family releases the copied ranges here
+    //and the next graphics submission acquires them with the matching barriers
+    if (_transferQueueFamily != _graphicsQueueFamily) {
+        VkBufferMemoryBarrier vertexBarrier = vkinit::buffer_barrier(_geometryPool._vertexBuffer._buffer, VK_ACCESS_TRANSFER_WRITE_BIT, 0);
+        vertexBarrier.srcQueueFamilyIndex = _transferQueueFamily;
+        vertexBarrier.dstQueueFamilyIndex = _graphicsQueueFamily;
+        vertexBarrier.offset = vertexCopy.dstOffset;
+        vertexBarrier.size = vertexCopy.size;
+
+        VkBufferMemoryBarrier indexBarrier = vkinit::buffer_barrier(_geometryPool._indexBuffer._buffer, VK_ACCESS_TRANSFER_WRITE_BIT, 0);
+        indexBarrier.srcQueueFamilyIndex = _transferQueueFamily;
+        indexBarrier.dstQueueFamilyIndex = _graphicsQueueFamily;
+        indexBarrier.offset = indexCopy.dstOffset;
+        indexBarrier.size = indexCopy.size;
+
+        VkBufferMemoryBarrier release[] = {vertexBarrier, indexBarrier};
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                             0, nullptr, 2, release, 0, nullptr);
+
+        vertexBarrier.srcAccessMask = 0;
+        vertexBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+        indexBarrier.srcAccessMask = 0;
+        indexBarrier.dstAccessMask = VK_ACCESS_INDEX_READ_BIT;
+        upload.acquireBarriers.push_back(vertexBarrier);
+        upload.acquireBarriers.push_back(indexBarrier);
+    }
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
+
+    SubmitSync sync;
+    sync.signal(_transferTimeline, upload.timelineValue);
+    submit(_transferQueue, cmd, sync);
+
+    _transferContext._pending.push_back(std::move(upload));
+}
+
+void VulkanEngine::retire_uploads() {
+    uint64_t completed;
+    VK_CHECK(vkGetSemaphoreCounterValue(_device, _transferTimeline, &completed));
+
+    //the acquire barriers are kept until a graphics submission has recorded them
+    std::vector<PendingUpload>& pending = _transferContext._pending;
+    auto retired = std::remove_if(pending.begin(), pending.end(), [&](PendingUpload& upload) {
+        if (upload.timelineValue > completed || upload.timelineValue > _transferValueAcquired) {
+            return false;
+        }
+        vkFreeCommandBuffers(_device, _transferContext._commandPool, 1, &upload.commandBuffer);
+        destroy_buffer(upload.stagingBuffer);
+        return true;
+    });
+    pending.erase(retired, pending.end());
+}
+
+void VulkanEngine::update_streaming(const SceneSnapshot& snapshot) {
+    if (_streamer.chunk_count() == 0) {
+        return;
+    }
+
+    //the view is the inverse of the camera transform
+    const glm::vec3 camera = glm::vec3(glm::inverse(snapshot.view)[3]);
+    _streamer.update(camera, _jobs);
+
+    //the previous frame has finished, nothing reads the freed ranges anymore. a chunk is uploaded at the
+    //earliest one frame before it is evicted, and that frame waited for the copy
+    for (uint32_t chunk : _streamer.evicted()) {
+        if (Mesh* mesh = _meshes.get(_chunkMeshes[chunk])) {
+            _geometryPool.free(mesh->_range);
+        }
+    }
+
+    //frames that stream allocate staging buffers and chunk data, steady frames with nothing to stream do not
+    for (uint32_t chunk : _streamer.ready()) {
+        Mesh* mesh = _meshes.get(_chunkMeshes[chunk]);
+        if (mesh && !_streamer.indices(chunk).empty()) {
+            mesh->_vertices.swap(_streamer.vertices(chunk));
+            mesh->_indices.swap(_streamer.indices(chunk));
+            upload_mesh(*mesh);
+            //the geometry pool holds the only copy
+            mesh->_vertices = std::vector<Vertex>();
+            mesh->_indices = std::vector<uint32_t>();
+        }
+        _streamer.release(chunk);
+    }
+}
+
+void VulkanEngine::submit(VkQueue queue, VkCommandBuffer cmd, const SubmitSync& sync) {
+    //binary semaphores in the lists take a value too, it is ignored
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.pNext = nullptr;
+    timelineInfo.waitSemaphoreValueCount = sync.waitCount;
+    timelineInfo.pWaitSemaphoreValues = sync.waitValues;
+    timelineInfo.signalSemaphoreValueCount = sync.signalCount;
+    timelineInfo.pSignalSemaphoreValues = sync.signalValues;
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = sync.waitCount;
+    submitInfo.pWaitSemaphores = sync.waitSemaphores;
+    submitInfo.pWaitDstStageMask = sync.waitStages;
+    submitInfo.signalSemaphoreCount = sync.signalCount;
+    submitInfo.pSignalSemaphores = sync.signalSemaphores;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmd;
+
+    VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+}
+
+AllocatedBuffer VulkanEngine::create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, MemoryCategory category,
+                                           bool sharedWithCompute) {
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.pNext = nullptr;
+    // total size in bytes of the buffer
+    bufferInfo.size = allocSize;
+    // how is the buffer going to be used?
+    bufferInfo.usage = usage;
+
+    //small per frame buffers written by the host, concurrent access is cheaper than transferring them every frame
+    uint32_t sharedFamilies[] = {_graphicsQueueFamily, _computeQueueFamily};
+    if (sharedWithCompute && _computeQueueFamily != _graphicsQueueFamily) {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = 2;
+        bufferInfo.pQueueFamilyIndices = sharedFamilies;
+    }
+
+    VmaAllocationCreateInfo vmaAllocationInfo = {};
+    //How will the memory be used?
+    vmaAllocationInfo.usage = memoryUsage;
+
+    AllocatedBuffer newBuffer;
+    VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaAllocationInfo,
+                             &newBuffer._buffer, &newBuffer._allocation,
+                             nullptr));
+
+    _gpuMemory.track(newBuffer._allocation, category);
+    return newBuffer;
+}
+
+void VulkanEngine::destroy_buffer(const AllocatedBuffer& buffer) {
+    _gpuMemory.untrack(buffer._allocation);
+    vmaDestroyBuffer(_allocator, buffer._buffer, buffer._allocation);
+}
+
+void VulkanEngine::request_defragmentation() {
+    _defragmentationRequested.store(true, std::memory_order_relaxed);
+}
+
+void VulkanEngine::update_memory() {
+    _gpuMemory.update((uint32_t)_frameNumber);
+
+    if (_gpuMemory.over_budget(_memoryWarningThreshold) && _frameNumber % 120 == 0) {
+        std::cout << "WARNING: GPU memory usage is above " << (int)(_memoryWarningThreshold * 100) << "% of the budget" << std::endl;
+        _gpuMemory.log_stats();
+    }
+
+    if (_memoryLogInterval > 0 && _frameNumber % _memoryLogInterval == 0) {
+        _gpuMemory.log_stats();
+    }
+
+    const bool overBudget = _defragmentWhenOverBudget && _frameNumber >= _nextDefragmentationFrame &&
+                            _gpuMemory.over_budget(_memoryWarningThreshold);
+    if ((_defragmentationRequested.exchange(false, std::memory_order_relaxed) || overBudget) && !_gpuMemory.is_defragmenting()) {
+        //bounded passes keep the per frame copy cost small
+        const VkDeviceSize maxBytesPerPass = 256ull * 1024 * 1024;
+        const uint32_t maxAllocationsPerPass = 4;
+        _gpuMemory.begin_defragmentation(maxBytesPerPass, maxAllocationsPerPass);
+        _nextDefragmentationFrame = _frameNumber + _defragmentationInterval;
+    }
+
+    //the previous frame has finished, so buffers it used can be moved. uploads still writing the pool on the
+    //transfer queue, or whose acquire barriers still name the old buffers, hold the pass back to a later frame
+    if (_gpuMemory.is_defragmenting() && _transferContext._pending.empty()) {
+        immediate_submit([&](VkCommandBuffer cmd) {
+            _gpuMemory.record_defragmentation_pass(cmd);
+        });
+        _gpuMemory.end_defragmentation_pass();
+    }
+}
+
+void VulkanEngine::immediate_submit(std::function<void(VkCommandBuffer)>&& function) {
+    VkCommandBuffer cmd = _uploadContext._commandBuffer;
+
+    VkCommandBufferBeginInfo cmdBeginInfo = {};
+    cmdBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    cmdBeginInfo.pNext = nullptr;
+    cmdBeginInfo.pInheritanceInfo = nullptr;
+    cmdBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+
+    function(cmd);
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = nullptr;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmd;
+
+    VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &submitInfo, _uploadContext._uploadFence));
+
+    vkWaitForFences(_device, 1, &_uploadContext._uploadFence, true, 9999999999);
+    vkResetFences(_device, 1, &_uploadContext._uploadFence);
+
+    //clears the command buffer allocated from the pool
+    vkResetCommandPool(_device, _uploadContext._commandPool, 0);
+}
+
+MaterialHandle VulkanEngine::create_material(VkPipeline pipeline, VkPipelineLayout layout, const std::string &name,
+                                             const glm::vec4& baseColor, BindlessIndex texture) {
+    Material mat;
+    mat.pipeline = pipeline;
+    mat.pipelineLayout = layout;
+    mat.baseColor = baseColor;
+    mat.texture = texture;
+    MaterialHandle handle = _materials.add(name, std::move(mat));
+
+    //bindless shaders look the parameters up at the registry slot. a duplicate name keeps the first material
+    const Material* stored = _materials.get(handle);
+    if (_materialData && stored && handle.index < _maxMaterials) {
+        _materialData[handle.index] = GPUMaterialData{stored->baseColor, stored->texture};
+    }
+    return handle;
+}
+
+MaterialHandle VulkanEngine::get_material(NameId name) const {
+    return _materials.find(name);
+}
+
+MeshHandle VulkanEngine::get_mesh(NameId name) const {
+    return _meshes.find(name);
+}
+
+void VulkanEngine::select_mesh_variant() {
+    //the prepass writes depth for every fragment, cut out ones would leave holes in the main pass
+    uint32_t bits = _meshVariant.load(std::memory_order_relaxed);
+    if (_depthPrepass) {
+        bits &= ~(uint32_t)VARIANT_ALPHA_TEST;
+    }
+
+    //a lookup once the variant exists, never a compile on this thread.
+    //null means nothing is ready at all, the material keeps drawing with what it has
+    Material* material = _materials.get(_defaultMaterial);
+    if (material) {
+        VkPipeline pipeline = _meshVariants.get(bits);
+        if (pipeline != VK_NULL_HANDLE) {
+            material->pipeline = pipeline;
+        }
+    }
+    _meshVariantSettled = _meshVariants.settled(bits);
+}
+
+void VulkanEngine::cull_objects(const SceneSnapshot& snapshot) {
+    //objects past the object buffer capacity are not drawn
+    const uint32_t count = std::min((uint32_t)snapshot.transforms.size(), _maxObjects);
+    _objectSpheres.resize(count);
+    _objectMoved.resize(count);
+
+    const glm::mat4 viewProj = snapshot.projection * snapshot.view;
+    Frustum frustum = Frustum::from_matrix(viewProj);
+
+    //proxy i of the tree is object i, a different object count means a different scene
+    const bool rebuild = _spatialRebuild || _spatialIndex.get_stats().proxyCount != count;
+
+    //mesh and material handles never change after init_scene, only transforms come from the snapshot
+    _jobs.parallel_for(count, 1024, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            const Mesh* mesh = _meshes.get(_renderables[i].mesh);
+            const glm::mat4& transform = snapshot.transforms[i];
+
+            MeshBounds world = transform_bounds(mesh->_bounds, transform);
+            _objectSpheres[i] = glm::vec4(world.origin, world.radius);
+            _objectMoved[i] = !rebuild && !_spatialIndex.fat_box(i).contains(Aabb::from_sphere(world.origin, world.radius)) ? 1 : 0;
+
+            //the gpu finished last frame before draw() got here, so the buffer is free to overwrite
+            _objectData[i].renderMatrix = viewProj * transform;
+            _objectData[i].sphereBounds = glm::vec4(world.origin, world.radius);
+            _objectData[i].materialIndex = _renderables[i].material.index;
+            _objectData[i].fade = 1.f;
+        }
+    });
+
+    if (rebuild) {
+        std::vector<Aabb> boxes(count);
+        for (uint32_t i = 0; i < count; i++) {
+            boxes[i] = Aabb::from_sphere(glm::vec3(_objectSpheres[i]), _objectSpheres[i].w);
+        }
+        _spatialIndex.build(boxes.data(), count);
+        _spatialRebuild = false;
+    } else {
+        //objects that stayed inside their fat box need nothing, the rest are reinserted
+        for (uint32_t i = 0; i < count; i++) {
+            if (_objectMoved[i]) {
+                _spatialIndex.move(i, Aabb::from_sphere(glm::vec3(_objectSpheres[i]), _objectSpheres[i].w));
+            }
+        }
+    }
+
+    //subtrees outside the frustum are skipped whole, leaves under a subtree inside it need no test of their own
+    _visibleObjects.clear();
+    _spatialIndex.query_frustum(frustum, [this, &frustum](uint32_t object, bool contained) {
+        const glm::vec4& sphere = _objectSpheres[object];
+        if (contained || frustum.intersects_sphere(glm::vec3(sphere), sphere.w)) {
+            _visibleObjects.push_back(object);
+        }
+    });
+
+    //the tree visits in spatial order, sorting back to object order keeps draw order stable,
+    //which keeps pipeline binds grouped
+    std::sort(_visibleObjects.begin(), _visibleObjects.end());
+}
+
+void VulkanEngine::draw_objects(VkCommandBuffer cmd, const uint32_t* objectIndices, int count) {
+    set_draw_viewport(cmd);
+
+    //every mesh lives in the geometry pool, so the buffers are bound once for the whole list
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(cmd, 0, 1, &_geometryPool._vertexBuffer._buffer, &offset);
+    vkCmdBindIndexBuffer(cmd, _geometryPool._indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+
+    //bindless objects read their material by index, nothing changes between draws
+    if (_bindless) {
+        bind_bindless(cmd);
+    }
+
+    //handles are compared instead of resolved pointers so unchanged state costs nothing
+    MeshHandle lastMesh;
+    MaterialHandle lastMaterial;
+    const Mesh* mesh = nullptr;
+    const Material* material = nullptr;
+    for (int i = 0; i < count; i++){
+        const uint32_t objectIndex = objectIndices[i];
+        const RenderObject& object = _renderables[objectIndex];
+        if (!_bindless && object.material != lastMaterial) {
+            material = _materials.get(object.material);
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipeline);
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipelineLayout, 0, 1, &_objectDescriptor, 0, nullptr);
+            lastMaterial = object.material;
+        }
+
+        if(object.mesh != lastMesh) {
+            mesh = _meshes.get(object.mesh);
+            lastMesh = object.mesh;
+        }
+
+        //the object index reaches the shaders as gl_InstanceIndex
+        const MeshRange& range = mesh->_range;
+        vkCmdDrawIndexed(cmd, range.indexCount, 1, range.firstIndex, (int32_t)range.firstVertex, objectIndex);
+    }
+
+}
+
+void VulkanEngine::build_indirect_draws() {
+    _indirectBatches.clear();
+
+    for (uint32_t i = 0; i < (uint32_t)_visibleObjects.size(); i++) {
+        const uint32_t objectIndex = _visibleObjects[i];
+        const RenderObject& object = _renderables[objectIndex];
+        const MeshRange& range = _meshes.get(object.mesh)->_range;
+
+        VkDrawIndexedIndirectCommand& command = _drawCommands[i];
+        command.indexCount = range.indexCount;
+        command.instanceCount = 1;
+        command.firstIndex = range.firstIndex;
+        command.vertexOffset = (int32_t)range.firstVertex;
+        //needs drawIndirectFirstInstance, init_vulkan turns this path off without it
+        command.firstInstance = objectIndex;
+
+        //with bindless materials the whole list is a single batch
+        if (_indirectBatches.empty() || (!_bindless && _indirectBatches.back().material != object.material)) {
+            _indirectBatches.push_back(IndirectBatch{object.material, i, 0});
+        }
+        _indirectBatches.back().count++;
+    }
+}
+
+void VulkanEngine::draw_indirect(VkCommandBuffer cmd, bool depthOnly) {
+    set_draw_viewport(cmd);
+
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(cmd, 0, 1, &_geometryPool._vertexBuffer._buffer, &offset);
+    vkCmdBindIndexBuffer(cmd, _geometryPool._indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+
+    //the depth prepass keeps its own pipeline and the object set either way
+    const bool bindless = _bindless && !depthOnly;
+    if (bindless) {
+        bind_bindless(cmd);
+    }
+
+    const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+    for (const IndirectBatch& batch : _indirectBatches) {
+        if (!bindless) {
+            const Material* material = _materials.get(batch.material);
+            VkPipeline pipeline = depthOnly ? _depthPrepassPipeline : material->pipeline;
+            VkPipelineLayout layout = depthOnly ? _meshPipelineLayout : material->pipelineLayout;
+
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &_objectDescriptor, 0, nullptr);
+        }
+
+        //occluded objects are still here, the cull shader set their instance count to 0
+        VkDeviceSize batchOffset = (VkDeviceSize)batch.first * stride;
+        if (_multiDrawIndirect) {
+            vkCmdDrawIndexedIndirect(cmd, _drawCommandBuffer._buffer, batchOffset, batch.count, stride);
+        } else {
+            for (uint32_t i = 0; i < batch.count; i++) {
+                vkCmdDrawIndexedIndirect(cmd, _drawCommandBuffer._buffer, batchOffset + i * stride, 1, stride);
+            }
+        }
+    }
+}
+
+void VulkanEngine::bind_bindless(VkCommandBuffer cmd) {
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _bindlessPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _bindlessPipelineLayout, 0, 1, &_bindlessHeap._set, 0, nullptr);
+
+    BindlessPushConstants constants;
+    constants.objectBuffer = _objectBufferIndex;
+    constants.materialBuffer = _materialBufferIndex;
+    vkCmdPushConstants(cmd, _bindlessPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                       sizeof(BindlessPushConstants), &constants);
+}
+
+void VulkanEngine::set_draw_viewport(VkCommandBuffer cmd) {
+    VkViewport viewport = {};
+    viewport.x = 0.f;
+    viewport.y = 0.f;
+    viewport.width = (float)_drawExtent.width;
+    viewport.height = (float)_drawExtent.height;
+    viewport.minDepth = 0.f;
+    viewport.maxDepth = 1.f;
+
+    VkRect2D scissor = {};
+    scissor.offset = {0, 0};
+    scissor.extent = _drawExtent;
+
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+}
+
+void VulkanEngine::update_draw_extent() {
+    if (_dynamicResolution) {
+        _resolution.update(_gpuFrameMs);
+    }
+    const float scale = get_render_scale();
+
+    //even sizes keep the 2x upscale at 0.5 exact
+    _drawExtent.width = std::max(2u, (uint32_t)(_windowExtent.width * scale) & ~1u);
+    _drawExtent.height = std::max(2u, (uint32_t)(_windowExtent.height * scale) & ~1u);
+}
+
+void VulkanEngine::upscale_to_swapchain(VkCommandBuffer cmd, VkImage swapchainImage) {
+    VkImageMemoryBarrier toTransfer[] = {
+            vkinit::image_barrier(_drawImage._image, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                                  VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT),
+            vkinit::image_barrier(swapchainImage, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                                  VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT)
+    };
+    //transfer is in the source stages because the acquire semaphore wait is on the transfer stage
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, nullptr, 0, nullptr, 2, toTransfer);
+
+    VkImageBlit blit = {};
+    blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    blit.srcOffsets[1] = {(int32_t)_drawExtent.width, (int32_t)_drawExtent.height, 1};
+    blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    blit.dstOffsets[1] = {(int32_t)_windowExtent.width, (int32_t)_windowExtent.height, 1};
+
+    vkCmdBlitImage(cmd, _drawImage._image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   swapchainImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+    VkImageMemoryBarrier toPresent = vkinit::image_barrier(swapchainImage, VK_ACCESS_TRANSFER_WRITE_BIT, 0,
+                                                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                                                           VK_IMAGE_ASPECT_COLOR_BIT);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &toPresent);
+}
+
+void VulkanEngine::cull_occlusion(VkCommandBuffer cmd) {
+    const uint32_t drawCount = (uint32_t)_visibleObjects.size();
+
+    vkCmdFillBuffer(cmd, _cullStatsBuffer._buffer, 0, VK_WHOLE_SIZE, 0);
+    VkBufferMemoryBarrier clearBarrier = vkinit::buffer_barrier(_cullStatsBuffer._buffer, VK_ACCESS_TRANSFER_WRITE_BIT,
+                                                                VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         0, nullptr, 1, &clearBarrier, 0, nullptr);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipelineLayout, 0, 1, &_cullDescriptor, 0, nullptr);
+
+    //the pyramid holds last frame's depth, so objects are projected the way last frame saw them
+    OcclusionCullConstants constants = {};
+    constants.viewProj = _depthPyramidViewProj;
+    constants.pyramidSize = glm::vec2((float)_depthPyramidWidth, (float)_depthPyramidHeight);
+    constants.drawCount = drawCount;
+    vkCmdPushConstants(cmd, _cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(OcclusionCullConstants), &constants);
+
+    vkCmdDispatch(cmd, (drawCount + 63) / 64, 1, 1);
+
+    //graphics waits on the compute timeline for the draw commands, only the host readback needs a barrier
+    VkBufferMemoryBarrier statsBarrier = vkinit::buffer_barrier(_cullStatsBuffer._buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                         0, nullptr, 1, &statsBarrier, 0, nullptr);
+}
+
+void VulkanEngine::build_meshlet_work() {
+    _meshletWorkCount = 0;
+    _meshletWorkMeshlets = 0;
+
+    //the cpu frustum test already dropped whole objects, the shader only sees the survivors
+    for (uint32_t objectIndex : _visibleObjects) {
+        const Mesh* mesh = _meshes.get(_renderables[objectIndex].mesh);
+        if (mesh->_meshlets.empty()) {
+            continue;
+        }
+
+        GPUMeshletWork& work = _meshletWork[_meshletWorkCount++];
+        work.objectIndex = objectIndex;
+        work.firstMeshlet = mesh->_firstMeshlet;
+        work.meshletCount = (uint32_t)mesh->_meshlets.size();
+        work.pad = 0;
+        _meshletWorkMeshlets += work.meshletCount;
+    }
+    _meshletWorkMeshlets = std::min(_meshletWorkMeshlets, _maxMeshletDraws);
+}
+
+void VulkanEngine::cull_meshlets(VkCommandBuffer cmd) {
+    //without a gpu count every draw up to the worst case is issued, the unwritten ones must be empty
+    vkCmdFillBuffer(cmd, _meshletCountBuffer._buffer, 0, VK_WHOLE_SIZE, 0);
+    if (!_drawIndirectCount && _meshletWorkMeshlets > 0) {
+        vkCmdFillBuffer(cmd, _meshletDrawBuffer._buffer, 0, sizeof(VkDrawIndexedIndirectCommand) * _meshletWorkMeshlets, 0);
+    }
+
+    //last frame's draws read the same buffers, the indirect stage is in the wait for that reason
+    VkBufferMemoryBarrier clearBarriers[] = {
+            vkinit::buffer_barrier(_meshletCountBuffer._buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT),
+            vkinit::buffer_barrier(_meshletDrawBuffer._buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_WRITE_BIT)
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         0, nullptr, 2, clearBarriers, 0, nullptr);
+
+    if (_meshletWorkCount > 0) {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _meshletPipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _meshletPipelineLayout, 0, 1, &_meshletDescriptor, 0, nullptr);
+
+        MeshletCullConstants constants = {};
+        constants.workCount = _meshletWorkCount;
+        constants.maxDraws = _maxMeshletDraws;
+        vkCmdPushConstants(cmd, _meshletPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MeshletCullConstants), &constants);
+
+        //one workgroup per object, its threads stride over the object's meshlets
+        vkCmdDispatch(cmd, _meshletWorkCount, 1, 1);
+    }
+}
+
+void VulkanEngine::check_meshlet_materials() {
+    if (!_meshletCulling || _bindless) {
+        return;
+    }
+    for (const RenderObject& object : _renderables) {
+        if (object.material != _defaultMaterial) {
+            std::cout << "Meshlet culling draws with the default material only, the scene uses others. Meshlet culling disabled" << std::endl;
+            _meshletCulling = false;
+            return;
+        }
+    }
+}
+
+void VulkanEngine::draw_meshlets(VkCommandBuffer cmd) {
+    set_draw_viewport(cmd);
+
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(cmd, 0, 1, &_geometryPool._vertexBuffer._buffer, &offset);
+    vkCmdBindIndexBuffer(cmd, _geometryPool._indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+
+    //a single stream, the draws carry the object index but not its material. bindless resolves
+    //materials per object, otherwise check_meshlet_materials keeps this to default material scenes
+    if (_bindless) {
+        bind_bindless(cmd);
+    } else {
+        const Material* material = _materials.get(_defaultMaterial);
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipelineLayout, 0, 1, &_objectDescriptor, 0, nullptr);
+    }
+
+    const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+    if (_drawIndirectCount) {
+        vkCmdDrawIndexedIndirectCount(cmd, _meshletDrawBuffer._buffer, 0, _meshletCountBuffer._buffer, 0, _meshletWorkMeshlets, stride);
+    } else if (_multiDrawIndirect) {
+        vkCmdDrawIndexedIndirect(cmd, _meshletDrawBuffer._buffer, 0, _meshletWorkMeshlets, stride);
+    } else {
+        for (uint32_t i = 0; i < _meshletWorkMeshlets; i++) {
+            vkCmdDrawIndexedIndirect(cmd, _meshletDrawBuffer._buffer, (VkDeviceSize)i * stride, 1, stride);
+        }
+    }
+}
+
+void VulkanEngine::update_lights(const SceneSnapshot& snapshot) {
+    //the vertex shader reads the inverse projection with or without lights
+    if (_clusterGrid.update(snapshot.projection)) {
+        memcpy(_clusterBoundsData, _clusterGrid.bounds().data(), sizeof(GPUClusterBounds) * CLUSTER_COUNT);
+    }
+    *_clusterParams = _clusterGrid.params(_drawExtent.width, _drawExtent.height, _lightCount);
+
+    for (uint32_t i = 0; i < _lightCount; i++) {
+        const PointLight& light = _lights[i];
+        glm::vec4 viewPosition = snapshot.view * glm::vec4(light.position, 1.f);
+        _lightData[i].positionRadius = glm::vec4(glm::vec3(viewPosition), light.radius);
+        _lightData[i].color = glm::vec4(light.color, light.intensity);
+    }
+}
+
+bool VulkanEngine::measure_light_passes(const GPUPointLight* viewLights, uint32_t count, uint32_t frames, LightPassTimings& out) {
+    //without lights at init there is no cull pipeline and the LIGHTING variant is not selected
+    if (_lightCount == 0 || count == 0 || count > _lightCapacity) {
+        return false;
+    }
+    frames = std::max(frames, 1u);
+
+    //update_lights moves the lights into view space every frame, so they go back out through the camera the frames use
+    draw();
+    const glm::mat4 viewToWorld = glm::inverse(_snapshots.read_buffer().view);
+    _lights.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        _lights[i].position = glm::vec3(viewToWorld * glm::vec4(glm::vec3(viewLights[i].positionRadius), 1.f));
+        _lights[i].radius = viewLights[i].positionRadius.w;
+        _lights[i].color = glm::vec3(viewLights[i].color);
+        _lights[i].intensity = viewLights[i].color.w;
+    }
+    _lightCount = count;
+
+    //timestamps describe an earlier frame, the first few were still drawn with the old lights
+    const uint32_t warmupFrames = 3;
+    for (uint32_t i = 0; i < warmupFrames; i++) {
+        draw();
+    }
+
+    out = {};
+    for (uint32_t i = 0; i < frames; i++) {
+        draw();
+        out.cullMs += _lightPassTimings.cullMs;
+        out.mainPassMs += _lightPassTimings.mainPassMs;
+    }
+    out.cullMs /= frames;
+    out.mainPassMs /= frames;
+    return true;
+}
+
+void VulkanEngine::cull_lights(VkCommandBuffer cmd) {
+    vkCmdFillBuffer(cmd, _clusterCountBuffer._buffer, 0, VK_WHOLE_SIZE, 0);
+
+    //last frame's fragments read the lists this pass rewrites
+    VkBufferMemoryBarrier clearBarriers[] = {
+            vkinit::buffer_barrier(_clusterCountBuffer._buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT),
+            vkinit::buffer_barrier(_clusterIndexBuffer._buffer, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT)
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         0, nullptr, 2, clearBarriers, 0, nullptr);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _lightCullPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _lightCullPipelineLayout, 0, 1, &_lightCullDescriptor, 0, nullptr);
+    vkCmdDispatch(cmd, (_lightCount + 63) / 64, 1, 1);
+}
+
+void VulkanEngine::build_render_graph() {
+    _renderGraph.begin();
+
+    //both targets are allocated at window size, the passes render into the _drawExtent corner
+    const RGImageDesc drawDesc = {_drawImageFormat, _windowExtent};
+    const RGImageDesc depthDesc = {_depthFormat, _windowExtent};
+
+    //cleared every frame, the upscale reads it in attachment layout and brings its own barrier
+    RGHandle drawImage = _renderGraph.import_image("draw image", _drawImage._image, _drawImageView, drawDesc, RG_NO_ACCESS);
+    _renderGraph.export_resource(drawImage, RG_COLOR_ATTACHMENT);
+
+    //last frame's pyramid build is done with the depth image, its contents are cleared again
+    RGHandle depth;
+    if (_occlusionCulling) {
+        depth = _renderGraph.import_image("depth", _depthImage._image, _depthImageView, depthDesc, RG_NO_ACCESS);
+
+        //release half of the handoff to the pyramid build, build_depth_pyramid records the acquire
+        const RGAccess pyramidRead = {VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+        if (_computeQueueFamily != _graphicsQueueFamily) {
+            _renderGraph.export_resource(depth, pyramidRead, _graphicsQueueFamily, _computeQueueFamily);
+        } else {
+            _renderGraph.export_resource(depth, pyramidRead);
+        }
+    } else {
+        depth = _renderGraph.create_image("depth", depthDesc);
+    }
+
+    //both compute passes clear their outputs with a fill first
+    const RGAccess computeFill = {VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                  VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED};
+
+    //graphics queues run compute too, keeping the passes here saves a queue handoff before the draws
+    RGHandle meshletDraws = RG_INVALID_HANDLE;
+    RGHandle meshletCount = RG_INVALID_HANDLE;
+    if (_meshletCulling) {
+        meshletDraws = _renderGraph.import_buffer("meshlet draws", _meshletDrawBuffer._buffer, RG_NO_ACCESS);
+        meshletCount = _renderGraph.import_buffer("meshlet count", _meshletCountBuffer._buffer, RG_NO_ACCESS);
+        //read back by get_meshlet_stats
+        _renderGraph.export_resource(meshletCount, RG_HOST_READ);
+
+        _renderGraph.add_pass("meshlet cull", [this](const RGPassContext& context) { cull_meshlets(context.cmd); })
+                .write(meshletDraws, computeFill)
+                .write(meshletCount, computeFill);
+    }
+
+    RGHandle clusterCounts = RG_INVALID_HANDLE;
+    RGHandle clusterIndices = RG_INVALID_HANDLE;
+    if (_lightCount > 0) {
+        clusterCounts = _renderGraph.import_buffer("cluster counts", _clusterCountBuffer._buffer, RG_NO_ACCESS);
+        clusterIndices = _renderGraph.import_buffer("cluster indices", _clusterIndexBuffer._buffer, RG_NO_ACCESS);
+
+        _renderGraph.add_pass("light cull", [this](const RGPassContext& context) {
+            if (_timestampPeriod > 0.f) {
+                vkCmdWriteTimestamp(context.cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, _timestampPool, TIMESTAMP_LIGHT_CULL_BEGIN);
+            }
+            cull_lights(context.cmd);
+            if (_timestampPeriod > 0.f) {
+                vkCmdWriteTimestamp(context.cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _timestampPool, TIMESTAMP_LIGHT_CULL_END);
+            }
+        })
+                .write(clusterCounts, computeFill)
+                .write(clusterIndices, computeFill);
+    }
+
+    if (_depthPrepass) {
+        _renderGraph.add_pass("depth prepass", [this](const RGPassContext& context) {
+            draw_indirect(context.cmd, true);
+            if (_timestampPeriod > 0.f) {
+                vkCmdWriteTimestamp(context.cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _timestampPool, TIMESTAMP_PREPASS_END);
+            }
+        }).depth(depth, 1.f);
+    }
+
+    //make a clear-color from frame number. This will flash with a 120*pi frame period.
+    float flash = abs(sin(_frameNumber/120.f));
+    VkClearColorValue clearColor = {{0.0f, 0.0f, flash, 1.0f}};
+
+    RGPass& mainPass = _renderGraph.add_pass("main", [this](const RGPassContext& context) { draw_main_pass(context); });
+    mainPass.color(drawImage, clearColor);
+    //after a depth prepass the main pass only tests against the stored depth
+    if (_depthPrepass) {
+        mainPass.depth(depth);
+    } else {
+        mainPass.depth(depth, 1.f);
+    }
+    if (_meshletCulling) {
+        mainPass.read(meshletDraws, RG_INDIRECT_READ).read(meshletCount, RG_INDIRECT_READ);
+    }
+    if (_lightCount > 0) {
+        mainPass.read(clusterCounts, RG_FRAGMENT_READ).read(clusterIndices, RG_FRAGMENT_READ);
+    }
+    //same choice as draw_main_pass
+    if (!_meshletCulling && !_depthPrepass && !_occlusionCulling && _parallelRecording && _jobs.thread_count() > 1) {
+        mainPass.secondary_contents();
+    }
+
+    //the exported slot keeps both passes alive, the consumer thread waits on the timeline before reading it
+    if (_readbackBuffer != VK_NULL_HANDLE) {
+        const RGAccess transferRead = {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL};
+        const RGAccess transferWrite = {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL};
+
+        RGHandle readbackImage = _renderGraph.import_image("readback image", _readbackImage._image, VK_NULL_HANDLE,
+                                                           {VK_FORMAT_R8G8B8A8_UNORM, _windowExtent}, RG_NO_ACCESS);
+        RGHandle readbackSlot = _renderGraph.import_buffer("readback slot", _readbackBuffer, RG_NO_ACCESS);
+        _renderGraph.export_resource(readbackSlot, RG_HOST_READ);
+
+        _renderGraph.add_pass("readback convert", [this](const RGPassContext& context) { convert_readback(context.cmd); })
+                .read(drawImage, transferRead)
+                .write(readbackImage, transferWrite);
+        _renderGraph.add_pass("readback copy", [this](const RGPassContext& context) { copy_readback(context.cmd); })
+                .read(readbackImage, transferRead)
+                .write(readbackSlot, transferWrite);
+    }
+}
+
+void VulkanEngine::init_readback() {
+    if (!_readback.init(_device, _allocator, &_gpuMemory, _graphicsTimeline, _windowExtent, _readbackTarget)) {
+        std::cout << "Frame readback to " << _readbackTarget << " disabled" << std::endl;
+        return;
+    }
+
+    VmaAllocationCreateInfo imageAllocInfo = {};
+    imageAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    imageAllocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VkImageCreateInfo imageInfo = vkinit::image_create_info(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                                                            {_windowExtent.width, _windowExtent.height, 1});
+    VK_CHECK(vmaCreateImage(_allocator, &imageInfo, &imageAllocInfo, &_readbackImage._image, &_readbackImage._allocation, nullptr));
+    _gpuMemory.track(_readbackImage._allocation, MemoryCategory::Attachment);
+
+    //cleanup() has the device idle by now, the consumer only writes out what was already submitted
+    _mainDeletionQueue.push_function([=]() {
+        _readback.cleanup();
+
+        ReadbackStats stats = _readback.get_stats();
+        std::cout << "Readback: " << stats.framesWritten << " frames written, " << stats.framesDropped << " dropped, latency avg "
+                  << stats.averageLatencyMs << " ms max " << stats.maxLatencyMs << " ms, " << stats.framesPerSecond << " fps, "
+                  << stats.megabytesPerSecond << " MB/s at " << _windowExtent.width << "x" << _windowExtent.height << std::endl;
+
+        _gpuMemory.untrack(_readbackImage._allocation);
+        vmaDestroyImage(_allocator, _readbackImage._image, _readbackImage._allocation);
+    });
+}
+
+void VulkanEngine::convert_readback(VkCommandBuffer cmd) {
+    //same scaling as the upscale to the swapchain, so the output matches what the window shows
+    VkImageBlit blit = {};
+    blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    blit.srcOffsets[1] = {(int32_t)_drawExtent.width, (int32_t)_drawExtent.height, 1};
+    blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    blit.dstOffsets[1] = {(int32_t)_windowExtent.width, (int32_t)_windowExtent.height, 1};
+
+    vkCmdBlitImage(cmd, _drawImage._image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   _readbackImage._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+}
+
+void VulkanEngine::copy_readback(VkCommandBuffer cmd) {
+    VkBufferImageCopy copy = {};
+    copy.bufferOffset = 0;
+    copy.bufferRowLength = 0;
+    copy.bufferImageHeight = 0;
+    copy.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    copy.imageExtent = {_windowExtent.width, _windowExtent.height, 1};
+
+    vkCmdCopyImageToBuffer(cmd, _readbackImage._image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, _readbackBuffer, 1, &copy);
+}
+
+void VulkanEngine::draw_main_pass(const RGPassContext& context) {
+    VkCommandBuffer cmd = context.cmd;
+
+    if (_meshletCulling) {
+        draw_meshlets(cmd);
+    } else if (_depthPrepass || _occlusionCulling) {
+        //a handful of indirect calls, nothing to spread across threads
+        draw_indirect(cmd, false);
+    } else if (_parallelRecording && _jobs.thread_count() > 1) {
+        auto recordStart = std::chrono::steady_clock::now();
+        if (_cacheCommands) {
+            record_cached();
+        } else {
+            record_parallel(context.framebuffer);
+            _recordingStats.chunks = (uint32_t)_chunkCommands.size();
+            _recordingStats.rerecorded = _recordingStats.chunks;
+        }
+        _recordingStats.recordMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - recordStart).count();
+
+        //a pass that executes secondaries takes no inline draws, the quads get one more secondary
+        if (_impostorCount > 0) {
+            VkCommandBuffer secondary = get_secondary_command_buffer(_recordingContexts[JobSystem::thread_index()]);
+
+            VkCommandBufferInheritanceInfo inheritanceInfo = {};
+            inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+            inheritanceInfo.pNext = nullptr;
+            inheritanceInfo.renderPass = _renderPass;
+            inheritanceInfo.subpass = 0;
+            inheritanceInfo.framebuffer = context.framebuffer;
+
+            VkCommandBufferBeginInfo beginInfo = {};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.pNext = nullptr;
+            beginInfo.pInheritanceInfo = &inheritanceInfo;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+            VK_CHECK(vkBeginCommandBuffer(secondary, &beginInfo));
+            draw_impostors(secondary);
+            VK_CHECK(vkEndCommandBuffer(secondary));
+            _chunkCommands.push_back(secondary);
+        }
+
+        if (!_chunkCommands.empty()) {
+            vkCmdExecuteCommands(cmd, (uint32_t)_chunkCommands.size(), _chunkCommands.data());
+        }
+        return;
+    } else {
+        draw_objects(cmd, _visibleObjects.data(), (int)_visibleObjects.size());
+    }
+
+    draw_impostors(cmd);
+}
+
+VkImageMemoryBarrier VulkanEngine::depth_to_compute_barrier(VkAccessFlags srcAccess, VkAccessFlags dstAccess) const {
+    VkImageMemoryBarrier barrier = vkinit::image_barrier(_depthImage._image, srcAccess, dstAccess,
+                                                         VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                                         VK_IMAGE_ASPECT_DEPTH_BIT);
+    if (_computeQueueFamily != _graphicsQueueFamily) {
+        barrier.srcQueueFamilyIndex = _graphicsQueueFamily;
+        barrier.dstQueueFamilyIndex = _computeQueueFamily;
+    }
+    return barrier;
+}
+
+void VulkanEngine::build_depth_pyramid(VkCommandBuffer cmd, const glm::mat4& viewProj) {
+    //compute is the source stage so this frame's occlusion test is done reading the pyramid before it is overwritten.
+    //the pyramid only ever lives on the compute queue, its first use moves it into general layout
+    VkImageMemoryBarrier pyramidToWrite = vkinit::image_barrier(_depthPyramid._image, 0, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                                                                _depthPyramidValid ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_UNDEFINED,
+                                                                VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    //graphics released the depth image after the main pass, a shared family already did the whole transition there
+    VkImageMemoryBarrier barriers[2] = {pyramidToWrite};
+    uint32_t barrierCount = 1;
+    if (_computeQueueFamily != _graphicsQueueFamily) {
+        barriers[barrierCount++] = depth_to_compute_barrier(0, VK_ACCESS_SHADER_READ_BIT);
+    }
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         0, nullptr, 0, nullptr, barrierCount, barriers);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _reducePipeline);
+
+    //only the rendered corner of the depth image is reduced, the pyramid always spans the whole view
+    uint32_t srcWidth = _drawExtent.width;
+    uint32_t srcHeight = _drawExtent.height;
+    for (uint32_t i = 0; i < _depthPyramidLevels; i++) {
+        uint32_t dstWidth = std::max(_depthPyramidWidth >> i, 1u);
+        uint32_t dstHeight = std::max(_depthPyramidHeight >> i, 1u);
+
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _reducePipelineLayout, 0, 1, &_reduceDescriptors[i], 0, nullptr);
+
+        DepthReduceConstants constants;
+        constants.srcSize = glm::vec2((float)srcWidth, (float)srcHeight);
+        constants.dstSize = glm::vec2((float)dstWidth, (float)dstHeight);
+        vkCmdPushConstants(cmd, _reducePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DepthReduceConstants), &constants);
+
+        vkCmdDispatch(cmd, (dstWidth + 31) / 32, (dstHeight + 31) / 32, 1);
+
+        //the next level reads this one, the last barrier also publishes the pyramid to next frame's cull
+        VkImageMemoryBarrier reduceBarrier = vkinit::image_barrier(_depthPyramid._image, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                                                   VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_ASPECT_COLOR_BIT);
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &reduceBarrier);
+
+        srcWidth = dstWidth;
+        srcHeight = dstHeight;
+    }
+
+    //the depth image is not handed back: next frame's passes start from an undefined layout and discard it,
+    //which needs no ownership transfer. graphics waits on the compute timeline before writing it again
+
+    _depthPyramidViewProj = viewProj;
+    _depthPyramidValid = true;
+}
+
+void VulkanEngine::read_gpu_stats() {
+    //each queue wrote its own range, ranges that were not written last frame are not ready and keep their old values
+    const float toMs = _timestampPeriod / 1000000.f;
+    uint64_t timestamps[TIMESTAMP_COUNT];
+
+    if (_computeTimestamps && _occlusionTestedLastFrame &&
+        vkGetQueryPoolResults(_device, _timestampPool, TIMESTAMP_CULL_BEGIN, 2, sizeof(uint64_t) * 2, &timestamps[TIMESTAMP_CULL_BEGIN],
+                              sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+        _occlusionStats.cullMs = (float)(timestamps[TIMESTAMP_CULL_END] - timestamps[TIMESTAMP_CULL_BEGIN]) * toMs;
+    }
+
+    if (_computeTimestamps && _occlusionCulling &&
+        vkGetQueryPoolResults(_device, _timestampPool, TIMESTAMP_PYRAMID_BEGIN, 2, sizeof(uint64_t) * 2, &timestamps[TIMESTAMP_PYRAMID_BEGIN],
+                              sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+        _occlusionStats.pyramidMs = (float)(timestamps[TIMESTAMP_PYRAMID_END] - timestamps[TIMESTAMP_PYRAMID_BEGIN]) * toMs;
+    }
+
+    //not ready before the first frame was submitted
+    if (_timestampPeriod > 0.f &&
+        vkGetQueryPoolResults(_device, _timestampPool, TIMESTAMP_GRAPHICS_BEGIN, 4, sizeof(uint64_t) * 4, &timestamps[TIMESTAMP_GRAPHICS_BEGIN],
+                              sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+        _occlusionStats.prepassMs = (float)(timestamps[TIMESTAMP_PREPASS_END] - timestamps[TIMESTAMP_GRAPHICS_BEGIN]) * toMs;
+        _occlusionStats.mainPassMs = (float)(timestamps[TIMESTAMP_MAIN_END] - timestamps[TIMESTAMP_PREPASS_END]) * toMs;
+
+        //the light cull runs first in the graph, the main pass starts after it or after the prepass
+        if (_lightCount > 0 &&
+            vkGetQueryPoolResults(_device, _timestampPool, TIMESTAMP_LIGHT_CULL_BEGIN, 2, sizeof(uint64_t) * 2, &timestamps[TIMESTAMP_LIGHT_CULL_BEGIN],
+                                  sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+            const uint64_t mainBegin = std::max(timestamps[TIMESTAMP_PREPASS_END], timestamps[TIMESTAMP_LIGHT_CULL_END]);
+            _lightPassTimings.cullMs = (float)(timestamps[TIMESTAMP_LIGHT_CULL_END] - timestamps[TIMESTAMP_LIGHT_CULL_BEGIN]) * toMs;
+            _lightPassTimings.mainPassMs = (float)(timestamps[TIMESTAMP_MAIN_END] - mainBegin) * toMs;
+        }
+
+        //graphics waits for the occlusion test, the pyramid build overlaps the upscale and is off the critical path
+        _gpuFrameMs = (float)(timestamps[TIMESTAMP_UPSCALE_END] - timestamps[TIMESTAMP_GRAPHICS_BEGIN]) * toMs;
+        if (_occlusionTestedLastFrame) {
+            _gpuFrameMs += _occlusionStats.cullMs;
+        }
+
+        const float drawMs = _occlusionStats.prepassMs + _occlusionStats.mainPassMs;
+        if (_baselineLastFrame) {
+            _occlusionStats.drawWithoutOcclusionMs = drawMs;
+        } else if (_occlusionTestedLastFrame && _occlusionStats.drawWithoutOcclusionMs > 0.f) {
+            _occlusionStats.savedMs = _occlusionStats.drawWithoutOcclusionMs - drawMs - _occlusionStats.cullMs;
+        }
+    }
+
+    //baseline frames keep the counts of the last tested frame
+    if (_occlusionTestedLastFrame) {
+        vmaInvalidateAllocation(_allocator, _cullStatsBuffer._allocation, 0, VK_WHOLE_SIZE);
+        _occlusionStats.objectsTested = _cullStats[0];
+        _occlusionStats.objectsOccluded = _cullStats[1];
+    }
+
+    if (_meshletsCulledLastFrame) {
+        vmaInvalidateAllocation(_allocator, _meshletCountBuffer._allocation, 0, VK_WHOLE_SIZE);
+        _meshletStats.meshletsTested = _meshletCounts[1];
+        _meshletStats.culledByFrustum = _meshletCounts[2];
+        _meshletStats.culledByBackface = _meshletCounts[3];
+        _meshletStats.trianglesSubmitted = _meshletCounts[4];
+
+        if (_logMeshletStats && _frameNumber % 240 == 0) {
+            std::cout << "Meshlets: " << _meshletStats.meshletsTested << " tested, " << _meshletStats.culledByFrustum
+                      << " frustum culled, " << _meshletStats.culledByBackface << " backface culled, "
+                      << _meshletStats.trianglesSubmitted << " triangles submitted" << std::endl;
+        }
+    }
+
+    //once per baseline interval, right after a fresh baseline was measured
+    if (_baselineLastFrame) {
+        std::cout << "Occlusion: " << _occlusionStats.objectsOccluded << "/" << _occlusionStats.objectsTested
+                  << " objects occluded, cull " << _occlusionStats.cullMs << " ms, prepass " << _occlusionStats.prepassMs
+                  << " ms, main " << _occlusionStats.mainPassMs << " ms, pyramid " << _occlusionStats.pyramidMs
+                  << " ms, saved " << _occlusionStats.savedMs << " ms" << std::endl;
+    }
+}
+
+VkCommandBuffer VulkanEngine::get_secondary_command_buffer(RecordingContext& context) {
+    if (context._used == context._commandBuffers.size()) {
+        //grow in batches, the pool is reset every frame but the buffers are kept
+        const uint32_t batch = 8;
+        VkCommandBufferAllocateInfo allocInfo =
+                vkinit::command_buffer_allocate_info(context._commandPool, batch, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+
+        size_t first = context._commandBuffers.size();
+        context._commandBuffers.resize(first + batch);
+        VK_CHECK(vkAllocateCommandBuffers(_device, &allocInfo, &context._commandBuffers[first]));
+    }
+    return context._commandBuffers[context._used++];
+}
+
+void VulkanEngine::record_parallel(VkFramebuffer framebuffer) {
+    const uint32_t count = (uint32_t)_visibleObjects.size();
+    const uint32_t chunkCount = (count + _recordChunkSize - 1) / _recordChunkSize;
+    _chunkCommands.resize(chunkCount);
+
+    _jobs.parallel_for(count, _recordChunkSize, [&](uint32_t begin, uint32_t end) {
+        RecordingContext& context = _recordingContexts[JobSystem::thread_index()];
+        VkCommandBuffer secondary = get_secondary_command_buffer(context);
+
+        VkCommandBufferInheritanceInfo inheritanceInfo = {};
+        inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritanceInfo.pNext = nullptr;
+        inheritanceInfo.renderPass = _renderPass;
+        inheritanceInfo.subpass = 0;
+        inheritanceInfo.framebuffer = framebuffer;
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.pNext = nullptr;
+        beginInfo.pInheritanceInfo = &inheritanceInfo;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        VK_CHECK(vkBeginCommandBuffer(secondary, &beginInfo));
+        draw_objects(secondary, _visibleObjects.data() + begin, end - begin);
+        VK_CHECK(vkEndCommandBuffer(secondary));
+
+        //chunks are executed in list order no matter which thread recorded them
+        _chunkCommands[begin / _recordChunkSize] = secondary;
+    });
+}
+
+uint64_t VulkanEngine::draw_state_hash() const {
+    uint64_t hash = 14695981039346656037ull;
+    hash = hash_value(hash, _drawExtent);
+    hash = hash_value(hash, _geometryPool._vertexBuffer._buffer);
+    hash = hash_value(hash, _geometryPool._indexBuffer._buffer);
+    hash = hash_value(hash, _objectDescriptor);
+    hash = hash_value(hash, _bindless);
+    if (_bindless) {
+        hash = hash_value(hash, _bindlessPipeline);
+        hash = hash_value(hash, _bindlessHeap._set);
+        hash = hash_value(hash, _objectBufferIndex);
+        hash = hash_value(hash, _materialBufferIndex);
+    }
+    return hash;
+}
+
+void VulkanEngine::record_cached() {
+    //chunks are fixed slices of the object index space instead of the visible list, so an object
+    //coming into view only changes the chunk it falls in and not every chunk after it
+    const uint32_t objectCount = (uint32_t)_renderables.size();
+    const uint32_t chunkCount = (objectCount + _recordChunkSize - 1) / _recordChunkSize;
+    //the previous frame is done, pools of chunks that are gone can go right away
+    while (_cachedChunks.size() > chunkCount) {
+        vkDestroyCommandPool(_device, _cachedChunks.back()._commandPool, _hostCallbacks);
+        _cachedChunks.pop_back();
+    }
+    while (_cachedChunks.size() < chunkCount) {
+        CachedChunk chunk;
+        VkCommandPoolCreateInfo poolInfo = vkinit::command_pool_create_info(_graphicsQueueFamily);
+        VK_CHECK(vkCreateCommandPool(_device, &poolInfo, _hostCallbacks, &chunk._commandPool));
+
+        VkCommandBufferAllocateInfo allocInfo =
+                vkinit::command_buffer_allocate_info(chunk._commandPool, 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+        VK_CHECK(vkAllocateCommandBuffers(_device, &allocInfo, &chunk._commandBuffer));
+        _cachedChunks.push_back(chunk);
+    }
+
+    //_visibleObjects is sorted, every chunk gets one contiguous run of it
+    uint32_t visible = 0;
+    for (uint32_t i = 0; i < chunkCount; i++) {
+        CachedChunk& chunk = _cachedChunks[i];
+        const uint32_t end = (i + 1) * _recordChunkSize;
+        chunk._first = visible;
+        while (visible < _visibleObjects.size() && _visibleObjects[visible] < end) {
+            visible++;
+        }
+        chunk._count = visible - chunk._first;
+        chunk._rerecorded = false;
+    }
+
+    const uint64_t stateHash = draw_state_hash();
+    _jobs.parallel_for(chunkCount, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            CachedChunk& chunk = _cachedChunks[i];
+            if (chunk._count == 0) {
+                continue;
+            }
+
+            //everything the draws of the chunk are recorded from. pipelines of mesh variants are only
+            //destroyed at cleanup, so a handle seen here can not come back for a different pipeline
+            const uint32_t* objects = _visibleObjects.data() + chunk._first;
+            uint64_t hash = hash_value(stateHash, chunk._count);
+            hash = hash_bytes(hash, objects, chunk._count * sizeof(uint32_t));
+            for (uint32_t j = 0; j < chunk._count; j++) {
+                const RenderObject& object = _renderables[objects[j]];
+                const Material* material = _materials.get(object.material);
+                hash = hash_value(hash, material->pipeline);
+                hash = hash_value(hash, material->pipelineLayout);
+                //only what the draw reads, the allocation handles and padding of MeshRange stay out of the key
+                const MeshRange& range = _meshes.get(object.mesh)->_range;
+                hash = hash_value(hash, range.firstVertex);
+                hash = hash_value(hash, range.firstIndex);
+                hash = hash_value(hash, range.indexCount);
+            }
+            if (hash == chunk._hash) {
+                continue;
+            }
+
+            VkCommandBufferInheritanceInfo inheritanceInfo = {};
+            inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+            inheritanceInfo.pNext = nullptr;
+            inheritanceInfo.renderPass = _renderPass;
+            inheritanceInfo.subpass = 0;
+            inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+
+            //submitted again every frame, and never while still pending since draw() waits for the last frame
+            VkCommandBufferBeginInfo beginInfo = {};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.pNext = nullptr;
+            beginInfo.pInheritanceInfo = &inheritanceInfo;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+
+            VK_CHECK(vkResetCommandPool(_device, chunk._commandPool, 0));
+            VK_CHECK(vkBeginCommandBuffer(chunk._commandBuffer, &beginInfo));
+            draw_objects(chunk._commandBuffer, objects, (int)chunk._count);
+            VK_CHECK(vkEndCommandBuffer(chunk._commandBuffer));
+
+            chunk._hash = hash;
+            chunk._rerecorded = true;
+        }
+    });
+
+    _chunkCommands.clear();
+    _recordingStats.rerecorded = 0;
+    for (const CachedChunk& chunk : _cachedChunks) {
+        if (chunk._count > 0) {
+            _chunkCommands.push_back(chunk._commandBuffer);
+            _recordingStats.rerecorded += chunk._rerecorded ? 1 : 0;
+        }
+    }
+    _recordingStats.chunks = (uint32_t)_chunkCommands.size();
+}
+
+void VulkanEngine::init_impostors() {
+    //every direction of a mesh side by side, one row per mesh
+    const uint32_t tileSize = std::min(_impostorTileSize, _maxImageDimension / IMPOSTOR_VIEWS);
+    const uint32_t maxKeys = tileSize > 0 ? std::min(_maxImpostorMeshes, _maxImageDimension / tileSize) : 0;
+
+    //streamed chunks are still empty here and never get a row
+    for (const RenderObject& object : _renderables) {
+        if (_impostorKeys.size() == maxKeys) {
+            break;
+        }
+        const Mesh* mesh = _meshes.get(object.mesh);
+        if (!mesh || mesh->_range.indexCount == 0) {
+            continue;
+        }
+        if (object.mesh.index >= _impostorRows.size()) {
+            _impostorRows.resize(object.mesh.index + 1, UINT32_MAX);
+        }
+        if (_impostorRows[object.mesh.index] == UINT32_MAX) {
+            _impostorRows[object.mesh.index] = (uint32_t)_impostorKeys.size();
+            _impostorKeys.emplace_back(object.mesh, object.material);
+        }
+    }
+    if (_impostorKeys.empty()) {
+        std::cout << "Impostors: no mesh to bake, disabled" << std::endl;
+        return;
+    }
+
+    const VkExtent2D tile = {tileSize, tileSize};
+    _impostorTile = tile;
+    const VkExtent3D atlasExtent = {tileSize * IMPOSTOR_VIEWS, tileSize * (uint32_t)_impostorKeys.size(), 1};
+
+    //the draw format, so the material pipelines render into it as they are
+    VmaAllocationCreateInfo imageAllocInfo = {};
+    imageAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    imageAllocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VkImageCreateInfo atlasInfo = vkinit::image_create_info(_drawImageFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                                                            atlasExtent);
+    VK_CHECK(vmaCreateImage(_allocator, &atlasInfo, &imageAllocInfo, &_impostorAtlas._image, &_impostorAtlas._allocation, nullptr));
+    _gpuMemory.track(_impostorAtlas._allocation, MemoryCategory::Texture);
+
+    VkImageViewCreateInfo atlasViewInfo = vkinit::imageview_create_info(_drawImageFormat, _impostorAtlas._image, VK_IMAGE_ASPECT_COLOR_BIT);
+    VK_CHECK(vkCreateImageView(_device, &atlasViewInfo, _hostCallbacks, &_impostorAtlasView));
+
+    //the bake uses whatever the default material points at, the requested variant if it is compiled by now.
+    //otherwise the fallback, and the atlas is baked again once the variant is ready
+    select_mesh_variant();
+    bake_impostors(tile);
+
+    //tiles are surrounded by empty texels, the sphere they are fit to is wider than any silhouette
+    VkSamplerCreateInfo samplerInfo = vkinit::sampler_create_info(VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+    VK_CHECK(vkCreateSampler(_device, &samplerInfo, _hostCallbacks, &_impostorSampler));
+
+    _impostorBuffer = create_buffer(sizeof(GPUImpostorInstance) * _maxObjects, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                    VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Frame);
+    vmaMapMemory(_allocator, _impostorBuffer._allocation, (void**)&_impostorData);
+
+    //quads, then the atlas they sample
+    VkDescriptorSetLayoutBinding impostorBindings[] = {
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0),
+            vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1)
+    };
+
+    VkDescriptorSetLayoutCreateInfo setInfo = {};
+    setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setInfo.pNext = nullptr;
+    setInfo.flags = 0;
+    setInfo.bindingCount = 2;
+    setInfo.pBindings = impostorBindings;
+    VK_CHECK(vkCreateDescriptorSetLayout(_device, &setInfo, _hostCallbacks, &_impostorSetLayout));
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.pNext = nullptr;
+    allocInfo.descriptorPool = _descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &_impostorSetLayout;
+    VK_CHECK(vkAllocateDescriptorSets(_device, &allocInfo, &_impostorDescriptor));
+
+    VkDescriptorBufferInfo instanceInfo = {_impostorBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorImageInfo atlasImageInfo = {_impostorSampler, _impostorAtlasView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+
+    VkWriteDescriptorSet writes[] = {
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _impostorDescriptor, &instanceInfo, 0),
+            vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _impostorDescriptor, &atlasImageInfo, 1)
+    };
+    vkUpdateDescriptorSets(_device, 2, writes, 0, nullptr);
+
+    VkShaderModule impostorVertShader;
+    if (!load_shader_module("../shaders/impostor.vert.spv", &impostorVertShader)) {
+        std::cout << "Error when building the impostor vertex shader module" << std::endl;
+    }
+    VkShaderModule impostorFragShader;
+    if (!load_shader_module("../shaders/impostor.frag.spv", &impostorFragShader)) {
+        std::cout << "Error when building the impostor fragment shader module" << std::endl;
+    }
+
+    VkPushConstantRange pushConstants = {};
+    pushConstants.offset = 0;
+    pushConstants.size = sizeof(ImpostorPushConstants);
+    pushConstants.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipeline_layout_create_info();
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &_impostorSetLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushConstants;
+    VK_CHECK(vkCreatePipelineLayout(_device, &layoutInfo, _hostCallbacks, &_impostorPipelineLayout));
+
+    //the corners come from gl_VertexIndex, there is no vertex input. alpha tested like the mesh, no blending
+    PipelineBuilder builder;
+    builder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, impostorVertShader));
+    builder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, impostorFragShader));
+    builder._vertexInputInfo = vkinit::vertex_input_state_create_info();
+    builder._inputAssembly = vkinit::input_assembly_create_info(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    builder._rasterizer = vkinit::rasterization_state_create_info(VK_POLYGON_MODE_FILL);
+    builder._multisampling = vkinit::multisampling_state_create_info();
+    builder._colorBlendAttachment = vkinit::color_blend_attachment_state();
+    builder._depthStencil = vkinit::depth_stencil_create_info(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
+    builder._pipelineLayout = _impostorPipelineLayout;
+
+    _impostorPipeline = builder.build_pipeline(_device, _renderPass);
+
+    vkDestroyShaderModule(_device, impostorVertShader, _hostCallbacks);
+    vkDestroyShaderModule(_device, impostorFragShader, _hostCallbacks);
+
+    _mainDeletionQueue.push_function([=]() {
+        vkDestroyPipeline(_device, _impostorPipeline, _hostCallbacks);
+        vkDestroyPipelineLayout(_device, _impostorPipelineLayout, _hostCallbacks);
+        vkDestroyDescriptorSetLayout(_device, _impostorSetLayout, _hostCallbacks);
+        vmaUnmapMemory(_allocator, _impostorBuffer._allocation);
+        destroy_buffer(_impostorBuffer);
+        vkDestroySampler(_device, _impostorSampler, _hostCallbacks);
+        vkDestroyImageView(_device, _impostorAtlasView, _hostCallbacks);
+        _gpuMemory.untrack(_impostorAtlas._allocation);
+        vmaDestroyImage(_allocator, _impostorAtlas._image, _impostorAtlas._allocation);
+    });
+
+    std::cout << "Impostors: " << _impostorKeys.size() << " meshes baked from " << IMPOSTOR_VIEWS << " directions into a "
+              << atlasExtent.width << "x" << atlasExtent.height << " atlas, switching under " << _impostorPixels << " pixels" << std::endl;
+}
+
+void VulkanEngine::bake_impostors(VkExtent2D tile) {
+    const uint32_t keyCount = (uint32_t)_impostorKeys.size();
+    const VkExtent2D atlasExtent = {tile.width * IMPOSTOR_VIEWS, tile.height * keyCount};
+
+    //compatible with _renderPass so the material pipelines can be used, the atlas ends up ready to sample
+    VkAttachmentDescription attachments[2] = {};
+    attachments[0].format = _drawImageFormat;
+    attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[0].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    attachments[1].format = _depthFormat;
+    attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference colorRef = {0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+    VkAttachmentReference depthRef = {1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorRef;
+    subpass.pDepthStencilAttachment = &depthRef;
+
+    //the main pass samples the atlas in later submissions on the same queue
+    VkSubpassDependency dependency = {};
+    dependency.srcSubpass = 0;
+    dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    dependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    VkRenderPassCreateInfo passInfo = {};
+    passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    passInfo.attachmentCount = 2;
+    passInfo.pAttachments = attachments;
+    passInfo.subpassCount = 1;
+    passInfo.pSubpasses = &subpass;
+    passInfo.dependencyCount = 1;
+    passInfo.pDependencies = &dependency;
+
+    VkRenderPass renderPass;
+    VK_CHECK(vkCreateRenderPass(_device, &passInfo, _hostCallbacks, &renderPass));
+
+    VmaAllocationCreateInfo imageAllocInfo = {};
+    imageAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    imageAllocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    AllocatedImage depthImage;
+    VkImageCreateInfo depthInfo = vkinit::image_create_info(_depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+                                                            {atlasExtent.width, atlasExtent.height, 1});
+    VK_CHECK(vmaCreateImage(_allocator, &depthInfo, &imageAllocInfo, &depthImage._image, &depthImage._allocation, nullptr));
+
+    VkImageView depthView;
+    VkImageViewCreateInfo depthViewInfo = vkinit::imageview_create_info(_depthFormat, depthImage._image, VK_IMAGE_ASPECT_DEPTH_BIT);
+    VK_CHECK(vkCreateImageView(_device, &depthViewInfo, _hostCallbacks, &depthView));
+
+    VkImageView framebufferViews[2] = {_impostorAtlasView, depthView};
+
+    VkFramebufferCreateInfo framebufferInfo = {};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.pNext = nullptr;
+    framebufferInfo.renderPass = renderPass;
+    framebufferInfo.attachmentCount = 2;
+    framebufferInfo.pAttachments = framebufferViews;
+    framebufferInfo.width = atlasExtent.width;
+    framebufferInfo.height = atlasExtent.height;
+    framebufferInfo.layers = 1;
+
+    VkFramebuffer framebuffer;
+    VK_CHECK(vkCreateFramebuffer(_device, &framebufferInfo, _hostCallbacks, &framebuffer));
+
+    //one object entry per view of every mesh, the meshes stay in object space
+    const uint32_t entryCount = keyCount * IMPOSTOR_VIEWS;
+    AllocatedBuffer objectBuffer = create_buffer(sizeof(GPUObjectData) * entryCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                 VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Staging);
+    GPUObjectData* objectData;
+    vmaMapMemory(_allocator, objectBuffer._allocation, (void**)&objectData);
+    for (uint32_t row = 0; row < keyCount; row++) {
+        const MeshBounds& bounds = _meshes.get(_impostorKeys[row].first)->_bounds;
+        for (uint32_t view = 0; view < IMPOSTOR_VIEWS; view++) {
+            GPUObjectData& entry = objectData[row * IMPOSTOR_VIEWS + view];
+            entry.renderMatrix = impostor_view_projection(bounds, view);
+            entry.sphereBounds = glm::vec4(bounds.origin, bounds.radius);
+            entry.materialIndex = _impostorKeys[row].second.index;
+            entry.fade = 1.f;
+        }
+    }
+    vmaUnmapMemory(_allocator, objectBuffer._allocation);
+
+    //no lights, the LIGHTING variant then only applies its fixed object space light, which does not depend on the view
+    AllocatedBuffer paramsBuffer = create_buffer(sizeof(GPUClusterParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                                                 VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Staging);
+    void* params;
+    vmaMapMemory(_allocator, paramsBuffer._allocation, &params);
+    memset(params, 0, sizeof(GPUClusterParams));
+    vmaUnmapMemory(_allocator, paramsBuffer._allocation);
+
+    VkDescriptorPoolSize sizes[] = {
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4},
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1}
+    };
 
-        vkCmdPushConstants(cmd,object.material->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,0,sizeof(MeshPushConstants),&constants);
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.pNext = nullptr;
+    poolInfo.flags = 0;
+    poolInfo.maxSets = 1;
+    poolInfo.poolSizeCount = 2;
+    poolInfo.pPoolSizes = sizes;
+
+    VkDescriptorPool descriptorPool;
+    VK_CHECK(vkCreateDescriptorPool(_device, &poolInfo, _hostCallbacks, &descriptorPool));
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.pNext = nullptr;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &_objectSetLayout;
+
+    VkDescriptorSet descriptor;
+    VK_CHECK(vkAllocateDescriptorSets(_device, &allocInfo, &descriptor));
+
+    //the light lists are bound only because the layout has them, no light is ever counted
+    VkDescriptorBufferInfo objectInfo = {objectBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo paramsInfo = {paramsBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo lightInfo = {_lightBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo clusterCountInfo = {_clusterCountBuffer._buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo clusterIndexInfo = {_clusterIndexBuffer._buffer, 0, VK_WHOLE_SIZE};
+
+    VkWriteDescriptorSet writes[] = {
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, descriptor, &objectInfo, 0),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, descriptor, &paramsInfo, 1),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, descriptor, &lightInfo, 2),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, descriptor, &clusterCountInfo, 3),
+            vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, descriptor, &clusterIndexInfo, 4)
+    };
+    vkUpdateDescriptorSets(_device, 5, writes, 0, nullptr);
+
+    VkCommandBuffer cmd = _uploadContext._commandBuffer;
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.pNext = nullptr;
+    beginInfo.pInheritanceInfo = nullptr;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+
+    //the meshes may still be on their way on the transfer queue
+    SubmitSync sync;
+    acquire_uploads(cmd, sync);
+
+    //alpha 0 everywhere the mesh is not, the impostor shader tests against it
+    VkClearValue clearValues[2];
+    clearValues[0].color = {{0.0f, 0.0f, 0.0f, 0.0f}};
+    clearValues[1].depthStencil.depth = 1.f;
+
+    VkRenderPassBeginInfo renderPassInfo = vkinit::renderpass_begin_info(renderPass, atlasExtent, framebuffer);
+    renderPassInfo.clearValueCount = 2;
+    renderPassInfo.pClearValues = clearValues;
+    vkCmdBeginRenderPass(cmd, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(cmd, 0, 1, &_geometryPool._vertexBuffer._buffer, &offset);
+    vkCmdBindIndexBuffer(cmd, _geometryPool._indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+
+    _impostorBakedPipelines.resize(keyCount);
+    for (uint32_t row = 0; row < keyCount; row++) {
+        const Material* material = _materials.get(_impostorKeys[row].second);
+        _impostorBakedPipelines[row] = material->pipeline;
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipelineLayout, 0, 1, &descriptor, 0, nullptr);
+
+        const MeshRange& range = _meshes.get(_impostorKeys[row].first)->_range;
+        for (uint32_t view = 0; view < IMPOSTOR_VIEWS; view++) {
+            VkViewport viewport = {};
+            viewport.x = (float)(view * tile.width);
+            viewport.y = (float)(row * tile.height);
+            viewport.width = (float)tile.width;
+            viewport.height = (float)tile.height;
+            viewport.minDepth = 0.f;
+            viewport.maxDepth = 1.f;
+
+            VkRect2D scissor = {};
+            scissor.offset = {(int32_t)viewport.x, (int32_t)viewport.y};
+            scissor.extent = tile;
+
+            vkCmdSetViewport(cmd, 0, 1, &viewport);
+            vkCmdSetScissor(cmd, 0, 1, &scissor);
+            vkCmdDrawIndexed(cmd, range.indexCount, 1, range.firstIndex, (int32_t)range.firstVertex, row * IMPOSTOR_VIEWS + view);
+        }
+    }
 
-        if(object.mesh != lastMesh) {
-            VkDeviceSize offset = 0;
-            vkCmdBindVertexBuffers(cmd, 0, 1, &object.mesh->_vertexBuffer._buffer, &offset);
-            lastMesh = object.mesh;
+    vkCmdEndRenderPass(cmd);
+    VK_CHECK(vkEndCommandBuffer(cmd));
+
+    //on the graphics timeline, so the first frame's wait covers it too
+    sync.signal(_graphicsTimeline, ++_graphicsTimelineValue);
+    submit(_graphicsQueue, cmd, sync);
+
+    VkSemaphoreWaitInfo waitInfo = {};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.pNext = nullptr;
+    waitInfo.flags = 0;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &_graphicsTimeline;
+    waitInfo.pValues = &_graphicsTimelineValue;
+    VK_CHECK(vkWaitSemaphores(_device, &waitInfo, UINT64_MAX));
+    VK_CHECK(vkResetCommandPool(_device, _uploadContext._commandPool, 0));
+
+    vkDestroyDescriptorPool(_device, descriptorPool, _hostCallbacks);
+    destroy_buffer(paramsBuffer);
+    destroy_buffer(objectBuffer);
+    vkDestroyFramebuffer(_device, framebuffer, _hostCallbacks);
+    vkDestroyImageView(_device, depthView, _hostCallbacks);
+    vmaDestroyImage(_allocator, depthImage._image, depthImage._allocation);
+    vkDestroyRenderPass(_device, renderPass, _hostCallbacks);
+}
+
+bool VulkanEngine::impostors_stale() const {
+    for (uint32_t row = 0; row < (uint32_t)_impostorKeys.size(); row++) {
+        const Material* material = _materials.get(_impostorKeys[row].second);
+        if (material && material->pipeline != _impostorBakedPipelines[row]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void VulkanEngine::select_impostors(const SceneSnapshot& snapshot) {
+    _impostorStats = {};
+    const uint32_t visibleCount = (uint32_t)_visibleObjects.size();
+    _impostorCandidates.resize(visibleCount);
+
+    const glm::vec3 cameraPosition = glm::vec3(glm::inverse(snapshot.view)[3]);
+    //projected diameter in pixels is sizeScale * radius / distance. window pixels, so the switch does not
+    //move with the render scale
+    const float sizeScale = fabsf(snapshot.projection[1][1]) * (float)_windowExtent.height;
+    //the prepass writes the whole mesh into depth, its dithered holes would show the clear color, so the switch is hard
+    const float fadeRange = _depthPrepass ? 0.f : _impostorFadeRange;
+    const float fadeEnd = _impostorPixels * (1.f + fadeRange);
+
+    _jobs.parallel_for(visibleCount, 1024, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            const uint32_t object = _visibleObjects[i];
+            const RenderObject& renderable = _renderables[object];
+            GPUImpostorInstance& candidate = _impostorCandidates[i];
+            candidate.tile = UINT32_MAX;
+
+            const uint32_t row = renderable.mesh.index < _impostorRows.size() ? _impostorRows[renderable.mesh.index] : UINT32_MAX;
+            if (row == UINT32_MAX || _impostorKeys[row].first != renderable.mesh || _impostorKeys[row].second != renderable.material) {
+                continue;
+            }
+
+            const glm::vec4& sphere = _objectSpheres[object];
+            const glm::vec3 toCamera = cameraPosition - glm::vec3(sphere);
+            const float distance = glm::length(toCamera);
+            if (distance <= sphere.w) {
+                continue;
+            }
+            const float size = sizeScale * sphere.w / distance;
+            if (size >= fadeEnd) {
+                continue;
+            }
+
+            //into object space to pick the baked view, the transpose undoes the rotation for uniform scale like
+            //the culling bounds assume, the scale goes with the normalize
+            const glm::vec3 direction = glm::transpose(glm::mat3(snapshot.transforms[object])) * toCamera;
+
+            candidate.sphere = sphere;
+            candidate.tile = row * IMPOSTOR_VIEWS + closest_impostor_view(direction);
+            candidate.fade = fadeEnd > _impostorPixels ? glm::clamp((size - _impostorPixels) / (fadeEnd - _impostorPixels), 0.f, 1.f) : 0.f;
+        }
+    });
+
+    //compacts _visibleObjects in place, the order of the meshes that stay is kept
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < visibleCount; i++) {
+        const uint32_t object = _visibleObjects[i];
+        const GPUImpostorInstance& candidate = _impostorCandidates[i];
+        const uint64_t vertices = _meshes.get(_renderables[object].mesh)->_range.indexCount;
+        _impostorStats.verticesWithoutImpostors += vertices;
+
+        if (candidate.tile == UINT32_MAX) {
+            _visibleObjects[kept++] = object;
+            _impostorStats.meshObjects++;
+            _impostorStats.verticesSubmitted += vertices;
+            continue;
+        }
+
+        _impostorData[_impostorCount++] = candidate;
+        _impostorStats.verticesSubmitted += 6;
+        if (candidate.fade > 0.f) {
+            _objectData[object].fade = candidate.fade;
+            _visibleObjects[kept++] = object;
+            _impostorStats.crossFading++;
+            _impostorStats.verticesSubmitted += vertices;
+        }
+    }
+    _visibleObjects.resize(kept);
+    _impostorStats.impostors = _impostorCount;
+
+    //the rows of the view matrix are the camera axes in world space
+    const glm::mat4& view = snapshot.view;
+    _impostorConstants.viewProj = snapshot.projection * view;
+    _impostorConstants.right = glm::vec4(view[0][0], view[1][0], view[2][0], (float)IMPOSTOR_VIEWS);
+    _impostorConstants.up = glm::vec4(view[0][1], view[1][1], view[2][1], (float)_impostorKeys.size());
+}
+
+void VulkanEngine::draw_impostors(VkCommandBuffer cmd) {
+    if (_impostorCount == 0) {
+        return;
+    }
+    set_draw_viewport(cmd);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _impostorPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _impostorPipelineLayout, 0, 1, &_impostorDescriptor, 0, nullptr);
+    vkCmdPushConstants(cmd, _impostorPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ImpostorPushConstants), &_impostorConstants);
+
+    //every quad in one draw, the instance index picks its entry
+    vkCmdDraw(cmd, 6, _impostorCount, 0, 0);
+}
+
+void VulkanEngine::prepare_offscreen(VkExtent2D tile, uint32_t columns, uint32_t rows) {
+    if (_offscreenRenderPass == VK_NULL_HANDLE) {
+        //same formats as _renderPass so the material pipelines can be used, but the atlas ends up ready for the blit
+        //and depth is never kept
+        VkAttachmentDescription attachments[2] = {};
+        attachments[0].format = _drawImageFormat;
+        attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        attachments[0].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+        attachments[1].format = _depthFormat;
+        attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference colorRef = {0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+        VkAttachmentReference depthRef = {1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+
+        VkSubpassDescription subpass = {};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments = &colorRef;
+        subpass.pDepthStencilAttachment = &depthRef;
+
+        //the previous batch in the same targets was read back before this one is recorded, only the
+        //attachment writes and the blit after the pass need ordering
+        VkSubpassDependency dependencies[2] = {};
+        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[0].dstSubpass = 0;
+        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependencies[0].srcAccessMask = 0;
+        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+        dependencies[1].srcSubpass = 0;
+        dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        VkRenderPassCreateInfo passInfo = {};
+        passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        passInfo.attachmentCount = 2;
+        passInfo.pAttachments = attachments;
+        passInfo.subpassCount = 1;
+        passInfo.pSubpasses = &subpass;
+        passInfo.dependencyCount = 2;
+        passInfo.pDependencies = dependencies;
+
+        VK_CHECK(vkCreateRenderPass(_device, &passInfo, _hostCallbacks, &_offscreenRenderPass));
+
+        VkDescriptorPoolSize sizes[] = {
+                {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 8},
+                {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2}
+        };
+
+        VkDescriptorPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.pNext = nullptr;
+        poolInfo.flags = 0;
+        poolInfo.maxSets = 2;
+        poolInfo.poolSizeCount = 2;
+        poolInfo.pPoolSizes = sizes;
+
+        VK_CHECK(vkCreateDescriptorPool(_device, &poolInfo, _hostCallbacks, &_offscreenDescriptorPool));
+
+        _offscreenParamsBuffer = create_buffer(sizeof(GPUClusterParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                                               VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Frame);
+        void* params;
+        vmaMapMemory(_allocator, _offscreenParamsBuffer._allocation, &params);
+        memset(params, 0, sizeof(GPUClusterParams));
+        vmaUnmapMemory(_allocator, _offscreenParamsBuffer._allocation);
+
+        for (OffscreenBatch& batch : _offscreenBatches) {
+            batch._objectBuffer = create_buffer(sizeof(GPUObjectData) * _offscreenObjectCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Frame);
+            vmaMapMemory(_allocator, batch._objectBuffer._allocation, (void**)&batch._objectData);
+
+            VkDescriptorSetAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            allocInfo.pNext = nullptr;
+            allocInfo.descriptorPool = _offscreenDescriptorPool;
+            allocInfo.descriptorSetCount = 1;
+            allocInfo.pSetLayouts = &_objectSetLayout;
+
+            VK_CHECK(vkAllocateDescriptorSets(_device, &allocInfo, &batch._descriptor));
+
+            //the light lists are bound only because the layout has them, no light is ever counted
+            VkDescriptorBufferInfo objectInfo = {batch._objectBuffer._buffer, 0, VK_WHOLE_SIZE};
+            VkDescriptorBufferInfo paramsInfo = {_offscreenParamsBuffer._buffer, 0, VK_WHOLE_SIZE};
+            VkDescriptorBufferInfo lightInfo = {_lightBuffer._buffer, 0, VK_WHOLE_SIZE};
+            VkDescriptorBufferInfo clusterCountInfo = {_clusterCountBuffer._buffer, 0, VK_WHOLE_SIZE};
+            VkDescriptorBufferInfo clusterIndexInfo = {_clusterIndexBuffer._buffer, 0, VK_WHOLE_SIZE};
+
+            VkWriteDescriptorSet writes[] = {
+                    vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, batch._descriptor, &objectInfo, 0),
+                    vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, batch._descriptor, &paramsInfo, 1),
+                    vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, batch._descriptor, &lightInfo, 2),
+                    vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, batch._descriptor, &clusterCountInfo, 3),
+                    vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, batch._descriptor, &clusterIndexInfo, 4)
+            };
+            vkUpdateDescriptorSets(_device, 5, writes, 0, nullptr);
+
+            VkCommandPoolCreateInfo poolCreateInfo = vkinit::command_pool_create_info(_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+            VK_CHECK(vkCreateCommandPool(_device, &poolCreateInfo, _hostCallbacks, &batch._commandPool));
+
+            VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(batch._commandPool, 1);
+            VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &batch._commandBuffer));
+        }
+
+        //cleanup() waits for the device before the queue is flushed, nothing is in flight by then
+        _mainDeletionQueue.push_function([=]() {
+            destroy_offscreen_targets();
+            for (OffscreenBatch& batch : _offscreenBatches) {
+                vmaUnmapMemory(_allocator, batch._objectBuffer._allocation);
+                destroy_buffer(batch._objectBuffer);
+                vkDestroyCommandPool(_device, batch._commandPool, _hostCallbacks);
+            }
+            destroy_buffer(_offscreenParamsBuffer);
+            vkDestroyDescriptorPool(_device, _offscreenDescriptorPool, _hostCallbacks);
+            vkDestroyRenderPass(_device, _offscreenRenderPass, _hostCallbacks);
+        });
+    }
+
+    if (_offscreenTile.width == tile.width && _offscreenTile.height == tile.height && _offscreenColumns == columns && _offscreenRows == rows) {
+        return;
+    }
+    destroy_offscreen_targets();
+    _offscreenTile = tile;
+    _offscreenColumns = columns;
+    _offscreenRows = rows;
+
+    VkExtent3D atlasExtent = {tile.width * columns, tile.height * rows, 1};
+
+    VmaAllocationCreateInfo imageAllocInfo = {};
+    imageAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    imageAllocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    for (OffscreenBatch& batch : _offscreenBatches) {
+        VkImageCreateInfo colorInfo = vkinit::image_create_info(_drawImageFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                                                                atlasExtent);
+        VK_CHECK(vmaCreateImage(_allocator, &colorInfo, &imageAllocInfo, &batch._colorImage._image, &batch._colorImage._allocation, nullptr));
+        _gpuMemory.track(batch._colorImage._allocation, MemoryCategory::Attachment);
+
+        VkImageViewCreateInfo colorViewInfo = vkinit::imageview_create_info(_drawImageFormat, batch._colorImage._image, VK_IMAGE_ASPECT_COLOR_BIT);
+        VK_CHECK(vkCreateImageView(_device, &colorViewInfo, _hostCallbacks, &batch._colorView));
+
+        VkImageCreateInfo depthInfo = vkinit::image_create_info(_depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, atlasExtent);
+        VK_CHECK(vmaCreateImage(_allocator, &depthInfo, &imageAllocInfo, &batch._depthImage._image, &batch._depthImage._allocation, nullptr));
+        _gpuMemory.track(batch._depthImage._allocation, MemoryCategory::Attachment);
+
+        VkImageViewCreateInfo depthViewInfo = vkinit::imageview_create_info(_depthFormat, batch._depthImage._image, VK_IMAGE_ASPECT_DEPTH_BIT);
+        VK_CHECK(vkCreateImageView(_device, &depthViewInfo, _hostCallbacks, &batch._depthView));
+
+        VkImageCreateInfo outputInfo = vkinit::image_create_info(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                                                                 atlasExtent);
+        VK_CHECK(vmaCreateImage(_allocator, &outputInfo, &imageAllocInfo, &batch._outputImage._image, &batch._outputImage._allocation, nullptr));
+        _gpuMemory.track(batch._outputImage._allocation, MemoryCategory::Attachment);
+
+        VkImageView attachments[2] = {batch._colorView, batch._depthView};
+
+        VkFramebufferCreateInfo framebufferInfo = {};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.pNext = nullptr;
+        framebufferInfo.renderPass = _offscreenRenderPass;
+        framebufferInfo.attachmentCount = 2;
+        framebufferInfo.pAttachments = attachments;
+        framebufferInfo.width = atlasExtent.width;
+        framebufferInfo.height = atlasExtent.height;
+        framebufferInfo.layers = 1;
+        VK_CHECK(vkCreateFramebuffer(_device, &framebufferInfo, _hostCallbacks, &batch._framebuffer));
+
+        const size_t readbackSize = (size_t)columns * rows * tile.width * tile.height * 4;
+        batch._readbackBuffer = create_buffer(readbackSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU, MemoryCategory::Frame);
+        vmaMapMemory(_allocator, batch._readbackBuffer._allocation, (void**)&batch._readback);
+    }
+}
+
+void VulkanEngine::destroy_offscreen_targets() {
+    if (_offscreenColumns == 0) {
+        return;
+    }
+    for (OffscreenBatch& batch : _offscreenBatches) {
+        vkDestroyFramebuffer(_device, batch._framebuffer, _hostCallbacks);
+        vkDestroyImageView(_device, batch._colorView, _hostCallbacks);
+        vkDestroyImageView(_device, batch._depthView, _hostCallbacks);
+        _gpuMemory.untrack(batch._colorImage._allocation);
+        _gpuMemory.untrack(batch._depthImage._allocation);
+        _gpuMemory.untrack(batch._outputImage._allocation);
+        vmaDestroyImage(_allocator, batch._colorImage._image, batch._colorImage._allocation);
+        vmaDestroyImage(_allocator, batch._depthImage._image, batch._depthImage._allocation);
+        vmaDestroyImage(_allocator, batch._outputImage._image, batch._outputImage._allocation);
+        vmaUnmapMemory(_allocator, batch._readbackBuffer._allocation);
+        destroy_buffer(batch._readbackBuffer);
+    }
+    _offscreenTile = {0, 0};
+    _offscreenColumns = 0;
+    _offscreenRows = 0;
+}
+
+bool VulkanEngine::render_views(const OffscreenView* views, uint32_t count, const OffscreenSettings& settings, const OffscreenCallback& onView) {
+    const VkExtent2D tile = settings.tileExtent;
+    if (count == 0 || tile.width == 0 || tile.height == 0 || tile.width > _maxImageDimension || tile.height > _maxImageDimension) {
+        return false;
+    }
+
+    //as square as the device allows, the last row may be partly empty
+    const uint32_t requested = std::max(settings.viewsPerBatch, 1u);
+    uint32_t columns = 1;
+    while (columns * columns < requested) {
+        columns++;
+    }
+    columns = std::min(columns, _maxImageDimension / tile.width);
+    const uint32_t rows = std::min((requested + columns - 1) / columns, _maxImageDimension / tile.height);
+    const uint32_t viewsPerBatch = std::min(requested, columns * rows);
+
+    //every batch of the last call was read back before it returned, the targets are free to replace
+    prepare_offscreen(tile, columns, rows);
+
+    auto start = std::chrono::steady_clock::now();
+
+    //the views see the scene the next frame would draw
+    _snapshots.acquire_latest();
+    const SceneSnapshot& snapshot = _snapshots.read_buffer();
+    const uint32_t objectCount = std::min((uint32_t)snapshot.transforms.size(), _maxObjects);
+
+    _offscreenSpheres.resize(objectCount);
+    _offscreenBoxes.resize(objectCount);
+    _jobs.parallel_for(objectCount, 1024, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            //objects without a mesh keep their proxy, a negative radius keeps them out of every view
+            const Mesh* mesh = _meshes.get(_renderables[i].mesh);
+            if (!mesh) {
+                _offscreenSpheres[i] = glm::vec4(0.f, 0.f, 0.f, -1.f);
+                _offscreenBoxes[i] = Aabb::from_sphere(glm::vec3(0.f), 0.f);
+                continue;
+            }
+            MeshBounds world = transform_bounds(mesh->_bounds, snapshot.transforms[i]);
+            _offscreenSpheres[i] = glm::vec4(world.origin, world.radius);
+            _offscreenBoxes[i] = Aabb::from_sphere(world.origin, world.radius);
+        }
+    });
+    _offscreenIndex.build(_offscreenBoxes.data(), objectCount);
+
+    if (_offscreenVisible.size() < viewsPerBatch) {
+        _offscreenVisible.resize(viewsPerBatch);
+    }
+    _offscreenFirstObject.resize(viewsPerBatch + 1);
+
+    _offscreenStats = {};
+    OffscreenBatch* previous = nullptr;
+    uint32_t next = 0;
+    uint32_t slot = 0;
+    while (next < count) {
+        OffscreenBatch& batch = _offscreenBatches[slot];
+        const uint32_t viewCount = build_offscreen_batch(batch, views, next, std::min(viewsPerBatch, count - next), snapshot);
+        record_offscreen_batch(batch, next == 0);
+        next += viewCount;
+
+        //the gpu renders this batch while the previous one is copied out
+        if (previous) {
+            read_offscreen_batch(*previous, onView);
+        }
+        previous = &batch;
+        slot ^= 1;
+        _offscreenStats.batches++;
+    }
+    read_offscreen_batch(*previous, onView);
+
+    _offscreenStats.views = count;
+    _offscreenStats.totalMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    _offscreenStats.viewsPerSecond = _offscreenStats.totalMs > 0.f ? count * 1000.f / _offscreenStats.totalMs : 0.f;
+    if (_offscreenStats.droppedDraws > 0) {
+        std::cout << "Offscreen views saw more objects than a batch holds, " << _offscreenStats.droppedDraws << " draws left out" << std::endl;
+    }
+    return true;
+}
+
+uint32_t VulkanEngine::build_offscreen_batch(OffscreenBatch& batch, const OffscreenView* views, uint32_t first, uint32_t count,
+                                             const SceneSnapshot& snapshot) {
+    _jobs.parallel_for(count, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t v = begin; v < end; v++) {
+            const OffscreenView& view = views[first + v];
+            Frustum frustum = Frustum::from_matrix(view.projection * view.view);
+
+            std::vector<uint32_t>& visible = _offscreenVisible[v];
+            visible.clear();
+            _offscreenIndex.query_frustum(frustum, [&](uint32_t object, bool contained) {
+                const glm::vec4& sphere = _offscreenSpheres[object];
+                if (sphere.w >= 0.f && (contained || frustum.intersects_sphere(glm::vec3(sphere), sphere.w))) {
+                    visible.push_back(object);
+                }
+            });
+            //object order keeps the pipeline binds grouped, like the main pass
+            std::sort(visible.begin(), visible.end());
+        }
+    });
+
+    //views whose objects no longer fit the batch's buffer wait for the next batch, at least one always goes
+    uint32_t viewCount = 0;
+    uint32_t entries = 0;
+    while (viewCount < count) {
+        const uint32_t needed = (uint32_t)_offscreenVisible[viewCount].size();
+        if (viewCount > 0 && entries + needed > _offscreenObjectCapacity) {
+            break;
+        }
+        _offscreenFirstObject[viewCount] = entries;
+        //a view alone in its batch that still needs more draws the first ones only
+        if (needed > _offscreenObjectCapacity) {
+            _offscreenStats.droppedDraws += needed - _offscreenObjectCapacity;
+        }
+        entries += std::min(needed, _offscreenObjectCapacity);
+        viewCount++;
+    }
+    _offscreenFirstObject[viewCount] = entries;
+
+    _jobs.parallel_for(viewCount, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t v = begin; v < end; v++) {
+            const OffscreenView& view = views[first + v];
+            const glm::mat4 viewProj = view.projection * view.view;
+            const std::vector<uint32_t>& visible = _offscreenVisible[v];
+
+            GPUObjectData* data = batch._objectData + _offscreenFirstObject[v];
+            const uint32_t visibleCount = _offscreenFirstObject[v + 1] - _offscreenFirstObject[v];
+            for (uint32_t i = 0; i < visibleCount; i++) {
+                const uint32_t object = visible[i];
+                data[i].renderMatrix = viewProj * snapshot.transforms[object];
+                data[i].sphereBounds = _offscreenSpheres[object];
+                data[i].materialIndex = _renderables[object].material.index;
+                data[i].fade = 1.f;
+            }
+        }
+    });
+
+    batch._firstView = first;
+    batch._viewCount = viewCount;
+    _offscreenStats.draws += entries;
+    return viewCount;
+}
+
+void VulkanEngine::record_offscreen_batch(OffscreenBatch& batch, bool acquireUploads) {
+    VkCommandBuffer cmd = batch._commandBuffer;
+    VK_CHECK(vkResetCommandPool(_device, batch._commandPool, 0));
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.pNext = nullptr;
+    beginInfo.pInheritanceInfo = nullptr;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+
+    SubmitSync sync;
+    if (acquireUploads) {
+        acquire_uploads(cmd, sync);
+    }
+
+    const VkExtent2D atlasExtent = {_offscreenTile.width * _offscreenColumns, _offscreenTile.height * _offscreenRows};
+
+    VkClearValue clearValues[2];
+    clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+    clearValues[1].depthStencil.depth = 1.f;
+
+    VkRenderPassBeginInfo passInfo = vkinit::renderpass_begin_info(_offscreenRenderPass, atlasExtent, batch._framebuffer);
+    passInfo.clearValueCount = 2;
+    passInfo.pClearValues = clearValues;
+    vkCmdBeginRenderPass(cmd, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(cmd, 0, 1, &_geometryPool._vertexBuffer._buffer, &offset);
+    vkCmdBindIndexBuffer(cmd, _geometryPool._indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+
+    //the bound pipeline carries over from one view to the next, only the viewport changes
+    MaterialHandle lastMaterial;
+    for (uint32_t v = 0; v < batch._viewCount; v++) {
+        VkViewport viewport = {};
+        viewport.x = (float)((v % _offscreenColumns) * _offscreenTile.width);
+        viewport.y = (float)((v / _offscreenColumns) * _offscreenTile.height);
+        viewport.width = (float)_offscreenTile.width;
+        viewport.height = (float)_offscreenTile.height;
+        viewport.minDepth = 0.f;
+        viewport.maxDepth = 1.f;
+
+        VkRect2D scissor = {};
+        scissor.offset = {(int32_t)viewport.x, (int32_t)viewport.y};
+        scissor.extent = _offscreenTile;
+
+        vkCmdSetViewport(cmd, 0, 1, &viewport);
+        vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+        const std::vector<uint32_t>& visible = _offscreenVisible[v];
+        const uint32_t firstEntry = _offscreenFirstObject[v];
+        const uint32_t visibleCount = _offscreenFirstObject[v + 1] - firstEntry;
+        for (uint32_t i = 0; i < visibleCount; i++) {
+            const RenderObject& object = _renderables[visible[i]];
+            if (object.material != lastMaterial) {
+                const Material* material = _materials.get(object.material);
+                vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipeline);
+                vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipelineLayout, 0, 1, &batch._descriptor, 0, nullptr);
+                lastMaterial = object.material;
+            }
+
+            //the entry of the object in this view reaches the shaders as gl_InstanceIndex
+            const MeshRange& range = _meshes.get(object.mesh)->_range;
+            vkCmdDrawIndexed(cmd, range.indexCount, 1, range.firstIndex, (int32_t)range.firstVertex, firstEntry + i);
         }
+    }
+
+    vkCmdEndRenderPass(cmd);
 
-        vkCmdDraw(cmd, object.mesh->_vertices.size(), 1,0,0);
+    //the render pass leaves the atlas in transfer source, the blit converts it to rgba8
+    VkImageMemoryBarrier toBlit = vkinit::image_barrier(batch._outputImage._image, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                                                        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toBlit);
+
+    VkImageBlit blit = {};
+    blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    blit.srcOffsets[1] = {(int32_t)atlasExtent.width, (int32_t)atlasExtent.height, 1};
+    blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    blit.dstOffsets[1] = {(int32_t)atlasExtent.width, (int32_t)atlasExtent.height, 1};
+    vkCmdBlitImage(cmd, batch._colorImage._image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   batch._outputImage._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_NEAREST);
+
+    VkImageMemoryBarrier toCopy = vkinit::image_barrier(batch._outputImage._image, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                                                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toCopy);
+
+    //one region per view, so every view lands in the readback buffer as its own tightly packed image
+    const VkDeviceSize tileBytes = (VkDeviceSize)_offscreenTile.width * _offscreenTile.height * 4;
+    _offscreenCopies.resize(batch._viewCount);
+    for (uint32_t v = 0; v < batch._viewCount; v++) {
+        VkBufferImageCopy& copy = _offscreenCopies[v];
+        copy = {};
+        copy.bufferOffset = v * tileBytes;
+        copy.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        copy.imageOffset = {(int32_t)((v % _offscreenColumns) * _offscreenTile.width), (int32_t)((v / _offscreenColumns) * _offscreenTile.height), 0};
+        copy.imageExtent = {_offscreenTile.width, _offscreenTile.height, 1};
     }
+    vkCmdCopyImageToBuffer(cmd, batch._outputImage._image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, batch._readbackBuffer._buffer,
+                           batch._viewCount, _offscreenCopies.data());
+
+    VkBufferMemoryBarrier toHost = vkinit::buffer_barrier(batch._readbackBuffer._buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &toHost, 0, nullptr);
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
 
+    //on the graphics timeline, so the next draw() waits for the batches like for its own frame
+    sync.signal(_graphicsTimeline, ++_graphicsTimelineValue);
+    batch._timelineValue = _graphicsTimelineValue;
+    submit(_graphicsQueue, cmd, sync);
+}
+
+void VulkanEngine::read_offscreen_batch(OffscreenBatch& batch, const OffscreenCallback& onView) {
+    //a big batch on a software rasterizer can take longer than a frame ever should
+    VkSemaphoreWaitInfo waitInfo = {};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.pNext = nullptr;
+    waitInfo.flags = 0;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &_graphicsTimeline;
+    waitInfo.pValues = &batch._timelineValue;
+    VK_CHECK(vkWaitSemaphores(_device, &waitInfo, UINT64_MAX));
+    batch._timelineValue = 0;
+
+    vmaInvalidateAllocation(_allocator, batch._readbackBuffer._allocation, 0, VK_WHOLE_SIZE);
+
+    const size_t tileBytes = (size_t)_offscreenTile.width * _offscreenTile.height * 4;
+    for (uint32_t v = 0; v < batch._viewCount; v++) {
+        onView(batch._firstView + v, batch._readback + v * tileBytes);
+    }
 }
 
 void VulkanEngine::init_scene() {
+    //resolve names once, the grid below only copies handles
+    MeshHandle monkeyMesh = get_mesh("monkey"_id);
+    MeshHandle triangleMesh = get_mesh("triangle"_id);
+    MaterialHandle defaultMaterial = get_material("defaultmesh"_id);
+
     RenderObject monkey;
-    monkey.mesh = get_mesh("monkey");
-    monkey.material = get_material("defaultmesh");
-    monkey.transformMatrix = glm::mat4{1.0f};
+    monkey.mesh = monkeyMesh;
+    monkey.material = defaultMaterial;
+    monkey.transform = _transforms.add_node(NO_TRANSFORM_PARENT);
 
     _renderables.push_back(monkey);
 
-    for(int x = -20; x <=20;x++){
-        for(int y = -20; y <= 20; y++){
+    const int gridMin = -20;
+    const int gridSize = 41;
+    const size_t gridStart = _renderables.size();
+    _renderables.resize(gridStart + gridSize * gridSize);
+
+    //the triangles hang off one grid node, moving it moves the whole grid.
+    //the hierarchy is not thread safe, so the nodes are added up front and get consecutive ids
+    TransformNode gridRoot = _transforms.add_node(NO_TRANSFORM_PARENT);
+    TransformNode firstTriangle = gridRoot + 1;
+    for (int row = 0; row < gridSize; row++) {
+        for (int column = 0; column < gridSize; column++) {
+            Transform local;
+            local.translation = glm::vec3(gridMin + row, 0, gridMin + column);
+            local.scale = glm::vec3(0.2f);
+            _transforms.add_node(gridRoot, local);
+        }
+    }
+
+    //one row of the grid per job
+    _jobs.parallel_for(gridSize, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t row = begin; row < end; row++) {
+            for (int column = 0; column < gridSize; column++) {
+                const uint32_t index = row * gridSize + column;
+
+                RenderObject& tri = _renderables[gridStart + index];
+                tri.mesh = triangleMesh;
+                tri.material = defaultMaterial;
+                tri.transform = firstTriangle + index;
+            }
+        }
+    });
+
+    //chunks are drawn like any other object, culled by their bounds and empty until they stream in.
+    //they are not split into meshlets, the meshlet buffer never gives space back
+    if (!_worldPath.empty() && _streamer.open(_worldPath)) {
+        _chunkMeshes.resize(_streamer.chunk_count());
+        for (uint32_t i = 0; i < _streamer.chunk_count(); i++) {
+            Mesh chunkMesh;
+            chunkMesh._bounds = _streamer.chunk(i).bounds;
+            _chunkMeshes[i] = _meshes.add("chunk_" + std::to_string(i), std::move(chunkMesh));
+            if (!_chunkMeshes[i].valid()) {
+                continue;
+            }
+
+            RenderObject chunk;
+            chunk.mesh = _chunkMeshes[i];
+            chunk.material = defaultMaterial;
+            chunk.transform = _transforms.add_node(NO_TRANSFORM_PARENT);
+            _renderables.push_back(chunk);
+        }
+        if (_renderables.size() > _maxObjects) {
+            std::cout << "World has more chunks than the object buffer holds, " << _renderables.size() - _maxObjects << " are never drawn" << std::endl;
+        }
 
-            RenderObject tri;
-            tri.mesh = get_mesh("triangle");
-            tri.material = get_material("defaultmesh");
-            glm::mat4 translation = glm::translate(glm::mat4{1.0},glm::vec3(x,0,y));
-            glm::mat4 scale = glm::scale(glm::mat4{1.0}, glm::vec3(0.2,0.2,0.2));
-            tri.transformMatrix = translation * scale;
+        _mainDeletionQueue.push_function([=]() {
+            _streamer.close(_jobs);
+        });
+    }
+
+    _transforms.update(&_jobs);
+
+    //point lights scattered just above the grid, fixed seed so runs compare
+    std::mt19937 random(1337);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    _lights.resize(_lightCount);
+    for (PointLight& light : _lights) {
+        light.position = glm::vec3(gridMin + unit(random) * (gridSize - 1), 0.5f + unit(random) * 2.f, gridMin + unit(random) * (gridSize - 1));
+        light.radius = 1.f + unit(random) * 3.f;
+        light.color = glm::vec3(unit(random), unit(random), unit(random));
+        light.intensity = 1.f;
+    }
+}
 
-            _renderables.push_back(tri);
+void VulkanEngine::acquire_uploads(VkCommandBuffer cmd, SubmitSync& sync) {
+    //meshes uploaded since the last frame, a dedicated transfer family needs the acquire half of the ownership transfer
+    if (_transferTimelineValue > _transferValueAcquired) {
+        _acquireBarriers.clear();
+        for (const PendingUpload& upload : _transferContext._pending) {
+            if (upload.timelineValue > _transferValueAcquired) {
+                _acquireBarriers.insert(_acquireBarriers.end(), upload.acquireBarriers.begin(), upload.acquireBarriers.end());
+            }
         }
+        if (!_acquireBarriers.empty()) {
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+                                 0, nullptr, (uint32_t)_acquireBarriers.size(), _acquireBarriers.data(), 0, nullptr);
+        }
+
+        sync.wait(_transferTimeline, _transferTimelineValue, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+        _transferValueAcquired = _transferTimelineValue;
     }
 }
 
 void VulkanEngine::draw()
 {
-    VK_CHECK(vkWaitForFences(_device, 1, &_renderFence, true, ONE_SECOND_TIMEOUT));
-    VK_CHECK(vkResetFences(_device, 1, &_renderFence));
+    //a frame is a small graph of submissions: occlusion test on compute, then the passes on graphics,
+    //then the depth pyramid on compute next to the upscale on graphics. uploads run on the transfer queue.
+    //the previous frame is done once both timelines reached its last values
+    const HeapAllocationCounters heapStart = heap_allocation_counters();
+    const uint64_t hostStart = host_allocator().total_allocations();
+
+    VkSemaphore frameSemaphores[] = {_graphicsTimeline, _computeTimeline};
+    uint64_t frameValues[] = {_graphicsTimelineValue, _computeTimelineValue};
+
+    VkSemaphoreWaitInfo frameWait = {};
+    frameWait.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    frameWait.pNext = nullptr;
+    frameWait.flags = 0;
+    frameWait.semaphoreCount = 2;
+    frameWait.pSemaphores = frameSemaphores;
+    frameWait.pValues = frameValues;
+    VK_CHECK(vkWaitSemaphores(_device, &frameWait, ONE_SECOND_TIMEOUT));
+
+    retire_uploads();
+    update_memory();
+    read_gpu_stats();
+    update_draw_extent();
+
+    auto cpuStart = std::chrono::steady_clock::now();
 
     //Request image from the swapchain
-    uint32_t swapchainImageIndex;
+    uint32_t swapchainImageIndex = 0;
     //sent presentSemaphore to check later
-    VK_CHECK(vkAcquireNextImageKHR(_device, _swapchain, ONE_SECOND_TIMEOUT, _presentSemaphore, nullptr, &swapchainImageIndex));
-    //empty Command Buffer
+    if (!_headless) {
+        VK_CHECK(vkAcquireNextImageKHR(_device, _swapchain, ONE_SECOND_TIMEOUT, _presentSemaphore, nullptr, &swapchainImageIndex));
+    }
+    //empty Command Buffers
     VK_CHECK(vkResetCommandBuffer(_mainCommandBuffer, 0));
+    VK_CHECK(vkResetCommandBuffer(_upscaleCommandBuffer, 0));
+    VK_CHECK(vkResetCommandPool(_device, _computeContext._commandPool, 0));
 
-    VkCommandBuffer cmd = _mainCommandBuffer;
+    //the gpu is done with last frame's secondaries once both timelines have reached it
+    for (RecordingContext& context : _recordingContexts) {
+        VK_CHECK(vkResetCommandPool(_device, context._commandPool, 0));
+        context._used = 0;
+    }
+
+    //render the newest complete snapshot, or the previous one again if the simulation has not ticked
+    if (!_snapshots.acquire_latest()) {
+        _simulationStats.repeatedSnapshots++;
+    }
+    const SceneSnapshot& snapshot = _snapshots.read_buffer();
+
+    float latencyMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - snapshot.publishTime).count();
+    _simulationStats.averageLatencyMs = _simulationStats.averageLatencyMs * 0.95f + latencyMs * 0.05f;
+    if (latencyMs > _simulationStats.maxLatencyMs) {
+        _simulationStats.maxLatencyMs = latencyMs;
+    }
+
+    update_streaming(snapshot);
+    cull_objects(snapshot);
+    select_mesh_variant();
+    update_lights(snapshot);
+
+    if (_captureAtFrame == _frameNumber) {
+        request_capture({});
+    }
+    if (_captureRequested.exchange(false, std::memory_order_acquire)) {
+        std::string capturePath;
+        {
+            std::lock_guard<std::mutex> lock(_captureLock);
+            capturePath.swap(_capturePath);
+        }
+        if (capturePath.empty()) {
+            capturePath = "frame_" + std::to_string(_frameNumber) + ".vkcap";
+        }
+        capture_frame(snapshot, capturePath);
+    }
+
+    //after the capture, which records every visible object as a mesh
+    _impostorCount = 0;
+    if (!_impostorKeys.empty()) {
+        //the previous frame is done with the atlas. a stall, so it waits out the compile of a new variant
+        //on the workers instead of baking its fallback first, then bakes once per change of the mesh shading
+        if (_meshVariantSettled && impostors_stale()) {
+            bake_impostors(_impostorTile);
+            if (_logFramePacing) {
+                std::cout << "Impostors: re-baked for the new mesh pipelines" << std::endl;
+            }
+        }
+        select_impostors(snapshot);
+    }
+
+    //the occlusion test needs a pyramid from a previous frame, baseline frames skip it to measure its benefit
+    const bool gpuDriven = _depthPrepass || _occlusionCulling;
+    const bool baselineFrame = _occlusionBaselineInterval > 0 && _frameNumber % _occlusionBaselineInterval == 0;
+    const bool testOcclusion = _occlusionCulling && _depthPyramidValid && !baselineFrame;
+    _occlusionTestedLastFrame = testOcclusion;
+    _baselineLastFrame = _occlusionCulling && baselineFrame;
+
+    if (gpuDriven) {
+        build_indirect_draws();
+    }
+    if (_meshletCulling) {
+        build_meshlet_work();
+    }
+    _meshletsCulledLastFrame = _meshletCulling;
 
     //Begin recording commands
     VkCommandBufferBeginInfo cmdBeginInfo = {};
@@ -712,58 +4145,128 @@ void VulkanEngine::draw()
     cmdBeginInfo.pInheritanceInfo = nullptr;
     cmdBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-    VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+    const bool timestamps = _timestampPeriod > 0.f;
 
-    VkClearValue clearValue;
+    if (testOcclusion) {
+        VkCommandBuffer cullCmd = _computeContext._cullCommandBuffer;
+        VK_CHECK(vkBeginCommandBuffer(cullCmd, &cmdBeginInfo));
 
-    //make a clear-color from frame number. This will flash with a 120*pi frame period.
-    float flash = abs(sin(_frameNumber/120.f));
-    clearValue.color = {{0.0f,0.0f,flash,1.0f}};
+        if (_computeTimestamps) {
+            vkCmdResetQueryPool(cullCmd, _timestampPool, TIMESTAMP_CULL_BEGIN, 2);
+            vkCmdWriteTimestamp(cullCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, _timestampPool, TIMESTAMP_CULL_BEGIN);
+        }
+        cull_occlusion(cullCmd);
+        if (_computeTimestamps) {
+            vkCmdWriteTimestamp(cullCmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _timestampPool, TIMESTAMP_CULL_END);
+        }
+
+        VK_CHECK(vkEndCommandBuffer(cullCmd));
+
+        SubmitSync cullSync;
+        cullSync.signal(_computeTimeline, ++_computeTimelineValue);
+        submit(_computeQueue, cullCmd, cullSync);
+    }
+
+    VkCommandBuffer cmd = _mainCommandBuffer;
+    VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
 
-    VkClearValue depthClear;
-    depthClear.depthStencil.depth = 1.f;
+    if (timestamps) {
+        vkCmdResetQueryPool(cmd, _timestampPool, TIMESTAMP_GRAPHICS_BEGIN, 4);
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, _timestampPool, TIMESTAMP_GRAPHICS_BEGIN);
+        if (_lightCount > 0) {
+            vkCmdResetQueryPool(cmd, _timestampPool, TIMESTAMP_LIGHT_CULL_BEGIN, 2);
+        }
+    }
 
-    //begin renderpass
-    VkRenderPassBeginInfo rpInfo = vkinit::renderpass_begin_info(_renderPass, _windowExtent, _framebuffers[swapchainImageIndex]);
+    SubmitSync passSync;
 
-    rpInfo.clearValueCount = 2;
+    //the occlusion test's draw commands, and last frame's pyramid build done reading the depth image
+    if (_computeTimelineValue > 0) {
+        passSync.wait(_computeTimeline, _computeTimelineValue, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                      VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT);
+    }
 
-    VkClearValue clearValues[] = {clearValue, depthClear };
+    acquire_uploads(cmd, passSync);
 
-    rpInfo.pClearValues = &clearValues[0];
+    //a full ring drops this frame's readback rather than waiting for the consumer
+    _readbackBuffer = _readback.is_enabled() ? _readback.begin_frame() : VK_NULL_HANDLE;
 
-    vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+    //culls, prepass and main pass. the graph records the barriers between them and the depth release
+    build_render_graph();
+    _renderGraph.compile();
+    if (timestamps && !_depthPrepass) {
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _timestampPool, TIMESTAMP_PREPASS_END);
+    }
+    _renderGraph.execute(cmd, _drawExtent);
+    if (timestamps) {
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _timestampPool, TIMESTAMP_MAIN_END);
+    }
 
-    draw_objects(cmd, _renderables.data(), _renderables.size());
+    //headless frames end here, the draw image is the result
+    if (_headless && timestamps) {
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _timestampPool, TIMESTAMP_UPSCALE_END);
+    }
 
-    //finalize the render pass
-    vkCmdEndRenderPass(cmd);
     //finalize command buffer
     VK_CHECK(vkEndCommandBuffer(cmd));
 
-    //Prepare the submission to the Queue
-    //wait on the semaphore to know that the swapchain is ready
+    passSync.signal(_graphicsTimeline, ++_graphicsTimelineValue);
+    const uint64_t passesDone = _graphicsTimelineValue;
 
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.pNext = nullptr;
+    _cpuFrameMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - cpuStart).count();
+
+    submit(_graphicsQueue, cmd, passSync);
+    if (_readbackBuffer != VK_NULL_HANDLE) {
+        _readback.end_frame(passesDone);
+    }
 
-    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    //next frame tests against this pyramid, it only has to be done before next frame's occlusion test
+    if (_occlusionCulling) {
+        VkCommandBuffer pyramidCmd = _computeContext._pyramidCommandBuffer;
+        VK_CHECK(vkBeginCommandBuffer(pyramidCmd, &cmdBeginInfo));
 
-    submitInfo.pWaitDstStageMask = &waitStage;
+        if (_computeTimestamps) {
+            vkCmdResetQueryPool(pyramidCmd, _timestampPool, TIMESTAMP_PYRAMID_BEGIN, 2);
+            vkCmdWriteTimestamp(pyramidCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, _timestampPool, TIMESTAMP_PYRAMID_BEGIN);
+        }
+        build_depth_pyramid(pyramidCmd, snapshot.projection * snapshot.view);
+        if (_computeTimestamps) {
+            vkCmdWriteTimestamp(pyramidCmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _timestampPool, TIMESTAMP_PYRAMID_END);
+        }
 
-    //await the swapChain image
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = &_presentSemaphore;
+        VK_CHECK(vkEndCommandBuffer(pyramidCmd));
 
-    //begin rendering
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = &_renderSemaphore;
+        SubmitSync pyramidSync;
+        pyramidSync.wait(_graphicsTimeline, passesDone, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        pyramidSync.signal(_computeTimeline, ++_computeTimelineValue);
+        submit(_computeQueue, pyramidCmd, pyramidSync);
+    }
 
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &cmd;
+    if (_headless) {
+        check_frame_allocations(heapStart, hostStart);
+        if (_frameNumber == 0) {
+            finish_startup();
+        }
+        _frameNumber++;
+        return;
+    }
+
+    VkCommandBuffer upscaleCmd = _upscaleCommandBuffer;
+    VK_CHECK(vkBeginCommandBuffer(upscaleCmd, &cmdBeginInfo));
 
-    VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &submitInfo, _renderFence));
+    upscale_to_swapchain(upscaleCmd, _swapchainImages[swapchainImageIndex]);
+    if (timestamps) {
+        vkCmdWriteTimestamp(upscaleCmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _timestampPool, TIMESTAMP_UPSCALE_END);
+    }
+
+    VK_CHECK(vkEndCommandBuffer(upscaleCmd));
+
+    //the swapchain image is first touched by the upscale blit, binary semaphores ignore the value
+    SubmitSync upscaleSync;
+    upscaleSync.wait(_presentSemaphore, 0, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    upscaleSync.signal(_renderSemaphore, 0);
+    upscaleSync.signal(_graphicsTimeline, ++_graphicsTimelineValue);
+    submit(_graphicsQueue, upscaleCmd, upscaleSync);
 
     //wait on the renderSemaphore so we know the drawing commands are completed and the image is ready to present
     VkPresentInfoKHR presentInfo = {};
@@ -780,39 +4283,340 @@ void VulkanEngine::draw()
 
     VK_CHECK(vkQueuePresentKHR(_graphicsQueue, &presentInfo));
 
+    check_frame_allocations(heapStart, hostStart);
+    if (_frameNumber == 0) {
+        finish_startup();
+    }
+
     //increase number of frames drawn
     _frameNumber++;
 }
 
-void VulkanEngine::run()
-{
+void VulkanEngine::check_frame_allocations(const HeapAllocationCounters& heapStart, uint64_t hostStart) {
+    //other threads allocating at the same time are counted too, in decoupled mode that includes the simulation
+    const HeapAllocationCounters heapEnd = heap_allocation_counters();
+    _frameAllocations.heapAllocations = heapEnd.allocations - heapStart.allocations;
+    _frameAllocations.heapBytes = heapEnd.bytes - heapStart.bytes;
+    _frameAllocations.hostAllocations = host_allocator().total_allocations() - hostStart;
+
+    const bool allocated = _frameAllocations.heapAllocations > 0 || _frameAllocations.hostAllocations > 0;
+    if (!allocated || (uint32_t)_frameNumber < _allocationWarmupFrames) {
+        return;
+    }
+    _frameAllocations.flaggedFrames++;
+
+    if (_assertNoFrameAllocations) {
+        std::cout << "Frame " << _frameNumber << " allocated: " << _frameAllocations.heapAllocations << " heap ("
+                  << _frameAllocations.heapBytes << " bytes), " << _frameAllocations.hostAllocations << " Vulkan host" << std::endl;
+        assert(!allocated && "steady state frame allocated");
+    }
+}
+
+void VulkanEngine::request_capture(const std::string& path) {
+    {
+        std::lock_guard<std::mutex> lock(_captureLock);
+        _capturePath = path;
+    }
+    _captureRequested.store(true, std::memory_order_release);
+}
+
+void VulkanEngine::capture_frame(const SceneSnapshot& snapshot, const std::string& path) {
+    FrameCapture capture;
+    capture.frame = (uint64_t)_frameNumber;
+    capture.windowWidth = _windowExtent.width;
+    capture.windowHeight = _windowExtent.height;
+    capture.renderScale = get_render_scale();
+    capture.flags = (_depthPrepass ? CAPTURE_DEPTH_PREPASS : 0) | (_occlusionCulling ? CAPTURE_OCCLUSION_CULLING : 0);
+    capture.view = snapshot.view;
+    capture.projection = snapshot.projection;
+
+    //names instead of handles, handles are only meaningful inside this process
+    capture.objects.resize(snapshot.transforms.size());
+    for (size_t i = 0; i < snapshot.transforms.size(); i++) {
+        capture.objects[i].mesh = NameId{_meshes.name_of(_renderables[i].mesh)}.value;
+        capture.objects[i].material = NameId{_materials.name_of(_renderables[i].material)}.value;
+        capture.objects[i].transform = snapshot.transforms[i];
+    }
+    capture.drawList = _visibleObjects;
+
+    if (save_capture(path, capture)) {
+        std::cout << "Captured frame " << _frameNumber << " (" << capture.objects.size() << " objects, "
+                  << capture.drawList.size() << " draws) to " << path << std::endl;
+    }
+}
+
+bool VulkanEngine::apply_capture(const FrameCapture& capture, uint32_t firstDraw, uint32_t drawCount) {
+    //either every captured object, or only a slice of the ones that were drawn
+    std::vector<uint32_t> objectIndices;
+    if (drawCount == UINT32_MAX) {
+        for (uint32_t i = 0; i < (uint32_t)capture.objects.size(); i++) {
+            objectIndices.push_back(i);
+        }
+    } else {
+        const uint32_t drawListSize = (uint32_t)capture.drawList.size();
+        const uint32_t first = std::min(firstDraw, drawListSize);
+        const uint32_t count = std::min(drawCount, drawListSize - first);
+        objectIndices.assign(capture.drawList.begin() + first, capture.drawList.begin() + first + count);
+    }
+
+    //resolve every name before touching the scene, a capture this build cannot load leaves it as it was
+    std::vector<RenderObject> renderables;
+    renderables.reserve(objectIndices.size());
+    for (uint32_t index : objectIndices) {
+        const CapturedObject& captured = capture.objects[index];
+
+        RenderObject object;
+        object.mesh = get_mesh(NameId{captured.mesh});
+        object.material = get_material(NameId{captured.material});
+        if (!object.mesh.valid() || !object.material.valid()) {
+            std::cout << "Capture uses a mesh or material this build does not load" << std::endl;
+            return false;
+        }
+        renderables.push_back(object);
+    }
+
+    //captures hold world matrices, every object comes back as a root
+    _transforms.clear();
+    for (uint32_t i = 0; i < (uint32_t)renderables.size(); i++) {
+        renderables[i].transform = _transforms.add_node(NO_TRANSFORM_PARENT, Transform::from_matrix(capture.objects[objectIndices[i]].transform));
+    }
+    _renderables = std::move(renderables);
+    _transforms.update(&_jobs);
+    check_meshlet_materials();
+
+    _depthPrepass = (capture.flags & CAPTURE_DEPTH_PREPASS) != 0;
+    _occlusionCulling = (capture.flags & CAPTURE_OCCLUSION_CULLING) != 0;
+    //the sampled depth image and the pyramid are only made by init() with occlusion culling on
+    if (_occlusionCulling && _depthImage._image == VK_NULL_HANDLE) {
+        std::cout << "Capture used occlusion culling, set it before init() to replay it. Replaying without" << std::endl;
+        _occlusionCulling = false;
+    }
+    if ((_depthPrepass || _occlusionCulling) && !_drawIndirectFirstInstance) {
+        std::cout << "Capture used the indirect path, the device lacks drawIndirectFirstInstance. Replaying without" << std::endl;
+        _depthPrepass = false;
+        _occlusionCulling = false;
+    }
+    //replay the resolution the frame actually had, not whatever a controller would pick now
+    _dynamicResolution = false;
+    _renderScale = capture.renderScale;
+
+    //the camera comes from the capture, so the snapshot is written here instead of by publish_snapshot
+    SceneSnapshot& snapshot = _snapshots.write_buffer();
+    snapshot.tick = capture.frame;
+    snapshot.view = capture.view;
+    snapshot.projection = capture.projection;
+    snapshot.transforms.resize(_renderables.size());
+    for (size_t i = 0; i < _renderables.size(); i++) {
+        snapshot.transforms[i] = capture.objects[objectIndices[i]].transform;
+    }
+    _spatialRebuild = true;
+    snapshot.publishTime = std::chrono::steady_clock::now();
+    _snapshots.publish();
+    return true;
+}
+
+void VulkanEngine::update_simulation(float deltaTime) {
+    //no scene logic yet, the tick only advances the clock
+    _simulationTime += deltaTime;
+    _simulationTick++;
+
+    //only subtrees under nodes moved since the last tick are recomputed, a static scene costs nothing
+    _transforms.update(&_jobs);
+}
+
+void VulkanEngine::publish_snapshot() {
+    SceneSnapshot& snapshot = _snapshots.write_buffer();
+    snapshot.tick = _simulationTick;
+
+    //camera view
+    snapshot.view = glm::translate(glm::mat4(1.f), _camPos);
+    //camera projection
+    snapshot.projection = glm::perspective(glm::radians(70.f), (float)_windowExtent.width / (float)_windowExtent.height, 0.1f, 200.0f);
+    snapshot.projection[1][1] *= -1;
+
+    //only grows when renderables are added, steady state ticks do not allocate
+    snapshot.transforms.resize(_renderables.size());
+    for (size_t i = 0; i < _renderables.size(); i++) {
+        snapshot.transforms[i] = _transforms.get_world(_renderables[i].transform);
+    }
+
+    snapshot.publishTime = std::chrono::steady_clock::now();
+    _snapshots.publish();
+}
+
+bool VulkanEngine::handle_events() {
 	SDL_Event e;
 	bool bQuit = false;
 
-	//main loop
-	while (!bQuit)
+	//Handle events on queue
+	while (SDL_PollEvent(&e) != 0)
 	{
-		//Handle events on queue
-		while (SDL_PollEvent(&e) != 0)
-		{
-			//close the window when user alt-f4s or clicks the X button			
-			if (e.type == SDL_QUIT) { bQuit = true; }
-            else if (e.type == SDL_KEYDOWN){
-                // which key is it?
-                if(e.key.keysym.sym == SDLK_SPACE) {
-                    _selectedShader+=1;
-                    if (_selectedShader > 1) {
-                        // Toggle shader
-                        _selectedShader = 0;
-                    }
-                }
+        //any input may change what is on screen
+        mark_scene_dirty();
+
+		//close the window when user alt-f4s or clicks the X button
+		if (e.type == SDL_QUIT) { bQuit = true; }
+        else if (e.type == SDL_WINDOWEVENT) {
+            switch (e.window.event) {
+                case SDL_WINDOWEVENT_MINIMIZED: _windowMinimized = true; break;
+                case SDL_WINDOWEVENT_MAXIMIZED:
+                case SDL_WINDOWEVENT_RESTORED: _windowMinimized = false; break;
+                case SDL_WINDOWEVENT_HIDDEN: _windowHidden = true; break;
+                case SDL_WINDOWEVENT_SHOWN: _windowHidden = false; break;
+                case SDL_WINDOWEVENT_FOCUS_LOST: _windowFocused = false; break;
+                case SDL_WINDOWEVENT_FOCUS_GAINED: _windowFocused = true; break;
+                default: break;
             }
+        }
+        else if (e.type == SDL_KEYDOWN){
+            // which key is it?
+            if(e.key.keysym.sym == SDLK_F12) {
+                //named on the render thread, _frameNumber belongs to it
+                request_capture({});
+            }
+            else if(e.key.keysym.sym == SDLK_SPACE) {
+                //next permutation, drawn with a fallback until its pipeline is compiled
+                //only this thread writes it
+                _meshVariant.store((_meshVariant.load(std::memory_order_relaxed) + 1) % SHADER_VARIANT_COUNT, std::memory_order_relaxed);
+                mark_scene_dirty();
+            }
+        }
+
+	}
+
+    _renderSuspended = _windowMinimized || _windowHidden || (_suspendOnFocusLoss && !_windowFocused);
+	return !bQuit;
+}
 
-		}
+void VulkanEngine::log_frame_pacing() {
+    if (!_logFramePacing || !_pacer.stats_updated()) {
+        return;
+    }
+    PacingStats stats = _pacer.get_stats();
+    std::cout << "Frame pacing: " << stats.frames << " fps, avg " << stats.averageFrameMs << " ms, jitter "
+              << stats.jitterMs << " ms, max " << stats.maxFrameMs << " ms, cpu " << stats.cpuUtilization * 100.f << "%, record "
+              << _recordingStats.recordMs << " ms (" << _recordingStats.rerecorded << "/" << _recordingStats.chunks << " chunks recorded)"
+              << std::endl;
+
+    if (!_impostorKeys.empty()) {
+        const ImpostorStats& impostors = _impostorStats;
+        const float saved = impostors.verticesWithoutImpostors > 0
+                            ? 100.f * (1.f - (float)impostors.verticesSubmitted / (float)impostors.verticesWithoutImpostors) : 0.f;
+        std::cout << "Impostors: " << impostors.impostors << " quads (" << impostors.crossFading << " cross-fading), "
+                  << impostors.meshObjects << " meshes only, " << impostors.verticesSubmitted << " vertices instead of "
+                  << impostors.verticesWithoutImpostors << " (" << saved << "% fewer)" << std::endl;
+    }
+}
+
+void VulkanEngine::run()
+{
+    if (_decoupledSimulation) {
+        run_decoupled();
+        return;
+    }
+
+    auto lastFrame = std::chrono::steady_clock::now();
+
+	//main loop
+	while (handle_events())
+	{
+        //nothing to show, or nothing new to show: block on the event queue instead of spinning.
+        //the timeout keeps mark_scene_dirty from other threads responsive
+        if (_renderSuspended || (_idleWhenStatic && !_sceneDirty.exchange(false, std::memory_order_relaxed))) {
+            SDL_WaitEventTimeout(nullptr, 100);
+            //the pause is neither simulated time nor a long frame
+            lastFrame = std::chrono::steady_clock::now();
+            _pacer.reset();
+            continue;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        float deltaTime = std::chrono::duration<float>(now - lastFrame).count();
+        lastFrame = now;
+
+        update_simulation(deltaTime);
+        publish_snapshot();
 
 		draw();
+
+        _pacer.frame_finished();
+        log_frame_pacing();
 	}
+
+    PacingStats pacing = _pacer.get_stats();
+    std::cout << "Frame pacing: avg " << pacing.averageFrameMs << " ms, jitter " << pacing.jitterMs
+              << " ms, cpu " << pacing.cpuUtilization * 100.f << "%" << std::endl;
 }
 
+void VulkanEngine::run_decoupled()
+{
+    using clock = std::chrono::steady_clock;
+
+    std::atomic<bool> quit{false};
+
+    //the render thread never waits for the simulation, it redraws the last snapshot instead
+    std::thread renderThread([&]() {
+        //this thread records command buffers while the simulation thread, index 0, may steal its recording
+        //jobs from inside its own waits. each needs a recording context of its own
+        _jobs.register_thread();
+
+        uint32_t frames = 0;
+        auto windowStart = clock::now();
+        while (!quit.load(std::memory_order_relaxed)) {
+            //same idle rule as run(), polled since the event queue belongs to the simulation thread
+            if (_renderSuspended || (_idleWhenStatic && !_sceneDirty.exchange(false, std::memory_order_relaxed))) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                _pacer.reset();
+                continue;
+            }
+
+            draw();
+            _pacer.frame_finished();
+            log_frame_pacing();
+
+            frames++;
+            float elapsed = std::chrono::duration<float>(clock::now() - windowStart).count();
+            if (elapsed >= 1.f) {
+                _simulationStats.renderFramesPerSecond = frames / elapsed;
+                frames = 0;
+                windowStart = clock::now();
+            }
+        }
+    });
+
+    //SDL wants its events pumped from the thread that created the window, so the simulation stays here
+    const auto tickLength = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / _simulationRate));
+    const float tickSeconds = 1.f / _simulationRate;
 
+    auto nextTick = clock::now();
+    auto windowStart = nextTick;
+    uint32_t ticks = 0;
 
+    while (handle_events()) {
+        update_simulation(tickSeconds);
+        publish_snapshot();
+
+        ticks++;
+        float elapsed = std::chrono::duration<float>(clock::now() - windowStart).count();
+        if (elapsed >= 1.f) {
+            _simulationStats.simulationTicksPerSecond = ticks / elapsed;
+            ticks = 0;
+            windowStart = clock::now();
+        }
+
+        //fixed tick rate, if a tick overran skip ahead instead of bursting to catch up
+        nextTick += tickLength;
+        auto now = clock::now();
+        if (nextTick < now) {
+            nextTick = now;
+        }
+        std::this_thread::sleep_until(nextTick);
+    }
+
+    quit = true;
+    renderThread.join();
+
+    std::cout << "Simulation " << _simulationStats.simulationTicksPerSecond << " ticks/s, render "
+              << _simulationStats.renderFramesPerSecond << " fps, snapshot latency avg "
+              << _simulationStats.averageLatencyMs << " ms max " << _simulationStats.maxLatencyMs << " ms" << std::endl;
+}
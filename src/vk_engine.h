@@ -5,29 +5,149 @@
 
 #include <vk_types.h>
 #include <vector>
+#include <cassert>
 #include <functional>
 #include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include "vk_mesh.h"
+#include "vk_registry.h"
+#include "vk_jobs.h"
+#include "vk_snapshot.h"
+#include "vk_memory.h"
+#include "vk_resolution.h"
+#include "vk_capture.h"
+#include "vk_pacing.h"
+#include "vk_bindless.h"
+#include "vk_transform.h"
+#include "vk_allocator.h"
+#include "vk_variants.h"
+#include "vk_lights.h"
+#include "vk_rendergraph.h"
+#include "vk_spatial.h"
+#include "vk_streaming.h"
+#include "vk_vfs.h"
+#include "vk_readback.h"
+#include "vk_impostor.h"
 #include <glm/glm.hpp>
-#include <unordered_map>
 
 struct MeshPushConstants {
     glm::vec4 data;
-    glm::mat4 render_matrix;
+};
+
+//per object entry of the object storage buffer, indexed with gl_InstanceIndex
+struct GPUObjectData {
+    glm::mat4 renderMatrix;
+    //world space bounding sphere, xyz center and w radius
+    glm::vec4 sphereBounds;
+    //entry of the material table, only read by the bindless shaders
+    uint32_t materialIndex;
+    //1 draws the whole mesh, less dithers it out while its impostor fades in
+    float fade;
+    uint32_t pad[2];
+};
+
+//material table entry of the bindless path, indexed by the material's registry slot
+struct GPUMaterialData {
+    glm::vec4 baseColor;
+    BindlessIndex textureIndex;
+    uint32_t pad[3];
+};
+
+//bindless heap slots of the buffers the bindless mesh shaders read
+struct BindlessPushConstants {
+    BindlessIndex objectBuffer;
+    BindlessIndex materialBuffer;
+};
+
+//results of the depth prepass / occlusion culling path, from the last frame the gpu finished
+struct OcclusionStats {
+    uint32_t objectsTested;
+    uint32_t objectsOccluded;
+
+    float cullMs;
+    float prepassMs;
+    float mainPassMs;
+    float pyramidMs;
+
+    //prepass + main pass time of the last frame drawn without the occlusion test,
+    //and how much the test saves against it once its own cost is paid
+    float drawWithoutOcclusionMs;
+    float savedMs;
+};
+
+//results of the meshlet culling pass, from the last frame the gpu finished
+struct MeshletStats {
+    uint32_t meshletsTested;
+    uint32_t culledByFrustum;
+    uint32_t culledByBackface;
+    uint32_t trianglesSubmitted;
+};
+
+//one workgroup of the meshlet cull shader, the meshlets of one visible object
+struct GPUMeshletWork {
+    uint32_t objectIndex;
+    uint32_t firstMeshlet;
+    uint32_t meshletCount;
+    uint32_t pad;
+};
+
+struct FrameAllocationStats {
+    //operator new calls and bytes during the last draw()
+    uint64_t heapAllocations;
+    uint64_t heapBytes;
+    //allocations the driver made through the host callbacks during the last draw()
+    uint64_t hostAllocations;
+    //steady state frames that allocated at all
+    uint32_t flaggedFrames;
+};
+
+//one node of the startup graph, times are relative to the start of init()
+struct StartupPhase {
+    const char* name;
+    float startMs;
+    float durationMs;
+    //0 for the main thread, 1..N for job system workers
+    uint32_t thread;
+};
+
+struct StartupStats {
+    //init() from the first line to the scene being ready
+    float initMs;
+    //the first draw() on its own, pipelines and caches are cold here
+    float firstFrameMs;
+    //init() plus the first draw(), the number startup changes are measured against
+    float timeToFirstFrameMs;
 };
 
 struct Material {
     VkPipeline pipeline;
     VkPipelineLayout pipelineLayout;
+
+    //parameters of the bindless path, the per material pipelines ignore them
+    glm::vec4 baseColor{1.f};
+    BindlessIndex texture{0};
+};
+
+using MeshHandle = Handle<Mesh>;
+using MaterialHandle = Handle<Material>;
+
+//run of indirect draws that share a material
+struct IndirectBatch {
+    MaterialHandle material;
+    uint32_t first;
+    uint32_t count;
 };
 
 //a simple way to hold content for scenes
 struct RenderObject {
-    Mesh* mesh;
+    MeshHandle mesh;
 
-    Material* material;
+    MaterialHandle material;
 
-    glm::mat4 transformMatrix;
+    //node in _transforms, the world matrix is read from there when publishing a snapshot
+    TransformNode transform;
 };
 
 
@@ -36,8 +156,11 @@ struct RenderObject {
 //FIFO Queue to house Vulkan objects for deletion
 struct DeletionQueue{
     std::deque<std::function<void()>> deletors;
+    //startup phases on job threads push concurrently
+    std::mutex lock;
 
     void push_function(std::function<void()>&& function) {
+        std::lock_guard<std::mutex> guard(lock);
         deletors.push_back(function);
     }
 
@@ -50,6 +173,149 @@ struct DeletionQueue{
 
 };
 
+//resources for one-off transfer work outside of the frame loop
+struct UploadContext {
+    VkFence _uploadFence;
+    VkCommandPool _commandPool;
+    VkCommandBuffer _commandBuffer;
+};
+
+//a staging copy on the transfer queue, retired once the transfer timeline reaches its value
+struct PendingUpload {
+    uint64_t timelineValue;
+    VkCommandBuffer commandBuffer;
+    AllocatedBuffer stagingBuffer;
+    //graphics half of the queue ownership transfer, empty when both queues share a family
+    std::vector<VkBufferMemoryBarrier> acquireBarriers;
+};
+
+//uploads run on the transfer queue and overlap with rendering
+struct TransferContext {
+    VkCommandPool _commandPool;
+    std::vector<PendingUpload> _pending;
+};
+
+//async compute work of a frame: the occlusion test before graphics, the depth pyramid after it
+struct ComputeContext {
+    VkCommandPool _commandPool;
+    VkCommandBuffer _cullCommandBuffer;
+    VkCommandBuffer _pyramidCommandBuffer;
+};
+
+//semaphore waits and signals of one queue submission, binary semaphores ignore their value
+struct SubmitSync {
+    //fixed capacity, a frame builds several of these and none of them may touch the heap
+    static constexpr uint32_t MAX_SEMAPHORES = 4;
+
+    VkSemaphore waitSemaphores[MAX_SEMAPHORES];
+    uint64_t waitValues[MAX_SEMAPHORES];
+    VkPipelineStageFlags waitStages[MAX_SEMAPHORES];
+    uint32_t waitCount{0};
+    VkSemaphore signalSemaphores[MAX_SEMAPHORES];
+    uint64_t signalValues[MAX_SEMAPHORES];
+    uint32_t signalCount{0};
+
+    void wait(VkSemaphore semaphore, uint64_t value, VkPipelineStageFlags stage) {
+        assert(waitCount < MAX_SEMAPHORES);
+        waitSemaphores[waitCount] = semaphore;
+        waitValues[waitCount] = value;
+        waitStages[waitCount] = stage;
+        waitCount++;
+    }
+
+    void signal(VkSemaphore semaphore, uint64_t value) {
+        assert(signalCount < MAX_SEMAPHORES);
+        signalSemaphores[signalCount] = semaphore;
+        signalValues[signalCount] = value;
+        signalCount++;
+    }
+};
+
+//per thread pool of secondary command buffers for parallel recording
+struct RecordingContext {
+    VkCommandPool _commandPool;
+    std::vector<VkCommandBuffer> _commandBuffers;
+    uint32_t _used{0};
+};
+
+//secondary command buffer of one slice of the object list, kept across frames while its draws stay the same
+struct CachedChunk {
+    //one pool per chunk so any thread can reset and re-record it
+    VkCommandPool _commandPool;
+    VkCommandBuffer _commandBuffer;
+    //what the commands were recorded from, 0 until the first recording
+    uint64_t _hash{0};
+    //this frame's visible objects of the slice, a range of _visibleObjects
+    uint32_t _first;
+    uint32_t _count;
+    bool _rerecorded;
+};
+
+struct RecordingStats {
+    //non empty chunks executed by the main pass
+    uint32_t chunks;
+    //chunks recorded this frame, the rest were executed as recorded before
+    uint32_t rerecorded;
+    //cpu time spent recording the main pass
+    float recordMs;
+};
+
+//camera of one render_views image
+struct OffscreenView {
+    glm::mat4 view;
+    glm::mat4 projection;
+};
+
+struct OffscreenSettings {
+    //image size of every view
+    VkExtent2D tileExtent{256, 256};
+    //views per submission, tiled into one atlas. lowered to what fits the largest image the device supports
+    uint32_t viewsPerBatch{64};
+};
+
+struct OffscreenStats {
+    uint32_t views;
+    uint32_t batches;
+    //objects drawn, summed over the views
+    uint64_t draws;
+    //visible objects left out of views that see more than _offscreenObjectCapacity on their own
+    uint64_t droppedDraws;
+    //the whole render_views call, from culling the first batch to handing out the last view
+    float totalMs;
+    float viewsPerSecond;
+};
+
+//rgba8 pixels of one view, tileExtent sized with tightly packed rows. only valid during the call
+using OffscreenCallback = std::function<void(uint32_t view, const uint8_t* pixels)>;
+
+//targets, buffers and commands of one render_views batch. there are two, one is read back while the other renders
+struct OffscreenBatch {
+    //the views tiled into one image in the draw format, so the material pipelines render into it as they are
+    AllocatedImage _colorImage;
+    VkImageView _colorView;
+    AllocatedImage _depthImage;
+    VkImageView _depthView;
+    //the atlas blitted to rgba8, copied from here into the readback buffer one view after the other
+    AllocatedImage _outputImage;
+    VkFramebuffer _framebuffer;
+
+    //object data of every view in the batch, each view's draws point at their own entries
+    AllocatedBuffer _objectBuffer;
+    GPUObjectData* _objectData;
+    VkDescriptorSet _descriptor;
+
+    AllocatedBuffer _readbackBuffer;
+    uint8_t* _readback;
+
+    VkCommandPool _commandPool;
+    VkCommandBuffer _commandBuffer;
+
+    //graphics timeline value of the submission, 0 when nothing is waiting to be read back
+    uint64_t _timelineValue{0};
+    uint32_t _firstView;
+    uint32_t _viewCount;
+};
+
 // pipelines
 
 class PipelineBuilder {
@@ -58,13 +324,13 @@ public:
     std::vector<VkPipelineShaderStageCreateInfo> _shaderStages;
     VkPipelineVertexInputStateCreateInfo _vertexInputInfo;
     VkPipelineInputAssemblyStateCreateInfo _inputAssembly;
-    VkViewport _viewport;
-    VkRect2D _scissor;
     VkPipelineRasterizationStateCreateInfo _rasterizer;
     VkPipelineColorBlendAttachmentState _colorBlendAttachment;
     VkPipelineMultisampleStateCreateInfo _multisampling;
     VkPipelineLayout _pipelineLayout;
     VkPipelineDepthStencilStateCreateInfo _depthStencil;
+    //0 for depth only passes
+    uint32_t _colorAttachmentCount{1};
 
     VkPipeline build_pipeline(VkDevice device, VkRenderPass pass);
 };
@@ -73,7 +339,7 @@ public:
 class VulkanEngine {
 public:
 
-    VkSwapchainKHR  _swapchain;
+    VkSwapchainKHR  _swapchain{VK_NULL_HANDLE};
     // image format expected by the windowing system
     VkFormat _swapchainImageFormat;
 
@@ -87,19 +353,79 @@ public:
     VkDebugUtilsMessengerEXT _debug_messenger; //Debug handle
     VkPhysicalDevice _chosenGPU; // physical device
     VkDevice _device;  // vulkan interface to chosen device
-    VkSurfaceKHR _surface; // chosen window surface
+    VkSurfaceKHR _surface{VK_NULL_HANDLE}; // chosen window surface
 
     VkQueue _graphicsQueue; //queue to submit too
     uint32_t _graphicsQueueFamily; //family of that queue
 
+    //dedicated queues when the device exposes them, otherwise they alias the graphics queue
+    VkQueue _computeQueue;
+    uint32_t _computeQueueFamily;
+    VkQueue _transferQueue;
+    uint32_t _transferQueueFamily;
+
+    //one timeline per queue holding the last value submitted to it, frames wait on these instead of a fence
+    VkSemaphore _graphicsTimeline;
+    VkSemaphore _computeTimeline;
+    VkSemaphore _transferTimeline;
+    uint64_t _graphicsTimelineValue{0};
+    uint64_t _computeTimelineValue{0};
+    uint64_t _transferTimelineValue{0};
+    //last transfer value a graphics submission has waited for
+    uint64_t _transferValueAcquired{0};
+
+    ComputeContext _computeContext;
+    TransferContext _transferContext;
+
     VkCommandPool _commandPool; //holds commands to issue
     VkCommandBuffer _mainCommandBuffer; //buffer to execute commands
+    //upscale and present transition, submitted separately so the depth pyramid can overlap it
+    VkCommandBuffer _upscaleCommandBuffer;
 
+    //compatibility template for the main pass pipelines and secondaries, the graph makes the real ones
     VkRenderPass _renderPass;
-    std::vector<VkFramebuffer> _framebuffers;
 
+    //the passes of _mainCommandBuffer, rebuilt every frame. barriers, load and store ops come from it
+    RenderGraph _renderGraph;
+
+    //scene is rendered offscreen at _drawExtent and upscaled into the swapchain image.
+    //the targets are allocated at window size, lower resolutions use their top left corner
+    AllocatedImage _drawImage;
+    VkImageView _drawImageView;
+    VkFormat _drawImageFormat;
+    VkExtent2D _drawExtent;
+
+    //scale the render resolution to hold the controller's target gpu frame time
+    bool _dynamicResolution{false};
+    ResolutionController _resolution;
+    //render scale while _dynamicResolution is off
+    float _renderScale{1.f};
+    //whole frame on the gpu, from the timestamps of the last finished frame
+    float _gpuFrameMs{0.f};
+    //cpu side of the last draw(), from the frame wait to the graphics submit
+    float _cpuFrameMs{0.f};
+
+    //no window, surface or swapchain. frames stay in the draw image, used by the replay tool
+    bool _headless{false};
+
+    //every frame is read back and written here when set, see FrameReadback for the targets
+    std::string _readbackTarget;
+    FrameReadback _readback;
+    //the final image converted to rgba8 at window size, copied from here into the readback slot
+    AllocatedImage _readbackImage;
+    //this frame's slot, VK_NULL_HANDLE when readback is off or the ring was full
+    VkBuffer _readbackBuffer{VK_NULL_HANDLE};
+
+    //writes a FrameCapture of the next frame when set, F12 requests one at runtime. request_capture runs on the
+    //event thread, the render thread takes the path under the lock
+    std::atomic<bool> _captureRequested{false};
+    std::mutex _captureLock;
+    std::string _capturePath;
+    //captures this frame number once, -1 disables it
+    int _captureAtFrame{-1};
+
+    //swapchain acquire and present can only use binary semaphores
     VkSemaphore _presentSemaphore, _renderSemaphore;
-    VkFence _renderFence;
 
     VkPipelineLayout _trianglePipelineLayout;
 
@@ -108,25 +434,340 @@ public:
 
     DeletionQueue _mainDeletionQueue;
 
+    std::chrono::steady_clock::time_point _startupBegin;
+    //filled concurrently by the startup jobs, logged after the first frame
+    std::vector<StartupPhase> _startupPhases;
+    std::mutex _startupLock;
+    StartupStats _startupStats{};
+
+    //spir-v read ahead of device creation, load_shader_module takes files from here and
+    //falls back to the pack or the disk. only filled during startup
+    std::unordered_map<std::string, AssetData> _shaderCache;
+    //parsed on a job during device creation, moved into the mesh registry by load_meshes
+    std::vector<std::pair<std::string, Mesh>> _parsedMeshes;
+
+    //every asset and shader in one mapped file made by the AssetPack target, mounted over "../".
+    //paths it does not have are read as loose files, an empty path never opens one
+    std::string _assetPackPath{"../assets.pak"};
+    AssetPack _assetPack;
+    //drops the pack and the loose asset files from the os cache before init(), so the startup
+    //numbers are cold cache ones. linux only
+    bool _coldStart{false};
+
+    //host memory of every Vulkan object goes through the tracked callbacks
+    VkAllocationCallbacks* _hostCallbacks{host_allocator().callbacks()};
+
+    //report steady state frames that allocate, and assert on them in debug builds
+    bool _assertNoFrameAllocations{false};
+    //frames after startup that may still allocate, lazily grown containers settle in this window
+    uint32_t _allocationWarmupFrames{60};
+    //per scope host allocations and per frame heap counts at shutdown
+    bool _logAllocations{false};
+    FrameAllocationStats _frameAllocations{};
+    //scratch for the acquire barriers of finished uploads, kept to not allocate every frame
+    std::vector<VkBufferMemoryBarrier> _acquireBarriers;
+
     VmaAllocator _allocator;
 
+    //budget polling, per category accounting and defragmentation of the allocator above
+    GpuMemoryTracker _gpuMemory;
+    bool _memoryBudgetSupported{false};
+    //frames between memory log lines, 0 disables it
+    uint32_t _memoryLogInterval{1000};
+    //warn when a heap goes over this fraction of its budget
+    float _memoryWarningThreshold{0.9f};
+    //over the threshold a defragmentation starts on its own, at most once per _defragmentationInterval frames
+    bool _defragmentWhenOverBudget{true};
+    int _defragmentationInterval{600};
+    int _nextDefragmentationFrame{0};
+    //set by request_defragmentation from any thread, the render thread starts it in update_memory
+    std::atomic<bool> _defragmentationRequested{false};
+
     VkPipeline _meshPipeline;
-    Mesh _triangleMesh;
-    Mesh _monkeyMesh;
+
+    //every permutation of tri_mesh.vert + colored_triangle.frag, _meshPipeline is the base variant.
+    //the builder, vertex layout and modules stay alive because variants compile at any time
+    PipelineVariantCache _meshVariants;
+    PipelineBuilder _meshVariantBuilder;
+    VertexInputDescription _meshVertexDescription;
+    VkShaderModule _meshVertShader{VK_NULL_HANDLE};
+    VkShaderModule _meshFragShader{VK_NULL_HANDLE};
+    MaterialHandle _defaultMaterial;
+
+    UploadContext _uploadContext;
+
+    //all mesh vertices and indices are sub-allocated from here
+    GeometryPool _geometryPool;
 
     VkPipelineLayout _meshPipelineLayout;
 
-    VkImageView _depthImageView;
-    AllocatedImage _depthImage;
+    //only created when the depth pyramid samples it, otherwise depth is a render graph transient
+    VkImageView _depthImageView{VK_NULL_HANDLE};
+    AllocatedImage _depthImage{};
 
     VkFormat _depthFormat;
 
+    VkDescriptorPool _descriptorPool;
+
+    //object storage buffer, rewritten by cull_objects every frame
+    VkDescriptorSetLayout _objectSetLayout;
+    VkDescriptorSet _objectDescriptor;
+    AllocatedBuffer _objectBuffer;
+    GPUObjectData* _objectData;
+    uint32_t _maxObjects{65536};
+
+    //gpu driven path: indirect draws, optional depth prepass and hi-z occlusion culling.
+    //with both off the cpu recording path below is used
+    bool _depthPrepass{false};
+    bool _occlusionCulling{false};
+    //every this many frames the occlusion test is skipped to measure what it saves
+    uint32_t _occlusionBaselineInterval{240};
+    bool _multiDrawIndirect{false};
+    //indirect draws pass the object index as firstInstance, the gpu driven paths are off without it
+    bool _drawIndirectFirstInstance{false};
+
+    //one pipeline and one global descriptor set for every material, needs descriptor indexing.
+    //objects find their material parameters and textures by index instead of through binds
+    bool _bindless{false};
+    BindlessHeap _bindlessHeap;
+    VkPipelineLayout _bindlessPipelineLayout;
+    VkPipeline _bindlessPipeline;
+    AllocatedBuffer _materialBuffer;
+    GPUMaterialData* _materialData{nullptr};
+    uint32_t _maxMaterials{1024};
+    BindlessIndex _objectBufferIndex;
+    BindlessIndex _materialBufferIndex;
+    //1x1 white texture in bindless slot 0, sampled by materials without a texture
+    AllocatedImage _whiteTexture;
+    VkImageView _whiteTextureView;
+    VkSampler _textureSampler;
+
+    AllocatedBuffer _drawCommandBuffer;
+    VkDrawIndexedIndirectCommand* _drawCommands;
+    std::vector<IndirectBatch> _indirectBatches;
+
+    //compatibility template for the depth only pipeline
+    VkRenderPass _depthPrepassRenderPass;
+    VkPipeline _depthPrepassPipeline;
+
+    //max depth pyramid of the previous frame
+    AllocatedImage _depthPyramid;
+    VkImageView _depthPyramidView;
+    VkImageView _depthPyramidMips[16];
+    uint32_t _depthPyramidWidth;
+    uint32_t _depthPyramidHeight;
+    uint32_t _depthPyramidLevels;
+    VkSampler _depthSampler;
+    bool _depthPyramidValid{false};
+    glm::mat4 _depthPyramidViewProj;
+
+    VkDescriptorSetLayout _reduceSetLayout;
+    VkDescriptorSet _reduceDescriptors[16];
+    VkPipelineLayout _reducePipelineLayout;
+    VkPipeline _reducePipeline;
+
+    VkDescriptorSetLayout _cullSetLayout;
+    VkDescriptorSet _cullDescriptor;
+    VkPipelineLayout _cullPipelineLayout;
+    VkPipeline _cullPipeline;
+    AllocatedBuffer _cullStatsBuffer;
+    uint32_t* _cullStats;
+    bool _occlusionTestedLastFrame{false};
+    bool _baselineLastFrame{false};
+
+    //splits meshes into meshlets at load and culls those on the gpu against the frustum and their normal
+    //cone, the survivors are drawn from a compacted indirect list. replaces the prepass/occlusion path
+    bool _meshletCulling{false};
+    bool _drawIndirectCount{false};
+    //detected and reported only, meshlets are drawn through the indirect path
+    bool _meshShaderSupported{false};
+    uint32_t _maxMeshlets{65536};
+    uint32_t _maxMeshletDraws{262144};
+    uint32_t _meshletCount{0};
+    AllocatedBuffer _meshletBuffer;
+    GPUMeshlet* _meshletData;
+    AllocatedBuffer _meshletWorkBuffer;
+    GPUMeshletWork* _meshletWork;
+    uint32_t _meshletWorkCount{0};
+    //meshlets of the objects in the work list, the upper bound of this frame's draws
+    uint32_t _meshletWorkMeshlets{0};
+    AllocatedBuffer _meshletDrawBuffer;
+    //draw count followed by the counters of MeshletStats, also the count buffer of the indirect draw
+    AllocatedBuffer _meshletCountBuffer;
+    uint32_t* _meshletCounts;
+    VkDescriptorSetLayout _meshletSetLayout;
+    VkDescriptorSet _meshletDescriptor;
+    VkPipelineLayout _meshletPipelineLayout;
+    VkPipeline _meshletPipeline;
+    bool _meshletsCulledLastFrame{false};
+    MeshletStats _meshletStats{};
+    //prints _meshletStats every 240 frames
+    bool _logMeshletStats{false};
+
+    //clustered point lights, shaded by the LIGHTING mesh variant. the lights are binned into a view
+    //space cluster grid on the gpu every frame and fragments only loop over their cluster's list
+    uint32_t _lightCount{0};
+    uint32_t _maxLights{16384};
+    //lights the light buffer holds, fixed by init()
+    uint32_t _lightCapacity{0};
+    std::vector<PointLight> _lights;
+    ClusterGrid _clusterGrid;
+    AllocatedBuffer _lightBuffer;
+    GPUPointLight* _lightData;
+    AllocatedBuffer _clusterParamsBuffer;
+    GPUClusterParams* _clusterParams;
+    AllocatedBuffer _clusterBoundsBuffer;
+    GPUClusterBounds* _clusterBoundsData;
+    AllocatedBuffer _clusterCountBuffer;
+    AllocatedBuffer _clusterIndexBuffer;
+    VkDescriptorSetLayout _lightCullSetLayout;
+    VkDescriptorSet _lightCullDescriptor;
+    VkPipelineLayout _lightCullPipelineLayout;
+    VkPipeline _lightCullPipeline;
+
+    VkQueryPool _timestampPool;
+    float _timestampPeriod;
+    //timestamps can be missing on the compute family even when graphics has them
+    bool _computeTimestamps{false};
+    OcclusionStats _occlusionStats{};
+    //light cull and main pass of the last finished frame with lights
+    LightPassTimings _lightPassTimings{};
+
     std::vector<RenderObject> _renderables;
 
-    std::unordered_map<std::string, Material> _materials;
-    std::unordered_map<std::string, Mesh> _meshes;
+    //engine owned scheduler, used by loading, scene setup, culling and command recording
+    JobSystem _jobs;
+
+    //indexed by JobSystem::thread_index()
+    std::vector<RecordingContext> _recordingContexts;
+    std::vector<VkCommandBuffer> _chunkCommands;
+
+    //objects per secondary command buffer when recording in parallel
+    uint32_t _recordChunkSize{256};
+    bool _parallelRecording{true};
+
+    //parallel recording keeps the secondary of every _recordChunkSize slice of _renderables and only
+    //re-records slices whose visible objects, meshes or materials changed. transforms are read from the
+    //object buffer, so moving objects does not touch the commands
+    bool _cacheCommands{true};
+    std::vector<CachedChunk> _cachedChunks;
+    RecordingStats _recordingStats{};
+
+    //render_views state, made on the first call. the targets are made again when the atlas layout changes
+    OffscreenBatch _offscreenBatches[2];
+    VkRenderPass _offscreenRenderPass{VK_NULL_HANDLE};
+    VkDescriptorPool _offscreenDescriptorPool{VK_NULL_HANDLE};
+    //cluster params with no lights, the LIGHTING variant then only applies its fixed light
+    AllocatedBuffer _offscreenParamsBuffer;
+    VkExtent2D _offscreenTile{0, 0};
+    uint32_t _offscreenColumns{0};
+    uint32_t _offscreenRows{0};
+    //object entries per batch, a batch ends early when its views would need more
+    uint32_t _offscreenObjectCapacity{131072};
+    //every view is culled against one tree built from the snapshot
+    AabbTree _offscreenIndex;
+    std::vector<glm::vec4> _offscreenSpheres;
+    std::vector<Aabb> _offscreenBoxes;
+    //visible objects per view of the batch being built, and where its object entries start
+    std::vector<std::vector<uint32_t>> _offscreenVisible;
+    std::vector<uint32_t> _offscreenFirstObject;
+    std::vector<VkBufferImageCopy> _offscreenCopies;
+    OffscreenStats _offscreenStats{};
+    //limits.maxImageDimension2D, bounds the atlas
+    uint32_t _maxImageDimension{4096};
+
+    //visible objects smaller than _impostorPixels on screen are drawn as camera facing quads that sample the
+    //mesh baked from the closest of IMPOSTOR_VIEWS directions. between that size and _impostorFadeRange times
+    //more the mesh and the quad are both drawn and dither into each other. 0 disables impostors
+    float _impostorPixels{0.f};
+    float _impostorFadeRange{0.5f};
+    //square tile of one baked view, lowered to what fits the largest image the device supports
+    uint32_t _impostorTileSize{64};
+    //(mesh, material) pairs chosen at startup, one atlas row each. a mesh is baked with the material of the
+    //first renderable that uses it, objects with another material stay meshes
+    uint32_t _maxImpostorMeshes{16};
+    std::vector<std::pair<MeshHandle, MaterialHandle>> _impostorKeys;
+    //atlas row per mesh registry slot, UINT32_MAX for meshes without one
+    std::vector<uint32_t> _impostorRows;
+    //material pipeline each row was baked with. the mesh variant changing, or its compiled pipeline replacing
+    //the fallback, re-bakes the atlas so far objects are shaded like the meshes they fade into
+    std::vector<VkPipeline> _impostorBakedPipelines;
+    //the selected mesh variant compiled or failed for good, set by select_mesh_variant.
+    //until then the material draws with a fallback that is not worth baking
+    bool _meshVariantSettled{true};
+    VkExtent2D _impostorTile{0, 0};
+    AllocatedImage _impostorAtlas;
+    VkImageView _impostorAtlasView;
+    VkSampler _impostorSampler;
+    VkDescriptorSetLayout _impostorSetLayout;
+    VkDescriptorSet _impostorDescriptor;
+    VkPipelineLayout _impostorPipelineLayout;
+    VkPipeline _impostorPipeline;
+    //this frame's quads, written by select_impostors
+    AllocatedBuffer _impostorBuffer;
+    GPUImpostorInstance* _impostorData;
+    uint32_t _impostorCount{0};
+    ImpostorPushConstants _impostorConstants;
+    //per visible object, tile UINT32_MAX keeps it a mesh
+    std::vector<GPUImpostorInstance> _impostorCandidates;
+    ImpostorStats _impostorStats{};
+
+    //per frame results of cull_objects, indexed like _renderables
+    std::vector<glm::vec4> _objectSpheres;
+    std::vector<uint8_t> _objectMoved;
+    std::vector<uint32_t> _visibleObjects;
 
-    int _selectedShader{0};
+    //world bounds of the renderables, proxy i is renderable i. rebuilt when the scene is replaced
+    AabbTree _spatialIndex;
+    bool _spatialRebuild{true};
+
+    //chunk pack made by import_world, streamed around the camera. empty for no world.
+    //every chunk has a renderable and a mesh from the start, the mesh is empty while the chunk is not resident
+    std::string _worldPath;
+    ChunkStreamer _streamer;
+    std::vector<MeshHandle> _chunkMeshes;
+
+    // resources are owned by the registries, everything else holds handles into them
+    Registry<Material> _materials;
+    Registry<Mesh> _meshes;
+
+    //ShaderVariantBits of the default mesh material, space cycles through them on the event thread while the
+    //render thread reads it
+    std::atomic<uint32_t> _meshVariant{0};
+
+    //simulation state, owned by whichever thread runs the simulation
+    glm::vec3 _camPos{0.f, -6.f, -10.f};
+    uint64_t _simulationTick{0};
+    double _simulationTime{0.0};
+
+    //run simulation and input on the main thread at _simulationRate and render on a second thread
+    bool _decoupledSimulation{false};
+    float _simulationRate{120.f};
+
+    //simulation publishes, draw() renders whatever was published last
+    TripleBuffer<SceneSnapshot> _snapshots;
+    SimulationStats _simulationStats;
+
+    //scene graph owned by the simulation thread, renderables point into it
+    TransformHierarchy _transforms;
+
+    //frame rate cap (FramePacer::targetFps) and pacing measurements of the main loop
+    FramePacer _pacer;
+    bool _logFramePacing{false};
+
+    //window state from SDL, nothing is rendered while the window can not be seen
+    bool _windowMinimized{false};
+    bool _windowHidden{false};
+    bool _windowFocused{true};
+    bool _suspendOnFocusLoss{true};
+    //read by the render thread in decoupled mode
+    std::atomic<bool> _renderSuspended{false};
+
+    //skip frames until an event arrives or mark_scene_dirty is called. the single threaded loop blocks on
+    //the event queue, the decoupled render thread polls. mark_scene_dirty may come from any thread,
+    //the loop drawing consumes the flag with exchange
+    bool _idleWhenStatic{false};
+    std::atomic<bool> _sceneDirty{true};
 
 	bool _isInitialized{ false };
 	int _frameNumber {0};
@@ -135,13 +776,88 @@ public:
 
 	struct SDL_Window* _window{ nullptr };
 
-    Material* create_material(VkPipeline pipeline, VkPipelineLayout layout, const std::string& name);
+    MaterialHandle create_material(VkPipeline pipeline, VkPipelineLayout layout, const std::string& name,
+                                   const glm::vec4& baseColor = glm::vec4(1.f), BindlessIndex texture = 0);
+
+    //name lookups hash, resolve once and keep the handle
+    MaterialHandle get_material(NameId name) const;
+
+    MeshHandle get_mesh(NameId name) const;
+
+    //draws the listed renderables using the matrices computed by cull_objects
+    void draw_objects(VkCommandBuffer cmd, const uint32_t* objectIndices, int count);
+
+    //frustum culls every renderable and writes its object buffer entry, in parallel
+    void cull_objects(const SceneSnapshot& snapshot);
+
+    const OcclusionStats& get_occlusion_stats() const { return _occlusionStats; }
+
+    const MeshletStats& get_meshlet_stats() const { return _meshletStats; }
+
+    //replaces the lights with view space ones and averages the light cull and main pass gpu times over
+    //frames draws. needs lights at init(), count can not go past the light count init() sized the buffer for
+    bool measure_light_passes(const GPUPointLight* viewLights, uint32_t count, uint32_t frames, LightPassTimings& out);
+
+    float get_render_scale() const { return _dynamicResolution ? _resolution.scale() : _renderScale; }
+
+    //captures the next frame drawn into the file, an empty path names it after that frame's number.
+    //safe to call from any thread
+    void request_capture(const std::string& path);
+
+    //replaces the scene, camera and render settings with a capture. drawCount limits the scene to
+    //a slice of the captured draw list, UINT32_MAX keeps every captured object
+    bool apply_capture(const FrameCapture& capture, uint32_t firstDraw, uint32_t drawCount);
+
+    //advances scene logic by one tick
+    void update_simulation(float deltaTime);
+
+    //copies the render relevant simulation state into the triple buffer
+    void publish_snapshot();
+
+    const SimulationStats& get_simulation_stats() const { return _simulationStats; }
+
+    const TransformStats& get_transform_stats() const { return _transforms.get_stats(); }
+
+    //forces a frame while _idleWhenStatic is waiting for changes
+    void mark_scene_dirty() { _sceneDirty.store(true, std::memory_order_relaxed); }
 
-    Material* get_material(const std::string& name);
+    PacingStats get_pacing_stats() const { return _pacer.get_stats(); }
 
-    Mesh* get_mesh(const std::string& name);
+    //records commands with the function and blocks until the gpu has executed them
+    void immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function);
 
-    void draw_objects(VkCommandBuffer cmd, RenderObject* first, int count);
+    //shared buffers are concurrent between the graphics and compute families, no ownership transfers needed
+    AllocatedBuffer create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, MemoryCategory category,
+                                  bool sharedWithCompute = false);
+
+    void destroy_buffer(const AllocatedBuffer& buffer);
+
+    GpuMemoryStats get_memory_stats() const { return _gpuMemory.get_stats(); }
+
+    const FrameAllocationStats& get_frame_allocation_stats() const { return _frameAllocations; }
+
+    const StartupStats& get_startup_stats() const { return _startupStats; }
+
+    VariantCacheStats get_variant_stats() const { return _meshVariants.get_stats(); }
+
+    StreamingStats get_streaming_stats() const { return _streamer.get_stats(); }
+
+    const RecordingStats& get_recording_stats() const { return _recordingStats; }
+
+    //renders the newest scene snapshot once per view, headless or next to a window. views are culled on the
+    //job system and tiled into an atlas, viewsPerBatch of them per submission, and a batch is read back
+    //while the next one renders. onView gets every view in order before this returns.
+    //call it between frames, from the thread that calls draw(). lights and the bindless path are not used
+    bool render_views(const OffscreenView* views, uint32_t count, const OffscreenSettings& settings, const OffscreenCallback& onView);
+
+    const OffscreenStats& get_offscreen_stats() const { return _offscreenStats; }
+
+    ReadbackStats get_readback_stats() const { return _readback.get_stats(); }
+
+    const ImpostorStats& get_impostor_stats() const { return _impostorStats; }
+
+    //starts moving buffers to compact device memory on the next frame, one pass is done per frame
+    void request_defragmentation();
 
 	//initializes everything in the engine
 	void init();
@@ -167,16 +883,187 @@ private:
 
     void init_default_renderpass();
 
-    void init_framebuffers();
-
     void init_sync_structures();
 
+    //runs the phase and records its timing, safe to call from any startup job
+    void timed_phase(const char* name, const std::function<void()>& phase);
+
+    //prints the phase breakdown and time to first frame, called at the end of the first draw()
+    void finish_startup();
+
+    //the pack entry if there is one, the loose file otherwise
+    bool read_asset(const char* path, AssetData& out);
+
+    //reads every shader the startup pipelines use into _shaderCache, no device needed
+    void read_shaders();
+
     bool load_shader_module(const char* filePath, VkShaderModule* outShaderModule);
 
     void init_pipelines();
 
+    void init_descriptors();
+
+    void init_geometry_pool();
+
+    //bindless heap, material table and default texture, only when _bindless is set
+    void init_bindless();
+
+    //device local RGBA8 texture ready for sampling, uploaded with immediate_submit
+    AllocatedImage upload_texture(VkExtent2D extent, const void* rgbaPixels);
+
+    //points the default material at the requested mesh variant, or the closest one while it compiles
+    void select_mesh_variant();
+
+    //depth pyramid, reduce and cull compute pipelines, timestamp queries
+    void init_occlusion_culling();
+
+    //meshlet cull pipeline and its descriptor set, only when _meshletCulling is set
+    void init_meshlet_culling();
+
+    //light binning pipeline and its descriptor set, only when there are lights
+    void init_light_culling();
+
+    bool build_compute_pipeline(const char* shaderPath, VkPipelineLayout layout, VkPipeline* outPipeline);
+
+    //obj parsing and procedural meshes into _parsedMeshes, no device needed. the flag is read once at startup
+    void parse_meshes(bool buildMeshlets);
+
+    //moves the parsed meshes into the registry and uploads them
     void load_meshes();
 
+    //copies on the transfer queue without waiting, the next frame picks the mesh up
     void upload_mesh(Mesh& mesh);
 
+    //frees staging buffers of uploads the transfer queue has finished
+    void retire_uploads();
+
+    //frees the geometry of chunks the streamer dropped and uploads the ones it read, after the frame wait
+    void update_streaming(const SceneSnapshot& snapshot);
+
+    void submit(VkQueue queue, VkCommandBuffer cmd, const SubmitSync& sync);
+
+    //records the visible objects into secondary command buffers across the job system.
+    //the framebuffer is the one the render graph begins the main pass with
+    void record_parallel(VkFramebuffer framebuffer);
+
+    VkCommandBuffer get_secondary_command_buffer(RecordingContext& context);
+
+    //like record_parallel, but reuses the secondaries of chunks that hash the same as last frame.
+    //they are recorded without a framebuffer so a new render graph framebuffer does not invalidate them
+    void record_cached();
+
+    //hash of the state draw_objects bakes into every chunk
+    uint64_t draw_state_hash() const;
+
+    //starts the readback consumer and makes the rgba8 image frames are converted into
+    void init_readback();
+
+    //scales the draw image into _readbackImage, then copies it into this frame's slot
+    void convert_readback(VkCommandBuffer cmd);
+
+    void copy_readback(VkCommandBuffer cmd);
+
+    //records the acquire barriers of uploads the graphics queue has not seen yet, and makes the submit wait for them
+    void acquire_uploads(VkCommandBuffer cmd, SubmitSync& sync);
+
+    //makes the render_views resources on the first call, and the batch targets again for a new atlas layout
+    void prepare_offscreen(VkExtent2D tile, uint32_t columns, uint32_t rows);
+
+    void destroy_offscreen_targets();
+
+    //culls up to count views from first and fills the batch's object entries, returns how many views fit
+    uint32_t build_offscreen_batch(OffscreenBatch& batch, const OffscreenView* views, uint32_t first, uint32_t count,
+                                   const SceneSnapshot& snapshot);
+
+    void record_offscreen_batch(OffscreenBatch& batch, bool acquireUploads);
+
+    //waits for the batch and hands its views to the callback
+    void read_offscreen_batch(OffscreenBatch& batch, const OffscreenCallback& onView);
+
+    //bakes the atlas and builds the impostor pipeline, only when _impostorPixels is set
+    void init_impostors();
+
+    //renders every key from every impostor direction into its atlas row, waits for the gpu
+    void bake_impostors(VkExtent2D tile);
+
+    //true when a key's material now draws with another pipeline than the atlas was baked with
+    bool impostors_stale() const;
+
+    //moves visible objects under the size threshold from _visibleObjects to the impostor quads, and
+    //gives the ones cross-fading both
+    void select_impostors(const SceneSnapshot& snapshot);
+
+    //one instanced draw of every quad, inside the main pass after the meshes
+    void draw_impostors(VkCommandBuffer cmd);
+
+    //fills the indirect command buffer from the visible list, one batch per material run
+    void build_indirect_draws();
+
+    void draw_indirect(VkCommandBuffer cmd, bool depthOnly);
+
+    //the only state the bindless path binds, once per command buffer
+    void bind_bindless(VkCommandBuffer cmd);
+
+    //viewport and scissor are dynamic, every command buffer that draws sets them
+    void set_draw_viewport(VkCommandBuffer cmd);
+
+    //picks this frame's _drawExtent from the resolution controller
+    void update_draw_extent();
+
+    //linear blit of the draw image into the swapchain image, leaves it ready to present
+    void upscale_to_swapchain(VkCommandBuffer cmd, VkImage swapchainImage);
+
+    //zeroes the instance count of every draw hidden behind last frame's depth pyramid, on the compute queue
+    void cull_occlusion(VkCommandBuffer cmd);
+
+    //one work entry per visible object for the meshlet cull shader
+    void build_meshlet_work();
+
+    //culls the meshlets of the work list into the compacted draw list, a render graph pass before the draws
+    void cull_meshlets(VkCommandBuffer cmd);
+
+    //without bindless the meshlet draws bind the default material only, turns meshlet culling off
+    //for scenes that use any other material instead of drawing them wrong
+    void check_meshlet_materials();
+
+    void draw_meshlets(VkCommandBuffer cmd);
+
+    //cluster params for this frame's projection and draw extent, lights moved into view space
+    void update_lights(const SceneSnapshot& snapshot);
+
+    //bins the lights into the cluster grid, a render graph pass before the draws
+    void cull_lights(VkCommandBuffer cmd);
+
+    //declares this frame's passes of the main command buffer, draw() compiles and executes the graph
+    void build_render_graph();
+
+    //the scene draw inside the main pass, whichever recording path is active
+    void draw_main_pass(const RGPassContext& context);
+
+    //reduces the depth image on the compute queue once graphics released it
+    void build_depth_pyramid(VkCommandBuffer cmd, const glm::mat4& viewProj);
+
+    //acquire half of the depth image handoff from graphics to compute, the render graph records the
+    //release. skipped when both queues share a family
+    VkImageMemoryBarrier depth_to_compute_barrier(VkAccessFlags srcAccess, VkAccessFlags dstAccess) const;
+
+    //reads back timestamps and occlusion counters of the frame that just finished
+    void read_gpu_stats();
+
+    void capture_frame(const SceneSnapshot& snapshot, const std::string& path);
+
+    //drains the SDL queue, returns false once the window was closed
+    bool handle_events();
+
+    //periodic pacing line when _logFramePacing is set
+    void log_frame_pacing();
+
+    //counts what the frame allocated since the given counters and flags it once past the warm-up
+    void check_frame_allocations(const HeapAllocationCounters& heapStart, uint64_t hostStart);
+
+    void run_decoupled();
+
+    //budget poll, periodic log and one defragmentation pass, called once the previous frame has finished
+    void update_memory();
+
 };
@@ -0,0 +1,125 @@
+#include <vk_geometry.h>
+#include <vk_mesh.h>
+
+#include <iostream>
+
+namespace {
+
+    VmaVirtualBlock create_block(uint32_t elementCount) {
+        // the virtual block is sized in elements, so offsets come back as vertex/index numbers
+        VmaVirtualBlockCreateInfo blockInfo = {};
+        blockInfo.size = elementCount;
+
+        VmaVirtualBlock block;
+        if (vmaCreateVirtualBlock(&blockInfo, &block) != VK_SUCCESS) {
+            return VK_NULL_HANDLE;
+        }
+        return block;
+    }
+
+    AllocatedBuffer create_device_buffer(VmaAllocator allocator, VkDeviceSize size, VkBufferUsageFlags usage) {
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        // contents only ever arrive through staging copies, transfer src lets defragmentation move the buffer
+        bufferInfo.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+        VmaAllocationCreateInfo allocInfo = {};
+        allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+        AllocatedBuffer buffer = {};
+        if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &buffer._buffer, &buffer._allocation, nullptr) != VK_SUCCESS) {
+            std::cout << "Failed to allocate geometry pool buffer of " << size << " bytes" << std::endl;
+        }
+        return buffer;
+    }
+
+    float fragmentation(VmaVirtualBlock block) {
+        VmaDetailedStatistics stats;
+        vmaCalculateVirtualBlockStatistics(block, &stats);
+
+        VkDeviceSize freeSpace = stats.statistics.blockBytes - stats.statistics.allocationBytes;
+        if (freeSpace == 0 || stats.unusedRangeCount == 0) {
+            return 0.f;
+        }
+        return 1.f - (float)stats.unusedRangeSizeMax / (float)freeSpace;
+    }
+}
+
+void GeometryPool::init(VmaAllocator allocator, uint32_t maxVertices, uint32_t maxIndices) {
+    _allocator = allocator;
+    _vertexCapacity = maxVertices;
+    _indexCapacity = maxIndices;
+
+    _vertexBlock = create_block(maxVertices);
+    _indexBlock = create_block(maxIndices);
+
+    _vertexBuffer = create_device_buffer(allocator, (VkDeviceSize)maxVertices * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    _indexBuffer = create_device_buffer(allocator, (VkDeviceSize)maxIndices * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+}
+
+void GeometryPool::cleanup() {
+    // meshes are not required to free their ranges before shutdown
+    vmaClearVirtualBlock(_vertexBlock);
+    vmaClearVirtualBlock(_indexBlock);
+    vmaDestroyVirtualBlock(_vertexBlock);
+    vmaDestroyVirtualBlock(_indexBlock);
+
+    vmaDestroyBuffer(_allocator, _vertexBuffer._buffer, _vertexBuffer._allocation);
+    vmaDestroyBuffer(_allocator, _indexBuffer._buffer, _indexBuffer._allocation);
+    _rangeCount = 0;
+}
+
+bool GeometryPool::allocate(uint32_t vertexCount, uint32_t indexCount, MeshRange& outRange) {
+    VmaVirtualAllocationCreateInfo vertexInfo = {};
+    vertexInfo.size = vertexCount;
+
+    VkDeviceSize vertexOffset;
+    if (vmaVirtualAllocate(_vertexBlock, &vertexInfo, &outRange.vertexAllocation, &vertexOffset) != VK_SUCCESS) {
+        return false;
+    }
+
+    VmaVirtualAllocationCreateInfo indexInfo = {};
+    indexInfo.size = indexCount;
+
+    VkDeviceSize indexOffset;
+    if (vmaVirtualAllocate(_indexBlock, &indexInfo, &outRange.indexAllocation, &indexOffset) != VK_SUCCESS) {
+        vmaVirtualFree(_vertexBlock, outRange.vertexAllocation);
+        outRange.vertexAllocation = VK_NULL_HANDLE;
+        return false;
+    }
+
+    outRange.firstVertex = (uint32_t)vertexOffset;
+    outRange.vertexCount = vertexCount;
+    outRange.firstIndex = (uint32_t)indexOffset;
+    outRange.indexCount = indexCount;
+    _rangeCount++;
+    return true;
+}
+
+void GeometryPool::free(MeshRange& range) {
+    if (range.vertexAllocation == VK_NULL_HANDLE) {
+        return;
+    }
+    vmaVirtualFree(_vertexBlock, range.vertexAllocation);
+    vmaVirtualFree(_indexBlock, range.indexAllocation);
+    range = MeshRange{};
+    _rangeCount--;
+}
+
+GeometryPoolStats GeometryPool::get_stats() const {
+    VmaStatistics vertexStats;
+    VmaStatistics indexStats;
+    vmaGetVirtualBlockStatistics(_vertexBlock, &vertexStats);
+    vmaGetVirtualBlockStatistics(_indexBlock, &indexStats);
+
+    GeometryPoolStats stats = {};
+    stats.vertexCapacity = _vertexCapacity;
+    stats.verticesUsed = (uint32_t)vertexStats.allocationBytes;
+    stats.indexCapacity = _indexCapacity;
+    stats.indicesUsed = (uint32_t)indexStats.allocationBytes;
+    stats.rangeCount = _rangeCount;
+    stats.vertexFragmentation = fragmentation(_vertexBlock);
+    stats.indexFragmentation = fragmentation(_indexBlock);
+    return stats;
+}
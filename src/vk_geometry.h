@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vk_types.h>
+
+// where a mesh lives inside the shared geometry buffers, in elements rather than bytes.
+// firstVertex is passed as the vertexOffset of indexed draws, so indices stay mesh-local
+struct MeshRange {
+    uint32_t firstVertex{0};
+    uint32_t vertexCount{0};
+    uint32_t firstIndex{0};
+    uint32_t indexCount{0};
+
+    VmaVirtualAllocation vertexAllocation{VK_NULL_HANDLE};
+    VmaVirtualAllocation indexAllocation{VK_NULL_HANDLE};
+};
+
+struct GeometryPoolStats {
+    uint32_t vertexCapacity;
+    uint32_t verticesUsed;
+    uint32_t indexCapacity;
+    uint32_t indicesUsed;
+    uint32_t rangeCount;
+
+    // 1 - largest free range / total free space. 0 means all free space is contiguous
+    float vertexFragmentation;
+    float indexFragmentation;
+};
+
+// one device local vertex buffer and one index buffer shared by every mesh.
+// ranges are handed out by VMA virtual blocks (TLSF), so a frame can bind both
+// buffers once and draw everything with offsets
+class GeometryPool {
+public:
+    void init(VmaAllocator allocator, uint32_t maxVertices, uint32_t maxIndices);
+
+    void cleanup();
+
+    // reserves space for a mesh, returns false if either buffer is out of room
+    bool allocate(uint32_t vertexCount, uint32_t indexCount, MeshRange& outRange);
+
+    void free(MeshRange& range);
+
+    GeometryPoolStats get_stats() const;
+
+    AllocatedBuffer _vertexBuffer;
+    AllocatedBuffer _indexBuffer;
+
+private:
+    VmaAllocator _allocator{VK_NULL_HANDLE};
+
+    VmaVirtualBlock _vertexBlock{VK_NULL_HANDLE};
+    VmaVirtualBlock _indexBlock{VK_NULL_HANDLE};
+
+    uint32_t _vertexCapacity{0};
+    uint32_t _indexCapacity{0};
+    uint32_t _rangeCount{0};
+};
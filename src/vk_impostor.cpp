@@ -0,0 +1,51 @@
+#include <vk_impostor.h>
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+
+glm::vec3 impostor_direction(uint32_t view) {
+    const uint32_t azimuthIndex = view % IMPOSTOR_AZIMUTHS;
+    const uint32_t elevationIndex = view / IMPOSTOR_AZIMUTHS;
+
+    // ring centers, so the lowest and highest rings stay clear of the poles
+    const float azimuth = glm::two_pi<float>() * azimuthIndex / IMPOSTOR_AZIMUTHS;
+    const float elevation = -glm::half_pi<float>() + glm::pi<float>() * (elevationIndex + 0.5f) / IMPOSTOR_ELEVATIONS;
+
+    return glm::vec3(cosf(elevation) * cosf(azimuth), sinf(elevation), cosf(elevation) * sinf(azimuth));
+}
+
+uint32_t closest_impostor_view(const glm::vec3& direction) {
+    const float length = glm::length(direction);
+    if (length <= 0.f) {
+        return (IMPOSTOR_ELEVATIONS / 2) * IMPOSTOR_AZIMUTHS;
+    }
+    const glm::vec3 unit = direction / length;
+
+    // the ring the elevation falls in, then the nearest azimuth on it
+    const float elevation = asinf(std::min(std::max(unit.y, -1.f), 1.f));
+    const int elevationIndex = std::min(std::max((int)floorf((elevation + glm::half_pi<float>()) / glm::pi<float>() * IMPOSTOR_ELEVATIONS), 0),
+                                        (int)IMPOSTOR_ELEVATIONS - 1);
+
+    const float azimuth = atan2f(unit.z, unit.x);
+    int azimuthIndex = (int)roundf(azimuth / glm::two_pi<float>() * IMPOSTOR_AZIMUTHS) % (int)IMPOSTOR_AZIMUTHS;
+    if (azimuthIndex < 0) {
+        azimuthIndex += IMPOSTOR_AZIMUTHS;
+    }
+
+    return (uint32_t)elevationIndex * IMPOSTOR_AZIMUTHS + (uint32_t)azimuthIndex;
+}
+
+glm::mat4 impostor_view_projection(const MeshBounds& bounds, uint32_t view) {
+    const float radius = std::max(bounds.radius, 0.0001f);
+    const glm::vec3 direction = impostor_direction(view);
+
+    glm::mat4 viewMatrix = glm::lookAt(bounds.origin + direction * radius * 2.f, bounds.origin, glm::vec3(0.f, 1.f, 0.f));
+
+    // glm maps near..far to -1..1. the sphere is r..3r away from the eye, these planes put that range at 0..1
+    glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, -radius, 3.f * radius);
+    projection[1][1] *= -1;
+
+    return projection * viewMatrix;
+}
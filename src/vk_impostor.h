@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vk_culling.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+
+// every impostor mesh is baked from the same directions around it: rings of azimuths at a few
+// elevations, straight up and down are left out because a billboard seen from there has no up
+constexpr uint32_t IMPOSTOR_AZIMUTHS = 8;
+constexpr uint32_t IMPOSTOR_ELEVATIONS = 5;
+constexpr uint32_t IMPOSTOR_VIEWS = IMPOSTOR_AZIMUTHS * IMPOSTOR_ELEVATIONS;
+
+// one camera facing quad, indexed with gl_InstanceIndex. matches impostor.vert
+struct GPUImpostorInstance {
+    // world space bounding sphere of the object, the quad covers its radius like the baked tile does
+    glm::vec4 sphere;
+    // atlas tile, the row of the mesh times IMPOSTOR_VIEWS plus the baked view closest to the camera
+    uint32_t tile;
+    // fade of the mesh drawn in the same place, the impostor fills exactly the pixels the mesh dithers out
+    float fade;
+    uint32_t pad[2];
+};
+
+struct ImpostorPushConstants {
+    glm::mat4 viewProj;
+    // camera right and up in world space, w holds the atlas columns and rows
+    glm::vec4 right;
+    glm::vec4 up;
+};
+
+struct ImpostorStats {
+    // visible objects drawn as meshes only, as quads, and as both while they cross-fade
+    uint32_t meshObjects;
+    uint32_t impostors;
+    uint32_t crossFading;
+    // indices this frame's draws submit, each one a vertex shader invocation before post transform caching,
+    // and what the same visible objects would have submitted as meshes
+    uint64_t verticesSubmitted;
+    uint64_t verticesWithoutImpostors;
+};
+
+// object space direction from the mesh towards the camera of a baked view
+glm::vec3 impostor_direction(uint32_t view);
+
+// the baked view whose direction is closest, direction is object space and does not have to be normalized
+uint32_t closest_impostor_view(const glm::vec3& direction);
+
+// orthographic camera of a baked view, the bounding sphere exactly fills the tile. y is flipped like the
+// main projection so tiles are stored top row first
+glm::mat4 impostor_view_projection(const MeshBounds& bounds, uint32_t view);
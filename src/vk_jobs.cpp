@@ -0,0 +1,363 @@
+#include <vk_jobs.h>
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+namespace {
+    thread_local uint32_t t_threadIndex = 0;
+}
+
+uint32_t JobSystem::thread_index() {
+    return t_threadIndex;
+}
+
+void JobSystem::init(uint32_t workerCount) {
+    if (workerCount == 0) {
+        uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+
+    _running = true;
+
+    // queue 0 belongs to threads outside of the job system, the registered threads come after the workers.
+    // all of them exist up front, the vector is read without a lock
+    for (uint32_t i = 0; i <= workerCount + MAX_REGISTERED_THREADS; i++) {
+        _queues.push_back(std::make_unique<WorkQueue>());
+        _queues.back()->tasks.resize(QUEUE_CAPACITY);
+    }
+    _background.tasks.resize(QUEUE_CAPACITY);
+    _background.first = 0;
+    _background.count = 0;
+
+    for (uint32_t i = 1; i <= workerCount; i++) {
+        _workers.emplace_back(&JobSystem::worker_loop, this, i);
+    }
+}
+
+void JobSystem::cleanup() {
+    {
+        std::lock_guard<std::mutex> lock(_sleepLock);
+        _running = false;
+    }
+    _wake.notify_all();
+
+    for (std::thread& worker : _workers) {
+        worker.join();
+    }
+    _workers.clear();
+    _queues.clear();
+    _background.tasks.clear();
+    _registeredThreads = 0;
+}
+
+bool JobSystem::register_thread() {
+    const uint32_t slot = _registeredThreads.fetch_add(1);
+    if (slot >= MAX_REGISTERED_THREADS) {
+        std::cout << "Job system: no free thread slot, the thread shares queue 0" << std::endl;
+        return false;
+    }
+    t_threadIndex = (uint32_t)_workers.size() + 1 + slot;
+    return true;
+}
+
+void JobSystem::run(Job&& job, JobCounter* counter) {
+    if (counter) {
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // workers and registered threads keep their own jobs local, other threads feed the shared queue
+    uint32_t queueIndex = thread_index() < _queues.size() ? thread_index() : 0;
+    Task task;
+    task.job = std::move(job);
+    task.counter = counter;
+    push(queueIndex, std::move(task));
+}
+
+void JobSystem::run_background(Job&& job, JobCounter* counter) {
+    if (counter) {
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Task task;
+    task.job = std::move(job);
+    task.counter = counter;
+    {
+        std::lock_guard<std::mutex> lock(_background.lock);
+        _background.push_back(std::move(task));
+    }
+    _queuedTasks.fetch_add(1);
+
+    if (_sleepingWorkers.load() > 0) {
+        std::lock_guard<std::mutex> lock(_sleepLock);
+        _wake.notify_one();
+    }
+}
+
+void JobSystem::run_after(JobCounter& dependency, Job&& job, JobCounter* counter) {
+    if (counter) {
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    {
+        // the last job swaps the continuations out under this lock after pending reached zero, so pending alone
+        // tells whether it is still going to see this one
+        std::lock_guard<std::mutex> lock(dependency._lock);
+        if (dependency.pending.load(std::memory_order_acquire) != 0) {
+            dependency._continuations.emplace_back(std::move(job), counter);
+            return;
+        }
+    }
+    Task task;
+    task.job = std::move(job);
+    task.counter = counter;
+    push(0, std::move(task));
+}
+
+void JobSystem::wait(JobCounter& counter) {
+    const uint32_t index = thread_index() < _queues.size() ? thread_index() : 0;
+    while (!counter.done()) {
+        if (!try_run_one(index)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void JobSystem::parallel_for(uint32_t count, uint32_t grainSize, RangeFunction function, const void* data) {
+    if (count == 0) {
+        return;
+    }
+    if (grainSize == 0) {
+        grainSize = 1;
+    }
+    // not worth a round trip through the queues
+    if (count <= grainSize || _workers.empty()) {
+        function(data, 0, count);
+        return;
+    }
+
+    JobCounter counter;
+    const uint32_t queueIndex = thread_index() < _queues.size() ? thread_index() : 0;
+    for (uint32_t begin = 0; begin < count; begin += grainSize) {
+        Task task;
+        task.range = function;
+        task.data = data;
+        task.begin = begin;
+        task.end = begin + grainSize < count ? begin + grainSize : count;
+        task.counter = &counter;
+        counter.pending.fetch_add(1, std::memory_order_relaxed);
+        push(queueIndex, std::move(task));
+    }
+    wait(counter);
+}
+
+void JobSystem::WorkQueue::push_back(Task&& task) {
+    const uint32_t capacity = (uint32_t)tasks.size();
+    if (count == capacity) {
+        // full, unroll into a ring twice the size
+        std::vector<Task> grown(capacity * 2);
+        for (uint32_t i = 0; i < count; i++) {
+            grown[i] = std::move(tasks[(first + i) & (capacity - 1)]);
+        }
+        tasks.swap(grown);
+        first = 0;
+    }
+    tasks[(first + count) & ((uint32_t)tasks.size() - 1)] = std::move(task);
+    count++;
+}
+
+JobSystem::Task JobSystem::WorkQueue::pop_back() {
+    count--;
+    return std::move(tasks[(first + count) & ((uint32_t)tasks.size() - 1)]);
+}
+
+JobSystem::Task JobSystem::WorkQueue::pop_front() {
+    Task task = std::move(tasks[first]);
+    first = (first + 1) & ((uint32_t)tasks.size() - 1);
+    count--;
+    return task;
+}
+
+void JobSystem::push(uint32_t queueIndex, Task&& task) {
+    {
+        std::lock_guard<std::mutex> lock(_queues[queueIndex]->lock);
+        _queues[queueIndex]->push_back(std::move(task));
+    }
+    _queuedTasks.fetch_add(1);
+
+    // the sleep lock orders this notify after a worker that is about to sleep has checked the queue count
+    if (_sleepingWorkers.load() > 0) {
+        std::lock_guard<std::mutex> lock(_sleepLock);
+        _wake.notify_one();
+    }
+}
+
+bool JobSystem::try_run_one(uint32_t threadIndex) {
+    Task task;
+    bool found = false;
+
+    // own queue first, newest job is the one most likely still in cache
+    {
+        WorkQueue& own = *_queues[threadIndex];
+        std::lock_guard<std::mutex> lock(own.lock);
+        if (own.count > 0) {
+            task = own.pop_back();
+            found = true;
+        }
+    }
+
+    // steal the oldest job of another thread
+    const uint32_t queueCount = (uint32_t)_queues.size();
+    for (uint32_t i = 1; i < queueCount && !found; i++) {
+        WorkQueue& victim = *_queues[(threadIndex + i) % queueCount];
+        std::lock_guard<std::mutex> lock(victim.lock);
+        if (victim.count > 0) {
+            task = victim.pop_front();
+            found = true;
+        }
+    }
+
+    if (!found) {
+        return false;
+    }
+    execute(task);
+    return true;
+}
+
+bool JobSystem::try_run_background() {
+    Task task;
+    {
+        std::lock_guard<std::mutex> lock(_background.lock);
+        if (_background.count == 0) {
+            return false;
+        }
+        task = _background.pop_front();
+    }
+    execute(task);
+    return true;
+}
+
+void JobSystem::execute(Task& task) {
+    _queuedTasks.fetch_sub(1);
+    if (task.range) {
+        task.range(task.data, task.begin, task.end);
+    } else {
+        task.job();
+    }
+    complete(task.counter);
+}
+
+void JobSystem::complete(JobCounter* counter) {
+    if (!counter) {
+        return;
+    }
+
+    // the waiter may destroy the counter as soon as pending is zero, unless a job still holds it in _completing
+    counter->_completing.fetch_add(1, std::memory_order_relaxed);
+    if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        counter->_completing.fetch_sub(1, std::memory_order_release);
+        return;
+    }
+
+    // last job of the group, release everything that was waiting on it
+    std::vector<std::pair<Job, JobCounter*>> continuations;
+    {
+        std::lock_guard<std::mutex> lock(counter->_lock);
+        continuations.swap(counter->_continuations);
+    }
+    counter->_completing.fetch_sub(1, std::memory_order_release);
+    for (auto& continuation : continuations) {
+        Task task;
+        task.job = std::move(continuation.first);
+        task.counter = continuation.second;
+        push(0, std::move(task));
+    }
+}
+
+void JobSystem::worker_loop(uint32_t threadIndex) {
+    t_threadIndex = threadIndex;
+
+    while (true) {
+        // frame work first, background jobs only when there is none
+        if (try_run_one(threadIndex) || try_run_background()) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_sleepLock);
+        _sleepingWorkers.fetch_add(1);
+        _wake.wait(lock, [this]() { return !_running || _queuedTasks.load() > 0; });
+        _sleepingWorkers.fetch_sub(1);
+
+        if (!_running && _queuedTasks.load() == 0) {
+            return;
+        }
+    }
+}
+
+void run_job_system_benchmark() {
+    using clock = std::chrono::high_resolution_clock;
+
+    const uint32_t maxThreads = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+
+    // scheduling overhead: empty jobs through one counter
+    {
+        JobSystem jobs;
+        jobs.init(maxThreads > 1 ? maxThreads - 1 : 1);
+
+        const uint32_t jobCount = 200000;
+        JobCounter counter;
+
+        auto start = clock::now();
+        for (uint32_t i = 0; i < jobCount; i++) {
+            jobs.run([]() {}, &counter);
+        }
+        jobs.wait(counter);
+        double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+
+        std::cout << "Job overhead: " << ns / jobCount << " ns per empty job (" << jobs.thread_count() << " threads)" << std::endl;
+        jobs.cleanup();
+    }
+
+    // scaling: a fixed amount of math split with parallel_for
+    const uint32_t itemCount = 1 << 20;
+    const uint32_t grainSize = 4096;
+    std::vector<float> results(itemCount);
+
+    double singleThreadMs = 0.0;
+    for (uint32_t threads = 1; threads <= maxThreads; threads++) {
+        // a single thread runs the kernel inline as the baseline
+        JobSystem jobs;
+        if (threads > 1) {
+            jobs.init(threads - 1);
+        }
+
+        auto kernel = [&results](uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; i++) {
+                float v = (float)i;
+                for (int k = 0; k < 64; k++) {
+                    v = std::sqrt(v * 1.0001f + 1.f);
+                }
+                results[i] = v;
+            }
+        };
+
+        auto start = clock::now();
+        const int iterations = 10;
+        for (int i = 0; i < iterations; i++) {
+            if (threads > 1) {
+                jobs.parallel_for(itemCount, grainSize, kernel);
+            } else {
+                kernel(0, itemCount);
+            }
+        }
+        double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count() / iterations;
+
+        if (threads > 1) {
+            jobs.cleanup();
+        } else {
+            singleThreadMs = ms;
+        }
+
+        std::cout << "parallel_for " << threads << " threads: " << ms << " ms, speedup " << singleThreadMs / ms << "x" << std::endl;
+    }
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using Job = std::function<void()>;
+
+// one range of a parallel_for, called with the data pointer the range was queued with
+using RangeFunction = void (*)(const void* data, uint32_t begin, uint32_t end);
+
+// tracks a group of jobs. it reaches zero once every job submitted with it has finished,
+// and jobs queued with run_after on it are released at that point
+struct JobCounter {
+    std::atomic<int> pending{0};
+
+    // also waits for the last job to be done with the counter, so a counter on the stack can go away once it is done
+    bool done() const {
+        return pending.load(std::memory_order_acquire) == 0 && _completing.load(std::memory_order_acquire) == 0;
+    }
+
+private:
+    friend class JobSystem;
+    // jobs between their decrement of pending and their last access to the counter
+    std::atomic<int> _completing{0};
+    std::mutex _lock;
+    std::vector<std::pair<Job, JobCounter*>> _continuations;
+};
+
+// work stealing scheduler. every thread owns a deque, the owner pushes and pops at the
+// back while idle threads steal from the front of the others. threads that are not
+// workers share queue 0 unless they called register_thread
+class JobSystem {
+public:
+    // outside threads that can have their own queue and index besides the one that calls init
+    static constexpr uint32_t MAX_REGISTERED_THREADS = 2;
+
+    // 0 workers picks one per hardware thread, minus the calling thread
+    void init(uint32_t workerCount = 0);
+
+    void cleanup();
+
+    void run(Job&& job, JobCounter* counter = nullptr);
+
+    // for long jobs nobody waits on within a frame. only idle workers take them, never a thread inside wait(),
+    // so a frame's parallel_for can not end up running one inline
+    void run_background(Job&& job, JobCounter* counter = nullptr);
+
+    // queues the job once dependency reaches zero
+    void run_after(JobCounter& dependency, Job&& job, JobCounter* counter = nullptr);
+
+    // executes queued jobs on the calling thread until the counter reaches zero
+    void wait(JobCounter& counter);
+
+    // splits [0, count) into ranges of grainSize and blocks until all ranges are done. the ranges only keep a
+    // pointer to function, so captures of any size are never copied into a heap allocated Job
+    template<typename F>
+    void parallel_for(uint32_t count, uint32_t grainSize, const F& function) {
+        parallel_for(count, grainSize, [](const void* data, uint32_t begin, uint32_t end) {
+            (*static_cast<const F*>(data))(begin, end);
+        }, &function);
+    }
+
+    void parallel_for(uint32_t count, uint32_t grainSize, RangeFunction function, const void* data);
+
+    // gives the calling outside thread its own queue and thread_index, so per thread state indexed by it
+    // (command pools) is never shared with another thread. call once per thread after init, false when
+    // every slot is taken and the thread keeps sharing index 0
+    bool register_thread();
+
+    // workers, the shared queue for outside threads and the slots for registered threads
+    uint32_t thread_count() const { return (uint32_t)_queues.size(); }
+
+    // 0 for threads that are not workers of any job system, 1..N for workers, N+1.. for registered threads
+    static uint32_t thread_index();
+
+private:
+    // a Job, or a parallel_for range when range is set
+    struct Task {
+        Job job;
+        RangeFunction range{nullptr};
+        const void* data{nullptr};
+        uint32_t begin{0};
+        uint32_t end{0};
+        JobCounter* counter{nullptr};
+    };
+
+    // ring of tasks allocated at init. it only grows when a burst outgrows it, so steady frames
+    // push and pop without touching the heap
+    struct WorkQueue {
+        std::mutex lock;
+        std::vector<Task> tasks;
+        uint32_t first{0};
+        uint32_t count{0};
+
+        void push_back(Task&& task);
+
+        Task pop_back();
+
+        Task pop_front();
+    };
+
+    // initial tasks per queue, a power of two
+    static constexpr uint32_t QUEUE_CAPACITY = 1024;
+
+    void push(uint32_t queueIndex, Task&& task);
+
+    bool try_run_one(uint32_t threadIndex);
+
+    bool try_run_background();
+
+    void execute(Task& task);
+
+    void complete(JobCounter* counter);
+
+    void worker_loop(uint32_t threadIndex);
+
+    std::vector<std::unique_ptr<WorkQueue>> _queues;
+    WorkQueue _background;
+    std::vector<std::thread> _workers;
+    std::atomic<uint32_t> _registeredThreads{0};
+
+    std::atomic<bool> _running{false};
+    std::atomic<int> _queuedTasks{0};
+    std::atomic<int> _sleepingWorkers{0};
+    std::mutex _sleepLock;
+    std::condition_variable _wake;
+};
+
+// measures per job scheduling overhead and parallel_for scaling from 1 to N threads
+void run_job_system_benchmark();
@@ -0,0 +1,229 @@
+#include <vk_lights.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+bool ClusterGrid::update(const glm::mat4& projection) {
+    if (projection == _projection && !_bounds.empty()) {
+        return false;
+    }
+    _projection = projection;
+    _inverseProjection = glm::inverse(projection);
+
+    // glm perspective: [2][2] = -(f + n) / (f - n), [3][2] = -2fn / (f - n)
+    _near = projection[3][2] / (projection[2][2] - 1.f);
+    _far = projection[3][2] / (projection[2][2] + 1.f);
+
+    const float logRatio = std::log(_far / _near);
+    _sliceScale = (float)CLUSTER_GRID_Z / logRatio;
+    _sliceBias = (float)CLUSTER_GRID_Z * std::log(_near) / logRatio;
+
+    // a point on the view ray through an ndc position, any depth works
+    auto view_ray = [&](float x, float y) {
+        glm::vec4 point = _inverseProjection * glm::vec4(x, y, 1.f, 1.f);
+        glm::vec3 ray = glm::vec3(point) / point.w;
+        return ray / -ray.z;
+    };
+
+    _bounds.resize(CLUSTER_COUNT);
+    for (uint32_t z = 0; z < CLUSTER_GRID_Z; z++) {
+        const float sliceNear = _near * std::pow(_far / _near, (float)z / CLUSTER_GRID_Z);
+        const float sliceFar = _near * std::pow(_far / _near, (float)(z + 1) / CLUSTER_GRID_Z);
+
+        for (uint32_t y = 0; y < CLUSTER_GRID_Y; y++) {
+            for (uint32_t x = 0; x < CLUSTER_GRID_X; x++) {
+                const float x0 = (float)x / CLUSTER_GRID_X * 2.f - 1.f;
+                const float x1 = (float)(x + 1) / CLUSTER_GRID_X * 2.f - 1.f;
+                const float y0 = (float)y / CLUSTER_GRID_Y * 2.f - 1.f;
+                const float y1 = (float)(y + 1) / CLUSTER_GRID_Y * 2.f - 1.f;
+                const glm::vec3 rays[4] = {view_ray(x0, y0), view_ray(x1, y0), view_ray(x0, y1), view_ray(x1, y1)};
+
+                glm::vec3 minPoint{FLT_MAX};
+                glm::vec3 maxPoint{-FLT_MAX};
+                for (const glm::vec3& ray : rays) {
+                    minPoint = glm::min(minPoint, glm::min(ray * sliceNear, ray * sliceFar));
+                    maxPoint = glm::max(maxPoint, glm::max(ray * sliceNear, ray * sliceFar));
+                }
+
+                GPUClusterBounds& bounds = _bounds[x + y * CLUSTER_GRID_X + z * CLUSTER_GRID_X * CLUSTER_GRID_Y];
+                bounds.min = glm::vec4(minPoint, 0.f);
+                bounds.max = glm::vec4(maxPoint, 0.f);
+            }
+        }
+    }
+    return true;
+}
+
+GPUClusterParams ClusterGrid::params(uint32_t drawWidth, uint32_t drawHeight, uint32_t lightCount) const {
+    GPUClusterParams params = {};
+    params.projection = _projection;
+    params.inverseProjection = _inverseProjection;
+    params.pixelToTile = glm::vec2((float)CLUSTER_GRID_X / (float)drawWidth, (float)CLUSTER_GRID_Y / (float)drawHeight);
+    params.sliceScale = _sliceScale;
+    params.sliceBias = _sliceBias;
+    params.nearPlane = _near;
+    params.farPlane = _far;
+    params.lightCount = lightCount;
+    return params;
+}
+
+uint32_t ClusterGrid::slice(float depth) const {
+    float slice = std::floor(std::log(std::max(depth, _near)) * _sliceScale - _sliceBias);
+    return (uint32_t)std::min(std::max(slice, 0.f), (float)(CLUSTER_GRID_Z - 1));
+}
+
+bool ClusterGrid::cluster_range(const glm::vec4& sphere, glm::uvec3& outMin, glm::uvec3& outMax) const {
+    const glm::vec3 center = glm::vec3(sphere);
+    const float radius = sphere.w;
+    const float depth = -center.z;
+    if (depth + radius < _near || depth - radius > _far) {
+        return false;
+    }
+
+    outMin = glm::uvec3(0, 0, slice(depth - radius));
+    outMax = glm::uvec3(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1, slice(depth + radius));
+
+    // a sphere through the near plane can cover any tile, otherwise its box projects to a screen rectangle
+    if (depth - radius <= _near) {
+        return true;
+    }
+
+    glm::vec2 ndcMin{1.f};
+    glm::vec2 ndcMax{-1.f};
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner = center + radius * glm::vec3((i & 1) ? 1.f : -1.f, (i & 2) ? 1.f : -1.f, (i & 4) ? 1.f : -1.f);
+        glm::vec4 clip = _projection * glm::vec4(corner, 1.f);
+        glm::vec2 ndc = glm::vec2(clip) / clip.w;
+        ndcMin = glm::min(ndcMin, ndc);
+        ndcMax = glm::max(ndcMax, ndc);
+    }
+    if (ndcMin.x > 1.f || ndcMin.y > 1.f || ndcMax.x < -1.f || ndcMax.y < -1.f) {
+        return false;
+    }
+
+    const glm::vec2 grid{(float)CLUSTER_GRID_X, (float)CLUSTER_GRID_Y};
+    glm::vec2 tileMin = glm::floor((glm::clamp(ndcMin, -1.f, 1.f) * 0.5f + 0.5f) * grid);
+    glm::vec2 tileMax = glm::floor((glm::clamp(ndcMax, -1.f, 1.f) * 0.5f + 0.5f) * grid);
+    tileMax = glm::min(tileMax, grid - 1.f);
+
+    outMin.x = (uint32_t)tileMin.x;
+    outMin.y = (uint32_t)tileMin.y;
+    outMax.x = (uint32_t)tileMax.x;
+    outMax.y = (uint32_t)tileMax.y;
+    return true;
+}
+
+LightBinStats bin_lights(const ClusterGrid& grid, const GPUPointLight* lights, uint32_t lightCount,
+                         uint32_t* counts, uint32_t* indices) {
+    LightBinStats stats = {};
+    memset(counts, 0, sizeof(uint32_t) * CLUSTER_COUNT);
+
+    const std::vector<GPUClusterBounds>& bounds = grid.bounds();
+    for (uint32_t i = 0; i < lightCount; i++) {
+        const glm::vec4 sphere = lights[i].positionRadius;
+        glm::uvec3 minCluster;
+        glm::uvec3 maxCluster;
+        if (!grid.cluster_range(sphere, minCluster, maxCluster)) {
+            continue;
+        }
+
+        bool binned = false;
+        for (uint32_t z = minCluster.z; z <= maxCluster.z; z++) {
+            for (uint32_t y = minCluster.y; y <= maxCluster.y; y++) {
+                for (uint32_t x = minCluster.x; x <= maxCluster.x; x++) {
+                    const uint32_t cluster = x + y * CLUSTER_GRID_X + z * CLUSTER_GRID_X * CLUSTER_GRID_Y;
+
+                    // closest point of the box against the radius, the range above is only conservative
+                    glm::vec3 closest = glm::clamp(glm::vec3(sphere), glm::vec3(bounds[cluster].min), glm::vec3(bounds[cluster].max));
+                    glm::vec3 offset = closest - glm::vec3(sphere);
+                    if (glm::dot(offset, offset) > sphere.w * sphere.w) {
+                        continue;
+                    }
+
+                    uint32_t slot = counts[cluster]++;
+                    if (slot < MAX_LIGHTS_PER_CLUSTER) {
+                        indices[cluster * MAX_LIGHTS_PER_CLUSTER + slot] = i;
+                    }
+                    binned = true;
+                }
+            }
+        }
+        if (binned) {
+            stats.lightsBinned++;
+        }
+    }
+
+    for (uint32_t c = 0; c < CLUSTER_COUNT; c++) {
+        if (counts[c] == 0) {
+            continue;
+        }
+        stats.occupiedClusters++;
+        stats.references += std::min(counts[c], MAX_LIGHTS_PER_CLUSTER);
+        stats.maxPerCluster = std::max(stats.maxPerCluster, counts[c]);
+        if (counts[c] > MAX_LIGHTS_PER_CLUSTER) {
+            stats.overflowedClusters++;
+        }
+    }
+    return stats;
+}
+
+void run_light_benchmark(const LightPassTimer& gpuTimer) {
+    using clock = std::chrono::high_resolution_clock;
+
+    // the engine camera, lights are generated straight in view space
+    glm::mat4 projection = glm::perspective(glm::radians(70.f), 1700.f / 900.f, 0.1f, 200.0f);
+    projection[1][1] *= -1;
+
+    ClusterGrid grid;
+    grid.update(projection);
+
+    std::vector<uint32_t> counts(CLUSTER_COUNT);
+    std::vector<uint32_t> indices(CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER);
+
+    const uint32_t lightCounts[] = {1, 10, 100, 1000, 10000};
+    const int iterations = 20;
+
+    // fixed volume: every light is in front of the camera and density grows with the count.
+    // fixed density: the volume grows with the count, most lights end up outside the view
+    for (int sweep = 0; sweep < 2; sweep++) {
+        std::cout << (sweep == 0 ? "Lights in a fixed volume:" : "Lights at a fixed density:") << std::endl;
+
+        for (uint32_t lightCount : lightCounts) {
+            const float extent = sweep == 0 ? 1.f : std::cbrt((float)lightCount / 1000.f);
+
+            std::mt19937 random(lightCount);
+            std::uniform_real_distribution<float> unit(0.f, 1.f);
+            std::vector<GPUPointLight> lights(lightCount);
+            for (GPUPointLight& light : lights) {
+                glm::vec3 position = glm::vec3(unit(random) * 80.f - 40.f, unit(random) * 40.f - 20.f, -1.f - unit(random) * 80.f) * extent;
+                light.positionRadius = glm::vec4(position, 2.f + unit(random) * 4.f);
+                light.color = glm::vec4(unit(random), unit(random), unit(random), 1.f);
+            }
+
+            LightBinStats stats = {};
+            auto start = clock::now();
+            for (int i = 0; i < iterations; i++) {
+                stats = bin_lights(grid, lights.data(), lightCount, counts.data(), indices.data());
+            }
+            double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count() / iterations;
+
+            // what a fragment in an occupied cluster loops over, against every light for the naive loop
+            float perCluster = stats.occupiedClusters > 0 ? (float)stats.references / (float)stats.occupiedClusters : 0.f;
+            std::cout << "  " << lightCount << " lights: bin " << ms << " ms, " << stats.lightsBinned << " in view, "
+                      << perCluster << " per occupied cluster (max " << stats.maxPerCluster << ", "
+                      << stats.overflowedClusters << " overflowed), naive loop " << lightCount;
+
+            LightPassTimings timings;
+            if (gpuTimer && gpuTimer(lights.data(), lightCount, timings)) {
+                std::cout << ", gpu cull " << timings.cullMs << " ms, main pass " << timings.mainPassMs << " ms";
+            }
+            std::cout << std::endl;
+        }
+    }
+}
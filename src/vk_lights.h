@@ -0,0 +1,107 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// view space cluster grid: screen tiles times exponential depth slices. the constants are repeated in
+// light_cull.comp and colored_triangle.frag
+constexpr uint32_t CLUSTER_GRID_X = 16;
+constexpr uint32_t CLUSTER_GRID_Y = 9;
+constexpr uint32_t CLUSTER_GRID_Z = 24;
+constexpr uint32_t CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+// fixed size light list per cluster. lights past it are dropped, the count keeps counting
+constexpr uint32_t MAX_LIGHTS_PER_CLUSTER = 128;
+
+// world space, what the scene owns
+struct PointLight {
+    glm::vec3 position;
+    float radius;
+    glm::vec3 color;
+    float intensity;
+};
+
+// view space copy the shaders read, rewritten every frame
+struct GPUPointLight {
+    glm::vec4 positionRadius;
+    // rgb and intensity
+    glm::vec4 color;
+};
+
+// view space box around one cluster, w unused
+struct GPUClusterBounds {
+    glm::vec4 min;
+    glm::vec4 max;
+};
+
+// uniform shared by the mesh shaders and the light cull pass, std140
+struct GPUClusterParams {
+    glm::mat4 projection;
+    // the vertex shader gets view space from clip space with it, the object data only has viewproj * model
+    glm::mat4 inverseProjection;
+    // cluster grid size divided by the draw extent, gl_FragCoord to tile
+    glm::vec2 pixelToTile;
+    // slice = log(depth) * sliceScale - sliceBias
+    float sliceScale;
+    float sliceBias;
+    float nearPlane;
+    float farPlane;
+    uint32_t lightCount;
+    uint32_t pad;
+};
+
+struct LightBinStats {
+    // lights that touched at least one cluster
+    uint32_t lightsBinned;
+    // light list entries written over all clusters
+    uint32_t references;
+    uint32_t occupiedClusters;
+    uint32_t maxPerCluster;
+    // clusters that had more lights than MAX_LIGHTS_PER_CLUSTER
+    uint32_t overflowedClusters;
+};
+
+class ClusterGrid {
+public:
+    // rebuilds the cluster bounds for a new projection, returns false if it did not change.
+    // near and far are read back from the projection, which has to be a glm perspective
+    bool update(const glm::mat4& projection);
+
+    const std::vector<GPUClusterBounds>& bounds() const { return _bounds; }
+
+    GPUClusterParams params(uint32_t drawWidth, uint32_t drawHeight, uint32_t lightCount) const;
+
+    // inclusive cluster ranges a view space sphere can touch, false when it misses the view
+    bool cluster_range(const glm::vec4& sphere, glm::uvec3& outMin, glm::uvec3& outMax) const;
+
+    uint32_t slice(float depth) const;
+
+private:
+    glm::mat4 _projection{0.f};
+    glm::mat4 _inverseProjection{1.f};
+    float _near{0.1f};
+    float _far{200.f};
+    float _sliceScale{0.f};
+    float _sliceBias{0.f};
+    std::vector<GPUClusterBounds> _bounds;
+};
+
+// cpu version of light_cull.comp. counts has CLUSTER_COUNT entries, the lights of cluster c
+// are at indices[c * MAX_LIGHTS_PER_CLUSTER]
+LightBinStats bin_lights(const ClusterGrid& grid, const GPUPointLight* lights, uint32_t lightCount,
+                         uint32_t* counts, uint32_t* indices);
+
+// gpu time of the light cull pass and of the main pass that shades with its lists
+struct LightPassTimings {
+    float cullMs;
+    float mainPassMs;
+};
+
+// renders with the given view space lights and averages their pass timings, false when it can not
+using LightPassTimer = std::function<bool(const GPUPointLight* lights, uint32_t lightCount, LightPassTimings& out)>;
+
+// bins 1 to 10k random lights, once in a fixed volume and once at a fixed density, and compares
+// the lights a fragment loops over with the naive loop over every light. with a timer every
+// light set is also measured on the gpu and reported on the same line
+void run_light_benchmark(const LightPassTimer& gpuTimer = nullptr);
@@ -0,0 +1,211 @@
+#include <vk_memory.h>
+#include <vk_allocator.h>
+
+#include <iostream>
+
+const char* memory_category_name(MemoryCategory category) {
+    switch (category) {
+        case MemoryCategory::Mesh: return "mesh";
+        case MemoryCategory::Texture: return "texture";
+        case MemoryCategory::Attachment: return "attachment";
+        case MemoryCategory::Staging: return "staging";
+        case MemoryCategory::Frame: return "frame";
+        default: return "unknown";
+    }
+}
+
+void GpuMemoryTracker::init(VkDevice device, VmaAllocator allocator, bool budgetExtension) {
+    _device = device;
+    _allocator = allocator;
+    _budgetExtension = budgetExtension;
+
+    const VkPhysicalDeviceMemoryProperties* memoryProperties;
+    vmaGetMemoryProperties(_allocator, &memoryProperties);
+    _heapCount = memoryProperties->memoryHeapCount;
+    for (uint32_t i = 0; i < _heapCount; i++) {
+        _heaps[i] = {};
+        _heaps[i].deviceLocal = (memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+    }
+}
+
+void GpuMemoryTracker::track(VmaAllocation allocation, MemoryCategory category) {
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(_allocator, allocation, &info);
+
+    // the name shows up in vmaBuildStatsString dumps
+    vmaSetAllocationName(_allocator, allocation, memory_category_name(category));
+
+    std::lock_guard<std::mutex> lock(_lock);
+    _allocations[allocation] = TrackedAllocation{category, info.size};
+}
+
+void GpuMemoryTracker::untrack(VmaAllocation allocation) {
+    std::lock_guard<std::mutex> lock(_lock);
+    _allocations.erase(allocation);
+}
+
+void GpuMemoryTracker::register_movable(AllocatedBuffer* buffer, VkDeviceSize size, VkBufferUsageFlags usage) {
+    MovableBuffer movable;
+    movable.buffer = buffer;
+    movable.createInfo = {};
+    movable.createInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    movable.createInfo.size = size;
+    // moves are done with a copy from the old buffer into the new one, the original buffer needs both bits too
+    movable.createInfo.usage = usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    std::lock_guard<std::mutex> lock(_lock);
+    _movable[buffer->_allocation] = movable;
+}
+
+void GpuMemoryTracker::unregister_movable(AllocatedBuffer* buffer) {
+    std::lock_guard<std::mutex> lock(_lock);
+    _movable.erase(buffer->_allocation);
+}
+
+void GpuMemoryTracker::update(uint32_t frameIndex) {
+    // budget values are cached by vma per frame index
+    vmaSetCurrentFrameIndex(_allocator, frameIndex);
+
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets(_allocator, budgets);
+
+    for (uint32_t i = 0; i < _heapCount; i++) {
+        _heaps[i].budget = budgets[i].budget;
+        _heaps[i].usage = budgets[i].usage;
+    }
+}
+
+GpuMemoryStats GpuMemoryTracker::get_stats() const {
+    GpuMemoryStats stats = {};
+    stats.heapCount = _heapCount;
+    for (uint32_t i = 0; i < _heapCount; i++) {
+        stats.heaps[i] = _heaps[i];
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        for (const auto& it : _allocations) {
+            size_t category = (size_t)it.second.category;
+            stats.categoryBytes[category] += it.second.size;
+            stats.categoryAllocations[category]++;
+        }
+    }
+
+    stats.defragmentedBytes = _defragmentedBytes;
+    stats.defragmentedAllocations = _defragmentedAllocations;
+    return stats;
+}
+
+bool GpuMemoryTracker::over_budget(float fraction) const {
+    for (uint32_t i = 0; i < _heapCount; i++) {
+        if (_heaps[i].budget > 0 && (float)_heaps[i].usage > (float)_heaps[i].budget * fraction) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void GpuMemoryTracker::log_stats() const {
+    const double mb = 1024.0 * 1024.0;
+    GpuMemoryStats stats = get_stats();
+
+    std::cout << "GPU memory" << (_budgetExtension ? "" : " (estimated, no VK_EXT_memory_budget)") << ":";
+    for (uint32_t i = 0; i < stats.heapCount; i++) {
+        std::cout << " heap" << i << (stats.heaps[i].deviceLocal ? "[local] " : " ")
+                  << stats.heaps[i].usage / mb << "/" << stats.heaps[i].budget / mb << "MB";
+    }
+    for (size_t c = 0; c < (size_t)MemoryCategory::Count; c++) {
+        std::cout << " " << memory_category_name((MemoryCategory)c) << " " << stats.categoryBytes[c] / mb
+                  << "MB(" << stats.categoryAllocations[c] << ")";
+    }
+    std::cout << std::endl;
+}
+
+void GpuMemoryTracker::begin_defragmentation(VkDeviceSize maxBytesPerPass, uint32_t maxAllocationsPerPass) {
+    if (_defragmentation != VK_NULL_HANDLE) {
+        return;
+    }
+
+    VmaDefragmentationInfo defragInfo = {};
+    defragInfo.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT;
+    defragInfo.pool = VK_NULL_HANDLE;
+    defragInfo.maxBytesPerPass = maxBytesPerPass;
+    defragInfo.maxAllocationsPerPass = maxAllocationsPerPass;
+
+    if (vmaBeginDefragmentation(_allocator, &defragInfo, &_defragmentation) != VK_SUCCESS) {
+        std::cout << "Defragmentation is not supported by the allocator" << std::endl;
+        _defragmentation = VK_NULL_HANDLE;
+    }
+}
+
+bool GpuMemoryTracker::record_defragmentation_pass(VkCommandBuffer cmd) {
+    if (_defragmentation == VK_NULL_HANDLE) {
+        return false;
+    }
+
+    _passInfo = {};
+    if (vmaBeginDefragmentationPass(_allocator, _defragmentation, &_passInfo) == VK_SUCCESS) {
+        // nothing left to move
+        VmaDefragmentationStats defragStats;
+        vmaEndDefragmentation(_allocator, _defragmentation, &defragStats);
+        _defragmentation = VK_NULL_HANDLE;
+        _passInfo = {};
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_lock);
+    for (uint32_t i = 0; i < _passInfo.moveCount; i++) {
+        VmaDefragmentationMove& move = _passInfo.pMoves[i];
+
+        // only registered buffers know how to rebuild themselves, leave everything else in place
+        auto it = _movable.find(move.srcAllocation);
+        if (it == _movable.end()) {
+            move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+            continue;
+        }
+
+        MovableBuffer& movable = it->second;
+        VkBuffer newBuffer;
+        if (vkCreateBuffer(_device, &movable.createInfo, host_allocator().callbacks(), &newBuffer) != VK_SUCCESS) {
+            move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+            continue;
+        }
+        vmaBindBufferMemory(_allocator, move.dstTmpAllocation, newBuffer);
+
+        VkBufferCopy copy = {};
+        copy.size = movable.createInfo.size;
+        vkCmdCopyBuffer(cmd, movable.buffer->_buffer, newBuffer, 1, &copy);
+
+        _pendingMoves.push_back(PendingMove{&movable, newBuffer});
+    }
+    return true;
+}
+
+void GpuMemoryTracker::end_defragmentation_pass() {
+    if (_defragmentation == VK_NULL_HANDLE || _passInfo.moveCount == 0) {
+        return;
+    }
+
+    bool movedAny;
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        movedAny = !_pendingMoves.empty();
+        // the copies are done, swap every moved buffer over to its new VkBuffer
+        for (PendingMove& pending : _pendingMoves) {
+            vkDestroyBuffer(_device, pending.movable->buffer->_buffer, host_allocator().callbacks());
+            pending.movable->buffer->_buffer = pending.newBuffer;
+            _defragmentedBytes += pending.movable->createInfo.size;
+            _defragmentedAllocations++;
+        }
+        _pendingMoves.clear();
+    }
+
+    // a pass where every proposed move was ignored would be proposed again next frame, stop instead
+    if (vmaEndDefragmentationPass(_allocator, _defragmentation, &_passInfo) == VK_SUCCESS || !movedAny) {
+        VmaDefragmentationStats defragStats;
+        vmaEndDefragmentation(_allocator, _defragmentation, &defragStats);
+        _defragmentation = VK_NULL_HANDLE;
+        std::cout << "Defragmentation finished, " << _defragmentedAllocations << " buffers moved in total" << std::endl;
+    }
+    _passInfo = {};
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <vk_types.h>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+enum class MemoryCategory : uint8_t {
+    Mesh,
+    Texture,
+    Attachment,
+    Staging,
+    //host written buffers the gpu reads every frame
+    Frame,
+    Count
+};
+
+const char* memory_category_name(MemoryCategory category);
+
+struct HeapBudget {
+    VkDeviceSize budget;
+    VkDeviceSize usage;
+    bool deviceLocal;
+};
+
+struct GpuMemoryStats {
+    uint32_t heapCount;
+    HeapBudget heaps[VK_MAX_MEMORY_HEAPS];
+
+    VkDeviceSize categoryBytes[(size_t)MemoryCategory::Count];
+    uint32_t categoryAllocations[(size_t)MemoryCategory::Count];
+
+    // bytes moved by defragmentation since startup
+    VkDeviceSize defragmentedBytes;
+    uint32_t defragmentedAllocations;
+};
+
+// keeps a category per VMA allocation, polls heap budgets once per frame and runs
+// incremental defragmentation over the buffers that were registered as movable
+class GpuMemoryTracker {
+public:
+    void init(VkDevice device, VmaAllocator allocator, bool budgetExtension);
+
+    void track(VmaAllocation allocation, MemoryCategory category);
+
+    void untrack(VmaAllocation allocation);
+
+    // movable buffers can be relocated by defragmentation, the AllocatedBuffer is updated in place
+    void register_movable(AllocatedBuffer* buffer, VkDeviceSize size, VkBufferUsageFlags usage);
+
+    void unregister_movable(AllocatedBuffer* buffer);
+
+    // polls heap budgets, call once per frame
+    void update(uint32_t frameIndex);
+
+    GpuMemoryStats get_stats() const;
+
+    // true if any heap is using more than the given fraction of its budget
+    bool over_budget(float fraction) const;
+
+    void log_stats() const;
+
+    // starts an incremental defragmentation, the passes run through record/end_defragmentation_pass
+    void begin_defragmentation(VkDeviceSize maxBytesPerPass, uint32_t maxAllocationsPerPass);
+
+    bool is_defragmenting() const { return _defragmentation != VK_NULL_HANDLE; }
+
+    // records the copies for one pass into cmd, returns false if the pass had no moves
+    bool record_defragmentation_pass(VkCommandBuffer cmd);
+
+    // call once the commands from record_defragmentation_pass have finished executing
+    void end_defragmentation_pass();
+
+private:
+    struct TrackedAllocation {
+        MemoryCategory category;
+        VkDeviceSize size;
+    };
+
+    struct MovableBuffer {
+        AllocatedBuffer* buffer;
+        VkBufferCreateInfo createInfo;
+    };
+
+    struct PendingMove {
+        MovableBuffer* movable;
+        VkBuffer newBuffer;
+    };
+
+    VkDevice _device{VK_NULL_HANDLE};
+    VmaAllocator _allocator{VK_NULL_HANDLE};
+    bool _budgetExtension{false};
+
+    // uploads may be tracked from loading threads
+    mutable std::mutex _lock;
+    std::unordered_map<VmaAllocation, TrackedAllocation> _allocations;
+    std::unordered_map<VmaAllocation, MovableBuffer> _movable;
+
+    uint32_t _heapCount{0};
+    HeapBudget _heaps[VK_MAX_MEMORY_HEAPS];
+
+    VmaDefragmentationContext _defragmentation{VK_NULL_HANDLE};
+    VmaDefragmentationPassMoveInfo _passInfo{};
+    std::vector<PendingMove> _pendingMoves;
+    VkDeviceSize _defragmentedBytes{0};
+    uint32_t _defragmentedAllocations{0};
+};
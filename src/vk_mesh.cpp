@@ -3,7 +3,10 @@
 //
 #include <vk_mesh.h>
 #include <tiny_obj_loader.h>
+#include <fstream>
 #include <iostream>
+#include <unordered_map>
+#include <algorithm>
 
 
 VertexInputDescription Vertex::get_vertex_description() {
@@ -44,7 +47,32 @@ VertexInputDescription Vertex::get_vertex_description() {
     return description;
 }
 
+namespace {
+    //read only stream over memory, tinyobj parses from it without a copy
+    struct MemoryStreamBuffer : std::streambuf {
+        MemoryStreamBuffer(const uint8_t* data, size_t size) {
+            char* begin = (char*)data;
+            setg(begin, begin, begin + size);
+        }
+    };
+}
+
 bool Mesh::load_from_obj(const char* filename){
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Could not open " << filename << std::endl;
+        return false;
+    }
+    return load_from_obj(file);
+}
+
+bool Mesh::load_from_obj(const uint8_t* data, size_t size) {
+    MemoryStreamBuffer buffer(data, size);
+    std::istream stream(&buffer);
+    return load_from_obj(stream);
+}
+
+bool Mesh::load_from_obj(std::istream& stream) {
     // contains vertex data (position/normal/texcoord)
     tinyobj::attrib_t attrib;
     // structure that contains meshes, lines, and points (all defined by tinyobj)
@@ -55,7 +83,8 @@ bool Mesh::load_from_obj(const char* filename){
     std::string warn;
     std::string err;
     //Load obj file
-    tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename, nullptr);
+    //materials are not used, so no material reader
+    tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, &stream, nullptr);
 
     if(!warn.empty()) {
         std::cout << "WARN: " << warn << std::endl;
@@ -66,6 +95,18 @@ bool Mesh::load_from_obj(const char* filename){
         return false;
     }
 
+    // obj faces reference position and normal separately, so a vertex is unique per (position, normal) pair
+    std::unordered_map<uint64_t, uint32_t> uniqueVertices;
+
+    //the index count is known up front, and there are never more unique vertices than indices
+    size_t indexCount = 0;
+    for (size_t s = 0; s < shapes.size(); s++) {
+        indexCount += shapes[s].mesh.num_face_vertices.size() * 3;
+    }
+    _indices.reserve(_indices.size() + indexCount);
+    _vertices.reserve(_vertices.size() + indexCount);
+    uniqueVertices.reserve(indexCount);
+
     for (size_t s = 0; s < shapes.size(); s++) {
         size_t index_offset = 0;
         for(size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
@@ -75,6 +116,13 @@ bool Mesh::load_from_obj(const char* filename){
                 // access to vertex
                 tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
 
+                uint64_t key = ((uint64_t)(uint32_t)idx.vertex_index << 32) | (uint32_t)idx.normal_index;
+                auto existing = uniqueVertices.find(key);
+                if (existing != uniqueVertices.end()) {
+                    _indices.push_back(existing->second);
+                    continue;
+                }
+
                 //vertex position
                 tinyobj::real_t vx = attrib.vertices[3 * idx.vertex_index + 0];
                 tinyobj::real_t vy = attrib.vertices[3 * idx.vertex_index + 1];
@@ -96,6 +144,8 @@ bool Mesh::load_from_obj(const char* filename){
 
                 new_vert.color = new_vert.normal;
 
+                uniqueVertices[key] = (uint32_t)_vertices.size();
+                _indices.push_back((uint32_t)_vertices.size());
                 _vertices.push_back(new_vert);
             }
             index_offset += fv;
@@ -105,3 +155,23 @@ bool Mesh::load_from_obj(const char* filename){
     return true;
 }
 
+void Mesh::compute_bounds() {
+    if (_vertices.empty()) {
+        _bounds = MeshBounds{};
+        return;
+    }
+
+    //sphere around the center of the aabb, not minimal but cheap and stable
+    glm::vec3 minPos = _vertices[0].position;
+    glm::vec3 maxPos = _vertices[0].position;
+    for (const Vertex& vertex : _vertices) {
+        minPos = glm::min(minPos, vertex.position);
+        maxPos = glm::max(maxPos, vertex.position);
+    }
+
+    _bounds.origin = (minPos + maxPos) * 0.5f;
+    _bounds.radius = 0.f;
+    for (const Vertex& vertex : _vertices) {
+        _bounds.radius = std::max(_bounds.radius, glm::length(vertex.position - _bounds.origin));
+    }
+}
@@ -1,6 +1,10 @@
 #pragma once
 
 #include <vk_types.h>
+#include <vk_geometry.h>
+#include <vk_culling.h>
+#include <vk_meshlet.h>
+#include <istream>
 #include <vector>
 #include <glm/vec3.hpp>
 
@@ -21,8 +25,26 @@ struct Vertex {
 
 struct Mesh {
     std::vector<Vertex> _vertices;
-    AllocatedBuffer _vertexBuffer;
+    std::vector<uint32_t> _indices;
+
+    // location of the uploaded vertices/indices inside the engine geometry pool
+    MeshRange _range;
+
+    MeshBounds _bounds;
+
+    // only built when meshlet culling is on. _firstMeshlet is where they start in the engine meshlet buffer
+    std::vector<Meshlet> _meshlets;
+    uint32_t _firstMeshlet{0};
 
     bool load_from_obj(const char *filename);
+
+    //same as above for obj text already in memory, like an asset pack entry. the data is not copied
+    bool load_from_obj(const uint8_t* data, size_t size);
+
+    //fits _bounds around _vertices
+    void compute_bounds();
+
+private:
+    bool load_from_obj(std::istream& stream);
 };
 
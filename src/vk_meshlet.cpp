@@ -0,0 +1,110 @@
+#include <vk_meshlet.h>
+#include <vk_mesh.h>
+
+#include <algorithm>
+#include <cmath>
+
+static void compute_meshlet_bounds(Meshlet& meshlet, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+                                   const std::vector<uint32_t>& uniqueVertices) {
+    glm::vec3 center{0.f};
+    for (uint32_t vertex : uniqueVertices) {
+        center += vertices[vertex].position;
+    }
+    center /= (float)uniqueVertices.size();
+
+    float radius = 0.f;
+    for (uint32_t vertex : uniqueVertices) {
+        radius = std::max(radius, glm::length(vertices[vertex].position - center));
+    }
+    meshlet.center = center;
+    meshlet.radius = radius;
+
+    // geometric normals, the backface test is about winding and not the shading normals
+    const uint32_t firstIndex = meshlet.triangleOffset * 3;
+    glm::vec3 axis{0.f};
+    std::vector<glm::vec3> normals;
+    normals.reserve(meshlet.triangleCount);
+    for (uint32_t t = 0; t < meshlet.triangleCount; t++) {
+        const glm::vec3& a = vertices[indices[firstIndex + t * 3 + 0]].position;
+        const glm::vec3& b = vertices[indices[firstIndex + t * 3 + 1]].position;
+        const glm::vec3& c = vertices[indices[firstIndex + t * 3 + 2]].position;
+
+        glm::vec3 normal = glm::cross(b - a, c - a);
+        float area = glm::length(normal);
+        // degenerate triangles face nowhere and can not be back facing
+        if (area <= 0.f) {
+            continue;
+        }
+        normals.push_back(normal / area);
+        axis += normals.back();
+    }
+
+    meshlet.coneAxis = glm::vec3(0.f, 0.f, 1.f);
+    meshlet.coneCutoff = 1.f;
+
+    float axisLength = glm::length(axis);
+    if (normals.empty() || axisLength <= 0.f) {
+        return;
+    }
+    axis /= axisLength;
+
+    float minDot = 1.f;
+    for (const glm::vec3& normal : normals) {
+        minDot = std::min(minDot, glm::dot(normal, axis));
+    }
+
+    // a cone wider than a hemisphere always has a normal facing the viewer
+    meshlet.coneAxis = axis;
+    meshlet.coneCutoff = minDot <= 0.f ? 1.f : std::sqrt(1.f - minDot * minDot);
+}
+
+std::vector<Meshlet> build_meshlets(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) {
+    std::vector<Meshlet> meshlets;
+    const uint32_t triangleCount = (uint32_t)(indices.size() / 3);
+    if (triangleCount == 0) {
+        return meshlets;
+    }
+
+    // last meshlet each vertex was added to, avoids clearing a set for every meshlet
+    std::vector<uint32_t> vertexMeshlet(vertices.size(), UINT32_MAX);
+    std::vector<uint32_t> uniqueVertices;
+    uniqueVertices.reserve(MESHLET_MAX_VERTICES);
+
+    Meshlet current = {};
+    uint32_t currentId = 0;
+    for (uint32_t t = 0; t < triangleCount; t++) {
+        uint32_t newVertices = 0;
+        for (uint32_t v = 0; v < 3; v++) {
+            uint32_t vertex = indices[t * 3 + v];
+            // a triangle can repeat a vertex, only count it once
+            bool repeated = (v > 0 && vertex == indices[t * 3]) || (v > 1 && vertex == indices[t * 3 + 1]);
+            if (vertexMeshlet[vertex] != currentId && !repeated) {
+                newVertices++;
+            }
+        }
+
+        if (current.triangleCount == MESHLET_MAX_TRIANGLES || current.vertexCount + newVertices > MESHLET_MAX_VERTICES) {
+            compute_meshlet_bounds(current, vertices, indices, uniqueVertices);
+            meshlets.push_back(current);
+
+            current = {};
+            current.triangleOffset = t;
+            currentId++;
+            uniqueVertices.clear();
+        }
+
+        for (uint32_t v = 0; v < 3; v++) {
+            uint32_t vertex = indices[t * 3 + v];
+            if (vertexMeshlet[vertex] != currentId) {
+                vertexMeshlet[vertex] = currentId;
+                uniqueVertices.push_back(vertex);
+                current.vertexCount++;
+            }
+        }
+        current.triangleCount++;
+    }
+
+    compute_meshlet_bounds(current, vertices, indices, uniqueVertices);
+    meshlets.push_back(current);
+    return meshlets;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+struct Vertex;
+
+// limits of one cluster, small enough for a mesh shader workgroup to output in one go
+constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+// a run of consecutive triangles of a mesh's index list, in mesh space
+struct Meshlet {
+    glm::vec3 center;
+    float radius;
+    // every triangle normal is within the cone around this axis. coneCutoff is the sine of the cone
+    // half angle, 1 means the normals are too spread out for the backface test
+    glm::vec3 coneAxis;
+    float coneCutoff;
+
+    // in triangles from the start of the mesh's indices
+    uint32_t triangleOffset;
+    uint32_t triangleCount;
+    uint32_t vertexCount;
+};
+
+// what the cull shader reads, one entry per meshlet of every uploaded mesh.
+// the index range is absolute in the geometry pool, so a surviving meshlet is copied into a draw as is
+struct GPUMeshlet {
+    glm::vec4 sphere;
+    glm::vec4 cone;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    int32_t vertexOffset;
+    uint32_t pad;
+};
+
+// splits an indexed triangle list into meshlets. triangles are taken in index order and a meshlet is
+// closed once the next triangle would break either limit, so the indices need no reordering
+std::vector<Meshlet> build_meshlets(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
@@ -0,0 +1,88 @@
+#include <vk_pacing.h>
+
+#include <cmath>
+#include <thread>
+
+void FramePacer::reset() {
+    _started = false;
+}
+
+void FramePacer::frame_finished() {
+    if (targetFps > 0.f) {
+        const auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / targetFps));
+        if (!_started) {
+            _nextDeadline = clock::now() + period;
+        } else {
+            _nextDeadline += period;
+            // after a long frame start counting again from now instead of rushing to catch up
+            if (_nextDeadline < clock::now()) {
+                _nextDeadline = clock::now();
+            }
+        }
+        wait_until(_nextDeadline);
+    }
+
+    auto now = clock::now();
+    if (!_started) {
+        _started = true;
+        _lastFrame = now;
+        _windowStart = now;
+        _windowCpuStart = std::clock();
+        _windowFrames = 0;
+        _windowSum = 0.0;
+        _windowSumSquares = 0.0;
+        _windowMax = 0.f;
+        return;
+    }
+
+    float frameMs = std::chrono::duration<float, std::milli>(now - _lastFrame).count();
+    _lastFrame = now;
+
+    _windowFrames++;
+    _windowSum += frameMs;
+    _windowSumSquares += (double)frameMs * frameMs;
+    if (frameMs > _windowMax) {
+        _windowMax = frameMs;
+    }
+
+    double windowSeconds = std::chrono::duration<double>(now - _windowStart).count();
+    if (windowSeconds < 1.0) {
+        return;
+    }
+
+    std::clock_t cpuNow = std::clock();
+    double mean = _windowSum / _windowFrames;
+    double variance = _windowSumSquares / _windowFrames - mean * mean;
+
+    _stats.averageFrameMs = (float)mean;
+    _stats.jitterMs = (float)std::sqrt(variance > 0.0 ? variance : 0.0);
+    _stats.maxFrameMs = _windowMax;
+    _stats.cpuUtilization = (float)((double)(cpuNow - _windowCpuStart) / CLOCKS_PER_SEC / windowSeconds);
+    _stats.frames = _windowFrames;
+    _statsUpdated = true;
+
+    _windowStart = now;
+    _windowCpuStart = cpuNow;
+    _windowFrames = 0;
+    _windowSum = 0.0;
+    _windowSumSquares = 0.0;
+    _windowMax = 0.f;
+}
+
+bool FramePacer::stats_updated() {
+    bool updated = _statsUpdated;
+    _statsUpdated = false;
+    return updated;
+}
+
+void FramePacer::wait_until(clock::time_point deadline) {
+    const auto spin = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float, std::milli>(spinMs));
+
+    auto now = clock::now();
+    if (deadline - now > spin) {
+        std::this_thread::sleep_until(deadline - spin);
+    }
+    while (clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+
+struct PacingStats {
+    float averageFrameMs;
+    // standard deviation of the frame interval
+    float jitterMs;
+    float maxFrameMs;
+    // std::clock over wall time. that is cpu time of the whole process: the simulation thread, the
+    // render thread and every job worker count, not just the thread calling frame_finished.
+    // goes above 1 with several threads busy
+    float cpuUtilization;
+    uint32_t frames;
+};
+
+// caps the frame rate and measures how evenly frames are delivered.
+// waits sleep most of the way to the deadline and spin the rest, os sleeps overshoot by up to a scheduler tick
+class FramePacer {
+public:
+    // 0 leaves the frame rate to the present mode
+    float targetFps{0.f};
+    // the last part of every wait is spun instead of slept
+    float spinMs{1.5f};
+
+    // forgets the last frame time, call after a pause so the gap is not counted as a frame
+    void reset();
+
+    // call once per frame after presenting, blocks until the next frame slot when capped
+    void frame_finished();
+
+    // true once per second, when get_stats has a fresh window of measurements
+    bool stats_updated();
+
+    PacingStats get_stats() const { return _stats; }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    void wait_until(clock::time_point deadline);
+
+    bool _started{false};
+    clock::time_point _lastFrame;
+    clock::time_point _nextDeadline;
+
+    clock::time_point _windowStart;
+    std::clock_t _windowCpuStart{0};
+    uint32_t _windowFrames{0};
+    double _windowSum{0.0};
+    double _windowSumSquares{0.0};
+    float _windowMax{0.f};
+
+    PacingStats _stats{};
+    bool _statsUpdated{false};
+};
@@ -0,0 +1,279 @@
+#include <vk_readback.h>
+#include <vk_memory.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// the consumer wakes up this often while the gpu is busy, to notice cleanup
+static const uint64_t CONSUMER_WAIT_TIMEOUT = 100000000;
+
+bool FrameReadback::init(VkDevice device, VmaAllocator allocator, GpuMemoryTracker* memory, VkSemaphore timeline, VkExtent2D extent,
+                         const std::string& target) {
+    _device = device;
+    _allocator = allocator;
+    _memory = memory;
+    _timeline = timeline;
+    _extent = extent;
+    _frameBytes = (size_t)extent.width * extent.height * 4;
+
+    if (_slotCount == 0 || !open_output(target)) {
+        return false;
+    }
+
+    _slots.reset(new Slot[_slotCount]);
+    for (uint32_t i = 0; i < _slotCount; i++) {
+        Slot& slot = _slots[i];
+
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.pNext = nullptr;
+        bufferInfo.size = _frameBytes;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+        // cached host memory where there is any, the consumer reads every byte
+        VmaAllocationCreateInfo allocInfo = {};
+        allocInfo.usage = VMA_MEMORY_USAGE_GPU_TO_CPU;
+
+        if (vmaCreateBuffer(_allocator, &bufferInfo, &allocInfo, &slot.buffer._buffer, &slot.buffer._allocation, nullptr) != VK_SUCCESS) {
+            std::cout << "Readback: could not allocate " << _slotCount << " frames of " << _frameBytes << " bytes" << std::endl;
+            _slotCount = i;
+            cleanup();
+            return false;
+        }
+        _memory->track(slot.buffer._allocation, MemoryCategory::Staging);
+        vmaMapMemory(_allocator, slot.buffer._allocation, (void**)&slot.data);
+    }
+
+    _produce = 0;
+    _consume = 0;
+    _stopping = false;
+    _consumer = std::thread([this]() { consume(); });
+    return true;
+}
+
+void FrameReadback::cleanup() {
+    if (_consumer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _wake.notify_one();
+        _consumer.join();
+    }
+
+    if (_slots) {
+        for (uint32_t i = 0; i < _slotCount; i++) {
+            Slot& slot = _slots[i];
+            vmaUnmapMemory(_allocator, slot.buffer._allocation);
+            _memory->untrack(slot.buffer._allocation);
+            vmaDestroyBuffer(_allocator, slot.buffer._buffer, slot.buffer._allocation);
+        }
+        _slots.reset();
+    }
+    close_output();
+}
+
+VkBuffer FrameReadback::begin_frame() {
+    Slot& slot = _slots[_produce];
+    if (slot.state.load(std::memory_order_acquire) != SLOT_FREE) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return VK_NULL_HANDLE;
+    }
+    slot.state.store(SLOT_RECORDING, std::memory_order_relaxed);
+    return slot.buffer._buffer;
+}
+
+void FrameReadback::end_frame(uint64_t timelineValue) {
+    Slot& slot = _slots[_produce];
+    slot.timelineValue = timelineValue;
+    slot.submitTime = std::chrono::steady_clock::now();
+    {
+        // under the lock so the consumer can not check the slot and go to sleep in between
+        std::lock_guard<std::mutex> lock(_mutex);
+        slot.state.store(SLOT_PENDING, std::memory_order_release);
+    }
+    _wake.notify_one();
+    _produce = (_produce + 1) % _slotCount;
+}
+
+ReadbackStats FrameReadback::get_stats() const {
+    std::lock_guard<std::mutex> lock(_statsMutex);
+    ReadbackStats stats = _stats;
+    stats.framesDropped = _dropped.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void FrameReadback::consume() {
+    for (;;) {
+        // slots are handed out and written in ring order, so the next one to write is always _consume
+        Slot& slot = _slots[_consume];
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [&]() { return _stopping || slot.state.load(std::memory_order_acquire) == SLOT_PENDING; });
+            // cleanup waits for the frames already submitted, not for ones that will never come
+            if (slot.state.load(std::memory_order_acquire) != SLOT_PENDING) {
+                return;
+            }
+        }
+
+        VkSemaphoreWaitInfo waitInfo = {};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.pNext = nullptr;
+        waitInfo.flags = 0;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &_timeline;
+        waitInfo.pValues = &slot.timelineValue;
+
+        VkResult result;
+        do {
+            result = vkWaitSemaphores(_device, &waitInfo, CONSUMER_WAIT_TIMEOUT);
+        } while (result == VK_TIMEOUT);
+
+        if (result == VK_SUCCESS) {
+            vmaInvalidateAllocation(_allocator, slot.buffer._allocation, 0, VK_WHOLE_SIZE);
+
+            // straight from the mapping into the output
+            const bool written = write_frame(slot.data);
+            auto now = std::chrono::steady_clock::now();
+            const float latencyMs = std::chrono::duration<float, std::milli>(now - slot.submitTime).count();
+
+            if (written) {
+                std::lock_guard<std::mutex> lock(_statsMutex);
+                if (_stats.framesWritten == 0) {
+                    _firstWrite = now;
+                }
+                _stats.framesWritten++;
+                _stats.bytesWritten += _frameBytes;
+                _latencyTotalMs += latencyMs;
+                _stats.averageLatencyMs = (float)(_latencyTotalMs / _stats.framesWritten);
+                _stats.maxLatencyMs = std::max(_stats.maxLatencyMs, latencyMs);
+
+                // rate between the first and the last write, the first frame only starts the clock
+                const float seconds = std::chrono::duration<float>(now - _firstWrite).count();
+                if (seconds > 0.f) {
+                    _stats.framesPerSecond = (_stats.framesWritten - 1) / seconds;
+                    _stats.megabytesPerSecond = _stats.framesPerSecond * _frameBytes / (1024.f * 1024.f);
+                }
+            }
+        } else {
+            std::cout << "Readback: waiting for a frame failed (" << result << ")" << std::endl;
+        }
+
+        slot.state.store(SLOT_FREE, std::memory_order_release);
+        _consume = (_consume + 1) % _slotCount;
+    }
+}
+
+bool FrameReadback::write_frame(const uint8_t* data) {
+    if (_ring) {
+        const uint64_t frame = _ring->frameCount.load(std::memory_order_relaxed);
+        uint8_t* frames = (uint8_t*)(_ring + 1);
+        memcpy(frames + (frame % _ring->slotCount) * _frameBytes, data, _frameBytes);
+        _ring->frameCount.store(frame + 1, std::memory_order_release);
+        return true;
+    }
+
+    if (!_file) {
+        return false;
+    }
+    if (fwrite(data, 1, _frameBytes, _file) != _frameBytes) {
+        // the reader went away, the frames keep being read back but go nowhere
+        std::cout << "Readback: output closed, no more frames are written" << std::endl;
+        close_output();
+        return false;
+    }
+    return true;
+}
+
+bool FrameReadback::open_output(const std::string& target) {
+    if (target.compare(0, 5, "pipe:") == 0) {
+#ifdef _WIN32
+        _file = _popen(target.c_str() + 5, "wb");
+#else
+        // a reader that exits early would otherwise kill the process on the next write
+        signal(SIGPIPE, SIG_IGN);
+        _file = popen(target.c_str() + 5, "w");
+#endif
+        _pipe = true;
+    } else if (target.compare(0, 4, "shm:") == 0) {
+#ifdef _WIN32
+        std::cout << "Readback: shared memory output needs posix shared memory" << std::endl;
+        return false;
+#else
+        _ringName = target.substr(4);
+        if (_ringName.empty() || _ringName[0] != '/') {
+            _ringName = "/" + _ringName;
+        }
+        _ringSize = sizeof(SharedFrameRing) + _frameBytes * _slotCount;
+
+        int fd = shm_open(_ringName.c_str(), O_CREAT | O_RDWR, 0644);
+        if (fd < 0 || ftruncate(fd, (off_t)_ringSize) != 0) {
+            std::cout << "Readback: could not create shared memory " << _ringName << std::endl;
+            if (fd >= 0) {
+                close(fd);
+                shm_unlink(_ringName.c_str());
+            }
+            return false;
+        }
+        void* mapping = mmap(nullptr, _ringSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            std::cout << "Readback: could not map shared memory " << _ringName << std::endl;
+            shm_unlink(_ringName.c_str());
+            return false;
+        }
+
+        _ring = new (mapping) SharedFrameRing();
+        _ring->width = _extent.width;
+        _ring->height = _extent.height;
+        _ring->slotCount = _slotCount;
+        _ring->frameBytes = _frameBytes;
+        _ring->frameCount.store(0, std::memory_order_relaxed);
+        // last, readers check it before trusting the rest
+        std::atomic_thread_fence(std::memory_order_release);
+        _ring->magic = SharedFrameRing::MAGIC;
+        return true;
+#endif
+    } else {
+        _file = fopen(target.c_str(), "wb");
+    }
+
+    if (!_file) {
+        std::cout << "Readback: could not open " << target << std::endl;
+        return false;
+    }
+    // frames go from the mapped buffer to the kernel, not through a stdio buffer first
+    setvbuf(_file, nullptr, _IONBF, 0);
+    return true;
+}
+
+void FrameReadback::close_output() {
+    if (_file) {
+        if (_pipe) {
+#ifdef _WIN32
+            _pclose(_file);
+#else
+            pclose(_file);
+#endif
+        } else {
+            fclose(_file);
+        }
+        _file = nullptr;
+    }
+#ifndef _WIN32
+    if (_ring) {
+        munmap(_ring, _ringSize);
+        shm_unlink(_ringName.c_str());
+        _ring = nullptr;
+    }
+#endif
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vk_types.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class GpuMemoryTracker;
+
+// header at the start of the shared memory ring, followed by slotCount frames of frameBytes each.
+// frame n is in slot n % slotCount and complete once frameCount is past n
+struct SharedFrameRing {
+    static constexpr uint32_t MAGIC = 0x52464b56; // "VKFR"
+
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+    uint32_t slotCount;
+    uint64_t frameBytes;
+    std::atomic<uint64_t> frameCount;
+};
+
+struct ReadbackStats {
+    uint64_t framesWritten;
+    // frames that found every slot still waiting for the consumer, they are not read back
+    uint64_t framesDropped;
+    uint64_t bytesWritten;
+    // from the submit of a frame to its pixels being in the output
+    float averageLatencyMs;
+    float maxLatencyMs;
+    // since the first frame was written
+    float framesPerSecond;
+    float megabytesPerSecond;
+};
+
+// copies finished frames out of the gpu without ever making the render loop wait.
+// every frame the graphics queue copies the final image into the next free slot of a ring of persistently
+// mapped host buffers. a consumer thread waits on the graphics timeline for each slot in turn and writes the
+// mapped memory straight to the output, rgba8 rows with no header:
+//   "pipe:<command>"  the stdin of the command, e.g. an encoder reading raw video
+//   "shm:<name>"      a SharedFrameRing in posix shared memory, readers poll frameCount
+//   anything else     a file, a fifo works too
+// when the consumer falls behind the ring fills up and frames are dropped instead of stalling
+class FrameReadback {
+public:
+    // frames in flight between the gpu and the output
+    uint32_t _slotCount{4};
+
+    bool init(VkDevice device, VmaAllocator allocator, GpuMemoryTracker* memory, VkSemaphore timeline, VkExtent2D extent,
+              const std::string& target);
+
+    // writes out the frames still in flight, the device has to be idle
+    void cleanup();
+
+    bool is_enabled() const { return _slots != nullptr; }
+
+    VkExtent2D extent() const { return _extent; }
+
+    // the buffer this frame copies into, VK_NULL_HANDLE when every slot is still in flight
+    VkBuffer begin_frame();
+
+    // the frame's copy is submitted and done once the timeline reaches value. only after a begin_frame
+    // that returned a buffer
+    void end_frame(uint64_t timelineValue);
+
+    ReadbackStats get_stats() const;
+
+private:
+    enum SlotState : uint8_t {
+        SLOT_FREE,
+        // handed out by begin_frame, the frame is being recorded
+        SLOT_RECORDING,
+        SLOT_PENDING
+    };
+
+    struct Slot {
+        AllocatedBuffer buffer;
+        const uint8_t* data;
+        std::atomic<uint8_t> state{SLOT_FREE};
+        uint64_t timelineValue;
+        std::chrono::steady_clock::time_point submitTime;
+    };
+
+    bool open_output(const std::string& target);
+
+    void close_output();
+
+    void consume();
+
+    bool write_frame(const uint8_t* data);
+
+    VkDevice _device{VK_NULL_HANDLE};
+    VmaAllocator _allocator{VK_NULL_HANDLE};
+    GpuMemoryTracker* _memory{nullptr};
+    VkSemaphore _timeline{VK_NULL_HANDLE};
+    VkExtent2D _extent{0, 0};
+    size_t _frameBytes{0};
+
+    std::unique_ptr<Slot[]> _slots;
+    // next slot begin_frame hands out, render thread only
+    uint32_t _produce{0};
+    // next slot the consumer writes, consumer thread only
+    uint32_t _consume{0};
+
+    std::thread _consumer;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _stopping{false};
+
+    FILE* _file{nullptr};
+    bool _pipe{false};
+    SharedFrameRing* _ring{nullptr};
+    size_t _ringSize{0};
+    std::string _ringName;
+
+    // written by the consumer, read by get_stats
+    mutable std::mutex _statsMutex;
+    ReadbackStats _stats{};
+    double _latencyTotalMs{0.0};
+    std::chrono::steady_clock::time_point _firstWrite;
+    std::atomic<uint64_t> _dropped{0};
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// 32 bit FNV-1a. constexpr so names written as literals are hashed by the compiler
+constexpr uint32_t fnv1a_32(const char* str, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= static_cast<uint8_t>(str[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// interned resource name, only the hash is kept around at runtime
+struct NameId {
+    uint32_t value{0};
+
+    constexpr NameId() = default;
+    constexpr explicit NameId(uint32_t hash) : value(hash) {}
+    explicit NameId(const std::string& name) : value(fnv1a_32(name.data(), name.size())) {}
+
+    constexpr bool operator==(NameId other) const { return value == other.value; }
+    constexpr bool operator!=(NameId other) const { return value != other.value; }
+};
+
+constexpr NameId operator""_id(const char* str, size_t length) {
+    return NameId{fnv1a_32(str, length)};
+}
+
+// index into a registry slot plus the generation the slot had when the handle was made.
+// a handle to a removed (or reused) slot fails the generation check instead of dangling
+template<typename T>
+struct Handle {
+    static constexpr uint32_t INVALID_INDEX = UINT32_MAX;
+
+    uint32_t index{INVALID_INDEX};
+    uint32_t generation{0};
+
+    bool valid() const { return index != INVALID_INDEX; }
+
+    bool operator==(Handle other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(Handle other) const { return !(*this == other); }
+};
+
+// dense slot array of resources addressed by handle. names are only hashed when a
+// resource is registered or looked up by name, never when resolving a handle
+template<typename T>
+class Registry {
+public:
+    Handle<T> add(const std::string& name, T&& value) {
+        NameId id{name};
+        auto existing = _lookup.find(id.value);
+        if (existing != _lookup.end()) {
+            // two names with one hash, find() could only ever return one of them
+            if (_names[existing->second] != name) {
+                std::cout << "Registry: \"" << name << "\" has the same name hash as \"" << _names[existing->second]
+                          << "\", not registered" << std::endl;
+                return {};
+            }
+            // the first registration wins, the resource in the slot may own memory the new one would leak.
+            // value is dropped, the caller must not have allocated anything for it yet
+            std::cout << "Registry: \"" << name << "\" is already registered, keeping the existing one" << std::endl;
+            return make_handle(existing->second);
+        }
+
+        uint32_t slot;
+        if (!_freeSlots.empty()) {
+            slot = _freeSlots.back();
+            _freeSlots.pop_back();
+            _items[slot] = std::move(value);
+            _names[slot] = name;
+            _alive[slot] = true;
+        } else {
+            slot = static_cast<uint32_t>(_items.size());
+            _items.push_back(std::move(value));
+            _names.push_back(name);
+            _generations.push_back(0);
+            _alive.push_back(true);
+        }
+        _lookup[id.value] = slot;
+        return make_handle(slot);
+    }
+
+    void remove(Handle<T> handle) {
+        if (!is_alive(handle)) {
+            return;
+        }
+        _lookup.erase(NameId{_names[handle.index]}.value);
+        _items[handle.index] = T{};
+        _names[handle.index].clear();
+        _alive[handle.index] = false;
+        _generations[handle.index]++;
+        _freeSlots.push_back(handle.index);
+    }
+
+    Handle<T> find(NameId name) const {
+        auto it = _lookup.find(name.value);
+        if (it == _lookup.end()) {
+            return {};
+        }
+        return make_handle(it->second);
+    }
+
+    T* get(Handle<T> handle) {
+        return is_alive(handle) ? &_items[handle.index] : nullptr;
+    }
+
+    const T* get(Handle<T> handle) const {
+        return is_alive(handle) ? &_items[handle.index] : nullptr;
+    }
+
+    const std::string& name_of(Handle<T> handle) const {
+        static const std::string empty;
+        return is_alive(handle) ? _names[handle.index] : empty;
+    }
+
+    bool is_alive(Handle<T> handle) const {
+        return handle.index < _items.size() && _alive[handle.index] && _generations[handle.index] == handle.generation;
+    }
+
+    // visits every live resource as (handle, resource)
+    template<typename F>
+    void for_each(F&& function) {
+        for (uint32_t i = 0; i < _items.size(); i++) {
+            if (_alive[i]) {
+                function(make_handle(i), _items[i]);
+            }
+        }
+    }
+
+    size_t size() const { return _lookup.size(); }
+
+private:
+    Handle<T> make_handle(uint32_t slot) const {
+        Handle<T> handle;
+        handle.index = slot;
+        handle.generation = _generations[slot];
+        return handle;
+    }
+
+    std::vector<T> _items;
+    std::vector<std::string> _names;
+    std::vector<uint32_t> _generations;
+    std::vector<bool> _alive;
+    std::vector<uint32_t> _freeSlots;
+    std::unordered_map<uint32_t, uint32_t> _lookup;
+};
@@ -0,0 +1,709 @@
+#include <vk_rendergraph.h>
+#include <vk_allocator.h>
+#include <vk_initializers.h>
+#include <vk_memory.h>
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+static bool is_depth_format(VkFormat format) {
+    switch (format) {
+        case VK_FORMAT_D16_UNORM:
+        case VK_FORMAT_X8_D24_UNORM_PACK32:
+        case VK_FORMAT_D32_SFLOAT:
+        case VK_FORMAT_D16_UNORM_S8_UINT:
+        case VK_FORMAT_D24_UNORM_S8_UINT:
+        case VK_FORMAT_D32_SFLOAT_S8_UINT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static VkImageAspectFlags aspect_of(VkFormat format) {
+    return is_depth_format(format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+}
+
+// the usage bit a non attachment access needs, from the layout it is done in
+static VkImageUsageFlags usage_of(VkImageLayout layout) {
+    switch (layout) {
+        case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL: return VK_IMAGE_USAGE_SAMPLED_BIT;
+        case VK_IMAGE_LAYOUT_GENERAL: return VK_IMAGE_USAGE_STORAGE_BIT;
+        case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL: return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL: return VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        default: return 0;
+    }
+}
+
+static const VkImageUsageFlags ATTACHMENT_USAGE = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                                                  VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+
+RGPass& RGPass::add_use(RGHandle resource, const RGAccess& access, bool write, Attachment attachment, const VkClearValue* clear) {
+    assert(_useCount < MAX_USES && "too many resources in one render graph pass");
+    Use& use = _uses[_useCount++];
+    use.resource = resource;
+    use.access = access;
+    use.write = write;
+    use.attachment = attachment;
+    use.clear = clear != nullptr;
+    use.clearValue = clear ? *clear : VkClearValue{};
+    use.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    use.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    if (attachment != Attachment::None) {
+        assert(_attachmentCount < MAX_ATTACHMENTS);
+        _attachmentCount++;
+    }
+    return *this;
+}
+
+RGPass& RGPass::color(RGHandle image) {
+    return add_use(image, RG_COLOR_ATTACHMENT, true, Attachment::Color, nullptr);
+}
+
+RGPass& RGPass::color(RGHandle image, VkClearColorValue clear) {
+    VkClearValue value;
+    value.color = clear;
+    return add_use(image, RG_COLOR_ATTACHMENT, true, Attachment::Color, &value);
+}
+
+RGPass& RGPass::depth(RGHandle image) {
+    return add_use(image, RG_DEPTH_ATTACHMENT, true, Attachment::Depth, nullptr);
+}
+
+RGPass& RGPass::depth(RGHandle image, float clear) {
+    VkClearValue value;
+    value.depthStencil.depth = clear;
+    value.depthStencil.stencil = 0;
+    return add_use(image, RG_DEPTH_ATTACHMENT, true, Attachment::Depth, &value);
+}
+
+RGPass& RGPass::read(RGHandle resource, const RGAccess& access) {
+    return add_use(resource, access, false, Attachment::None, nullptr);
+}
+
+RGPass& RGPass::write(RGHandle resource, const RGAccess& access) {
+    return add_use(resource, access, true, Attachment::None, nullptr);
+}
+
+RGPass& RGPass::secondary_contents() {
+    _secondaryContents = true;
+    return *this;
+}
+
+RGPass& RGPass::side_effects() {
+    _sideEffects = true;
+    return *this;
+}
+
+void RenderGraph::init(VkDevice device, VmaAllocator allocator, GpuMemoryTracker* memory) {
+    _device = device;
+    _allocator = allocator;
+    _memory = memory;
+}
+
+void RenderGraph::cleanup() {
+    destroy_transients();
+    for (const CachedRenderPass& cached : _renderPasses) {
+        vkDestroyRenderPass(_device, cached.renderPass, host_allocator().callbacks());
+    }
+    _renderPasses.clear();
+    _passes.clear();
+    _resources.clear();
+}
+
+void RenderGraph::begin() {
+    _passes.clear();
+    _resources.clear();
+}
+
+RGHandle RenderGraph::import_image(const char* name, VkImage image, VkImageView view, const RGImageDesc& desc, const RGAccess& initial) {
+    Resource resource = {};
+    resource.name = name;
+    resource.isImage = true;
+    resource.image = image;
+    resource.view = view;
+    resource.desc = desc;
+    resource.initial = initial;
+    _resources.push_back(resource);
+    return (RGHandle)(_resources.size() - 1);
+}
+
+RGHandle RenderGraph::import_buffer(const char* name, VkBuffer buffer, const RGAccess& initial) {
+    Resource resource = {};
+    resource.name = name;
+    resource.buffer = buffer;
+    resource.initial = initial;
+    _resources.push_back(resource);
+    return (RGHandle)(_resources.size() - 1);
+}
+
+RGHandle RenderGraph::create_image(const char* name, const RGImageDesc& desc) {
+    Resource resource = {};
+    resource.name = name;
+    resource.isImage = true;
+    resource.transient = true;
+    resource.desc = desc;
+    resource.initial = RG_NO_ACCESS;
+    _resources.push_back(resource);
+    return (RGHandle)(_resources.size() - 1);
+}
+
+void RenderGraph::export_resource(RGHandle resource, const RGAccess& final, uint32_t srcQueueFamily, uint32_t dstQueueFamily) {
+    Resource& exported = _resources[resource];
+    exported.exported = true;
+    exported.final = final;
+    exported.srcQueueFamily = srcQueueFamily;
+    exported.dstQueueFamily = dstQueueFamily;
+}
+
+RGPass& RenderGraph::add_pass(const char* name, std::function<void(const RGPassContext&)>&& execute) {
+    _passes.emplace_back();
+    RGPass& pass = _passes.back();
+    pass._name = name;
+    pass._execute = std::move(execute);
+    return pass;
+}
+
+void RenderGraph::cull_passes() {
+    //walks the passes backwards. a resource is needed while a later pass or the export still reads what
+    //is in it, a clear ends that. store ops fall out of the same walk
+    _needed.assign(_resources.size(), 0);
+    for (size_t i = 0; i < _resources.size(); i++) {
+        _needed[i] = _resources[i].exported ? 1 : 0;
+    }
+
+    for (size_t p = _passes.size(); p-- > 0;) {
+        RGPass& pass = _passes[p];
+
+        pass._culled = !pass._sideEffects;
+        for (uint32_t u = 0; u < pass._useCount; u++) {
+            if (pass._uses[u].write && _needed[pass._uses[u].resource]) {
+                pass._culled = false;
+            }
+        }
+        if (pass._culled) {
+            continue;
+        }
+
+        for (uint32_t u = 0; u < pass._useCount; u++) {
+            RGPass::Use& use = pass._uses[u];
+            if (use.attachment != RGPass::Attachment::None) {
+                use.storeOp = _needed[use.resource] ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            }
+        }
+        //shader writes can be partial, only a cleared attachment fully replaces what was there
+        for (uint32_t u = 0; u < pass._useCount; u++) {
+            const RGPass::Use& use = pass._uses[u];
+            _needed[use.resource] = (use.attachment != RGPass::Attachment::None && use.clear) ? 0 : 1;
+        }
+    }
+}
+
+void RenderGraph::compile() {
+    cull_passes();
+
+    for (Resource& resource : _resources) {
+        resource.usage = 0;
+        resource.firstPass = UINT32_MAX;
+        resource.lastPass = UINT32_MAX;
+        resource.transientIndex = UINT32_MAX;
+        resource.hasContents = !resource.isImage || (!resource.transient && resource.initial.layout != VK_IMAGE_LAYOUT_UNDEFINED);
+    }
+
+    _stats.passes = (uint32_t)_passes.size();
+    _stats.culledPasses = 0;
+    for (uint32_t p = 0; p < (uint32_t)_passes.size(); p++) {
+        RGPass& pass = _passes[p];
+        if (pass._culled) {
+            _stats.culledPasses++;
+            continue;
+        }
+
+        for (uint32_t u = 0; u < pass._useCount; u++) {
+            RGPass::Use& use = pass._uses[u];
+            Resource& resource = _resources[use.resource];
+            if (resource.firstPass == UINT32_MAX) {
+                resource.firstPass = p;
+            }
+            resource.lastPass = p;
+
+            if (use.attachment == RGPass::Attachment::Color) {
+                resource.usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+            } else if (use.attachment == RGPass::Attachment::Depth) {
+                resource.usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+            } else {
+                resource.usage |= usage_of(use.access.layout);
+            }
+
+            if (use.attachment != RGPass::Attachment::None) {
+                if (use.clear) {
+                    use.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+                } else {
+                    use.loadOp = resource.hasContents ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+                }
+            }
+            if (use.write) {
+                resource.hasContents = true;
+            }
+        }
+    }
+    for (Resource& resource : _resources) {
+        if (resource.exported) {
+            resource.usage |= usage_of(resource.final.layout);
+        }
+    }
+
+    place_transients();
+
+    for (RGPass& pass : _passes) {
+        pass._renderPass = VK_NULL_HANDLE;
+        pass._framebuffer = VK_NULL_HANDLE;
+        if (pass._culled || pass._attachmentCount == 0) {
+            continue;
+        }
+
+        //colors first, the depth attachment last
+        RenderPassKey key = {};
+        VkImageView views[RGPass::MAX_ATTACHMENTS];
+        VkExtent2D extent = {UINT32_MAX, UINT32_MAX};
+        for (int depthSlot = 0; depthSlot < 2; depthSlot++) {
+            const RGPass::Attachment kind = depthSlot ? RGPass::Attachment::Depth : RGPass::Attachment::Color;
+            for (uint32_t u = 0; u < pass._useCount; u++) {
+                const RGPass::Use& use = pass._uses[u];
+                if (use.attachment != kind) {
+                    continue;
+                }
+                const Resource& resource = _resources[use.resource];
+                const uint32_t slot = key.attachmentCount++;
+                key.formats[slot] = resource.desc.format;
+                key.loadOps[slot] = use.loadOp;
+                key.storeOps[slot] = use.storeOp;
+                key.hasDepth = key.hasDepth || depthSlot;
+                views[slot] = resource.view;
+                pass._clearValues[slot] = use.clearValue;
+                extent.width = std::min(extent.width, resource.desc.extent.width);
+                extent.height = std::min(extent.height, resource.desc.extent.height);
+            }
+        }
+
+        pass._renderPass = get_render_pass(key);
+        pass._framebuffer = get_framebuffer(pass._renderPass, views, key.attachmentCount, extent);
+    }
+}
+
+static bool same_transient(const VkImageUsageFlags usageA, const RGImageDesc& a, uint32_t firstA, uint32_t lastA,
+                           const VkImageUsageFlags usageB, const RGImageDesc& b, uint32_t firstB, uint32_t lastB) {
+    return usageA == usageB && a.format == b.format && a.extent.width == b.extent.width && a.extent.height == b.extent.height &&
+           firstA == firstB && lastA == lastB;
+}
+
+void RenderGraph::place_transients() {
+    _transientRequests.clear();
+    for (uint32_t i = 0; i < (uint32_t)_resources.size(); i++) {
+        Resource& resource = _resources[i];
+        if (!resource.transient || resource.firstPass == UINT32_MAX) {
+            continue;
+        }
+        TransientImage request = {};
+        request.desc = resource.desc;
+        request.usage = resource.usage;
+        request.firstPass = resource.firstPass;
+        request.lastPass = resource.lastPass;
+        request.resource = i;
+        request.previousAlias = UINT32_MAX;
+        resource.transientIndex = (uint32_t)_transientRequests.size();
+        _transientRequests.push_back(request);
+    }
+
+    //same shape as last frame, the images and their memory are reused
+    bool reuse = _transientRequests.size() == _transients.size();
+    for (size_t i = 0; reuse && i < _transients.size(); i++) {
+        const TransientImage& a = _transientRequests[i];
+        const TransientImage& b = _transients[i];
+        reuse = same_transient(a.usage, a.desc, a.firstPass, a.lastPass, b.usage, b.desc, b.firstPass, b.lastPass);
+    }
+
+    if (!reuse) {
+        destroy_transients();
+        _transients = _transientRequests;
+
+        _stats.transientImages = (uint32_t)_transients.size();
+        _stats.lazyImages = 0;
+        _stats.transientBytes = 0;
+        _stats.allocatedBytes = 0;
+
+        VmaAllocationCreateInfo lazyInfo = {};
+        lazyInfo.usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED;
+
+        std::vector<uint32_t> aliased;
+        for (uint32_t i = 0; i < (uint32_t)_transients.size(); i++) {
+            TransientImage& transient = _transients[i];
+
+            //attachment only images never need backing memory outside the render pass on tilers
+            const bool attachmentOnly = (transient.usage & ~ATTACHMENT_USAGE) == 0;
+            VkImageUsageFlags usage = transient.usage;
+            if (attachmentOnly) {
+                usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+            }
+
+            VkImageCreateInfo imageInfo = vkinit::image_create_info(transient.desc.format, usage,
+                                                                    {transient.desc.extent.width, transient.desc.extent.height, 1});
+            if (vkCreateImage(_device, &imageInfo, host_allocator().callbacks(), &transient.image) != VK_SUCCESS) {
+                std::cout << "Failed to create render graph image " << _resources[transient.resource].name << std::endl;
+                transient.image = VK_NULL_HANDLE;
+                continue;
+            }
+            vkGetImageMemoryRequirements(_device, transient.image, &transient.requirements);
+            _stats.transientBytes += transient.requirements.size;
+
+            uint32_t lazyType;
+            transient.lazy = attachmentOnly &&
+                             vmaFindMemoryTypeIndex(_allocator, transient.requirements.memoryTypeBits, &lazyInfo, &lazyType) == VK_SUCCESS;
+            if (transient.lazy) {
+                VmaAllocation allocation;
+                if (vmaAllocateMemory(_allocator, &transient.requirements, &lazyInfo, &allocation, nullptr) == VK_SUCCESS) {
+                    vmaBindImageMemory(_allocator, allocation, transient.image);
+                    _memory->track(allocation, MemoryCategory::Attachment);
+                    _transientMemory.push_back(allocation);
+                    _stats.lazyImages++;
+                    continue;
+                }
+                transient.lazy = false;
+            }
+            aliased.push_back(i);
+        }
+
+        //largest first, each image goes into the first block whose images are all dead before it starts
+        //or born after it ends. the block grows to the largest image it holds
+        std::sort(aliased.begin(), aliased.end(), [&](uint32_t a, uint32_t b) {
+            return _transients[a].requirements.size > _transients[b].requirements.size;
+        });
+
+        struct Block {
+            VkMemoryRequirements requirements;
+            std::vector<uint32_t> images;
+        };
+        std::vector<Block> blocks;
+        for (uint32_t index : aliased) {
+            TransientImage& transient = _transients[index];
+
+            Block* target = nullptr;
+            for (Block& block : blocks) {
+                if ((block.requirements.memoryTypeBits & transient.requirements.memoryTypeBits) == 0) {
+                    continue;
+                }
+                bool overlaps = false;
+                for (uint32_t other : block.images) {
+                    overlaps = overlaps || (_transients[other].firstPass <= transient.lastPass && transient.firstPass <= _transients[other].lastPass);
+                }
+                if (!overlaps) {
+                    target = &block;
+                    break;
+                }
+            }
+            if (!target) {
+                blocks.push_back(Block{transient.requirements, {}});
+                target = &blocks.back();
+            }
+
+            target->requirements.size = std::max(target->requirements.size, transient.requirements.size);
+            target->requirements.alignment = std::max(target->requirements.alignment, transient.requirements.alignment);
+            target->requirements.memoryTypeBits &= transient.requirements.memoryTypeBits;
+            target->images.push_back(index);
+        }
+
+        VmaAllocationCreateInfo blockInfo = {};
+        blockInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        blockInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        for (Block& block : blocks) {
+            VmaAllocation allocation;
+            if (vmaAllocateMemory(_allocator, &block.requirements, &blockInfo, &allocation, nullptr) != VK_SUCCESS) {
+                std::cout << "Failed to allocate " << block.requirements.size << " bytes of render graph memory" << std::endl;
+                continue;
+            }
+            _memory->track(allocation, MemoryCategory::Attachment);
+            _transientMemory.push_back(allocation);
+            _stats.allocatedBytes += block.requirements.size;
+
+            //in pass order, so every image knows whose accesses it has to wait for
+            std::sort(block.images.begin(), block.images.end(), [&](uint32_t a, uint32_t b) {
+                return _transients[a].firstPass < _transients[b].firstPass;
+            });
+            for (size_t i = 0; i < block.images.size(); i++) {
+                TransientImage& transient = _transients[block.images[i]];
+                vmaBindImageMemory(_allocator, allocation, transient.image);
+                transient.previousAlias = i > 0 ? block.images[i - 1] : UINT32_MAX;
+            }
+        }
+
+        for (TransientImage& transient : _transients) {
+            if (transient.image == VK_NULL_HANDLE) {
+                continue;
+            }
+            VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(transient.desc.format, transient.image, aspect_of(transient.desc.format));
+            if (vkCreateImageView(_device, &viewInfo, host_allocator().callbacks(), &transient.view) != VK_SUCCESS) {
+                std::cout << "Failed to create render graph image view" << std::endl;
+                transient.view = VK_NULL_HANDLE;
+            }
+        }
+
+        if (!_placedBefore || logPlacements) {
+            std::cout << "Render graph: " << _stats.transientImages << " transient images, " << _stats.transientBytes / 1024 << " KB requested, "
+                      << _stats.allocatedBytes / 1024 << " KB allocated after aliasing, " << _stats.lazyImages << " lazily allocated" << std::endl;
+        }
+        _placedBefore = true;
+    }
+
+    for (size_t i = 0; i < _transients.size(); i++) {
+        _transients[i].resource = _transientRequests[i].resource;
+        Resource& resource = _resources[_transients[i].resource];
+        resource.image = _transients[i].image;
+        resource.view = _transients[i].view;
+    }
+}
+
+void RenderGraph::destroy_transients() {
+    //framebuffers may point at the views below, they are cheap to make again
+    for (const CachedFramebuffer& cached : _framebuffers) {
+        vkDestroyFramebuffer(_device, cached.framebuffer, host_allocator().callbacks());
+    }
+    _framebuffers.clear();
+
+    for (const TransientImage& transient : _transients) {
+        if (transient.view != VK_NULL_HANDLE) {
+            vkDestroyImageView(_device, transient.view, host_allocator().callbacks());
+        }
+        if (transient.image != VK_NULL_HANDLE) {
+            vkDestroyImage(_device, transient.image, host_allocator().callbacks());
+        }
+    }
+    _transients.clear();
+
+    for (VmaAllocation allocation : _transientMemory) {
+        _memory->untrack(allocation);
+        vmaFreeMemory(_allocator, allocation);
+    }
+    _transientMemory.clear();
+}
+
+VkRenderPass RenderGraph::get_render_pass(const RenderPassKey& key) {
+    for (const CachedRenderPass& cached : _renderPasses) {
+        bool same = cached.key.attachmentCount == key.attachmentCount && cached.key.hasDepth == key.hasDepth;
+        for (uint32_t i = 0; same && i < key.attachmentCount; i++) {
+            same = cached.key.formats[i] == key.formats[i] && cached.key.loadOps[i] == key.loadOps[i] &&
+                   cached.key.storeOps[i] == key.storeOps[i];
+        }
+        if (same) {
+            return cached.renderPass;
+        }
+    }
+
+    //the graph's barriers do every layout transition, attachments stay in their attachment layout for
+    //the whole pass and the implicit external dependencies are enough
+    VkAttachmentDescription attachments[RGPass::MAX_ATTACHMENTS];
+    VkAttachmentReference references[RGPass::MAX_ATTACHMENTS];
+    for (uint32_t i = 0; i < key.attachmentCount; i++) {
+        const bool depth = key.hasDepth && i == key.attachmentCount - 1;
+        const VkImageLayout layout = depth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        attachments[i] = {};
+        attachments[i].format = key.formats[i];
+        attachments[i].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachments[i].loadOp = key.loadOps[i];
+        attachments[i].storeOp = key.storeOps[i];
+        attachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[i].initialLayout = layout;
+        attachments[i].finalLayout = layout;
+
+        references[i].attachment = i;
+        references[i].layout = layout;
+    }
+
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = key.hasDepth ? key.attachmentCount - 1 : key.attachmentCount;
+    subpass.pColorAttachments = references;
+    subpass.pDepthStencilAttachment = key.hasDepth ? &references[key.attachmentCount - 1] : nullptr;
+
+    VkRenderPassCreateInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = key.attachmentCount;
+    renderPassInfo.pAttachments = attachments;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+
+    VkRenderPass renderPass;
+    if (vkCreateRenderPass(_device, &renderPassInfo, host_allocator().callbacks(), &renderPass) != VK_SUCCESS) {
+        std::cout << "Failed to create a render graph render pass" << std::endl;
+        return VK_NULL_HANDLE;
+    }
+    _renderPasses.push_back(CachedRenderPass{key, renderPass});
+    return renderPass;
+}
+
+VkFramebuffer RenderGraph::get_framebuffer(VkRenderPass renderPass, const VkImageView* views, uint32_t count, VkExtent2D extent) {
+    for (const CachedFramebuffer& cached : _framebuffers) {
+        bool same = cached.renderPass == renderPass && cached.attachmentCount == count &&
+                    cached.extent.width == extent.width && cached.extent.height == extent.height;
+        for (uint32_t i = 0; same && i < count; i++) {
+            same = cached.views[i] == views[i];
+        }
+        if (same) {
+            return cached.framebuffer;
+        }
+    }
+
+    VkFramebufferCreateInfo framebufferInfo = {};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = renderPass;
+    framebufferInfo.attachmentCount = count;
+    framebufferInfo.pAttachments = views;
+    framebufferInfo.width = extent.width;
+    framebufferInfo.height = extent.height;
+    framebufferInfo.layers = 1;
+
+    CachedFramebuffer cached = {};
+    cached.renderPass = renderPass;
+    cached.attachmentCount = count;
+    std::copy(views, views + count, cached.views);
+    cached.extent = extent;
+    if (vkCreateFramebuffer(_device, &framebufferInfo, host_allocator().callbacks(), &cached.framebuffer) != VK_SUCCESS) {
+        std::cout << "Failed to create a render graph framebuffer" << std::endl;
+        return VK_NULL_HANDLE;
+    }
+    _framebuffers.push_back(cached);
+    return cached.framebuffer;
+}
+
+void RenderGraph::transition(Resource& resource, const RGAccess& access, bool write, bool discard) {
+    VkPipelineStageFlags srcStages = resource.written ? resource.state.stages : 0;
+    VkAccessFlags srcAccess = resource.written ? resource.state.access : 0;
+    //write after read only needs the readers to finish
+    if (write && !resource.written) {
+        srcStages = resource.state.stages;
+    }
+
+    //an aliased image's first use waits for whatever used the memory before it
+    if (resource.transient && !resource.hasContents) {
+        const uint32_t previous = _transients[resource.transientIndex].previousAlias;
+        if (previous != UINT32_MAX) {
+            const Resource& other = _resources[_transients[previous].resource];
+            srcStages |= other.state.stages;
+            srcAccess |= other.written ? other.state.access : 0;
+        }
+    }
+
+    VkImageLayout oldLayout = resource.state.layout;
+    if ((discard || !resource.hasContents) && oldLayout != access.layout) {
+        oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    }
+    const bool layoutChange = resource.isImage && oldLayout != access.layout;
+
+    if (srcStages == 0 && !layoutChange) {
+        //reads after reads share one barrier, later writers wait for all of them
+        resource.state.stages |= access.stages;
+        resource.state.access |= access.access;
+        resource.written = resource.written || write;
+        resource.hasContents = resource.hasContents || write;
+        return;
+    }
+
+    if (resource.isImage) {
+        VkImageMemoryBarrier barrier = vkinit::image_barrier(resource.image, srcAccess, access.access, oldLayout, access.layout,
+                                                             aspect_of(resource.desc.format));
+        _imageBarriers.push_back(barrier);
+    } else {
+        _bufferBarriers.push_back(vkinit::buffer_barrier(resource.buffer, srcAccess, access.access));
+    }
+    _srcStages |= srcStages ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    _dstStages |= access.stages;
+
+    resource.state = access;
+    resource.written = write;
+    resource.hasContents = resource.hasContents || write;
+}
+
+void RenderGraph::flush_barriers(VkCommandBuffer cmd) {
+    if (_imageBarriers.empty() && _bufferBarriers.empty()) {
+        return;
+    }
+    vkCmdPipelineBarrier(cmd, _srcStages, _dstStages ? _dstStages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                         (uint32_t)_bufferBarriers.size(), _bufferBarriers.data(), (uint32_t)_imageBarriers.size(), _imageBarriers.data());
+    _stats.barriers += (uint32_t)(_imageBarriers.size() + _bufferBarriers.size());
+
+    _imageBarriers.clear();
+    _bufferBarriers.clear();
+    _srcStages = 0;
+    _dstStages = 0;
+}
+
+void RenderGraph::execute(VkCommandBuffer cmd, VkExtent2D renderArea) {
+    _stats.barriers = 0;
+    for (Resource& resource : _resources) {
+        resource.state = resource.initial;
+        resource.written = false;
+        resource.hasContents = !resource.isImage || (!resource.transient && resource.initial.layout != VK_IMAGE_LAYOUT_UNDEFINED);
+    }
+
+    for (RGPass& pass : _passes) {
+        if (pass._culled) {
+            continue;
+        }
+
+        for (uint32_t u = 0; u < pass._useCount; u++) {
+            const RGPass::Use& use = pass._uses[u];
+            const bool discard = use.attachment != RGPass::Attachment::None && use.loadOp != VK_ATTACHMENT_LOAD_OP_LOAD;
+            transition(_resources[use.resource], use.access, use.write, discard);
+        }
+        flush_barriers(cmd);
+
+        RGPassContext context = {cmd, pass._renderPass, pass._framebuffer};
+        if (pass._renderPass != VK_NULL_HANDLE) {
+            VkRenderPassBeginInfo beginInfo = vkinit::renderpass_begin_info(pass._renderPass, renderArea, pass._framebuffer);
+            beginInfo.clearValueCount = pass._attachmentCount;
+            beginInfo.pClearValues = pass._clearValues;
+            vkCmdBeginRenderPass(cmd, &beginInfo, pass._secondaryContents ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                                                                          : VK_SUBPASS_CONTENTS_INLINE);
+        }
+
+        pass._execute(context);
+
+        if (pass._renderPass != VK_NULL_HANDLE) {
+            vkCmdEndRenderPass(cmd);
+        }
+    }
+
+    //exports only get a barrier for a layout change, a queue family transfer (the release half of it) or
+    //host reads, the host can not record a barrier of its own
+    for (Resource& resource : _resources) {
+        if (!resource.exported || resource.firstPass == UINT32_MAX) {
+            continue;
+        }
+        const bool familyChange = resource.srcQueueFamily != resource.dstQueueFamily;
+        const bool layoutChange = resource.isImage && resource.state.layout != resource.final.layout;
+        const bool hostRead = (resource.final.stages & VK_PIPELINE_STAGE_HOST_BIT) != 0;
+        if (!familyChange && !layoutChange && !hostRead) {
+            continue;
+        }
+
+        const VkAccessFlags srcAccess = resource.written ? resource.state.access : 0;
+        if (resource.isImage) {
+            VkImageMemoryBarrier barrier = vkinit::image_barrier(resource.image, srcAccess, resource.final.access, resource.state.layout,
+                                                                 resource.final.layout, aspect_of(resource.desc.format));
+            barrier.srcQueueFamilyIndex = resource.srcQueueFamily;
+            barrier.dstQueueFamilyIndex = resource.dstQueueFamily;
+            _imageBarriers.push_back(barrier);
+        } else {
+            VkBufferMemoryBarrier barrier = vkinit::buffer_barrier(resource.buffer, srcAccess, resource.final.access);
+            barrier.srcQueueFamilyIndex = resource.srcQueueFamily;
+            barrier.dstQueueFamilyIndex = resource.dstQueueFamily;
+            _bufferBarriers.push_back(barrier);
+        }
+        _srcStages |= resource.state.stages ? resource.state.stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        _dstStages |= resource.final.stages;
+        resource.state = resource.final;
+    }
+    flush_barriers(cmd);
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <vk_types.h>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+class GpuMemoryTracker;
+
+// index of a resource in the graph being built, valid until the next begin()
+using RGHandle = uint32_t;
+constexpr RGHandle RG_INVALID_HANDLE = UINT32_MAX;
+
+// how a pass touches a resource. the layout is ignored for buffers
+struct RGAccess {
+    VkPipelineStageFlags stages;
+    VkAccessFlags access;
+    VkImageLayout layout;
+};
+
+constexpr RGAccess RG_COMPUTE_READ = {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL};
+constexpr RGAccess RG_COMPUTE_WRITE = {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                                       VK_IMAGE_LAYOUT_GENERAL};
+constexpr RGAccess RG_FRAGMENT_READ = {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+constexpr RGAccess RG_INDIRECT_READ = {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED};
+constexpr RGAccess RG_HOST_READ = {VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED};
+constexpr RGAccess RG_COLOR_ATTACHMENT = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                                          VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                                          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+constexpr RGAccess RG_DEPTH_ATTACHMENT = {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                                          VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                                          VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+// imported resources whose previous contents are not needed, or that nothing touched yet
+constexpr RGAccess RG_NO_ACCESS = {0, 0, VK_IMAGE_LAYOUT_UNDEFINED};
+
+struct RGImageDesc {
+    VkFormat format;
+    VkExtent2D extent;
+};
+
+// what a pass callback records into. the render pass and framebuffer are null for passes without attachments
+struct RGPassContext {
+    VkCommandBuffer cmd;
+    VkRenderPass renderPass;
+    VkFramebuffer framebuffer;
+};
+
+struct RenderGraphStats {
+    uint32_t passes;
+    uint32_t culledPasses;
+    // image and buffer barriers recorded by the last execute()
+    uint32_t barriers;
+    uint32_t transientImages;
+    uint32_t lazyImages;
+    // what the transient images would take with one allocation each, and what was actually allocated
+    // after lifetime aliasing. lazily allocated images count as zero, tilers keep them in tile memory
+    VkDeviceSize transientBytes;
+    VkDeviceSize allocatedBytes;
+};
+
+class RenderGraph;
+
+// returned by add_pass, declares what the pass touches. attachments are bound in declaration order,
+// colors first then depth, the same order the pipelines' render passes use
+class RGPass {
+public:
+    static constexpr uint32_t MAX_USES = 8;
+    static constexpr uint32_t MAX_ATTACHMENTS = 5;
+
+    // without a clear value the previous contents are loaded, or discarded if there are none
+    RGPass& color(RGHandle image);
+    RGPass& color(RGHandle image, VkClearColorValue clear);
+    RGPass& depth(RGHandle image);
+    RGPass& depth(RGHandle image, float clear);
+
+    RGPass& read(RGHandle resource, const RGAccess& access);
+    RGPass& write(RGHandle resource, const RGAccess& access);
+
+    // the callback fills the render pass with vkCmdExecuteCommands
+    RGPass& secondary_contents();
+
+    // kept even when nothing reads what it writes
+    RGPass& side_effects();
+
+private:
+    friend class RenderGraph;
+
+    enum class Attachment : uint8_t { None, Color, Depth };
+
+    struct Use {
+        RGHandle resource;
+        RGAccess access;
+        bool write;
+        Attachment attachment;
+        bool clear;
+        VkClearValue clearValue;
+        // picked by compile()
+        VkAttachmentLoadOp loadOp;
+        VkAttachmentStoreOp storeOp;
+    };
+
+    RGPass& add_use(RGHandle resource, const RGAccess& access, bool write, Attachment attachment, const VkClearValue* clear);
+
+    const char* _name{nullptr};
+    std::function<void(const RGPassContext&)> _execute;
+    Use _uses[MAX_USES];
+    uint32_t _useCount{0};
+    uint32_t _attachmentCount{0};
+    bool _secondaryContents{false};
+    bool _sideEffects{false};
+
+    // filled by compile()
+    bool _culled{false};
+    VkRenderPass _renderPass{VK_NULL_HANDLE};
+    VkFramebuffer _framebuffer{VK_NULL_HANDLE};
+    VkClearValue _clearValues[MAX_ATTACHMENTS];
+};
+
+// per frame graph of the passes in one command buffer. passes only declare the resources they read and
+// write, compile() culls passes nobody depends on, picks attachment load and store ops and places the
+// transient images, execute() records every layout transition and barrier in between.
+// rebuilt every frame, render passes, framebuffers and transient images are cached across frames so a
+// graph with the same shape as the last one allocates nothing
+class RenderGraph {
+public:
+    // the transient memory summary is printed for the first placement, and for every later one
+    // (resizes, dynamic resolution) only when this is set
+    bool logPlacements{false};
+
+    void init(VkDevice device, VmaAllocator allocator, GpuMemoryTracker* memory);
+
+    // the device has to be idle
+    void cleanup();
+
+    // drops last frame's passes and resources, the gpu has to be done with the previous execute()
+    void begin();
+
+    // an image owned outside the graph, initial is how it was left. RG_NO_ACCESS discards the contents
+    RGHandle import_image(const char* name, VkImage image, VkImageView view, const RGImageDesc& desc, const RGAccess& initial);
+
+    RGHandle import_buffer(const char* name, VkBuffer buffer, const RGAccess& initial);
+
+    // an image that only lives inside the frame. it gets memory shared with transients whose lifetimes
+    // do not overlap, or lazily allocated memory when it is only ever used as an attachment
+    RGHandle create_image(const char* name, const RGImageDesc& desc);
+
+    // keeps the resource and its last write alive after the graph, and leaves it in the given state.
+    // the consumer outside the graph brings its own barrier unless the layout or the queue family changes
+    void export_resource(RGHandle resource, const RGAccess& final, uint32_t srcQueueFamily = VK_QUEUE_FAMILY_IGNORED,
+                         uint32_t dstQueueFamily = VK_QUEUE_FAMILY_IGNORED);
+
+    // passes run in the order they are added. the returned pass is valid until the next add_pass
+    RGPass& add_pass(const char* name, std::function<void(const RGPassContext&)>&& execute);
+
+    void compile();
+
+    // records the surviving passes, graphics passes render into renderArea
+    void execute(VkCommandBuffer cmd, VkExtent2D renderArea);
+
+    RenderGraphStats get_stats() const { return _stats; }
+
+private:
+    struct Resource {
+        const char* name;
+        bool isImage;
+        bool transient;
+        VkImage image;
+        VkImageView view;
+        VkBuffer buffer;
+        RGImageDesc desc;
+        RGAccess initial;
+
+        bool exported;
+        RGAccess final;
+        uint32_t srcQueueFamily;
+        uint32_t dstQueueFamily;
+
+        // compile()
+        VkImageUsageFlags usage;
+        uint32_t firstPass;
+        uint32_t lastPass;
+        uint32_t transientIndex;
+
+        // execute(), where the last access left it
+        RGAccess state;
+        bool written;
+        bool hasContents;
+    };
+
+    struct TransientImage {
+        RGImageDesc desc;
+        VkImageUsageFlags usage;
+        uint32_t firstPass;
+        uint32_t lastPass;
+        // resource of this frame's graph that uses the image
+        uint32_t resource;
+        VkImage image;
+        VkImageView view;
+        bool lazy;
+        VkMemoryRequirements requirements;
+        // transient that used the same memory before this one, its accesses have to finish first
+        uint32_t previousAlias;
+    };
+
+    struct RenderPassKey {
+        uint32_t attachmentCount;
+        bool hasDepth;
+        VkFormat formats[RGPass::MAX_ATTACHMENTS];
+        VkAttachmentLoadOp loadOps[RGPass::MAX_ATTACHMENTS];
+        VkAttachmentStoreOp storeOps[RGPass::MAX_ATTACHMENTS];
+    };
+
+    struct CachedRenderPass {
+        RenderPassKey key;
+        VkRenderPass renderPass;
+    };
+
+    struct CachedFramebuffer {
+        VkRenderPass renderPass;
+        uint32_t attachmentCount;
+        VkImageView views[RGPass::MAX_ATTACHMENTS];
+        VkExtent2D extent;
+        VkFramebuffer framebuffer;
+    };
+
+    void cull_passes();
+
+    void place_transients();
+
+    void destroy_transients();
+
+    VkRenderPass get_render_pass(const RenderPassKey& key);
+
+    VkFramebuffer get_framebuffer(VkRenderPass renderPass, const VkImageView* views, uint32_t count, VkExtent2D extent);
+
+    // queues the barrier that takes the resource from its current state to the access, if one is needed
+    void transition(Resource& resource, const RGAccess& access, bool write, bool discard);
+
+    void flush_barriers(VkCommandBuffer cmd);
+
+    VkDevice _device{VK_NULL_HANDLE};
+    VmaAllocator _allocator{VK_NULL_HANDLE};
+    GpuMemoryTracker* _memory{nullptr};
+
+    // cleared every frame, the capacity is kept
+    std::vector<RGPass> _passes;
+    std::vector<Resource> _resources;
+    std::vector<uint8_t> _needed;
+    std::vector<TransientImage> _transientRequests;
+
+    std::vector<TransientImage> _transients;
+    std::vector<VmaAllocation> _transientMemory;
+    std::vector<CachedRenderPass> _renderPasses;
+    std::vector<CachedFramebuffer> _framebuffers;
+
+    std::vector<VkImageMemoryBarrier> _imageBarriers;
+    std::vector<VkBufferMemoryBarrier> _bufferBarriers;
+    VkPipelineStageFlags _srcStages{0};
+    VkPipelineStageFlags _dstStages{0};
+
+    RenderGraphStats _stats{};
+    bool _placedBefore{false};
+};
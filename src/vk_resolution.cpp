@@ -0,0 +1,33 @@
+#include <vk_resolution.h>
+
+#include <algorithm>
+#include <cmath>
+
+float ResolutionController::update(float gpuFrameMs) {
+    if (gpuFrameMs <= 0.f) {
+        return _scale;
+    }
+
+    _smoothedMs = _smoothedMs == 0.f ? gpuFrameMs : _smoothedMs * 0.8f + gpuFrameMs * 0.2f;
+
+    if (_cooldown > 0) {
+        _cooldown--;
+        return _scale;
+    }
+
+    float ratio = targetFrameMs / _smoothedMs;
+    if (ratio > 1.f - tolerance && ratio < 1.f + tolerance) {
+        return _scale;
+    }
+
+    // only go half way to the estimate, fixed costs make the square root model overshoot
+    float ideal = _scale * std::sqrt(ratio);
+    float next = std::min(std::max(_scale + (ideal - _scale) * 0.5f, minScale), maxScale);
+    if (next != _scale) {
+        _scale = next;
+        _cooldown = cooldownFrames;
+        // older samples were measured at the previous resolution
+        _smoothedMs = 0.f;
+    }
+    return _scale;
+}
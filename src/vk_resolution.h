@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+// picks the internal render scale from measured gpu frame times.
+// gpu cost is roughly proportional to the pixel count, so the scale moves with the square root of the error
+class ResolutionController {
+public:
+    float targetFrameMs{16.6f};
+    float minScale{0.5f};
+    float maxScale{1.f};
+    // no change while the smoothed frame time is within this fraction of the target
+    float tolerance{0.1f};
+    // frames to wait after a change, timings arrive a frame late and need a few samples at the new size
+    uint32_t cooldownFrames{8};
+
+    // feeds one gpu frame time, returns the scale for the next frame. 0 or less is ignored
+    float update(float gpuFrameMs);
+
+    float scale() const { return _scale; }
+
+    float smoothed_frame_ms() const { return _smoothedMs; }
+
+private:
+    float _scale{1.f};
+    float _smoothedMs{0.f};
+    uint32_t _cooldown{0};
+};
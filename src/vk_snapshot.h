@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// everything the renderer needs from the simulation for one frame.
+// a published snapshot is never written again until the render thread hands it back
+struct SceneSnapshot {
+    uint64_t tick{0};
+    std::chrono::steady_clock::time_point publishTime;
+
+    glm::mat4 view{1.f};
+    glm::mat4 projection{1.f};
+
+    // world matrix per renderable, indexed like VulkanEngine::_renderables
+    std::vector<glm::mat4> transforms;
+};
+
+// lock free single producer / single consumer triple buffer.
+// the writer always has a buffer to fill and the reader always has the newest complete one,
+// they only ever exchange the middle slot so neither side waits on the other
+template<typename T>
+class TripleBuffer {
+public:
+    // buffer owned by the producer, fill it then publish
+    T& write_buffer() { return _buffers[_writeIndex]; }
+
+    void publish() {
+        uint8_t previous = _middle.exchange(_writeIndex | FRESH_BIT, std::memory_order_acq_rel);
+        _writeIndex = previous & INDEX_MASK;
+    }
+
+    // swaps in the newest published buffer, false if nothing new was published since the last call
+    bool acquire_latest() {
+        if ((_middle.load(std::memory_order_relaxed) & FRESH_BIT) == 0) {
+            return false;
+        }
+        uint8_t previous = _middle.exchange(_readIndex, std::memory_order_acq_rel);
+        _readIndex = previous & INDEX_MASK;
+        return true;
+    }
+
+    // buffer owned by the consumer, valid until the next acquire_latest
+    const T& read_buffer() const { return _buffers[_readIndex]; }
+
+private:
+    static constexpr uint8_t INDEX_MASK = 0x3;
+    static constexpr uint8_t FRESH_BIT = 0x4;
+
+    T _buffers[3];
+    uint8_t _writeIndex{0};
+    std::atomic<uint8_t> _middle{1};
+    uint8_t _readIndex{2};
+};
+
+// written by the simulation and render threads, read from anywhere
+struct SimulationStats {
+    std::atomic<float> simulationTicksPerSecond{0.f};
+    std::atomic<float> renderFramesPerSecond{0.f};
+    // age of the snapshot when the render thread picked it up
+    std::atomic<float> averageLatencyMs{0.f};
+    std::atomic<float> maxLatencyMs{0.f};
+    // frames that re-rendered an old snapshot because the simulation had not ticked yet
+    std::atomic<uint64_t> repeatedSnapshots{0};
+};
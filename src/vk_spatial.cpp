@@ -0,0 +1,527 @@
+#include <vk_spatial.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+void AabbTree::clear() {
+    _nodes.clear();
+    _root = NULL_NODE;
+    _freeList = NULL_NODE;
+    _proxyCount = 0;
+    _reinserted = 0;
+}
+
+uint32_t AabbTree::allocate_node() {
+    uint32_t node = _freeList;
+    if (node != NULL_NODE) {
+        _freeList = _nodes[node].parent;
+    } else {
+        node = (uint32_t)_nodes.size();
+        _nodes.emplace_back();
+    }
+
+    Node& n = _nodes[node];
+    n.parent = NULL_NODE;
+    n.children[0] = NULL_NODE;
+    n.children[1] = NULL_NODE;
+    n.height = 0;
+    n.userData = 0;
+    return node;
+}
+
+void AabbTree::free_node(uint32_t node) {
+    _nodes[node].parent = _freeList;
+    _nodes[node].height = -1;
+    _freeList = node;
+}
+
+Aabb AabbTree::fatten(const Aabb& box) const {
+    glm::vec3 margin = (box.max - box.min) * _marginScale + glm::vec3(_marginMin);
+    return Aabb{box.min - margin, box.max + margin};
+}
+
+void AabbTree::build(const Aabb* boxes, uint32_t count) {
+    clear();
+    if (count == 0) {
+        return;
+    }
+    _nodes.reserve((size_t)count * 2 - 1);
+
+    // leaves first, so proxy i is node i
+    _scratch.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t leaf = allocate_node();
+        _nodes[leaf].box = fatten(boxes[i]);
+        _nodes[leaf].userData = i;
+        _scratch[i] = leaf;
+    }
+    _proxyCount = count;
+
+    _root = build_range(_scratch.data(), count, NULL_NODE);
+}
+
+uint32_t AabbTree::build_range(uint32_t* leaves, uint32_t count, uint32_t parent) {
+    if (count == 1) {
+        _nodes[leaves[0]].parent = parent;
+        return leaves[0];
+    }
+
+    // split at the median center along the longest axis of the centers
+    glm::vec3 centerMin{FLT_MAX};
+    glm::vec3 centerMax{-FLT_MAX};
+    for (uint32_t i = 0; i < count; i++) {
+        glm::vec3 center = _nodes[leaves[i]].box.center();
+        centerMin = glm::min(centerMin, center);
+        centerMax = glm::max(centerMax, center);
+    }
+    glm::vec3 size = centerMax - centerMin;
+    int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+
+    uint32_t half = count / 2;
+    std::nth_element(leaves, leaves + half, leaves + count, [&](uint32_t a, uint32_t b) {
+        return _nodes[a].box.center()[axis] < _nodes[b].box.center()[axis];
+    });
+
+    uint32_t node = allocate_node();
+    uint32_t left = build_range(leaves, half, node);
+    uint32_t right = build_range(leaves + half, count - half, node);
+
+    Node& n = _nodes[node];
+    n.parent = parent;
+    n.children[0] = left;
+    n.children[1] = right;
+    n.box = Aabb::merge(_nodes[left].box, _nodes[right].box);
+    n.height = 1 + std::max(_nodes[left].height, _nodes[right].height);
+    return node;
+}
+
+SpatialProxy AabbTree::insert(const Aabb& box, uint32_t userData) {
+    uint32_t leaf = allocate_node();
+    _nodes[leaf].box = fatten(box);
+    _nodes[leaf].userData = userData;
+    insert_leaf(leaf);
+    _proxyCount++;
+    return leaf;
+}
+
+void AabbTree::remove(SpatialProxy proxy) {
+    assert(_nodes[proxy].is_leaf() && _nodes[proxy].height == 0);
+    remove_leaf(proxy);
+    free_node(proxy);
+    _proxyCount--;
+}
+
+bool AabbTree::move(SpatialProxy proxy, const Aabb& box) {
+    if (_nodes[proxy].box.contains(box)) {
+        return false;
+    }
+    remove_leaf(proxy);
+    _nodes[proxy].box = fatten(box);
+    insert_leaf(proxy);
+    _reinserted++;
+    return true;
+}
+
+void AabbTree::set_bounds(SpatialProxy proxy, const Aabb& box) {
+    _nodes[proxy].box = fatten(box);
+}
+
+void AabbTree::refit() {
+    if (_root == NULL_NODE) {
+        return;
+    }
+
+    // parents come before their children in pre order, walking it backwards refits bottom up
+    _scratch.clear();
+    _scratch.push_back(_root);
+    for (size_t i = 0; i < _scratch.size(); i++) {
+        const Node& node = _nodes[_scratch[i]];
+        if (!node.is_leaf()) {
+            _scratch.push_back(node.children[0]);
+            _scratch.push_back(node.children[1]);
+        }
+    }
+    for (size_t i = _scratch.size(); i-- > 0;) {
+        Node& node = _nodes[_scratch[i]];
+        if (!node.is_leaf()) {
+            node.box = Aabb::merge(_nodes[node.children[0]].box, _nodes[node.children[1]].box);
+        }
+    }
+}
+
+void AabbTree::insert_leaf(uint32_t leaf) {
+    if (_root == NULL_NODE) {
+        _root = leaf;
+        _nodes[leaf].parent = NULL_NODE;
+        return;
+    }
+
+    // descend towards the sibling whose merge adds the least surface area to the tree.
+    // every node on the way grows to cover the leaf, that growth is paid by both children alike
+    const Aabb leafBox = _nodes[leaf].box;
+    uint32_t index = _root;
+    while (!_nodes[index].is_leaf()) {
+        const Node& node = _nodes[index];
+        const float area = node.box.surface_area();
+        const float combinedArea = Aabb::merge(node.box, leafBox).surface_area();
+
+        // pairing with this node: a new parent covering both
+        const float cost = 2.f * combinedArea;
+        const float inheritanceCost = 2.f * (combinedArea - area);
+
+        float childCost[2];
+        for (int c = 0; c < 2; c++) {
+            const Node& child = _nodes[node.children[c]];
+            const float merged = Aabb::merge(leafBox, child.box).surface_area();
+            childCost[c] = (child.is_leaf() ? merged : merged - child.box.surface_area()) + inheritanceCost;
+        }
+
+        if (cost < childCost[0] && cost < childCost[1]) {
+            break;
+        }
+        index = childCost[0] < childCost[1] ? node.children[0] : node.children[1];
+    }
+
+    const uint32_t sibling = index;
+    const uint32_t oldParent = _nodes[sibling].parent;
+    const uint32_t newParent = allocate_node();
+    {
+        Node& n = _nodes[newParent];
+        n.parent = oldParent;
+        n.box = Aabb::merge(leafBox, _nodes[sibling].box);
+        n.height = _nodes[sibling].height + 1;
+        n.children[0] = sibling;
+        n.children[1] = leaf;
+    }
+
+    if (oldParent != NULL_NODE) {
+        Node& p = _nodes[oldParent];
+        p.children[p.children[0] == sibling ? 0 : 1] = newParent;
+    } else {
+        _root = newParent;
+    }
+    _nodes[sibling].parent = newParent;
+    _nodes[leaf].parent = newParent;
+
+    // grow and rebalance the ancestors
+    index = _nodes[leaf].parent;
+    while (index != NULL_NODE) {
+        index = balance(index);
+
+        Node& node = _nodes[index];
+        const Node& left = _nodes[node.children[0]];
+        const Node& right = _nodes[node.children[1]];
+        node.height = 1 + std::max(left.height, right.height);
+        node.box = Aabb::merge(left.box, right.box);
+
+        index = node.parent;
+    }
+}
+
+void AabbTree::remove_leaf(uint32_t leaf) {
+    if (leaf == _root) {
+        _root = NULL_NODE;
+        return;
+    }
+
+    // the sibling takes the parent's place
+    const uint32_t parent = _nodes[leaf].parent;
+    const uint32_t grandParent = _nodes[parent].parent;
+    const uint32_t sibling = _nodes[parent].children[0] == leaf ? _nodes[parent].children[1] : _nodes[parent].children[0];
+
+    if (grandParent == NULL_NODE) {
+        _root = sibling;
+        _nodes[sibling].parent = NULL_NODE;
+        free_node(parent);
+        return;
+    }
+
+    Node& g = _nodes[grandParent];
+    g.children[g.children[0] == parent ? 0 : 1] = sibling;
+    _nodes[sibling].parent = grandParent;
+    free_node(parent);
+
+    uint32_t index = grandParent;
+    while (index != NULL_NODE) {
+        index = balance(index);
+
+        Node& node = _nodes[index];
+        const Node& left = _nodes[node.children[0]];
+        const Node& right = _nodes[node.children[1]];
+        node.box = Aabb::merge(left.box, right.box);
+        node.height = 1 + std::max(left.height, right.height);
+
+        index = node.parent;
+    }
+}
+
+uint32_t AabbTree::balance(uint32_t iA) {
+    Node& A = _nodes[iA];
+    if (A.is_leaf() || A.height < 2) {
+        return iA;
+    }
+
+    const uint32_t iB = A.children[0];
+    const uint32_t iC = A.children[1];
+    Node& B = _nodes[iB];
+    Node& C = _nodes[iC];
+
+    auto replace_in_parent = [&](uint32_t oldChild, uint32_t newChild, uint32_t parent) {
+        if (parent == NULL_NODE) {
+            _root = newChild;
+            return;
+        }
+        Node& p = _nodes[parent];
+        p.children[p.children[0] == oldChild ? 0 : 1] = newChild;
+    };
+
+    const int32_t difference = C.height - B.height;
+
+    // C is too deep, it takes A's place and gives A its shallower child
+    if (difference > 1) {
+        const uint32_t iF = C.children[0];
+        const uint32_t iG = C.children[1];
+        Node& F = _nodes[iF];
+        Node& G = _nodes[iG];
+
+        C.children[0] = iA;
+        C.parent = A.parent;
+        A.parent = iC;
+        replace_in_parent(iA, iC, C.parent);
+
+        if (F.height > G.height) {
+            C.children[1] = iF;
+            A.children[1] = iG;
+            G.parent = iA;
+            A.box = Aabb::merge(B.box, G.box);
+            C.box = Aabb::merge(A.box, F.box);
+            A.height = 1 + std::max(B.height, G.height);
+            C.height = 1 + std::max(A.height, F.height);
+        } else {
+            C.children[1] = iG;
+            A.children[1] = iF;
+            F.parent = iA;
+            A.box = Aabb::merge(B.box, F.box);
+            C.box = Aabb::merge(A.box, G.box);
+            A.height = 1 + std::max(B.height, F.height);
+            C.height = 1 + std::max(A.height, G.height);
+        }
+        return iC;
+    }
+
+    // same for B
+    if (difference < -1) {
+        const uint32_t iD = B.children[0];
+        const uint32_t iE = B.children[1];
+        Node& D = _nodes[iD];
+        Node& E = _nodes[iE];
+
+        B.children[0] = iA;
+        B.parent = A.parent;
+        A.parent = iB;
+        replace_in_parent(iA, iB, B.parent);
+
+        if (D.height > E.height) {
+            B.children[1] = iD;
+            A.children[0] = iE;
+            E.parent = iA;
+            A.box = Aabb::merge(C.box, E.box);
+            B.box = Aabb::merge(A.box, D.box);
+            A.height = 1 + std::max(C.height, E.height);
+            B.height = 1 + std::max(A.height, D.height);
+        } else {
+            B.children[1] = iE;
+            A.children[0] = iD;
+            D.parent = iA;
+            A.box = Aabb::merge(C.box, D.box);
+            B.box = Aabb::merge(A.box, E.box);
+            A.height = 1 + std::max(C.height, D.height);
+            B.height = 1 + std::max(A.height, E.height);
+        }
+        return iB;
+    }
+
+    return iA;
+}
+
+float AabbTree::ray_entry(const Aabb& box, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance) {
+    glm::vec3 t0 = (box.min - origin) * inverseDirection;
+    glm::vec3 t1 = (box.max - origin) * inverseDirection;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+
+    float entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.f));
+    float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+    return entry <= exit ? entry : -1.f;
+}
+
+SpatialStats AabbTree::get_stats() const {
+    SpatialStats stats = {};
+    stats.proxyCount = _proxyCount;
+    stats.nodeCount = _proxyCount > 0 ? _proxyCount * 2 - 1 : 0;
+    stats.height = _root != NULL_NODE ? (uint32_t)_nodes[_root].height : 0;
+    stats.reinserted = _reinserted;
+    return stats;
+}
+
+void run_spatial_benchmark() {
+    using clock = std::chrono::high_resolution_clock;
+    auto elapsed_ms = [](clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    };
+
+    // the engine camera in the middle of the scene, whatever the scene size the frustum covers the same volume
+    glm::mat4 view = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, 1.f, 0.f));
+    glm::mat4 projection = glm::perspective(glm::radians(70.f), 1700.f / 900.f, 0.1f, 200.0f);
+    projection[1][1] *= -1;
+    const Frustum frustum = Frustum::from_matrix(projection * view);
+
+    const uint32_t objectCounts[] = {10000, 100000, 1000000};
+    const int queries = 1000;
+
+    std::cout << "Spatial index, objects at a fixed density:" << std::endl;
+    for (uint32_t count : objectCounts) {
+        // one object per 10x10x10 cell
+        const float extent = std::cbrt((float)count) * 10.f * 0.5f;
+
+        std::mt19937 random(count);
+        std::uniform_real_distribution<float> unit(0.f, 1.f);
+        auto random_point = [&]() {
+            return glm::vec3(unit(random), unit(random), unit(random)) * (2.f * extent) - extent;
+        };
+
+        std::vector<glm::vec4> spheres(count);
+        std::vector<Aabb> boxes(count);
+        for (uint32_t i = 0; i < count; i++) {
+            spheres[i] = glm::vec4(random_point(), 0.5f + unit(random) * 1.5f);
+            boxes[i] = Aabb::from_sphere(glm::vec3(spheres[i]), spheres[i].w);
+        }
+
+        AabbTree tree;
+        auto start = clock::now();
+        tree.build(boxes.data(), count);
+        const double buildMs = elapsed_ms(start);
+
+        AabbTree incremental;
+        start = clock::now();
+        for (uint32_t i = 0; i < count; i++) {
+            incremental.insert(boxes[i], i);
+        }
+        const double insertMs = elapsed_ms(start);
+
+        std::cout << "  " << count << " objects: build " << buildMs << " ms (height " << tree.get_stats().height
+                  << "), incremental insert " << insertMs << " ms (height " << incremental.get_stats().height << ")" << std::endl;
+
+        // everything jitters a little, the fat boxes should absorb most of it
+        for (uint32_t i = 0; i < count; i++) {
+            glm::vec3 offset = (glm::vec3(unit(random), unit(random), unit(random)) - 0.5f) * 0.1f;
+            boxes[i].min += offset;
+            boxes[i].max += offset;
+        }
+        start = clock::now();
+        for (uint32_t i = 0; i < count; i++) {
+            tree.move(i, boxes[i]);
+        }
+        const double smallMoveMs = elapsed_ms(start);
+        const uint32_t smallReinserted = tree.get_stats().reinserted;
+
+        // 1% teleports somewhere else
+        const uint32_t teleported = count / 100;
+        start = clock::now();
+        for (uint32_t i = 0; i < teleported; i++) {
+            uint32_t object = (uint32_t)(unit(random) * (float)(count - 1));
+            glm::vec3 center = random_point();
+            spheres[object] = glm::vec4(center, spheres[object].w);
+            boxes[object] = Aabb::from_sphere(center, spheres[object].w);
+            tree.move(object, boxes[object]);
+        }
+        const double largeMoveMs = elapsed_ms(start);
+
+        std::cout << "    move all by a little " << smallMoveMs << " ms (" << smallReinserted << " reinserted), teleport "
+                  << teleported << " " << largeMoveMs << " ms, height now " << tree.get_stats().height << std::endl;
+
+        start = clock::now();
+        for (uint32_t i = 0; i < count; i++) {
+            incremental.set_bounds(i, boxes[i]);
+        }
+        incremental.refit();
+        std::cout << "    set bounds of all and refit " << elapsed_ms(start) << " ms" << std::endl;
+
+        // frustum against the same loop cull_objects did before, every sphere against the planes
+        uint32_t linearVisible = 0;
+        start = clock::now();
+        for (uint32_t i = 0; i < count; i++) {
+            if (frustum.intersects_sphere(glm::vec3(spheres[i]), spheres[i].w)) {
+                linearVisible++;
+            }
+        }
+        const double linearMs = elapsed_ms(start);
+
+        uint32_t treeVisible = 0;
+        uint32_t accepted = 0;
+        start = clock::now();
+        tree.query_frustum(frustum, [&](uint32_t object, bool contained) {
+            if (contained) {
+                accepted++;
+                treeVisible++;
+            } else if (frustum.intersects_sphere(glm::vec3(spheres[object]), spheres[object].w)) {
+                treeVisible++;
+            }
+        });
+        const double treeMs = elapsed_ms(start);
+
+        std::cout << "    frustum: tree " << treeMs << " ms, " << treeVisible << " visible (" << accepted
+                  << " accepted with their subtree), linear " << linearMs << " ms, " << linearVisible << " visible" << std::endl;
+
+        uint32_t sphereHits = 0;
+        start = clock::now();
+        for (int q = 0; q < queries; q++) {
+            const glm::vec3 center = random_point();
+            const float radius = 20.f;
+            tree.query_sphere(center, radius, [&](uint32_t object) {
+                glm::vec3 offset = glm::vec3(spheres[object]) - center;
+                float reach = radius + spheres[object].w;
+                if (glm::dot(offset, offset) <= reach * reach) {
+                    sphereHits++;
+                }
+            });
+        }
+        const double sphereMs = elapsed_ms(start);
+
+        // closest hit against the spheres themselves
+        uint32_t rayHits = 0;
+        start = clock::now();
+        for (int q = 0; q < queries; q++) {
+            const glm::vec3 origin = random_point();
+            const glm::vec3 direction = glm::normalize(random_point() - origin + glm::vec3(1e-3f));
+            float closest = -1.f;
+            tree.query_ray(origin, direction, 1000.f, [&](uint32_t object, float) {
+                glm::vec3 toCenter = glm::vec3(spheres[object]) - origin;
+                float along = glm::dot(toCenter, direction);
+                float distanceSquared = glm::dot(toCenter, toCenter) - along * along;
+                float radiusSquared = spheres[object].w * spheres[object].w;
+                float limit = closest < 0.f ? 1000.f : closest;
+                if (distanceSquared <= radiusSquared) {
+                    float hit = along - std::sqrt(radiusSquared - distanceSquared);
+                    if (hit >= 0.f && hit < limit) {
+                        closest = hit;
+                        return hit;
+                    }
+                }
+                return limit;
+            });
+            if (closest >= 0.f) {
+                rayHits++;
+            }
+        }
+        const double rayMs = elapsed_ms(start);
+
+        std::cout << "    " << queries << " sphere queries " << sphereMs << " ms (" << sphereHits << " hits), " << queries
+                  << " closest hit rays " << rayMs << " ms (" << rayHits << " hit)" << std::endl;
+    }
+}
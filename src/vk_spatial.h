@@ -0,0 +1,249 @@
+#pragma once
+
+#include <vk_culling.h>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// leaf of the tree. it keeps its id through moves, only remove() frees it
+using SpatialProxy = uint32_t;
+
+struct SpatialStats {
+    uint32_t proxyCount;
+    uint32_t nodeCount;
+    // root height, a leaf alone is 0
+    uint32_t height;
+    // moves that left their fat box and were reinserted, since the last build
+    uint32_t reinserted;
+};
+
+// dynamic bounding volume hierarchy over axis aligned boxes. every leaf stores its box grown by a
+// margin, a move that stays inside it costs nothing. one that leaves it is removed and reinserted next
+// to the sibling that grows the total surface area least, and rotations on the way up keep the tree
+// balanced. build() makes a balanced tree from scratch, refit() recomputes every inner box after a
+// batch of set_bounds without changing the structure.
+// queries walk it from the root, so a box that is outside rejects its whole subtree and a box inside
+// a frustum accepts its whole subtree without another test
+class AabbTree {
+public:
+    // added on every side of a leaf box: a fraction of its size plus a fixed minimum
+    float _marginScale{0.1f};
+    float _marginMin{0.05f};
+
+    void clear();
+
+    // replaces the tree with a top down median split build. boxes[i] gets proxy i and user data i
+    void build(const Aabb* boxes, uint32_t count);
+
+    SpatialProxy insert(const Aabb& box, uint32_t userData);
+
+    void remove(SpatialProxy proxy);
+
+    // reinserts the proxy if the box left its fat box, returns true if it did
+    bool move(SpatialProxy proxy, const Aabb& box);
+
+    // replaces the leaf box and leaves the inner boxes stale until refit()
+    void set_bounds(SpatialProxy proxy, const Aabb& box);
+
+    void refit();
+
+    const Aabb& fat_box(SpatialProxy proxy) const { return _nodes[proxy].box; }
+
+    uint32_t user_data(SpatialProxy proxy) const { return _nodes[proxy].userData; }
+
+    // visit(userData, contained) for every leaf whose fat box touches the frustum. contained is true
+    // when the box is entirely inside, then the caller can skip its own finer test
+    template<typename Visit>
+    void query_frustum(const Frustum& frustum, Visit&& visit) const;
+
+    // visit(userData) for every leaf whose fat box touches the sphere
+    template<typename Visit>
+    void query_sphere(const glm::vec3& center, float radius, Visit&& visit) const;
+
+    // visit(userData, entryDistance) for the leaves the ray enters within maxDistance, nearest subtree
+    // first. it returns the distance the query keeps going to: maxDistance for every hit, the hit distance
+    // for the closest one, a negative value to stop
+    template<typename Visit>
+    void query_ray(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, Visit&& visit) const;
+
+    SpatialStats get_stats() const;
+
+private:
+    static constexpr uint32_t NULL_NODE = UINT32_MAX;
+    // deeper than any balanced tree of 2^32 leaves
+    static constexpr uint32_t MAX_STACK = 128;
+
+    struct Node {
+        Aabb box;
+        // next free node while on the free list
+        uint32_t parent;
+        uint32_t children[2];
+        // 0 for leaves, -1 for free nodes
+        int32_t height;
+        uint32_t userData;
+
+        bool is_leaf() const { return children[0] == NULL_NODE; }
+    };
+
+    uint32_t allocate_node();
+
+    void free_node(uint32_t node);
+
+    Aabb fatten(const Aabb& box) const;
+
+    void insert_leaf(uint32_t leaf);
+
+    void remove_leaf(uint32_t leaf);
+
+    // rotates a child up when the two subtrees differ by more than one level, returns the node now in its place
+    uint32_t balance(uint32_t node);
+
+    uint32_t build_range(uint32_t* leaves, uint32_t count, uint32_t parent);
+
+    template<typename Visit>
+    void visit_subtree(uint32_t root, Visit& visit) const;
+
+    // entry distance of the ray into the box, or a negative value on a miss
+    static float ray_entry(const Aabb& box, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance);
+
+    std::vector<Node> _nodes;
+    uint32_t _root{NULL_NODE};
+    uint32_t _freeList{NULL_NODE};
+    uint32_t _proxyCount{0};
+    uint32_t _reinserted{0};
+
+    // scratch kept between calls
+    std::vector<uint32_t> _scratch;
+};
+
+template<typename Visit>
+void AabbTree::visit_subtree(uint32_t root, Visit& visit) const {
+    uint32_t stack[MAX_STACK];
+    uint32_t top = 0;
+    stack[top++] = root;
+    while (top > 0) {
+        const Node& node = _nodes[stack[--top]];
+        if (node.is_leaf()) {
+            visit(node.userData, true);
+            continue;
+        }
+        assert(top + 2 <= MAX_STACK);
+        stack[top++] = node.children[0];
+        stack[top++] = node.children[1];
+    }
+}
+
+template<typename Visit>
+void AabbTree::query_frustum(const Frustum& frustum, Visit&& visit) const {
+    if (_root == NULL_NODE) {
+        return;
+    }
+
+    // planes a parent is inside of are skipped for its children
+    uint32_t stack[MAX_STACK];
+    uint8_t masks[MAX_STACK];
+    uint32_t top = 0;
+    stack[top] = _root;
+    masks[top++] = 0x3f;
+    while (top > 0) {
+        top--;
+        const Node& node = _nodes[stack[top]];
+        uint32_t planeMask = masks[top];
+
+        FrustumTest test = frustum.test_box(node.box, planeMask);
+        if (test == FrustumTest::Outside) {
+            continue;
+        }
+        if (test == FrustumTest::Inside) {
+            visit_subtree(stack[top], visit);
+            continue;
+        }
+        if (node.is_leaf()) {
+            visit(node.userData, false);
+            continue;
+        }
+        assert(top + 2 <= MAX_STACK);
+        stack[top] = node.children[0];
+        masks[top++] = (uint8_t)planeMask;
+        stack[top] = node.children[1];
+        masks[top++] = (uint8_t)planeMask;
+    }
+}
+
+template<typename Visit>
+void AabbTree::query_sphere(const glm::vec3& center, float radius, Visit&& visit) const {
+    if (_root == NULL_NODE) {
+        return;
+    }
+
+    uint32_t stack[MAX_STACK];
+    uint32_t top = 0;
+    stack[top++] = _root;
+    while (top > 0) {
+        const Node& node = _nodes[stack[--top]];
+
+        glm::vec3 offset = glm::clamp(center, node.box.min, node.box.max) - center;
+        if (glm::dot(offset, offset) > radius * radius) {
+            continue;
+        }
+        if (node.is_leaf()) {
+            visit(node.userData);
+            continue;
+        }
+        assert(top + 2 <= MAX_STACK);
+        stack[top++] = node.children[0];
+        stack[top++] = node.children[1];
+    }
+}
+
+template<typename Visit>
+void AabbTree::query_ray(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, Visit&& visit) const {
+    if (_root == NULL_NODE) {
+        return;
+    }
+    const glm::vec3 inverseDirection = 1.f / direction;
+
+    uint32_t stack[MAX_STACK];
+    float entries[MAX_STACK];
+    uint32_t top = 0;
+    stack[top] = _root;
+    entries[top++] = ray_entry(_nodes[_root].box, origin, inverseDirection, maxDistance);
+    while (top > 0) {
+        top--;
+        // the distance may have shrunk since the node was pushed
+        if (entries[top] < 0.f || entries[top] > maxDistance) {
+            continue;
+        }
+        const Node& node = _nodes[stack[top]];
+        if (node.is_leaf()) {
+            maxDistance = visit(node.userData, entries[top]);
+            if (maxDistance < 0.f) {
+                return;
+            }
+            continue;
+        }
+
+        uint32_t near = node.children[0];
+        uint32_t far = node.children[1];
+        float nearEntry = ray_entry(_nodes[near].box, origin, inverseDirection, maxDistance);
+        float farEntry = ray_entry(_nodes[far].box, origin, inverseDirection, maxDistance);
+        if (farEntry >= 0.f && (nearEntry < 0.f || farEntry < nearEntry)) {
+            std::swap(near, far);
+            std::swap(nearEntry, farEntry);
+        }
+
+        assert(top + 2 <= MAX_STACK);
+        if (farEntry >= 0.f) {
+            stack[top] = far;
+            entries[top++] = farEntry;
+        }
+        if (nearEntry >= 0.f) {
+            stack[top] = near;
+            entries[top++] = nearEntry;
+        }
+    }
+}
+
+// build, refit, move and query throughput for 10k to 1M boxes, against a linear scan
+void run_spatial_benchmark();
@@ -0,0 +1,310 @@
+#include <vk_streaming.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+    const char PACK_MAGIC[4] = {'V', 'K', 'W', 'C'};
+    const uint32_t PACK_VERSION = 1;
+
+    struct PackHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t chunkCount;
+        float chunkSize;
+    };
+
+    // 21 bits per axis, cells are counted from the most negative one
+    uint64_t cell_key(const glm::vec3& point, float chunkSize) {
+        const int64_t bias = 1 << 20;
+        const glm::vec3 cell = glm::floor(point / chunkSize);
+        uint64_t x = (uint64_t)std::min(std::max((int64_t)cell.x + bias, (int64_t)0), (int64_t)(2 * bias - 1));
+        uint64_t y = (uint64_t)std::min(std::max((int64_t)cell.y + bias, (int64_t)0), (int64_t)(2 * bias - 1));
+        uint64_t z = (uint64_t)std::min(std::max((int64_t)cell.z + bias, (int64_t)0), (int64_t)(2 * bias - 1));
+        return x | (y << 21) | (z << 42);
+    }
+}
+
+bool import_world(const char* objPath, const char* packPath, float chunkSize) {
+    // the whole obj is in memory here, this is the only place that has to hold all of it
+    Mesh world;
+    if (!world.load_from_obj(objPath)) {
+        std::cout << "Could not load " << objPath << " to import" << std::endl;
+        return false;
+    }
+    const uint32_t triangleCount = (uint32_t)world._indices.size() / 3;
+
+    // triangles go to the cell of their centroid, so a chunk box can poke a little into its neighbours
+    std::unordered_map<uint64_t, uint32_t> cellChunks;
+    std::vector<std::vector<uint32_t>> chunkTriangles;
+    for (uint32_t t = 0; t < triangleCount; t++) {
+        const glm::vec3 centroid = (world._vertices[world._indices[t * 3 + 0]].position + world._vertices[world._indices[t * 3 + 1]].position +
+                                    world._vertices[world._indices[t * 3 + 2]].position) / 3.f;
+        auto inserted = cellChunks.emplace(cell_key(centroid, chunkSize), (uint32_t)chunkTriangles.size());
+        if (inserted.second) {
+            chunkTriangles.emplace_back();
+        }
+        chunkTriangles[inserted.first->second].push_back(t);
+    }
+
+    std::vector<Mesh> chunks(chunkTriangles.size());
+    std::vector<WorldChunkInfo> table(chunkTriangles.size());
+
+    // shared vertices are copied into every chunk that uses them, indices become chunk local
+    std::vector<uint32_t> remap(world._vertices.size(), UINT32_MAX);
+    std::vector<uint32_t> touched;
+    uint64_t offset = sizeof(PackHeader) + table.size() * sizeof(WorldChunkInfo);
+    uint32_t largestChunk = 0;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        Mesh& chunk = chunks[c];
+        for (uint32_t t : chunkTriangles[c]) {
+            for (uint32_t v = 0; v < 3; v++) {
+                const uint32_t vertex = world._indices[t * 3 + v];
+                if (remap[vertex] == UINT32_MAX) {
+                    remap[vertex] = (uint32_t)chunk._vertices.size();
+                    chunk._vertices.push_back(world._vertices[vertex]);
+                    touched.push_back(vertex);
+                }
+                chunk._indices.push_back(remap[vertex]);
+            }
+        }
+        for (uint32_t vertex : touched) {
+            remap[vertex] = UINT32_MAX;
+        }
+        touched.clear();
+
+        chunk.compute_bounds();
+
+        WorldChunkInfo& info = table[c];
+        info.box = Aabb{glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX)};
+        for (const Vertex& vertex : chunk._vertices) {
+            info.box.min = glm::min(info.box.min, vertex.position);
+            info.box.max = glm::max(info.box.max, vertex.position);
+        }
+        info.bounds = chunk._bounds;
+        info.fileOffset = offset;
+        info.vertexCount = (uint32_t)chunk._vertices.size();
+        info.indexCount = (uint32_t)chunk._indices.size();
+        offset += info.gpu_bytes();
+        largestChunk = std::max(largestChunk, info.vertexCount);
+    }
+
+    std::ofstream file(packPath, std::ios::binary);
+    if (!file.is_open()) {
+        std::cout << "Could not open " << packPath << " to write a chunk pack" << std::endl;
+        return false;
+    }
+
+    PackHeader header = {};
+    std::copy(PACK_MAGIC, PACK_MAGIC + 4, header.magic);
+    header.version = PACK_VERSION;
+    header.chunkCount = (uint32_t)table.size();
+    header.chunkSize = chunkSize;
+
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)table.data(), table.size() * sizeof(WorldChunkInfo));
+    for (const Mesh& chunk : chunks) {
+        file.write((const char*)chunk._vertices.data(), chunk._vertices.size() * sizeof(Vertex));
+        file.write((const char*)chunk._indices.data(), chunk._indices.size() * sizeof(uint32_t));
+    }
+    if (!file.good()) {
+        std::cout << "Writing " << packPath << " failed" << std::endl;
+        return false;
+    }
+
+    std::cout << "Imported " << objPath << ": " << triangleCount << " triangles into " << table.size() << " chunks of "
+              << chunkSize << " units, largest " << largestChunk << " vertices, " << offset / (1024 * 1024) << " MB" << std::endl;
+    return true;
+}
+
+bool ChunkStreamer::open(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        std::cout << "Could not open chunk pack " << path << std::endl;
+        return false;
+    }
+
+    PackHeader header;
+    file.read((char*)&header, sizeof(header));
+    if (!file || !std::equal(PACK_MAGIC, PACK_MAGIC + 4, header.magic) || header.version != PACK_VERSION) {
+        std::cout << path << " is not a version " << PACK_VERSION << " chunk pack" << std::endl;
+        return false;
+    }
+
+    _chunks.resize(header.chunkCount);
+    file.read((char*)_chunks.data(), _chunks.size() * sizeof(WorldChunkInfo));
+    if (!file) {
+        std::cout << "Chunk pack " << path << " is truncated" << std::endl;
+        _chunks.clear();
+        return false;
+    }
+
+    _path = path;
+    _data.reset(new ChunkData[_chunks.size()]);
+    _committedBytes = 0;
+
+    // sized once, updates only reuse them
+    _missing.reserve(_chunks.size());
+    _resident.reserve(_chunks.size());
+    _finished.reserve(_chunks.size());
+    _evicted.reserve(_chunks.size());
+    _ready.reserve(_chunks.size());
+
+    uint64_t totalBytes = 0;
+    for (const WorldChunkInfo& chunk : _chunks) {
+        totalBytes += chunk.gpu_bytes();
+    }
+    std::cout << "World " << path << ": " << _chunks.size() << " chunks, " << totalBytes / (1024 * 1024) << " MB of geometry, streaming budget "
+              << _memoryBudget / (1024 * 1024) << " MB" << std::endl;
+    return true;
+}
+
+void ChunkStreamer::close(JobSystem& jobs) {
+    jobs.wait(_reads);
+    _chunks.clear();
+    _data.reset();
+    _committedBytes = 0;
+    _readsInFlight = 0;
+}
+
+void ChunkStreamer::read_chunk(uint32_t index) {
+    const WorldChunkInfo& info = _chunks[index];
+    ChunkData& data = _data[index];
+
+    // every read opens its own stream, reads of different chunks run side by side
+    std::ifstream file(_path, std::ios::binary);
+    data.vertices.resize(info.vertexCount);
+    data.indices.resize(info.indexCount);
+    file.seekg((std::streamoff)info.fileOffset);
+    file.read((char*)data.vertices.data(), data.vertices.size() * sizeof(Vertex));
+    file.read((char*)data.indices.data(), data.indices.size() * sizeof(uint32_t));
+    if (!file) {
+        // an empty chunk uploads nothing, the rest of the world keeps streaming
+        std::cout << "Reading chunk " << index << " of " << _path << " failed" << std::endl;
+        data.vertices.clear();
+        data.indices.clear();
+    }
+
+    data.state.store(ChunkState::Read, std::memory_order_release);
+}
+
+void ChunkStreamer::update(const glm::vec3& camera, JobSystem& jobs) {
+    _missing.clear();
+    _resident.clear();
+    _finished.clear();
+    _evicted.clear();
+    _ready.clear();
+    _readsInFlight = 0;
+
+    auto evict = [this](uint32_t index) {
+        _data[index].state.store(ChunkState::Unloaded, std::memory_order_relaxed);
+        _committedBytes -= _chunks[index].gpu_bytes();
+        _evicted.push_back(index);
+        _evictions++;
+    };
+
+    for (uint32_t i = 0; i < (uint32_t)_chunks.size(); i++) {
+        const Aabb& box = _chunks[i].box;
+        const float distance = glm::length(glm::clamp(camera, box.min, box.max) - camera);
+
+        ChunkData& data = _data[i];
+        switch (data.state.load(std::memory_order_acquire)) {
+            case ChunkState::Unloaded:
+                if (distance < _loadRadius) {
+                    _missing.push_back(Candidate{i, distance});
+                }
+                break;
+            case ChunkState::Reading:
+                _readsInFlight++;
+                break;
+            case ChunkState::Read:
+                // the camera left while it was being read, it never gets uploaded
+                if (distance > _unloadRadius) {
+                    data.vertices = std::vector<Vertex>();
+                    data.indices = std::vector<uint32_t>();
+                    data.state.store(ChunkState::Unloaded, std::memory_order_relaxed);
+                    _committedBytes -= _chunks[i].gpu_bytes();
+                } else {
+                    _finished.push_back(Candidate{i, distance});
+                }
+                break;
+            case ChunkState::Resident:
+                if (distance > _unloadRadius) {
+                    evict(i);
+                } else {
+                    _resident.push_back(Candidate{i, distance});
+                }
+                break;
+        }
+    }
+
+    // nearest missing chunks first, and the farthest resident ones are the first to make room for them
+    std::sort(_missing.begin(), _missing.end(), [](const Candidate& a, const Candidate& b) { return a.distance < b.distance; });
+    std::sort(_resident.begin(), _resident.end(), [](const Candidate& a, const Candidate& b) { return a.distance > b.distance; });
+
+    size_t farthest = 0;
+    for (const Candidate& candidate : _missing) {
+        if (_readsInFlight >= _maxReadsInFlight) {
+            break;
+        }
+        const uint64_t bytes = _chunks[candidate.chunk].gpu_bytes();
+        if (bytes > _memoryBudget) {
+            continue;
+        }
+        while (_committedBytes + bytes > _memoryBudget && farthest < _resident.size() && _resident[farthest].distance > candidate.distance) {
+            evict(_resident[farthest++].chunk);
+        }
+        // everything further down the list is further away, none of it may push out what is resident
+        if (_committedBytes + bytes > _memoryBudget) {
+            break;
+        }
+
+        _committedBytes += bytes;
+        _readsInFlight++;
+        _loads++;
+        _data[candidate.chunk].state.store(ChunkState::Reading, std::memory_order_relaxed);
+        const uint32_t index = candidate.chunk;
+        jobs.run([this, index]() { read_chunk(index); }, &_reads);
+    }
+
+    std::sort(_finished.begin(), _finished.end(), [](const Candidate& a, const Candidate& b) { return a.distance < b.distance; });
+    uint64_t uploadBytes = 0;
+    for (const Candidate& candidate : _finished) {
+        const uint64_t bytes = _chunks[candidate.chunk].gpu_bytes();
+        if (!_ready.empty() && uploadBytes + bytes > _uploadBytesPerFrame) {
+            break;
+        }
+        uploadBytes += bytes;
+        _ready.push_back(candidate.chunk);
+    }
+}
+
+void ChunkStreamer::release(uint32_t index) {
+    ChunkData& data = _data[index];
+    data.vertices = std::vector<Vertex>();
+    data.indices = std::vector<uint32_t>();
+    data.state.store(ChunkState::Resident, std::memory_order_relaxed);
+}
+
+StreamingStats ChunkStreamer::get_stats() const {
+    StreamingStats stats = {};
+    stats.chunkCount = (uint32_t)_chunks.size();
+    for (uint32_t i = 0; i < stats.chunkCount; i++) {
+        switch (_data[i].state.load(std::memory_order_relaxed)) {
+            case ChunkState::Unloaded: break;
+            case ChunkState::Reading: stats.readingChunks++; break;
+            case ChunkState::Read: stats.readChunks++; break;
+            case ChunkState::Resident: stats.residentChunks++; break;
+        }
+    }
+    stats.missingChunks = (uint32_t)_missing.size();
+    stats.committedBytes = _committedBytes;
+    stats.budgetBytes = _memoryBudget;
+    stats.loads = _loads;
+    stats.evictions = _evictions;
+    return stats;
+}
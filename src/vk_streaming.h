@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vk_mesh.h>
+#include <vk_jobs.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// table entry of a chunk pack, the vertices and then the indices of the chunk are stored at fileOffset
+struct WorldChunkInfo {
+    // world space, chunks are never transformed
+    Aabb box;
+    MeshBounds bounds;
+    uint64_t fileOffset;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+
+    uint64_t gpu_bytes() const { return (uint64_t)vertexCount * sizeof(Vertex) + (uint64_t)indexCount * sizeof(uint32_t); }
+};
+
+// offline step for large scenes: buckets the triangles of the obj into a grid of chunkSize cells by their
+// centroid and writes one mesh per occupied cell, with the table of every chunk ahead of the data
+bool import_world(const char* objPath, const char* packPath, float chunkSize);
+
+enum class ChunkState : uint8_t {
+    Unloaded,
+    // a job is reading the chunk from the pack
+    Reading,
+    // the data is in memory and waits for its upload
+    Read,
+    // uploaded into the geometry pool
+    Resident
+};
+
+struct StreamingStats {
+    uint32_t chunkCount;
+    uint32_t residentChunks;
+    uint32_t readingChunks;
+    uint32_t readChunks;
+    // chunks in the load radius that are not resident
+    uint32_t missingChunks;
+    // geometry of resident chunks plus what reads in flight will need
+    uint64_t committedBytes;
+    uint64_t budgetBytes;
+    uint64_t loads;
+    uint64_t evictions;
+};
+
+// loads and unloads the chunks of a pack around the camera. open() only reads the chunk table, so startup
+// and memory no longer grow with the size of the world.
+// every update() orders the chunks by distance to the camera. the nearest missing ones are read on the job
+// system, a few at a time, and the finished reads are handed out for upload nearest first under a per
+// frame byte budget. resident chunks past the unload radius go away, and when a nearer chunk does not fit
+// the memory budget the farthest resident ones make room for it.
+// everything except the reads runs on the thread that calls update()
+class ChunkStreamer {
+public:
+    // geometry pool bytes the resident chunks may take
+    uint64_t _memoryBudget{96ull * 1024 * 1024};
+    // chunks closer than this to the camera are loaded, resident ones past the unload radius are dropped
+    float _loadRadius{96.f};
+    float _unloadRadius{128.f};
+    uint32_t _maxReadsInFlight{4};
+    // bytes of finished reads handed out for upload per update, at least one chunk always goes
+    uint64_t _uploadBytesPerFrame{8ull * 1024 * 1024};
+
+    bool open(const std::string& path);
+
+    // waits for the reads still in flight
+    void close(JobSystem& jobs);
+
+    uint32_t chunk_count() const { return (uint32_t)_chunks.size(); }
+
+    const WorldChunkInfo& chunk(uint32_t index) const { return _chunks[index]; }
+
+    // evicts, issues reads and picks this frame's uploads. the caller frees the evicted chunks' geometry,
+    // uploads the ready ones and hands their data back with release()
+    void update(const glm::vec3& camera, JobSystem& jobs);
+
+    // chunks to drop this frame, their geometry is no longer counted against the budget
+    const std::vector<uint32_t>& evicted() const { return _evicted; }
+
+    // chunks whose data is ready to upload this frame, nearest first
+    const std::vector<uint32_t>& ready() const { return _ready; }
+
+    // the read data of a ready chunk
+    std::vector<Vertex>& vertices(uint32_t index) { return _data[index].vertices; }
+    std::vector<uint32_t>& indices(uint32_t index) { return _data[index].indices; }
+
+    // marks a ready chunk resident and frees its cpu copy
+    void release(uint32_t index);
+
+    StreamingStats get_stats() const;
+
+private:
+    struct ChunkData {
+        std::atomic<ChunkState> state{ChunkState::Unloaded};
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+    };
+
+    struct Candidate {
+        uint32_t chunk;
+        float distance;
+    };
+
+    void read_chunk(uint32_t index);
+
+    std::string _path;
+    std::vector<WorldChunkInfo> _chunks;
+    std::unique_ptr<ChunkData[]> _data;
+
+    uint64_t _committedBytes{0};
+    uint32_t _readsInFlight{0};
+    JobCounter _reads;
+
+    // scratch kept between updates
+    std::vector<Candidate> _missing;
+    std::vector<Candidate> _resident;
+    std::vector<Candidate> _finished;
+    std::vector<uint32_t> _evicted;
+    std::vector<uint32_t> _ready;
+
+    uint64_t _loads{0};
+    uint64_t _evictions{0};
+};
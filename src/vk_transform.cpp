@@ -0,0 +1,310 @@
+#include <vk_transform.h>
+#include <vk_jobs.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+glm::mat4 Transform::to_matrix() const {
+    glm::mat4 matrix = glm::mat4_cast(rotation);
+    matrix[0] *= scale.x;
+    matrix[1] *= scale.y;
+    matrix[2] *= scale.z;
+    matrix[3] = glm::vec4(translation, 1.f);
+    return matrix;
+}
+
+Transform Transform::from_matrix(const glm::mat4& matrix) {
+    Transform transform;
+    transform.translation = glm::vec3(matrix[3]);
+    transform.scale = glm::vec3(glm::length(glm::vec3(matrix[0])), glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2])));
+
+    // a zero scale axis has no direction left, keep the column as it is
+    glm::mat3 rotation;
+    for (int axis = 0; axis < 3; axis++) {
+        const glm::vec3 column = glm::vec3(matrix[axis]);
+        rotation[axis] = transform.scale[axis] > 0.f ? column / transform.scale[axis] : column;
+    }
+    transform.rotation = glm::quat_cast(rotation);
+    return transform;
+}
+
+TransformNode TransformHierarchy::add_node(TransformNode parent, const Transform& local) {
+    const TransformNode node = (TransformNode)_slotOfNode.size();
+    const uint32_t slot = (uint32_t)_local.size();
+    const uint32_t parentSlot = parent == NO_TRANSFORM_PARENT ? UINT32_MAX : _slotOfNode[parent];
+    const uint32_t depth = parent == NO_TRANSFORM_PARENT ? 0 : _depth[parentSlot] + 1;
+
+    _local.push_back(local);
+    _parent.push_back(parentSlot);
+    _world.push_back(glm::mat4{1.f});
+    _depth.push_back(depth);
+    _dirty.push_back(1);
+    _firstChild.push_back(0);
+    _childCount.push_back(0);
+    _nodeOfSlot.push_back(node);
+    _slotOfNode.push_back(slot);
+
+    // the new node has to join its siblings and the level ranges have to be recounted,
+    // the re-sort also puts it on its dirty list
+    _levelsDirty = true;
+    return node;
+}
+
+void TransformHierarchy::set_local(TransformNode node, const Transform& local) {
+    const uint32_t slot = _slotOfNode[node];
+    _local[slot] = local;
+    if (_dirty[slot]) {
+        return;
+    }
+    _dirty[slot] = 1;
+    if (!_levelsDirty) {
+        _dirtyLevels[_depth[slot]].push_back(slot);
+    }
+}
+
+void TransformHierarchy::clear() {
+    _local.clear();
+    _parent.clear();
+    _world.clear();
+    _depth.clear();
+    _dirty.clear();
+    _firstChild.clear();
+    _childCount.clear();
+    _nodeOfSlot.clear();
+    _slotOfNode.clear();
+    _levelStart.clear();
+    _dirtyLevels.clear();
+    _levelsDirty = false;
+    _stats = {};
+}
+
+void TransformHierarchy::rebuild_levels() {
+    const uint32_t count = (uint32_t)_local.size();
+
+    // children of every slot, in slot order so siblings keep their relative order
+    std::vector<uint32_t> childOffset(count + 1, 0);
+    for (uint32_t slot = 0; slot < count; slot++) {
+        if (_parent[slot] != UINT32_MAX) {
+            childOffset[_parent[slot] + 1]++;
+        }
+    }
+    for (uint32_t slot = 0; slot < count; slot++) {
+        childOffset[slot + 1] += childOffset[slot];
+    }
+    std::vector<uint32_t> children(childOffset[count]);
+    std::vector<uint32_t> cursor(childOffset.begin(), childOffset.end() - 1);
+    for (uint32_t slot = 0; slot < count; slot++) {
+        if (_parent[slot] != UINT32_MAX) {
+            children[cursor[_parent[slot]]++] = slot;
+        }
+    }
+
+    // roots first, then the children of every node in the order the nodes themselves were placed
+    std::vector<uint32_t> order;
+    order.reserve(count);
+    for (uint32_t slot = 0; slot < count; slot++) {
+        if (_parent[slot] == UINT32_MAX) {
+            order.push_back(slot);
+        }
+    }
+    bool sorted = true;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t slot = order[i];
+        order.insert(order.end(), children.begin() + childOffset[slot], children.begin() + childOffset[slot + 1]);
+        sorted = sorted && slot == i;
+    }
+
+    if (!sorted) {
+        std::vector<uint32_t> newSlot(count);
+        for (uint32_t i = 0; i < count; i++) {
+            newSlot[order[i]] = i;
+        }
+
+        std::vector<Transform> local(count);
+        std::vector<uint32_t> parent(count);
+        std::vector<glm::mat4> world(count);
+        std::vector<uint32_t> depth(count);
+        std::vector<uint8_t> dirty(count);
+        std::vector<TransformNode> nodeOfSlot(count);
+        for (uint32_t slot = 0; slot < count; slot++) {
+            const uint32_t target = newSlot[slot];
+            local[target] = _local[slot];
+            parent[target] = _parent[slot] == UINT32_MAX ? UINT32_MAX : newSlot[_parent[slot]];
+            world[target] = _world[slot];
+            depth[target] = _depth[slot];
+            dirty[target] = _dirty[slot];
+            nodeOfSlot[target] = _nodeOfSlot[slot];
+            _slotOfNode[_nodeOfSlot[slot]] = target;
+        }
+
+        _local.swap(local);
+        _parent.swap(parent);
+        _world.swap(world);
+        _depth.swap(depth);
+        _dirty.swap(dirty);
+        _nodeOfSlot.swap(nodeOfSlot);
+    }
+
+    // breadth first order leaves the depths ascending and the children of a node in one run
+    const uint32_t levelCount = count > 0 ? _depth[count - 1] + 1 : 0;
+    _levelStart.assign(levelCount + 1, 0);
+    std::fill(_childCount.begin(), _childCount.end(), 0);
+    for (uint32_t slot = 0; slot < count; slot++) {
+        _levelStart[_depth[slot] + 1]++;
+        const uint32_t parent = _parent[slot];
+        if (parent != UINT32_MAX) {
+            if (_childCount[parent] == 0) {
+                _firstChild[parent] = slot;
+            }
+            _childCount[parent]++;
+        }
+    }
+    for (uint32_t level = 0; level < levelCount; level++) {
+        _levelStart[level + 1] += _levelStart[level];
+    }
+
+    _dirtyLevels.resize(levelCount);
+    for (std::vector<uint32_t>& level : _dirtyLevels) {
+        level.clear();
+    }
+    for (uint32_t slot = 0; slot < count; slot++) {
+        if (_dirty[slot]) {
+            _dirtyLevels[_depth[slot]].push_back(slot);
+        }
+    }
+    _levelsDirty = false;
+}
+
+void TransformHierarchy::update_slots(const uint32_t* slots, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t slot = slots[i];
+        const uint32_t parent = _parent[slot];
+        const glm::mat4 local = _local[slot].to_matrix();
+        _world[slot] = parent == UINT32_MAX ? local : _world[parent] * local;
+        _dirty[slot] = 0;
+    }
+}
+
+void TransformHierarchy::update(JobSystem* jobs, uint32_t grainSize) {
+    auto start = std::chrono::steady_clock::now();
+
+    if (_levelsDirty) {
+        rebuild_levels();
+    }
+
+    uint32_t updated = 0;
+    const uint32_t levelCount = (uint32_t)_dirtyLevels.size();
+    for (uint32_t level = 0; level < levelCount; level++) {
+        std::vector<uint32_t>& dirty = _dirtyLevels[level];
+        if (dirty.empty()) {
+            continue;
+        }
+        const uint32_t count = (uint32_t)dirty.size();
+
+        // a level only reads the one above it, which the previous iteration finished
+        if (jobs && count > grainSize) {
+            jobs->parallel_for(count, grainSize, [&](uint32_t rangeBegin, uint32_t rangeEnd) {
+                update_slots(dirty.data() + rangeBegin, rangeEnd - rangeBegin);
+            });
+        } else {
+            update_slots(dirty.data(), count);
+        }
+        updated += count;
+
+        // every child of a recomputed node follows it, unless set_local already listed it
+        if (level + 1 < levelCount) {
+            std::vector<uint32_t>& next = _dirtyLevels[level + 1];
+            for (uint32_t slot : dirty) {
+                const uint32_t firstChild = _firstChild[slot];
+                const uint32_t childEnd = firstChild + _childCount[slot];
+                for (uint32_t child = firstChild; child < childEnd; child++) {
+                    if (!_dirty[child]) {
+                        _dirty[child] = 1;
+                        next.push_back(child);
+                    }
+                }
+            }
+        }
+        dirty.clear();
+    }
+
+    _stats.nodeCount = node_count();
+    _stats.nodesUpdated = updated;
+    _stats.levelCount = levelCount;
+    _stats.updateMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void run_transform_benchmark() {
+    using clock = std::chrono::high_resolution_clock;
+
+    // 100 roots with 9 children of 110 leaves each: 1000 nodes per root, 100k in total.
+    // nodes are added depth first, so the first update also measures the breadth first sort
+    const uint32_t rootCount = 100;
+    const uint32_t childCount = 9;
+    const uint32_t leafCount = 110;
+
+    TransformHierarchy hierarchy;
+    std::vector<TransformNode> roots;
+    for (uint32_t r = 0; r < rootCount; r++) {
+        Transform rootLocal;
+        rootLocal.translation = glm::vec3((float)r * 10.f, 0.f, 0.f);
+        TransformNode root = hierarchy.add_node(NO_TRANSFORM_PARENT, rootLocal);
+        roots.push_back(root);
+
+        for (uint32_t c = 0; c < childCount; c++) {
+            Transform childLocal;
+            childLocal.translation = glm::vec3(0.f, (float)c, 0.f);
+            childLocal.rotation = glm::angleAxis(0.1f * (float)c, glm::vec3(0.f, 1.f, 0.f));
+            TransformNode child = hierarchy.add_node(root, childLocal);
+
+            for (uint32_t l = 0; l < leafCount; l++) {
+                Transform leafLocal;
+                leafLocal.translation = glm::vec3(0.f, 0.f, (float)l * 0.1f);
+                leafLocal.scale = glm::vec3(0.5f);
+                hierarchy.add_node(child, leafLocal);
+            }
+        }
+    }
+
+    auto first = clock::now();
+    hierarchy.update(nullptr);
+    double firstMs = std::chrono::duration<double, std::milli>(clock::now() - first).count();
+    std::cout << "Transforms: " << hierarchy.node_count() << " nodes in " << hierarchy.get_stats().levelCount
+              << " levels, first update with sort " << firstMs << " ms" << std::endl;
+
+    const uint32_t maxThreads = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+    JobSystem jobs;
+    jobs.init(maxThreads > 1 ? maxThreads - 1 : 1);
+
+    const int iterations = 50;
+    auto measure = [&](const char* name, JobSystem* jobSystem, const std::vector<TransformNode>& moved) {
+        uint32_t updated = 0;
+        auto start = clock::now();
+        for (int i = 0; i < iterations; i++) {
+            for (TransformNode node : moved) {
+                Transform local = hierarchy.get_local(node);
+                local.translation.y += 0.01f;
+                hierarchy.set_local(node, local);
+            }
+            hierarchy.update(jobSystem);
+            updated = hierarchy.get_stats().nodesUpdated;
+        }
+        double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count() / iterations;
+
+        std::cout << name << (jobSystem ? " (" + std::to_string(jobSystem->thread_count()) + " threads): " : " (1 thread): ")
+                  << ms << " ms, " << updated << "/" << hierarchy.node_count() << " nodes updated" << std::endl;
+    };
+
+    const std::vector<TransformNode> oneRoot = {roots[rootCount / 2]};
+    const std::vector<TransformNode> none;
+
+    measure("All roots moved", nullptr, roots);
+    measure("All roots moved", &jobs, roots);
+    measure("One root moved", nullptr, oneRoot);
+    measure("One root moved", &jobs, oneRoot);
+    measure("Nothing moved", nullptr, none);
+
+    jobs.cleanup();
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+class JobSystem;
+
+// local translation, rotation and scale relative to the parent
+struct Transform {
+    glm::vec3 translation{0.f};
+    glm::quat rotation{1.f, 0.f, 0.f, 0.f};
+    glm::vec3 scale{1.f};
+
+    glm::mat4 to_matrix() const;
+
+    // splits an affine matrix without shear back into TRS
+    static Transform from_matrix(const glm::mat4& matrix);
+};
+
+// stable id of a node, unlike its position in the arrays it survives re-sorting
+using TransformNode = uint32_t;
+constexpr TransformNode NO_TRANSFORM_PARENT = UINT32_MAX;
+
+struct TransformStats {
+    uint32_t nodeCount;
+    // world matrices recomputed by the last update
+    uint32_t nodesUpdated;
+    uint32_t levelCount;
+    float updateMs;
+};
+
+// parent/child transforms stored breadth first in contiguous arrays: local TRS, parent slot and world
+// matrix. every level of the tree is one contiguous range, parents always sit in an earlier level and
+// the children of a node sit next to each other.
+// set_local puts the node on its level's dirty list. an update walks the levels in order, recomputes the
+// listed nodes (independent subtrees, in parallel) and lists their children for the next level, so the
+// work follows the number of changed nodes rather than the size of the levels below the first change
+class TransformHierarchy {
+public:
+    TransformNode add_node(TransformNode parent, const Transform& local = Transform{});
+
+    void set_local(TransformNode node, const Transform& local);
+
+    const Transform& get_local(TransformNode node) const { return _local[_slotOfNode[node]]; }
+
+    // valid after the update that followed the last change
+    const glm::mat4& get_world(TransformNode node) const { return _world[_slotOfNode[node]]; }
+
+    // levels with fewer nodes than the grain size run inline, jobs is optional
+    void update(JobSystem* jobs, uint32_t grainSize = 1024);
+
+    void clear();
+
+    uint32_t node_count() const { return (uint32_t)_local.size(); }
+
+    const TransformStats& get_stats() const { return _stats; }
+
+private:
+    // breadth first re-sort, which keeps every parent ahead of its children and siblings in the order
+    // they were added. rebuilds the dirty lists from the dirty flags
+    void rebuild_levels();
+
+    void update_slots(const uint32_t* slots, uint32_t count);
+
+    // indexed by slot, in breadth first order
+    std::vector<Transform> _local;
+    std::vector<uint32_t> _parent;
+    std::vector<glm::mat4> _world;
+    std::vector<uint32_t> _depth;
+    // set while the node is on its level's dirty list, cleared once the update recomputed it
+    std::vector<uint8_t> _dirty;
+    // the children of a slot are childCount slots from firstChild, in the next level
+    std::vector<uint32_t> _firstChild;
+    std::vector<uint32_t> _childCount;
+    std::vector<TransformNode> _nodeOfSlot;
+
+    // indexed by TransformNode
+    std::vector<uint32_t> _slotOfNode;
+
+    // first slot of every level, plus one past the end
+    std::vector<uint32_t> _levelStart;
+    // slots to recompute per level. stale while _levelsDirty, the next update rebuilds them
+    std::vector<std::vector<uint32_t>> _dirtyLevels;
+    bool _levelsDirty{false};
+
+    TransformStats _stats{};
+};
+
+// moving one root in a 100k node hierarchy against a full update, single threaded and with the job system
+void run_transform_benchmark();
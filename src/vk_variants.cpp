@@ -0,0 +1,127 @@
+#include <vk_variants.h>
+
+#include <chrono>
+#include <iostream>
+
+static uint32_t count_bits(uint32_t value) {
+    uint32_t count = 0;
+    for (; value; value &= value - 1) {
+        count++;
+    }
+    return count;
+}
+
+void PipelineVariantCache::init(JobSystem* jobs, VariantBuildFunction&& build, uint32_t baseBits) {
+    _jobs = jobs;
+    _build = std::move(build);
+
+    // the fallback every other variant ends in, done on the calling thread
+    _slots[baseBits].state.store(SLOT_COMPILING, std::memory_order_relaxed);
+    compile(baseBits);
+}
+
+void PipelineVariantCache::compile(uint32_t bits) {
+    VkBool32 values[SHADER_VARIANT_BIT_COUNT];
+    VkSpecializationMapEntry entries[SHADER_VARIANT_BIT_COUNT];
+    for (uint32_t i = 0; i < SHADER_VARIANT_BIT_COUNT; i++) {
+        values[i] = (bits & (1u << i)) ? VK_TRUE : VK_FALSE;
+        entries[i].constantID = i;
+        entries[i].offset = i * sizeof(VkBool32);
+        entries[i].size = sizeof(VkBool32);
+    }
+
+    VkSpecializationInfo specialization = {};
+    specialization.mapEntryCount = SHADER_VARIANT_BIT_COUNT;
+    specialization.pMapEntries = entries;
+    specialization.dataSize = sizeof(values);
+    specialization.pData = values;
+
+    auto start = std::chrono::steady_clock::now();
+    VkPipeline pipeline = _build(specialization);
+    float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    Slot& slot = _slots[bits];
+    if (pipeline == VK_NULL_HANDLE) {
+        std::cout << "Pipeline variant " << bits << " failed to compile" << std::endl;
+        slot.state.store(SLOT_FAILED, std::memory_order_release);
+        return;
+    }
+    slot.pipeline = pipeline;
+    slot.state.store(SLOT_READY, std::memory_order_release);
+
+    std::lock_guard<std::mutex> lock(_statsLock);
+    _lastCompileMs = ms;
+    _totalCompileMs += ms;
+}
+
+VkPipeline PipelineVariantCache::get(uint32_t bits) {
+    bits &= SHADER_VARIANT_COUNT - 1;
+
+    Slot& slot = _slots[bits];
+    uint8_t state = slot.state.load(std::memory_order_acquire);
+    if (state == SLOT_READY) {
+        return slot.pipeline;
+    }
+
+    // only the caller that wins the exchange queues the compile. that is the one fallback counted for this
+    // variant, later calls while it compiles and every call after it failed answer the same way without counting.
+    // a failed variant stays failed, it is never compiled again
+    uint8_t expected = SLOT_MISSING;
+    if (state == SLOT_MISSING && slot.state.compare_exchange_strong(expected, SLOT_COMPILING, std::memory_order_acq_rel)) {
+        _fallbacks.fetch_add(1, std::memory_order_relaxed);
+        _jobs->run_background([this, bits]() { compile(bits); }, &_compiles);
+    }
+
+    // closest ready variant, fewest toggles different from the request. null only if even the base failed
+    VkPipeline fallback = VK_NULL_HANDLE;
+    uint32_t bestDistance = UINT32_MAX;
+    for (uint32_t candidate = 0; candidate < SHADER_VARIANT_COUNT; candidate++) {
+        if (_slots[candidate].state.load(std::memory_order_acquire) != SLOT_READY) {
+            continue;
+        }
+        uint32_t distance = count_bits(candidate ^ bits);
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            fallback = _slots[candidate].pipeline;
+        }
+    }
+    return fallback;
+}
+
+bool PipelineVariantCache::settled(uint32_t bits) const {
+    uint8_t state = _slots[bits & (SHADER_VARIANT_COUNT - 1)].state.load(std::memory_order_acquire);
+    return state == SLOT_READY || state == SLOT_FAILED;
+}
+
+void PipelineVariantCache::cleanup(VkDevice device, const VkAllocationCallbacks* callbacks) {
+    if (_jobs) {
+        _jobs->wait(_compiles);
+    }
+    for (Slot& slot : _slots) {
+        if (slot.state.load(std::memory_order_acquire) == SLOT_READY) {
+            vkDestroyPipeline(device, slot.pipeline, callbacks);
+        }
+        slot.pipeline = VK_NULL_HANDLE;
+        slot.state.store(SLOT_MISSING, std::memory_order_relaxed);
+    }
+}
+
+VariantCacheStats PipelineVariantCache::get_stats() const {
+    VariantCacheStats stats = {};
+    for (const Slot& slot : _slots) {
+        uint8_t state = slot.state.load(std::memory_order_acquire);
+        if (state == SLOT_READY) {
+            stats.compiled++;
+        } else if (state == SLOT_COMPILING) {
+            stats.compiling++;
+        } else if (state == SLOT_FAILED) {
+            stats.failed++;
+        }
+    }
+    stats.fallbacks = _fallbacks.load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(_statsLock);
+    stats.lastCompileMs = _lastCompileMs;
+    stats.totalCompileMs = _totalCompileMs;
+    return stats;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vk_jobs.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+// feature toggles of the mesh shaders, bit i is specialization constant constant_id = i
+enum ShaderVariantBits : uint32_t {
+    // ignore the vertex color attribute and draw a flat color
+    VARIANT_FLAT_COLOR = 1 << 0,
+    VARIANT_LIGHTING = 1 << 1,
+    // procedural cutout, fragments below the threshold are discarded
+    VARIANT_ALPHA_TEST = 1 << 2,
+};
+
+constexpr uint32_t SHADER_VARIANT_BIT_COUNT = 3;
+constexpr uint32_t SHADER_VARIANT_COUNT = 1 << SHADER_VARIANT_BIT_COUNT;
+
+struct VariantCacheStats {
+    uint32_t compiled;
+    uint32_t compiling;
+    // variants whose compile failed, get() falls back for them for good
+    uint32_t failed;
+    // variants requested before they were ready, each counted once however many frames it took
+    uint32_t fallbacks;
+    float lastCompileMs;
+    float totalCompileMs;
+};
+
+// creates the pipeline of one permutation, the specialization info holds a VkBool32 per bit
+using VariantBuildFunction = std::function<VkPipeline(const VkSpecializationInfo& specialization)>;
+
+// one pipeline per permutation of ShaderVariantBits, created on first use. get() never blocks: a missing
+// variant is queued as a background job for the workers and the closest ready variant is returned until it is done.
+// the base variant is compiled up front, so there is always something to draw with
+class PipelineVariantCache {
+public:
+    void init(JobSystem* jobs, VariantBuildFunction&& build, uint32_t baseBits = 0);
+
+    VkPipeline get(uint32_t bits);
+
+    // true once get(bits) gives its final answer: the variant compiled, or failed and falls back for good
+    bool settled(uint32_t bits) const;
+
+    // waits for background compiles, then destroys every pipeline the cache created
+    void cleanup(VkDevice device, const VkAllocationCallbacks* callbacks);
+
+    VariantCacheStats get_stats() const;
+
+private:
+    enum SlotState : uint8_t {
+        SLOT_MISSING,
+        SLOT_COMPILING,
+        SLOT_READY,
+        SLOT_FAILED
+    };
+
+    struct Slot {
+        std::atomic<uint8_t> state{SLOT_MISSING};
+        // written once before state becomes SLOT_READY
+        VkPipeline pipeline{VK_NULL_HANDLE};
+    };
+
+    void compile(uint32_t bits);
+
+    JobSystem* _jobs{nullptr};
+    VariantBuildFunction _build;
+    Slot _slots[SHADER_VARIANT_COUNT];
+    // background compiles in flight, cleanup waits on it
+    JobCounter _compiles;
+
+    std::atomic<uint32_t> _fallbacks{0};
+    mutable std::mutex _statsLock;
+    float _lastCompileMs{0.f};
+    float _totalCompileMs{0.f};
+};
@@ -0,0 +1,540 @@
+#include <vk_vfs.h>
+#include <vk_registry.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    const char PACK_MAGIC[4] = {'V', 'K', 'A', 'P'};
+    // 2 added the name table
+    const uint32_t PACK_VERSION = 2;
+    // entries start on a page, so readahead and mapping work on whole entries
+    const uint64_t ENTRY_ALIGNMENT = 4096;
+
+    struct PackHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t entryCount;
+        // size of the name table that follows the entries
+        uint32_t nameBytes;
+    };
+
+    // lz4 block format, the same bytes LZ4_compress_default / LZ4_decompress_safe produce and accept.
+    // a greedy single probe matcher: slower to compress and a little larger than the reference, which
+    // only matters to the packer
+    const uint32_t LZ4_MIN_MATCH = 4;
+    // the last match has to start this far from the end, the last 5 bytes are always literals
+    const size_t LZ4_MATCH_LIMIT = 12;
+    const size_t LZ4_LAST_LITERALS = 5;
+    const uint32_t LZ4_HASH_BITS = 16;
+
+    uint32_t read32(const uint8_t* p) {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    void write_length(std::vector<uint8_t>& out, size_t length) {
+        while (length >= 255) {
+            out.push_back(255);
+            length -= 255;
+        }
+        out.push_back((uint8_t)length);
+    }
+
+    void write_sequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t literalCount, uint32_t offset, size_t matchLength) {
+        const size_t matchCode = matchLength >= LZ4_MIN_MATCH ? matchLength - LZ4_MIN_MATCH : 0;
+        out.push_back((uint8_t)((std::min<size_t>(literalCount, 15) << 4) | (matchLength > 0 ? std::min<size_t>(matchCode, 15) : 0)));
+        if (literalCount >= 15) {
+            write_length(out, literalCount - 15);
+        }
+        out.insert(out.end(), literals, literals + literalCount);
+
+        // the final sequence is literals only
+        if (matchLength == 0) {
+            return;
+        }
+        out.push_back((uint8_t)(offset & 0xff));
+        out.push_back((uint8_t)(offset >> 8));
+        if (matchCode >= 15) {
+            write_length(out, matchCode - 15);
+        }
+    }
+
+    std::vector<uint8_t> lz4_compress(const uint8_t* src, size_t size) {
+        std::vector<uint8_t> out;
+        out.reserve(size / 2 + 16);
+
+        size_t anchor = 0;
+        if (size > LZ4_MATCH_LIMIT) {
+            // position + 1 of the last 4 bytes with each hash, 0 is empty
+            std::vector<uint32_t> table((size_t)1 << LZ4_HASH_BITS, 0);
+            const size_t limit = size - LZ4_MATCH_LIMIT;
+            size_t i = 0;
+            while (i < limit) {
+                const uint32_t sequence = read32(src + i);
+                const uint32_t hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+                const size_t candidate = table[hash];
+                table[hash] = (uint32_t)i + 1;
+
+                if (candidate == 0 || i - (candidate - 1) > 65535 || read32(src + candidate - 1) != sequence) {
+                    i++;
+                    continue;
+                }
+
+                const size_t reference = candidate - 1;
+                size_t length = LZ4_MIN_MATCH;
+                while (i + length < size - LZ4_LAST_LITERALS && src[reference + length] == src[i + length]) {
+                    length++;
+                }
+
+                write_sequence(out, src + anchor, i - anchor, (uint32_t)(i - reference), length);
+                i += length;
+                anchor = i;
+            }
+        }
+        write_sequence(out, src + anchor, size - anchor, 0, 0);
+        return out;
+    }
+
+    bool lz4_decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t rawSize) {
+        const uint8_t* in = src;
+        const uint8_t* const inEnd = src + size;
+        uint8_t* outPos = dst;
+        uint8_t* const outEnd = dst + rawSize;
+
+        auto read_length = [&](size_t& length) {
+            uint8_t byte;
+            do {
+                if (in >= inEnd) {
+                    return false;
+                }
+                byte = *in++;
+                length += byte;
+            } while (byte == 255);
+            return true;
+        };
+
+        while (in < inEnd) {
+            const uint8_t token = *in++;
+
+            size_t literalCount = token >> 4;
+            if (literalCount == 15 && !read_length(literalCount)) {
+                return false;
+            }
+            if (literalCount > (size_t)(inEnd - in) || literalCount > (size_t)(outEnd - outPos)) {
+                return false;
+            }
+            memcpy(outPos, in, literalCount);
+            in += literalCount;
+            outPos += literalCount;
+
+            if (in == inEnd) {
+                break;
+            }
+
+            if (inEnd - in < 2) {
+                return false;
+            }
+            const size_t offset = (size_t)in[0] | ((size_t)in[1] << 8);
+            in += 2;
+            if (offset == 0 || offset > (size_t)(outPos - dst)) {
+                return false;
+            }
+
+            size_t matchLength = token & 15;
+            if (matchLength == 15 && !read_length(matchLength)) {
+                return false;
+            }
+            matchLength += LZ4_MIN_MATCH;
+            if (matchLength > (size_t)(outEnd - outPos)) {
+                return false;
+            }
+
+            // the match can overlap what it writes, so it is copied forward a byte at a time
+            const uint8_t* match = outPos - offset;
+            for (size_t i = 0; i < matchLength; i++) {
+                outPos[i] = match[i];
+            }
+            outPos += matchLength;
+        }
+        return outPos == outEnd;
+    }
+
+    // path relative to the mount point, or nullptr when it is outside of it
+    const char* strip_mount_point(const char* path, const std::string& mountPoint) {
+        if (strncmp(path, mountPoint.c_str(), mountPoint.size()) != 0) {
+            return nullptr;
+        }
+        return path + mountPoint.size();
+    }
+}
+
+bool AssetPack::open(const std::string& path, const std::string& mountPoint) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    PackHeader header;
+    file.read((char*)&header, sizeof(header));
+    if (!file || !std::equal(PACK_MAGIC, PACK_MAGIC + 4, header.magic) || header.version != PACK_VERSION) {
+        std::cout << path << " is not a version " << PACK_VERSION << " asset pack" << std::endl;
+        return false;
+    }
+
+    _entries.resize(header.entryCount);
+    file.read((char*)_entries.data(), _entries.size() * sizeof(Entry));
+    _names.resize(header.nameBytes);
+    file.read(&_names[0], _names.size());
+    if (!file) {
+        std::cout << "Asset pack " << path << " is truncated" << std::endl;
+        _entries.clear();
+        _names.clear();
+        return false;
+    }
+    file.seekg(0, std::ios::end);
+    const uint64_t packSize = (uint64_t)file.tellg();
+
+    _stats = {};
+    _lookup.clear();
+    _lookup.reserve(_entries.size());
+    for (uint32_t i = 0; i < (uint32_t)_entries.size(); i++) {
+        const Entry& entry = _entries[i];
+        if (entry.offset + entry.size > packSize || (uint64_t)entry.nameOffset + entry.nameLength > _names.size()) {
+            std::cout << "Asset pack " << path << " has an entry past its end" << std::endl;
+            _entries.clear();
+            _names.clear();
+            _lookup.clear();
+            return false;
+        }
+        _lookup[entry.name] = i;
+        _stats.rawBytes += entry.rawSize;
+        if (entry.compressed) {
+            _stats.compressedEntries++;
+        }
+    }
+    _stats.entries = (uint32_t)_entries.size();
+    _stats.packBytes = packSize;
+
+#ifdef _WIN32
+    HANDLE fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (fileHandle != INVALID_HANDLE_VALUE) {
+        HANDLE mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle) {
+            _mapping = (const uint8_t*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+            _mappingHandle = mappingHandle;
+        }
+        _file = fileHandle;
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        void* mapping = mmap(nullptr, (size_t)packSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        // the mapping keeps the file alive on its own
+        ::close(fd);
+        if (mapping != MAP_FAILED) {
+            _mapping = (const uint8_t*)mapping;
+            // entries are read in no particular order, readahead comes from read_batch instead
+            madvise(mapping, (size_t)packSize, MADV_RANDOM);
+        }
+    }
+#endif
+    if (_mapping) {
+        _mappingSize = (size_t)packSize;
+    } else {
+        std::cout << "Could not map " << path << ", asset reads go through the file" << std::endl;
+    }
+    _stats.mapped = _mapping != nullptr;
+
+    _path = path;
+    _mountPoint = mountPoint;
+    return true;
+}
+
+void AssetPack::close() {
+#ifdef _WIN32
+    if (_mapping) {
+        UnmapViewOfFile(_mapping);
+    }
+    if (_mappingHandle) {
+        CloseHandle((HANDLE)_mappingHandle);
+    }
+    if (_file) {
+        CloseHandle((HANDLE)_file);
+    }
+    _mappingHandle = nullptr;
+    _file = nullptr;
+#else
+    if (_mapping) {
+        munmap((void*)_mapping, _mappingSize);
+    }
+#endif
+    _mapping = nullptr;
+    _mappingSize = 0;
+    _path.clear();
+    _entries.clear();
+    _names.clear();
+    _lookup.clear();
+    _stats = {};
+}
+
+const AssetPack::Entry* AssetPack::find(const char* path) const {
+    const char* name = strip_mount_point(path, _mountPoint);
+    if (!name) {
+        return nullptr;
+    }
+    const size_t length = strlen(name);
+    auto it = _lookup.find(fnv1a_32(name, length));
+    if (it == _lookup.end()) {
+        return nullptr;
+    }
+    // a path that only shares the hash is not in the pack
+    const Entry& entry = _entries[it->second];
+    if (entry.nameLength != length || memcmp(_names.data() + entry.nameOffset, name, length) != 0) {
+        return nullptr;
+    }
+    return &entry;
+}
+
+bool AssetPack::contains(const char* path) const {
+    return find(path) != nullptr;
+}
+
+bool AssetPack::read(const char* path, AssetData& out) const {
+    const Entry* entry = find(path);
+    return entry && read_entry(*entry, out);
+}
+
+bool AssetPack::read_entry(const Entry& entry, AssetData& out) const {
+    out.storage.clear();
+    out.data = nullptr;
+    out.size = 0;
+
+    const uint8_t* stored = nullptr;
+    std::vector<uint8_t> readBuffer;
+    if (_mapping) {
+        stored = _mapping + entry.offset;
+    } else {
+        std::ifstream file(_path, std::ios::binary);
+        readBuffer.resize(entry.size);
+        file.seekg((std::streamoff)entry.offset);
+        file.read((char*)readBuffer.data(), entry.size);
+        if (!file) {
+            return false;
+        }
+        stored = readBuffer.data();
+    }
+
+    if (entry.compressed) {
+        out.storage.resize(entry.rawSize);
+        if (!lz4_decompress(stored, entry.size, out.storage.data(), entry.rawSize)) {
+            std::cout << "Asset pack " << _path << " has a corrupt compressed entry" << std::endl;
+            out.storage.clear();
+            return false;
+        }
+    } else if (!_mapping) {
+        out.storage = std::move(readBuffer);
+    } else {
+        // zero copy, the data lives as long as the pack stays open
+        out.data = stored;
+        out.size = entry.size;
+        return true;
+    }
+    out.data = out.storage.data();
+    out.size = out.storage.size();
+    return true;
+}
+
+void AssetPack::read_batch(const char* const* paths, uint32_t count, AssetData* out, JobSystem& jobs, JobCounter* counter) const {
+#ifndef _WIN32
+    // one readahead request per entry before anything faults, the kernel reads them while the jobs start
+    if (_mapping) {
+        for (uint32_t i = 0; i < count; i++) {
+            const Entry* entry = find(paths[i]);
+            if (entry) {
+                madvise((void*)(_mapping + entry->offset), (size_t)entry->size, MADV_WILLNEED);
+            }
+        }
+    }
+#endif
+
+    for (uint32_t i = 0; i < count; i++) {
+        const Entry* entry = find(paths[i]);
+        if (!entry) {
+            continue;
+        }
+        AssetData* target = &out[i];
+        jobs.run([this, entry, target]() {
+            if (!read_entry(*entry, *target)) {
+                return;
+            }
+            // fault the stored pages in here rather than on whoever uses the data
+            if (target->storage.empty()) {
+                volatile uint8_t sink = 0;
+                for (size_t offset = 0; offset < target->size; offset += ENTRY_ALIGNMENT) {
+                    sink = sink + target->data[offset];
+                }
+            }
+        }, counter);
+    }
+}
+
+bool write_asset_pack(const std::string& packPath, const std::string& root, const std::vector<std::string>& directories, bool compress) {
+    namespace fs = std::filesystem;
+
+    std::vector<std::string> names;
+    for (const std::string& directory : directories) {
+        std::error_code error;
+        for (const fs::directory_entry& file : fs::recursive_directory_iterator(fs::path(root) / directory, error)) {
+            if (file.is_regular_file()) {
+                names.push_back(fs::relative(file.path(), root).generic_string());
+            }
+        }
+        if (error) {
+            std::cout << "Could not list " << (fs::path(root) / directory).string() << ": " << error.message() << std::endl;
+            return false;
+        }
+    }
+    // the same inputs always give the same pack
+    std::sort(names.begin(), names.end());
+
+    std::vector<AssetPack::Entry> entries;
+    std::vector<std::vector<uint8_t>> contents;
+    std::unordered_map<uint32_t, std::string> hashes;
+    std::string nameTable;
+    for (const std::string& name : names) {
+        nameTable += name;
+    }
+    const uint64_t tableBytes = sizeof(PackHeader) + names.size() * sizeof(AssetPack::Entry) + nameTable.size();
+    uint64_t offset = tableBytes;
+    uint32_t nameOffset = 0;
+    uint64_t rawBytes = 0;
+    for (const std::string& name : names) {
+        const uint32_t hash = fnv1a_32(name.data(), name.size());
+        auto inserted = hashes.emplace(hash, name);
+        if (!inserted.second) {
+            std::cout << name << " and " << inserted.first->second << " hash to the same name, rename one" << std::endl;
+            return false;
+        }
+
+        AssetData data;
+        if (!read_file((fs::path(root) / name).string().c_str(), data)) {
+            std::cout << "Could not read " << name << std::endl;
+            return false;
+        }
+
+        AssetPack::Entry entry = {};
+        entry.name = hash;
+        entry.nameOffset = nameOffset;
+        entry.nameLength = (uint32_t)name.size();
+        nameOffset += entry.nameLength;
+        entry.rawSize = data.size;
+        std::vector<uint8_t> stored = std::move(data.storage);
+        if (compress && !stored.empty()) {
+            std::vector<uint8_t> compressed = lz4_compress(stored.data(), stored.size());
+            if (compressed.size() * 4 <= stored.size() * 3) {
+                stored = std::move(compressed);
+                entry.compressed = 1;
+            }
+        }
+
+        offset = (offset + ENTRY_ALIGNMENT - 1) / ENTRY_ALIGNMENT * ENTRY_ALIGNMENT;
+        entry.offset = offset;
+        entry.size = stored.size();
+        offset += entry.size;
+        rawBytes += entry.rawSize;
+
+        entries.push_back(entry);
+        contents.push_back(std::move(stored));
+    }
+
+    std::ofstream file(packPath, std::ios::binary);
+    if (!file.is_open()) {
+        std::cout << "Could not open " << packPath << " to write an asset pack" << std::endl;
+        return false;
+    }
+
+    PackHeader header = {};
+    std::copy(PACK_MAGIC, PACK_MAGIC + 4, header.magic);
+    header.version = PACK_VERSION;
+    header.entryCount = (uint32_t)entries.size();
+    header.nameBytes = (uint32_t)nameTable.size();
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)entries.data(), entries.size() * sizeof(AssetPack::Entry));
+    file.write(nameTable.data(), (std::streamsize)nameTable.size());
+
+    const char padding[ENTRY_ALIGNMENT] = {};
+    uint64_t position = tableBytes;
+    for (size_t i = 0; i < entries.size(); i++) {
+        file.write(padding, (std::streamsize)(entries[i].offset - position));
+        file.write((const char*)contents[i].data(), contents[i].size());
+        position = entries[i].offset + entries[i].size;
+    }
+    if (!file.good()) {
+        std::cout << "Writing " << packPath << " failed" << std::endl;
+        return false;
+    }
+
+    std::cout << "Packed " << entries.size() << " files, " << rawBytes << " bytes into " << packPath << ", " << position << " bytes" << std::endl;
+    return true;
+}
+
+bool read_file(const char* path, AssetData& out) {
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    const size_t fileSize = (size_t)file.tellg();
+    out.storage.resize(fileSize);
+    file.seekg(0);
+    file.read((char*)out.storage.data(), fileSize);
+    if (!file) {
+        out.storage.clear();
+        return false;
+    }
+    out.data = out.storage.data();
+    out.size = fileSize;
+    return true;
+}
+
+void evict_file_cache(const std::string& path) {
+#ifdef __linux__
+    namespace fs = std::filesystem;
+    std::error_code error;
+    if (fs::is_directory(path, error)) {
+        for (const fs::directory_entry& file : fs::recursive_directory_iterator(path, error)) {
+            if (file.is_regular_file()) {
+                evict_file_cache(file.path().string());
+            }
+        }
+        return;
+    }
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    // dirty pages would stay, flush them first
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+#else
+    (void)path;
+#endif
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vk_jobs.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// contents of one file read through AssetPack or from disk. stored pack entries point straight into the
+// mapped pack, everything else owns a copy
+struct AssetData {
+    const uint8_t* data{nullptr};
+    size_t size{0};
+    // decompressed or read contents, empty while data points into the mapping
+    std::vector<uint8_t> storage;
+
+    bool valid() const { return data != nullptr; }
+};
+
+struct AssetPackStats {
+    uint32_t entries;
+    uint32_t compressedEntries;
+    uint64_t packBytes;
+    // size of every entry once decompressed
+    uint64_t rawBytes;
+    // false when the pack could not be mapped and entries are read through the file instead
+    bool mapped;
+};
+
+// one file holding every asset and shader, mounted over a directory so "../shaders/x.spv" resolves to the
+// entry "shaders/x.spv". the table of contents is a hash lookup checked against the stored path, entries start on a page boundary and are
+// stored as they are or lz4 compressed.
+// the pack is memory mapped: a stored entry costs no copy and no syscall, a batch read asks the kernel
+// to read ahead every entry of the batch at once and then touches or decompresses them on the job system.
+// without a mapping the same jobs fall back to reading through the file.
+// reads are const and can run on any thread
+class AssetPack {
+public:
+    bool open(const std::string& path, const std::string& mountPoint);
+
+    void close();
+
+    bool is_open() const { return !_path.empty(); }
+
+    // false for paths outside the mount point or not in the pack
+    bool contains(const char* path) const;
+
+    bool read(const char* path, AssetData& out) const;
+
+    // out[i] gets paths[i], entries that are not in the pack stay invalid. the data is ready once the
+    // counter reaches zero
+    void read_batch(const char* const* paths, uint32_t count, AssetData* out, JobSystem& jobs, JobCounter* counter) const;
+
+    AssetPackStats get_stats() const { return _stats; }
+
+private:
+    friend bool write_asset_pack(const std::string& packPath, const std::string& root, const std::vector<std::string>& directories,
+                                 bool compress);
+
+    struct Entry {
+        // fnv1a hash of the path relative to the mount point
+        uint32_t name;
+        uint32_t compressed;
+        // the path itself in the name table, a lookup compares it so a hash collision can not return another file
+        uint32_t nameOffset;
+        uint32_t nameLength;
+        uint64_t offset;
+        uint64_t size;
+        uint64_t rawSize;
+    };
+
+    const Entry* find(const char* path) const;
+
+    bool read_entry(const Entry& entry, AssetData& out) const;
+
+    std::string _path;
+    std::string _mountPoint;
+    std::vector<Entry> _entries;
+    std::string _names;
+    std::unordered_map<uint32_t, uint32_t> _lookup;
+
+    const uint8_t* _mapping{nullptr};
+    size_t _mappingSize{0};
+#ifdef _WIN32
+    void* _file{nullptr};
+    void* _mappingHandle{nullptr};
+#endif
+
+    AssetPackStats _stats{};
+};
+
+// packs every file under root/directory for each directory, named by their path relative to root.
+// entries are lz4 compressed when compress is set and it saves at least a quarter of the size
+bool write_asset_pack(const std::string& packPath, const std::string& root, const std::vector<std::string>& directories, bool compress);
+
+// reads a whole file from disk into out.storage
+bool read_file(const char* path, AssetData& out);
+
+// drops the file's pages from the os page cache so the next read goes to the disk. linux only,
+// a directory evicts every file under it
+void evict_file_cache(const std::string& path);